@@ -4,9 +4,15 @@
 #include "llvm/IR/Function.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "boost/container/flat_set.hpp"
 #include "boost/logic/tribool.hpp"
 
+#include <map>
+#include <memory>
+#include <tuple>
+
 #include "ufo/Expr.hpp"
+#include "ufo/ExprIdMap.hpp"
 #include "ufo/Smt/EZ3.hh"
 
 #include "seahorn/Analysis/CutPointGraph.hh"
@@ -19,13 +25,17 @@ typedef enum { mono_bmc, path_bmc } bmc_engine_t;
 namespace seahorn {
 using namespace expr;
 
+/// maps each literal of an implicant to the Boolean literal that enables it
+typedef ExprIdMap<Expr, true> ImplicantBoolMap;
+
 namespace bmc_impl {
 /// true if I is a call to a void function
 bool isCallToVoidFn(const llvm::Instruction &I);
 /// computes an implicant of f (interpreted as a conjunction) that
 /// contains the given model
 void get_model_implicant(const ExprVector &f, ufo::ZModel<ufo::EZ3> &model,
-                         ExprVector &out, ExprMap &active_bool_map);
+                         ExprVector &out,
+                         ImplicantBoolMap &active_bool_map);
 // out is a minimal unsat core f based on assumptions
 void unsat_core(ufo::ZSolver<ufo::EZ3> &solver, const ExprVector &f,
                 bool simplify, ExprVector &out);
@@ -50,6 +60,8 @@ protected:
 
   /// symbolic states corresponding to m_cps
   std::vector<SymStore> m_states;
+  /// size of m_side when each state of m_states was recorded
+  std::vector<unsigned> m_state_side_sz;
   /// edge-trace corresponding to m_cps
   SmallVector<const CpEdge *, 8> m_edges;
 
@@ -58,14 +70,41 @@ protected:
 
   ufo::ZSolver<ufo::EZ3> m_smt_solver;
 
+  /// context and solver of the portfolio worker that produced m_result,
+  /// if it was not m_smt_solver
+  std::unique_ptr<ufo::EZ3> m_portfolio_zctx;
+  std::unique_ptr<ufo::ZSolver<ufo::EZ3>> m_portfolio_solver;
+
+  /// solver that produced the latest result
+  ufo::ZSolver<ufo::EZ3> &resultSolver() {
+    return m_portfolio_solver ? *m_portfolio_solver : m_smt_solver;
+  }
+
+  /// races \p n differently configured solvers on m_side
+  boost::tribool solvePortfolio(unsigned n);
+
   SymStore m_ctxState;
   /// path-condition for m_cps
   ExprVector m_side;
 
+  /// true if m_side has been asserted to m_smt_solver by encode()
+  bool m_side_asserted;
+
+  /// number of entries of m_side asserted to m_smt_solver by
+  /// solveIncremental()
+  unsigned m_side_inc;
+  /// literal that enables the query of the latest depth checked by
+  /// solveIncremental()
+  Expr m_query_lit;
+
+  /// encodes the edges to the cut-points that are not encoded yet
+  void encodeNewEdges();
+
 public:
   BmcEngine(OperationalSemantics &sem, ufo::EZ3 &zctx)
       : m_sem(sem), m_efac(sem.efac()), m_result(boost::indeterminate),
-        m_cpg(nullptr), m_fn(nullptr), m_smt_solver(zctx), m_ctxState(m_efac) {
+        m_cpg(nullptr), m_fn(nullptr), m_smt_solver(zctx), m_ctxState(m_efac),
+        m_side_asserted(false), m_side_inc(0) {
 
     ufo::z3n_set_param(":model_compress", false);
     // ZParams<EZ3> params(zctx);
@@ -83,12 +122,32 @@ public:
   virtual void encode(bool assert_formula = true);
 
   /// checks satisfiability of the path condition
+  ///
+  /// With --horn-bmc-portfolio=N, races N differently configured solvers,
+  /// each on its own Z3 context and thread, and keeps the first answer
   virtual boost::tribool solve();
 
+  /// \brief Incremental BMC
+  ///
+  /// Checks whether \p query is reachable by the edge from the last
+  /// cut-point of the trace. The edges of the trace that are not encoded
+  /// yet are encoded and asserted to the solver. The query edge is encoded
+  /// from a copy of the symbolic state and asserted under a fresh literal,
+  /// and the solver is called assuming only that literal. The literal of
+  /// the previous query is negated first, so the solver keeps its learned
+  /// clauses from one depth to the next.
+  ///
+  /// On sat, \p query stays on the trace so that getTrace() can be used,
+  /// and the trace cannot be extended. Otherwise, the query is dropped and
+  /// the trace can be extended with addCutPoint() for the next depth.
+  ///
+  /// Not to be mixed with encode() and solve() on the same trace.
+  boost::tribool solveIncremental(const CutPoint &query);
+
   /// get model if side condition evaluated to sat.
   virtual ufo::ZModel<ufo::EZ3> getModel() {
     assert((bool)result());
-    return m_smt_solver.getModel();
+    return resultSolver().getModel();
   }
 
   /// Returns the BMC trace (if available)
@@ -106,10 +165,10 @@ public:
   virtual void unsatCore(ExprVector &out);
 
   /// output current path condition in SMT-LIB2 format
-  virtual raw_ostream &toSmtLib(raw_ostream &out) {
-    encode();
-    return m_smt_solver.toSmtLib(out);
-  }
+  ///
+  /// The path condition is written directly by SmtLibWriter and is not
+  /// asserted to the solver
+  virtual raw_ostream &toSmtLib(raw_ostream &out);
 
   /// returns the latest result from solve()
   boost::tribool result() { return m_result; }
@@ -135,58 +194,143 @@ public:
 
   /// get symbolic states corresponding to the cutpoint trace
   std::vector<SymStore> &getStates() { return m_states; }
+
+  /// get the size of the side condition when each state was recorded. The
+  /// side condition of edge i is between entries i and i + 1
+  const std::vector<unsigned> &getStateFormulaSizes() const {
+    return m_state_side_sz;
+  }
 };
 
+/// \brief A counterexample of BmcEngine
+///
+/// Every part of the trace is computed on first use and then kept: the
+/// basic blocks of the trace, the implicant of the path condition, and the
+/// values of expressions in the model. Blocks of an edge are selected by
+/// the implicant of the part of the path condition that encodes the edge,
+/// so the implicant of the whole formula is only built when asked for.
 class BmcTrace {
+  typedef boost::container::flat_set<Expr> ImplicantSet;
+  typedef std::shared_ptr<const ImplicantSet> ImplicantSetPtr;
+
   BmcEngine &m_bmc;
 
-  ufo::ZModel<ufo::EZ3> m_model;
+  /// the model. Mutable since evaluation does not change it
+  mutable ufo::ZModel<ufo::EZ3> m_model;
+
+  // -- everything below is computed on demand, possibly from const methods
 
   // for trace specific implicant
-  ExprVector m_trace;
-  ExprMap m_bool_map;
+  mutable bool m_has_implicant;
+  mutable ExprVector m_trace;
+  mutable ImplicantBoolMap m_bool_map;
+
+  /// literals of the implicant of the side condition of each edge
+  mutable std::vector<ImplicantSetPtr> m_edge_implicants;
+  /// literals of the implicant of the side condition that is not part of
+  /// any edge
+  mutable ImplicantSetPtr m_rest_implicant;
+
+  /// true if m_bbs and m_cpId are computed
+  mutable bool m_has_bbs;
 
   /// the trace of basic blocks
-  SmallVector<const BasicBlock *, 8> m_bbs;
+  mutable SmallVector<const BasicBlock *, 8> m_bbs;
 
   /// a map from an index of a basic block on a trace to the index
   /// of the corresponding cutpoint in BmcEngine
-  SmallVector<unsigned, 8> m_cpId;
+  mutable SmallVector<unsigned, 8> m_cpId;
+
+  /// values in the model of expressions in states, by state index,
+  /// expression and completion
+  std::map<std::tuple<unsigned, Expr, bool>, Expr> m_values;
 
   /// cutpoint id corresponding to the given location
-  unsigned cpid(unsigned loc) const { return m_cpId[loc]; }
+  unsigned cpid(unsigned loc) const {
+    computeBbs();
+    return m_cpId[loc];
+  }
 
   /// true if loc is the first location on a cutpoint edge
   bool isFirstOnEdge(unsigned loc) const {
     return loc == 0 || cpid(loc - 1) != cpid(loc);
   }
 
+  /// computes the implicant of the side condition between begin and end
+  ImplicantSetPtr mkImplicant(unsigned begin, unsigned end) const;
+  /// true if \p lit is in the implicant of the side condition of edge \p id
+  bool inEdgeImplicant(unsigned id, Expr lit) const;
+  /// computes the trace of basic blocks
+  void computeBbs() const;
+  /// computes the implicant of the whole side condition
+  void computeImplicant() const;
+  /// value of \p u in state \p stateidx
+  Expr evalInState(unsigned stateidx, Expr u, bool complete);
+  /// finds the register of \p val and the state in which it has its value
+  /// at \p loc. Returns false if \p val has no value
+  bool symbState(unsigned loc, const llvm::Value &val, unsigned &stateidx,
+                 Expr &u);
+
 public:
+  /// \brief A value to evaluate: \c val at location \c loc, or \c expr at
+  /// location \c loc if \c val is null
+  struct EvalQuery {
+    unsigned loc;
+    const llvm::Value *val;
+    Expr expr;
+  };
+
   BmcTrace(BmcEngine &bmc, ufo::ZModel<ufo::EZ3> &model);
 
   BmcTrace(const BmcTrace &other)
-      : m_bmc(other.m_bmc), m_model(other.m_model), m_bbs(other.m_bbs),
-        m_cpId(other.m_cpId) {}
+      : m_bmc(other.m_bmc), m_model(other.m_model),
+        m_has_implicant(other.m_has_implicant), m_trace(other.m_trace),
+        m_bool_map(other.m_bool_map),
+        m_edge_implicants(other.m_edge_implicants),
+        m_rest_implicant(other.m_rest_implicant), m_has_bbs(other.m_has_bbs),
+        m_bbs(other.m_bbs), m_cpId(other.m_cpId), m_values(other.m_values) {}
 
   /// underlying BMC engine
   BmcEngine &engine() { return m_bmc; }
   /// The number of basic blocks in the trace
-  unsigned size() const { return m_bbs.size(); }
+  unsigned size() const {
+    computeBbs();
+    return m_bbs.size();
+  }
 
   /// The basic block at a given location
-  const llvm::BasicBlock *bb(unsigned loc) const { return m_bbs[loc]; }
+  const llvm::BasicBlock *bb(unsigned loc) const {
+    computeBbs();
+    return m_bbs[loc];
+  }
 
   /// The value of the instruction at the given location
   Expr symb(unsigned loc, const llvm::Value &inst);
   Expr eval(unsigned loc, const llvm::Value &inst, bool complete = false);
   Expr eval(unsigned loc, Expr v, bool complete = false);
+  /// Evaluates all \p queries in one pass over the model. The value of
+  /// query i is out[i]
+  void eval(const std::vector<EvalQuery> &queries, ExprVector &out,
+            bool complete = false);
   template <typename Out> Out &print(Out &out);
 
-  ExprVector &get_implicant_formula() { return m_trace; }
-  ExprMap &get_implicant_bools_map() { return m_bool_map; }
+  ExprVector &get_implicant_formula() {
+    computeImplicant();
+    return m_trace;
+  }
+  ImplicantBoolMap &get_implicant_bools_map() {
+    computeImplicant();
+    return m_bool_map;
+  }
 
-  const ExprVector &get_implicant_formula() const { return m_trace; }
-  const ExprMap &get_implicant_bools_map() const { return m_bool_map; }
+  const ExprVector &get_implicant_formula() const {
+    computeImplicant();
+    return m_trace;
+  }
+  const ImplicantBoolMap &get_implicant_bools_map() const {
+    computeImplicant();
+    return m_bool_map;
+  }
 };
 } // namespace seahorn
 
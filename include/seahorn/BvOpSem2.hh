@@ -2,6 +2,7 @@
 
 #include "seahorn/Analysis/CanFail.hh"
 #include "seahorn/OperationalSemantics.hh"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
 #include "llvm/IR/DataLayout.h"
@@ -10,6 +11,10 @@
 
 #include <boost/container/flat_set.hpp>
 
+#include <map>
+#include <memory>
+#include <vector>
+
 namespace llvm {
 class GetElementPtrInst;
 }
@@ -36,11 +41,29 @@ class Bv2OpSem : public OperationalSemantics {
   const TargetLibraryInfo *m_tli;
   const CanFail *m_canFail;
 
+  /// \brief Symbolic summary of a basic block (see Bv2OpSem::summarize)
+  struct BbSummary;
+  /// \brief Shape of a basic block (see Bv2OpSem::shapeOf)
+  using BbShape = std::vector<uintptr_t>;
+  /// \brief Summaries of basic blocks that have been executed so far, by
+  /// shape
+  std::map<BbShape, std::unique_ptr<BbSummary>> m_bbSummaries;
+  /// \brief A basic block with a summary
+  struct BbInstance {
+    /// \brief summary of all blocks of the same shape
+    const BbSummary *sum = nullptr;
+    /// \brief values of the block that fill the slots of the summary
+    std::vector<const Value *> slots;
+  };
+  /// \brief Summarized basic blocks that have been executed so far
+  DenseMap<const BasicBlock *, BbInstance> m_bbInstances;
+
 public:
   Bv2OpSem(ExprFactory &efac, Pass &pass, const DataLayout &dl,
            TrackLevel trackLvl = MEM);
 
   Bv2OpSem(const Bv2OpSem &o);
+  ~Bv2OpSem() override;
 
   const DataLayout &getTD() {
     assert(m_td);
@@ -104,6 +127,30 @@ protected:
   void execBr(const BasicBlock &src, const BasicBlock &dst,
               seahorn::details::Bv2OpSemContext &ctx);
 
+  /// \brief Executes all non-PHI instructions of \p bb one at a time
+  void execInsts(const BasicBlock &bb, seahorn::details::Bv2OpSemContext &ctx);
+  /// \brief Returns true if the effect of \p bb on a context can be
+  /// summarized independently of the context
+  bool isSummarizable(const BasicBlock &bb) const;
+  /// \brief Computes the shape of \p bb and the values that fill its slots
+  ///
+  /// Blocks of the same shape, such as copies made by unrolling or
+  /// inlining, differ only in the values in \p slots
+  void shapeOf(const BasicBlock &bb, BbShape &shape,
+               std::vector<const Value *> &slots) const;
+  /// \brief Executes \p bb over fresh inputs and returns its summary
+  ///
+  /// On return, \p ctx is positioned at the terminator of \p bb, but its
+  /// store and side condition are unchanged
+  std::unique_ptr<BbSummary>
+  summarize(const BasicBlock &bb, const std::vector<const Value *> &slots,
+            seahorn::details::Bv2OpSemContext &ctx);
+  /// \brief Applies the summary \p sum to the current state of \p ctx for
+  /// a block with the given \p slots
+  void applySummary(const BbSummary &sum,
+                    const std::vector<const Value *> &slots,
+                    seahorn::details::Bv2OpSemContext &ctx);
+
 public:
   /// \brief Returns a concrete representation of a given symbolic expression.
   ///        Assumes that the input expression \p v has concrete representation.
@@ -35,6 +35,10 @@ public:
   /// The value of the instruction at the given location
   virtual Expr eval(unsigned loc, const llvm::Instruction &inst, bool complete);
   virtual Expr eval(unsigned loc, Expr v, bool complete);
+  /// The values of many instructions and expressions at once
+  /// \sa BmcTrace::eval
+  virtual void eval(const std::vector<BmcTrace::EvalQuery> &queries,
+                    ExprVector &out, bool complete);
 };
 
 class BmcTraceMemSim : public BmcTraceWrapper {
@@ -47,6 +51,8 @@ public:
   virtual Expr eval(unsigned loc, const llvm::Instruction &inst,
                     bool complete) override;
   virtual Expr eval(unsigned loc, Expr v, bool complete) override;
+  virtual void eval(const std::vector<BmcTrace::EvalQuery> &queries,
+                    ExprVector &out, bool complete) override;
 };
 
 std::unique_ptr<llvm::Module> createCexHarness(BmcTraceWrapper &trace,
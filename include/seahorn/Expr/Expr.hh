@@ -4,12 +4,14 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <deque>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -22,11 +24,12 @@
 #include <boost/functional/hash_fwd.hpp>
 #include <boost/intrusive_ptr.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/pool/pool.hpp>
-#include <boost/pool/poolfwd.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/iterator.h"
 #include "llvm/ADT/iterator_range.h"
 #include "llvm/Support/Casting.h"
 
@@ -106,14 +109,17 @@ public:
       brkt  -- whether the context in which the operator is printed
             -- might be ambiguous and brakets might be required
    **/
-  virtual void Print(std::ostream &OS, const std::vector<ENode *> &args,
+  virtual void Print(std::ostream &OS, llvm::ArrayRef<ENode *> args,
                      int depth = 0, bool brkt = true) const = 0;
   virtual bool operator==(const Operator &rhs) const = 0;
   virtual bool operator<(const Operator &rhs) const = 0;
   virtual size_t hash() const = 0;
   virtual bool isMutable() const { return false; }
-  /* Returns a heap-allocated clone of this */
-  virtual Operator *clone(ExprFactoryAllocator &allocator) const = 0;
+  /* Constructs a clone of this in place at mem. The memory must be at
+     least cloneSize() bytes and aligned to a pointer */
+  virtual Operator *clone(void *mem) const = 0;
+  /* Size in bytes of a clone of this */
+  virtual size_t cloneSize() const = 0;
   virtual std::string name() const = 0;
 };
 
@@ -123,39 +129,50 @@ inline std::ostream &operator<<(std::ostream &OS, const Operator &V) {
   return OS;
 }
 
-struct EFADeleter {
-  ExprFactoryAllocator *m_efa;
-  EFADeleter(ExprFactoryAllocator &efa) : m_efa(&efa) {}
-  EFADeleter(const EFADeleter &) = default;
-  EFADeleter &operator=(const EFADeleter &o) = default;
-  void operator()(void *p);
-};
-
 /* An expression node (a.k.a. an enode). A pointer into an
-   expression tree (or DAG)  */
+   expression tree (or DAG)
+
+   A node is allocated by its factory as a single block that holds the
+   node, its arguments, and its operator, in this order. There is room
+   for at least INLINE_ARGS arguments right after the node; wider nodes
+   get exactly as many slots as they have arguments.
+
+   Nodes of a concurrent factory update their reference counter with
+   atomic operations so that they can be shared between threads. Nodes of
+   a sequential factory use plain arithmetic.
+ */
 class ENode {
 protected:
   /** unique identifier of this expression node */
   unsigned int id;
-  /** reference counter */
+  /** reference counter. Atomic if m_concurrent is set */
   unsigned int count;
 
   ExprFactory *fac;
-  std::vector<ENode *> args;
-
-  std::unique_ptr<Operator, EFADeleter> m_oper;
-
-  void Deref() {
-    if (count > 0)
-      count--;
-  }
+  /** operator. Lives at the end of the memory block of the node */
+  Operator *m_oper;
+  /** arguments. Point right after the node, unless outgrown by renew_args */
+  ENode **m_args;
+  /** number of arguments */
+  unsigned m_arity;
+  /** number of arguments m_args has room for */
+  unsigned m_capacity : 31;
+  /** true if the node belongs to a concurrent factory */
+  unsigned m_concurrent : 1;
+
+  inline ENode(ExprFactory &f, Operator *o, unsigned capacity);
+  ~ENode() = default;
 
   /** assigns a unique id to the node */
   void setId(unsigned int v) { id = v; }
 
+  /** the argument slots that are allocated together with the node */
+  ENode **inlineArgs() { return reinterpret_cast<ENode **>(this + 1); }
+  bool hasInlineArgs() { return m_args == inlineArgs(); }
+
 public:
-  ENode(ExprFactory &f, const Operator &o);
-  ~ENode();
+  /** number of argument slots allocated with every node */
+  static const unsigned INLINE_ARGS = 3;
 
   ENode() = delete;
   ENode(const ENode &) = delete;
@@ -166,40 +183,54 @@ public:
   /** returns the unique id of this expression */
   unsigned int getId() const { return id; }
 
-  void Ref() { count++; }
-  bool isGarbage() const { return count == 0; }
+  inline void Ref();
+  bool isGarbage() const { return use_count() == 0; }
   bool isMutable() const { return m_oper->isMutable(); }
 
-  unsigned int use_count() { return count; }
+  unsigned int use_count() const {
+    return __atomic_load_n(&count, __ATOMIC_RELAXED);
+  }
 
   ENode *operator[](size_t p) { return arg(p); }
-  ENode *arg(size_t p) { return args[p]; }
+  ENode *arg(size_t p) {
+    assert(p < m_arity);
+    return m_args[p];
+  }
 
-  ENode *left() { return (args.size() > 0) ? args[0] : nullptr; }
+  ENode *left() { return (m_arity > 0) ? m_args[0] : nullptr; }
 
-  ENode *right() { return (args.size() > 1) ? args[1] : nullptr; }
+  ENode *right() { return (m_arity > 1) ? m_args[1] : nullptr; }
 
   ENode *first() { return left(); }
-  ENode *last() { return args.size() > 0 ? args[args.size() - 1] : nullptr; }
+  ENode *last() { return m_arity > 0 ? m_args[m_arity - 1] : nullptr; }
 
-  typedef std::vector<ENode *>::const_iterator args_iterator;
+  class args_iterator
+      : public llvm::iterator_adaptor_base<args_iterator, ENode *const *> {
+  public:
+    args_iterator() = default;
+    explicit args_iterator(ENode *const *p) : iterator_adaptor_base(p) {}
+  };
 
-  bool args_empty() const { return args.empty(); }
-  args_iterator args_begin() const { return args.begin(); }
-  args_iterator args_end() const { return args.end(); }
+  bool args_empty() const { return m_arity == 0; }
+  args_iterator args_begin() const { return args_iterator(m_args); }
+  args_iterator args_end() const { return args_iterator(m_args + m_arity); }
+  llvm::ArrayRef<ENode *> args() const {
+    return llvm::ArrayRef<ENode *>(m_args, m_arity);
+  }
 
   template <typename iterator> void renew_args(iterator b, iterator e);
 
   void push_back(ENode *a) {
-    args.push_back(a);
+    assert(m_arity < m_capacity);
+    m_args[m_arity++] = a;
     a->Ref();
   }
 
-  size_t arity() const { return args.size(); }
+  size_t arity() const { return m_arity; }
 
   const Operator &op() const { return *m_oper; }
   void Print(std::ostream &OS, int depth = 0, bool brkt = true) const {
-    m_oper->Print(OS, args, depth, brkt);
+    m_oper->Print(OS, args(), depth, brkt);
   }
   void dump() const {
     Print(std::cerr, 0, false);
@@ -208,6 +239,7 @@ public:
 
   friend class ExprFactory;
   friend struct std::less<expr::ENode *>;
+  friend inline void intrusive_ptr_release(ENode *v);
 };
 
 inline std::ostream &operator<<(std::ostream &OS, const ENode &V) {
@@ -292,9 +324,13 @@ struct ENodeUniqueEqual {
 };
 
 /**
- * A type erasure of a cache
+ * A type erasure of a cache. Registered stubs form an intrusive list, so
+ * that a stub is removed from it in constant time
  */
 struct CacheStub {
+  CacheStub *prev = nullptr;
+  CacheStub *next = nullptr;
+
   /** true if the stub own the cahce pointer by p */
   virtual bool owns(const void *p) = 0;
   /** erases val from the underlying cache */
@@ -313,95 +349,348 @@ template <typename C> struct CacheStubTmpl : CacheStub {
   virtual void erase(ENode *val) { cache.erase(val); }
 };
 
+/**
+ * Slab allocator for expression nodes.
+ *
+ * Memory is carved out of large slabs owned by the allocator and is only
+ * returned to the system when the allocator is destroyed. Freed blocks are
+ * kept in free lists, one per size (sizes are rounded up to GRANULE), and
+ * are reused by later allocations of the same size. Blocks larger than
+ * MAX_SLAB_OBJ bytes are allocated directly on the heap.
+ *
+ * An allocator is not thread-safe. A concurrent factory gives every thread
+ * its own allocator; a block may be freed into an allocator other than the
+ * one it came from as long as both belong to the same factory.
+ */
 class ExprFactoryAllocator : boost::noncopyable {
 private:
-  /** pool for tiny objects */
-  boost::pool<> tiny;
-  /** pool for small objects */
-  boost::pool<> small;
+  static const size_t GRANULE = sizeof(void *);
+  static const size_t MAX_SLAB_OBJ = 512;
+  static const size_t SLAB_SIZE = 64 * 1024;
+
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  /** free lists indexed by block size in granules */
+  std::array<FreeBlock *, MAX_SLAB_OBJ / GRANULE + 1> m_free;
+  std::vector<std::unique_ptr<char[]>> m_slabs;
+  /** unused part of the current slab */
+  char *m_cur;
+  char *m_end;
+  /** bytes handed out minus bytes freed through this allocator */
+  ptrdiff_t m_used;
+
+  static size_t roundUp(size_t n) { return (n + GRANULE - 1) & ~(GRANULE - 1); }
+  void pushFree(void *block, size_t n) {
+    FreeBlock *b = static_cast<FreeBlock *>(block);
+    b->next = m_free[n / GRANULE];
+    m_free[n / GRANULE] = b;
+  }
+  void newSlab();
 
 public:
-  ExprFactoryAllocator() : tiny(8, 65536), small(64, 65536){};
+  ExprFactoryAllocator() : m_cur(nullptr), m_end(nullptr), m_used(0) {
+    m_free.fill(nullptr);
+  }
 
   void *allocate(size_t n);
-  void free(void *block);
+  /** Frees a block of n bytes. n must be the size it was allocated with */
+  void free(void *block, size_t n);
 
-  EFADeleter get_deleter();
+  /** bytes allocated minus bytes freed. Negative if this allocator freed
+      blocks that were allocated by another one */
+  ptrdiff_t used() const { return m_used; }
+  /** number of bytes reserved in slabs */
+  size_t reserved() const { return m_slabs.size() * SLAB_SIZE; }
 };
 
+/**
+ * Unique (hash-consing) table of expression nodes.
+ *
+ * A single flat open-addressing table with linear probing. Nodes are
+ * keyed on the hash of their operator and the addresses of their
+ * children (see ENodeUniqueHash). The hash of every node is stored next
+ * to it so that probing, growing, and deleting never re-hash a node.
+ * Deletion uses backward shifting, so the table has no tombstones.
+ *
+ * The table is not synchronized; a concurrent factory shards nodes over
+ * several tables, each guarded by its own lock.
+ */
+class ExprUniqueTable : boost::noncopyable {
+  struct Slot {
+    size_t hash;
+    ENode *node;
+  };
+
+  std::vector<Slot> m_slots;
+  /// number of nodes in the table
+  size_t m_size;
+  /// log2 of the number of slots
+  unsigned m_bits;
+
+  static const unsigned INIT_BITS = 10;
+
+  size_t home(size_t h) const {
+    // -- Fibonacci hashing spreads the bits of weak hashes over the index
+    return static_cast<size_t>((h * 0x9E3779B97F4A7C15ULL) >> (64 - m_bits));
+  }
+  size_t mask() const { return m_slots.size() - 1; }
+
+  void grow() {
+    std::vector<Slot> old;
+    old.swap(m_slots);
+    ++m_bits;
+    m_slots.assign(size_t(1) << m_bits, Slot{0, nullptr});
+    for (const Slot &s : old)
+      if (s.node) {
+        size_t i = home(s.hash);
+        while (m_slots[i].node)
+          i = (i + 1) & mask();
+        m_slots[i] = s;
+      }
+  }
+
+public:
+  ExprUniqueTable() : m_size(0), m_bits(INIT_BITS) {
+    m_slots.assign(size_t(1) << m_bits, Slot{0, nullptr});
+  }
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  /// Inserts n, whose hash is h, unless a structurally equal node that
+  /// acquire() accepts is already present. Returns the node in the table
+  /// and whether n was inserted. Equal nodes rejected by acquire() stay
+  /// in the table until they are erased.
+  template <typename Acquire>
+  std::pair<ENode *, bool> insert(ENode *n, size_t h, Acquire acquire) {
+    // -- keep load factor below 3/4
+    if (4 * (m_size + 1) > 3 * m_slots.size())
+      grow();
+
+    ENodeUniqueEqual eq;
+    size_t i = home(h);
+    for (; m_slots[i].node; i = (i + 1) & mask())
+      if (m_slots[i].hash == h && eq(m_slots[i].node, n) &&
+          acquire(m_slots[i].node))
+        return std::make_pair(m_slots[i].node, false);
+
+    m_slots[i] = Slot{h, n};
+    ++m_size;
+    return std::make_pair(n, true);
+  }
+
+  /// Removes n, whose hash is h, from the table. Returns false if n is not
+  /// in the table
+  bool erase(ENode *n, size_t h) {
+    size_t i = home(h);
+    for (; m_slots[i].node != n; i = (i + 1) & mask())
+      if (!m_slots[i].node)
+        return false;
+
+    // -- shift back every following entry that is not at its home slot
+    size_t j = i;
+    for (;;) {
+      j = (j + 1) & mask();
+      if (!m_slots[j].node)
+        break;
+      size_t k = home(m_slots[j].hash);
+      // -- entry j may move to i only if its home is not in (i, j]
+      if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+        continue;
+      m_slots[i] = m_slots[j];
+      i = j;
+    }
+    m_slots[i] = Slot{0, nullptr};
+    --m_size;
+    return true;
+  }
+};
+
+/**
+ * Creates and owns expression nodes.
+ *
+ * A factory is either sequential (the default) or concurrent. A concurrent
+ * factory can be used by several threads at once: any thread may create
+ * nodes, and structurally equal nodes created by different threads are
+ * pointer equal. To that end, node reference counts are updated
+ * atomically, the unique table is split into independently locked shards,
+ * and every thread allocates and frees nodes through its own
+ * ExprFactoryAllocator. Caches registered with a concurrent factory are
+ * notified of dead nodes by whatever thread releases them, so they must
+ * tolerate that themselves.
+ */
 class ExprFactory : boost::noncopyable {
 protected:
-  typedef std::unordered_set<ENode *, ENodeUniqueHash, ENodeUniqueEqual>
-      unique_entry_type;
-  using unique_key_type = std::string;
-  // -- type of the unique table
-  typedef std::map<unique_key_type, unique_entry_type> unique_type;
+  /** per-thread state for allocating and releasing nodes */
+  struct ThreadCache {
+    ExprFactoryAllocator allocator;
+    /** nodes waiting to be released by freeNode */
+    std::vector<ENode *> dead;
+    /** true while freeNode is releasing nodes */
+    bool freeing;
+    /** dead nodes waiting to be removed by Remove */
+    std::vector<ENode *> removed;
+    /** true while Remove is removing nodes */
+    bool removing;
+    ThreadCache() : freeing(false), removing(false) {}
+  };
+
+  /** a shard of the unique table */
+  struct UniqueShard {
+    std::mutex lock;
+    ExprUniqueTable table;
+  };
 
-  typedef boost::ptr_vector<CacheStub> caches_type;
+  /** number of unique table shards of a concurrent factory (log2) */
+  static const unsigned CONCURRENT_SHARD_BITS = 6;
 
-  /** pool allocator */
-  ExprFactoryAllocator allocator;
+  const bool m_concurrent;
+  /** distinguishes this factory from all others, even at the same address */
+  const unsigned m_serial;
 
-  /** list of registered caches */
-  caches_type caches;
+  /** thread state of a sequential factory */
+  ThreadCache m_local;
+  /** thread states of a concurrent factory, one per thread that used it */
+  std::vector<std::unique_ptr<ThreadCache>> m_threadCaches;
+  mutable std::mutex m_threadCachesLock;
+
+  /** first of the registered caches */
+  CacheStub *m_caches = nullptr;
+  std::mutex m_cachesLock;
 
   // -- unique table
-  unique_type unique;
+  std::unique_ptr<UniqueShard[]> m_unique;
+  unsigned m_shardBits;
 
   /** counter for assigning unique ids*/
-  unsigned int idCount;
+  std::atomic<unsigned> idCount;
 
   /** returns a unique id > 0 */
-  unsigned int uniqueId() { return ++idCount; }
+  unsigned int uniqueId() {
+    if (m_concurrent)
+      return idCount.fetch_add(1, std::memory_order_relaxed) + 1;
+    unsigned id = idCount.load(std::memory_order_relaxed) + 1;
+    idCount.store(id, std::memory_order_relaxed);
+    return id;
+  }
+
+  static unsigned nextSerial() {
+    static std::atomic<unsigned> serial(0);
+    return serial.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ThreadCache &threadCache() {
+    return m_concurrent ? concurrentThreadCache() : m_local;
+  }
+  ThreadCache &concurrentThreadCache();
+
+  UniqueShard &shardOf(size_t h) {
+    // -- the table uses the high bits of the hash, shards use the low ones
+    return m_unique[h & ((size_t(1) << m_shardBits) - 1)];
+  }
+
+  /** Takes a reference to n, a node of a concurrent factory, if it is
+      alive. A node whose count dropped to 0 is being released by another
+      thread and cannot be revived */
+  bool tryRef(ENode *n) {
+    unsigned c = n->use_count();
+    while (c > 0)
+      if (__atomic_compare_exchange_n(&n->count, &c, c + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return true;
+    return false;
+  }
 
   /**
    * Remove value from unique table
+   *
+   * Erasing val from a cache destroys the cached value, which may release
+   * more nodes while the caches are locked. Such nodes are queued and
+   * removed once the caches are unlocked.
    */
   void Remove(ENode *val) {
-    clearCaches(val);
-    if (!val->isMutable()) {
-      unique_type::iterator it = unique.find(val->op().name());
-      // -- can only remove things that have been inserted before
-      assert(it != unique.end());
-      it->second.erase(val);
-      if (it->second.empty())
-        unique.erase(it);
-    }
+    ThreadCache &tc = threadCache();
+    tc.removed.push_back(val);
+    // -- an outer call is already draining the queue
+    if (tc.removing)
+      return;
 
-    freeNode(val);
+    tc.removing = true;
+    while (!tc.removed.empty()) {
+      ENode *d = tc.removed.back();
+      tc.removed.pop_back();
+      clearCaches(d);
+      if (!d->isMutable()) {
+        size_t h = ENodeUniqueHash()(d);
+        UniqueShard &shard = shardOf(h);
+        std::unique_lock<std::mutex> lock(shard.lock, std::defer_lock);
+        if (m_concurrent)
+          lock.lock();
+        bool erased = shard.table.erase(d, h);
+        // -- can only remove things that have been inserted before
+        assert(erased);
+        (void)erased;
+      }
+      freeNode(d);
+    }
+    tc.removing = false;
   }
 
   /**
    * Clear val from all registered caches
    */
   void clearCaches(ENode *val) {
-    for (CacheStub &c : caches)
-      c.erase(val);
+    std::unique_lock<std::mutex> lock(m_cachesLock, std::defer_lock);
+    if (m_concurrent)
+      lock.lock();
+    for (CacheStub *c = m_caches; c; c = c->next)
+      c->erase(val);
   }
 
   /**
-   * Return the canonical (unique) representetive of the input
+   * Return the canonical (unique) representetive of the input, with one
+   * reference taken on behalf of the caller
    */
   ENode *canonize(ENode *v) {
     if (v->isMutable()) {
       v->setId(uniqueId());
+      v->Ref();
       return v;
     }
 
-    auto x = unique[v->op().name()].insert(v);
-    if (x.second) {
-      v->setId(uniqueId());
-      return v;
+    size_t h = ENodeUniqueHash()(v);
+    UniqueShard &shard = shardOf(h);
+    std::pair<ENode *, bool> x;
+    if (!m_concurrent) {
+      x = shard.table.insert(v, h, [](ENode *n) {
+        n->count++;
+        return true;
+      });
+      if (x.second) {
+        v->setId(uniqueId());
+        v->count++;
+      }
     } else {
-      freeNode(v);
-      return *x.first;
+      std::lock_guard<std::mutex> lock(shard.lock);
+      x = shard.table.insert(v, h, [this](ENode *n) { return tryRef(n); });
+      // -- v must be complete before another thread can find it
+      if (x.second) {
+        v->setId(uniqueId());
+        v->Ref();
+      }
     }
+
+    if (!x.second)
+      freeNode(v);
+    return x.first;
   }
 
-  ENode *mkExpr(const Operator &op) { return canonize(allocNode(op)); }
+  ENode *mkExpr(const Operator &op) { return canonize(allocNode(op, 0)); }
 
   template <typename etype> ENode *mkExpr(const Operator &op, etype e) {
-    ENode *eVal = allocNode(op);
+    ENode *eVal = allocNode(op, 1);
     eVal->push_back(eptr(e));
     return canonize(eVal);
   }
@@ -409,7 +698,7 @@ protected:
   /** binary */
   template <typename etype>
   ENode *mkExpr(const Operator &op, etype e1, etype e2) {
-    ENode *eVal = allocNode(op);
+    ENode *eVal = allocNode(op, 2);
     eVal->push_back(eptr(e1));
     eVal->push_back(eptr(e2));
     return canonize(eVal);
@@ -418,7 +707,7 @@ protected:
   /** ternary */
   template <typename etype>
   ENode *mkExpr(const Operator &op, etype e1, etype e2, etype e3) {
-    ENode *eVal = allocNode(op);
+    ENode *eVal = allocNode(op, 3);
     eVal->push_back(eptr(e1));
     eVal->push_back(eptr(e2));
     eVal->push_back(eptr(e3));
@@ -430,134 +719,264 @@ protected:
   */
   template <typename iterator>
   ENode *mkNExpr(const Operator &op, iterator begin, iterator end) {
-    ENode *eVal = allocNode(op);
+    ENode *eVal = allocNode(op, std::distance(begin, end));
     for (; begin != end; ++begin)
       eVal->push_back(eptr(*begin));
     return canonize(eVal);
   }
 
 private:
-#define FREE_LIST_MAX_SIZE 1024 * 4
-  std::vector<ENode *> freeList;
   void freeNode(ENode *n);
-  ENode *allocNode(const Operator &op);
+  void releaseNode(ENode *n, ThreadCache &tc);
+  /** allocates a node with room for arity arguments */
+  ENode *allocNode(const Operator &op, size_t arity);
+  /** moves the arguments of n to a new array of the given capacity */
+  void growArgs(ENode *n, unsigned capacity);
 
 public:
-  ExprFactory() : idCount(0) {}
+  /** Creates a factory. A concurrent factory may be used by several
+      threads at the same time */
+  explicit ExprFactory(bool concurrent = false)
+      : m_concurrent(concurrent), m_serial(nextSerial()),
+        m_shardBits(concurrent ? CONCURRENT_SHARD_BITS : 0), idCount(0) {
+    m_unique.reset(new UniqueShard[size_t(1) << m_shardBits]);
+  }
+
+  ~ExprFactory() {
+    while (m_caches)
+      unlinkCache(m_caches);
+  }
+
+  bool isConcurrent() const { return m_concurrent; }
 
   /** Derefernce a value */
   void Deref(ENode *val) {
-    val->Deref();
-    if (val->isGarbage())
+    if (m_concurrent) {
+      if (__atomic_sub_fetch(&val->count, 1, __ATOMIC_ACQ_REL) == 0)
+        Remove(val);
+      return;
+    }
+
+    if (val->count > 0)
+      val->count--;
+    if (val->count == 0)
       Remove(val);
   }
 
   /** User functions */
-  Expr mkTerm(const Operator &o) { return Expr(mkExpr(o)); }
-  Expr mkUnary(const Operator &o, Expr e) { return Expr(mkExpr(o, e.get())); }
+  Expr mkTerm(const Operator &o) { return Expr(mkExpr(o), false); }
+  Expr mkUnary(const Operator &o, Expr e) {
+    return Expr(mkExpr(o, e.get()), false);
+  }
   Expr mkBin(const Operator &o, Expr e1, Expr e2) {
-    return Expr(mkExpr(o, e1.get(), e2.get()));
+    return Expr(mkExpr(o, e1.get(), e2.get()), false);
   }
   Expr mkTern(const Operator &o, Expr e1, Expr e2, Expr e3) {
-    return Expr(mkExpr(o, e1.get(), e2.get(), e3.get()));
+    return Expr(mkExpr(o, e1.get(), e2.get(), e3.get()), false);
   }
   template <typename iterator>
   Expr mkNary(const Operator &o, iterator b, iterator e) {
-    return Expr(mkNExpr(o, b, e));
+    return Expr(mkNExpr(o, b, e), false);
   }
 
   template <typename Range> Expr mkNary(const Operator &o, const Range &r) {
     return mkNary(o, begin(r), end(r));
   }
 
-  template <typename Cache> void registerCache(Cache &cache) {
-    // -- to avoid double registration
-    unregisterCache(cache);
-    caches.push_back(static_cast<CacheStub *>(new CacheStubTmpl<Cache>(cache)));
+  /** number of bytes currently used by expression nodes */
+  size_t allocatedBytes() const {
+    ptrdiff_t res = m_local.allocator.used();
+    std::lock_guard<std::mutex> lock(m_threadCachesLock);
+    for (auto &tc : m_threadCaches)
+      res += tc->allocator.used();
+    return res;
   }
 
+  /** Registers cache to be notified of dead nodes. A cache must not be
+      registered twice. Returns a handle for unregisterCache */
+  template <typename Cache> CacheStub *registerCache(Cache &cache) {
+    std::unique_lock<std::mutex> lock(m_cachesLock, std::defer_lock);
+    if (m_concurrent)
+      lock.lock();
+    CacheStub *stub = new CacheStubTmpl<Cache>(cache);
+    stub->next = m_caches;
+    if (m_caches)
+      m_caches->prev = stub;
+    m_caches = stub;
+    return stub;
+  }
+
+  /** Unregisters the cache of a handle returned by registerCache */
+  void unregisterCache(CacheStub *stub) {
+    std::unique_lock<std::mutex> lock(m_cachesLock, std::defer_lock);
+    if (m_concurrent)
+      lock.lock();
+    unlinkCache(stub);
+  }
+
+  /** Unregisters cache. Linear in the number of registered caches; keep
+      the handle of registerCache to avoid the search */
   template <typename Cache> bool unregisterCache(const Cache &cache) {
+    std::unique_lock<std::mutex> lock(m_cachesLock, std::defer_lock);
+    if (m_concurrent)
+      lock.lock();
     const void *ptr = static_cast<const void *>(&cache);
-
-    for (caches_type::iterator it = caches.begin(), end = caches.end();
-         it != end; ++it)
-      if (it->owns(ptr)) {
-        caches.erase(it);
+    for (CacheStub *c = m_caches; c; c = c->next)
+      if (c->owns(ptr)) {
+        unlinkCache(c);
         return true;
       }
     return false;
   }
 
+private:
+  void unlinkCache(CacheStub *stub) {
+    if (stub->prev)
+      stub->prev->next = stub->next;
+    else
+      m_caches = stub->next;
+    if (stub->next)
+      stub->next->prev = stub->prev;
+    delete stub;
+  }
+
+public:
+
   friend class ENode;
 };
 
-inline ENode::ENode(ExprFactory &f, const Operator &o)
-    : count(0), fac(&f),
-      m_oper(o.clone(f.allocator), f.allocator.get_deleter()) {}
 } // namespace expr
 
-inline void *operator new(size_t n, expr::ExprFactoryAllocator &alloc) {
-  return alloc.allocate(n);
-}
-
-inline void operator delete(void *p, expr::ExprFactoryAllocator &alloc) {
-  alloc.free(p);
-}
-
 namespace expr {
+/// Releases n and all of its descendants that become garbage. Uses an
+/// explicit work list so that long chains do not overflow the stack.
 inline void ExprFactory::freeNode(ENode *n) {
-  if (freeList.size() < FREE_LIST_MAX_SIZE) {
-    for (ENode *a : n->args)
-      Deref(a);
-    n->args.clear();
-    n->m_oper.reset();
-
-    if (freeList.size() < FREE_LIST_MAX_SIZE) {
-      assert(n->count == 0);
-      freeList.push_back(n);
-      return;
+  ThreadCache &tc = threadCache();
+  tc.dead.push_back(n);
+  // -- an outer call is already draining the work list
+  if (tc.freeing)
+    return;
+
+  tc.freeing = true;
+  while (!tc.dead.empty()) {
+    ENode *d = tc.dead.back();
+    tc.dead.pop_back();
+    releaseNode(d, tc);
+  }
+  tc.freeing = false;
+}
+
+inline void ExprFactory::releaseNode(ENode *n, ThreadCache &tc) {
+  assert(n->use_count() == 0);
+  // -- dead children are pushed on the dead list of tc
+  for (ENode *a : n->args())
+    Deref(a);
+  if (!n->hasInlineArgs())
+    tc.allocator.free(n->m_args, n->m_capacity * sizeof(ENode *));
+
+  // -- the operator is the last thing in the block of the node
+  Operator *op = n->m_oper;
+  size_t sz = (reinterpret_cast<char *>(op) - reinterpret_cast<char *>(n)) +
+              op->cloneSize();
+  op->~Operator();
+  n->~ENode();
+  tc.allocator.free(n, sz);
+}
+
+inline ENode *ExprFactory::allocNode(const Operator &op, size_t arity) {
+  size_t capacity = std::max<size_t>(arity, ENode::INLINE_ARGS);
+  size_t opOffset = sizeof(ENode) + capacity * sizeof(ENode *);
+  char *mem = static_cast<char *>(
+      threadCache().allocator.allocate(opOffset + op.cloneSize()));
+  return new (mem) ENode(*this, op.clone(mem + opOffset), capacity);
+}
+
+inline void ExprFactory::growArgs(ENode *n, unsigned capacity) {
+  assert(capacity > n->m_capacity);
+  ExprFactoryAllocator &allocator = threadCache().allocator;
+  ENode **args =
+      static_cast<ENode **>(allocator.allocate(capacity * sizeof(ENode *)));
+  std::copy(n->args_begin(), n->args_end(), args);
+  if (!n->hasInlineArgs())
+    allocator.free(n->m_args, n->m_capacity * sizeof(ENode *));
+  n->m_args = args;
+  n->m_capacity = capacity;
+}
+
+inline ExprFactory::ThreadCache &ExprFactory::concurrentThreadCache() {
+  // -- thread caches of all concurrent factories used by this thread.
+  // -- Keyed by serial, so entries of dead factories are never matched
+  static thread_local std::vector<std::pair<unsigned, ThreadCache *>> local;
+  static thread_local std::pair<unsigned, ThreadCache *> last(~0u, nullptr);
+  if (last.first == m_serial)
+    return *last.second;
+
+  for (auto &kv : local)
+    if (kv.first == m_serial) {
+      last = kv;
+      return *kv.second;
     }
+
+  ThreadCache *tc = new ThreadCache();
+  {
+    std::lock_guard<std::mutex> lock(m_threadCachesLock);
+    m_threadCaches.emplace_back(tc);
   }
+  local.emplace_back(m_serial, tc);
+  last = local.back();
+  return *tc;
+}
 
-  operator delete(static_cast<void *>(n), allocator);
+inline ENode::ENode(ExprFactory &f, Operator *o, unsigned capacity)
+    : id(0), count(0), fac(&f), m_oper(o), m_args(inlineArgs()), m_arity(0),
+      m_capacity(capacity), m_concurrent(f.isConcurrent()) {}
+
+inline void ENode::Ref() {
+  if (m_concurrent)
+    __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED);
+  else
+    count++;
 }
 
-inline ENode *ExprFactory::allocNode(const Operator &op) {
-  if (freeList.empty())
-    return new (allocator) ENode(*this, op);
+inline void ExprFactoryAllocator::newSlab() {
+  // -- recycle the tail of the current slab
+  if (m_end - m_cur >= static_cast<ptrdiff_t>(GRANULE))
+    pushFree(m_cur, m_end - m_cur);
 
-  ENode *res = freeList.back();
-  freeList.pop_back();
-  res->m_oper = std::unique_ptr<Operator, EFADeleter>(op.clone(allocator),
-                                                      allocator.get_deleter());
-  assert(res->count == 0);
-  return res;
+  m_slabs.emplace_back(new char[SLAB_SIZE]);
+  m_cur = m_slabs.back().get();
+  m_end = m_cur + SLAB_SIZE;
 }
 
 inline void *ExprFactoryAllocator::allocate(size_t n) {
-  if (n <= tiny.get_requested_size())
-    return tiny.malloc();
-  else if (n <= small.get_requested_size())
-    return small.malloc();
+  n = roundUp(n);
+  m_used += n;
+  if (n > MAX_SLAB_OBJ)
+    return ::operator new(n);
+
+  FreeBlock *&fl = m_free[n / GRANULE];
+  if (fl) {
+    void *res = fl;
+    fl = fl->next;
+    return res;
+  }
 
-  return static_cast<void *>(new char[n]);
+  if (m_cur + n > m_end)
+    newSlab();
+  void *res = m_cur;
+  m_cur += n;
+  return res;
 }
 
-inline void ExprFactoryAllocator::free(void *block) {
-  if (tiny.is_from(block))
-    tiny.free(block);
-  else if (small.is_from(block))
-    small.free(block);
+inline void ExprFactoryAllocator::free(void *block, size_t n) {
+  n = roundUp(n);
+  m_used -= n;
+  if (n > MAX_SLAB_OBJ)
+    ::operator delete(block);
   else
-    delete[] static_cast<char *const>(block);
-}
-
-inline EFADeleter ExprFactoryAllocator::get_deleter() {
-  return EFADeleter(*this);
+    pushFree(block, n);
 }
 
-inline void EFADeleter::operator()(void *p) { operator delete(p, *m_efa); }
-
 template <typename T> struct TerminalTrait {};
 enum class TerminalKind {
   STRING,
@@ -598,11 +1017,13 @@ public:
 
   base_type get() const { return val; }
 
-  this_type *clone(ExprFactoryAllocator &allocator) const override {
-    return new (allocator) this_type(val);
+  this_type *clone(void *mem) const override {
+    assert(reinterpret_cast<uintptr_t>(mem) % alignof(this_type) == 0);
+    return new (mem) this_type(val);
   }
+  size_t cloneSize() const override { return sizeof(this_type); }
 
-  void Print(std::ostream &OS, const std::vector<ENode *> &args, int depth = 0,
+  void Print(std::ostream &OS, llvm::ArrayRef<ENode *> args, int depth = 0,
              bool brkt = true) const override {
     terminal_type::print(OS, val, depth, brkt);
   }
@@ -799,7 +1220,7 @@ inline std::ostream &space(std::ostream &OS, size_t c) {
 struct PREFIX {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     if (args.size() >= 2)
       OS << "[";
     if (args.size() == 1 && brkt)
@@ -817,9 +1238,7 @@ struct PREFIX {
       return;
     }
 
-    for (std::vector<ENode *>::const_iterator it = args.begin(),
-                                              end = args.end();
-         it != end; ++it) {
+    for (auto it = args.begin(), end = args.end(); it != end; ++it) {
       OS << "\n";
       space(OS, depth + 2);
       (*it)->Print(OS, depth + 2, false);
@@ -834,7 +1253,7 @@ struct PREFIX {
 struct INFIX {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
 
     if (args.size() != 2) {
       PREFIX::print(OS, depth, brkt, name, args);
@@ -854,13 +1273,11 @@ struct INFIX {
 struct FUNCTIONAL {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     OS << name << "(";
 
     bool first = true;
-    for (std::vector<ENode *>::const_iterator it = args.begin(),
-                                              end = args.end();
-         it != end; ++it) {
+    for (auto it = args.begin(), end = args.end(); it != end; ++it) {
       if (!first)
         OS << ", ";
       (*it)->Print(OS, depth + 2, false);
@@ -874,13 +1291,11 @@ struct FUNCTIONAL {
 struct LISP {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     OS << "(" << name << " ";
 
     bool first = true;
-    for (std::vector<ENode *>::const_iterator it = args.begin(),
-                                              end = args.end();
-         it != end; ++it) {
+    for (auto it = args.begin(), end = args.end(); it != end; ++it) {
       if (!first)
         OS << " ";
       (*it)->Print(OS, depth + 2, true);
@@ -904,7 +1319,7 @@ struct DefOp : public B {
   DefOp() : B(kind) {}
   DefOp(DefOp const &) = default;
 
-  void Print(std::ostream &OS, const std::vector<ENode *> &args, int depth = 0,
+  void Print(std::ostream &OS, llvm::ArrayRef<ENode *> args, int depth = 0,
              bool brkt = true) const override {
     ps_type::print(OS, depth, brkt, op_type::name(), args);
   }
@@ -931,9 +1346,11 @@ struct DefOp : public B {
     return seed;
   }
 
-  this_type *clone(ExprFactoryAllocator &allocator) const override {
-    return new (allocator) this_type(*this);
+  this_type *clone(void *mem) const override {
+    assert(reinterpret_cast<uintptr_t>(mem) % alignof(this_type) == 0);
+    return new (mem) this_type(*this);
   }
+  size_t cloneSize() const override { return sizeof(this_type); }
 
   static bool classof(Operator const *op) {
     return llvm::isa<base_type>(op) &&
@@ -941,28 +1358,34 @@ struct DefOp : public B {
   }
 };
 
-inline ENode::~ENode() {
-  for (args_iterator b = args.begin(), e = args.end(); b != e; ++b)
-    efac().Deref(*b);
-}
-
 template <typename iterator> void ENode::renew_args(iterator b, iterator e) {
-  std::vector<ENode *> old = args;
-  args = std::vector<ENode *>();
+  std::vector<ENode *> old(args_begin(), args_end());
+  m_arity = 0;
+
+  size_t sz = std::distance(b, e);
+  if (sz > m_capacity)
+    efac().growArgs(this, sz);
 
   // -- increment reference count of all new arguments
   for (; b != e; ++b)
     this->push_back(eptr(*b));
 
   // -- decrement reference count of all old arguments
-  for (args_iterator b = old.begin(), e = old.end(); b != e; ++b)
-    efac().Deref(*b);
+  for (ENode *a : old)
+    efac().Deref(a);
 }
 
 /** Required by boost::intrusive_ptr */
 inline void intrusive_ptr_add_ref(ENode *v) { v->Ref(); }
 
-inline void intrusive_ptr_release(ENode *v) { v->efac().Deref(v); }
+inline void intrusive_ptr_release(ENode *v) {
+  // -- fast path: a node of a sequential factory that stays alive
+  if (!v->m_concurrent && v->count > 1) {
+    v->count--;
+    return;
+  }
+  v->efac().Deref(v);
+}
 
 struct BoolExprFn {
   virtual ~BoolExprFn() {}
@@ -1002,14 +1425,14 @@ template <typename T> struct ExprFunctionoid : public ExprFn {
 class VisitAction {
 public:
   // skipKids or doKids
-  VisitAction(bool kids = false)
-      : _skipKids(kids), fn(new ExprFunctionoid<IdentityRewriter>(
-                             std::make_shared<IdentityRewriter>())) {}
+  VisitAction(bool kids = false) : _skipKids(kids) {}
+
+  // changeTo or changeDoKids
+  VisitAction(Expr e, bool kids = false) : _skipKids(kids), expr(e) {}
 
   // changeTo or doKidsRewrite
   template <typename R>
-  VisitAction(Expr e, bool kids = false,
-              std::shared_ptr<R> r = std::make_shared<IdentityRewriter>())
+  VisitAction(Expr e, bool kids, std::shared_ptr<R> r)
       : _skipKids(kids), expr(e), fn(new ExprFunctionoid<R>(r)) {}
 
   bool isSkipKids() { return _skipKids && expr.get() == nullptr; }
@@ -1017,18 +1440,16 @@ public:
   bool isDoKids() { return !_skipKids && expr.get() == nullptr; }
   bool isChangeDoKidsRewrite() { return !_skipKids && expr.get() != nullptr; }
 
-  Expr rewrite(Expr v) { return fn->apply(v); }
+  Expr rewrite(Expr v) { return fn ? fn->apply(v) : v; }
 
   Expr getExpr() { return expr; }
 
   static inline VisitAction skipKids() { return VisitAction(true); }
   static inline VisitAction doKids() { return VisitAction(false); }
-  static inline VisitAction changeTo(Expr e) {
-    return VisitAction(e, true, std::make_shared<IdentityRewriter>());
-  }
+  static inline VisitAction changeTo(Expr e) { return VisitAction(e, true); }
 
   static inline VisitAction changeDoKids(Expr e) {
-    return VisitAction(e, false, std::make_shared<IdentityRewriter>());
+    return VisitAction(e, false);
   }
 
   template <typename R>
@@ -1041,77 +1462,277 @@ protected:
   Expr expr;
 
 private:
+  /// rewriter applied after the kids; identity when null
   std::shared_ptr<ExprFn> fn;
 };
 
-typedef std::unordered_map<ENode *, Expr> DagVisitCache;
+/**
+ * Cache of visit results indexed by node id.
+ *
+ * Ids are dense and never reused within a factory, so entries are kept in
+ * 64-slot pages addressed by id / 64. The cache does not keep its keys
+ * alive: a result equal to its key is stored as a flag rather than as a
+ * reference. The cache registers itself with the factory of its keys (see
+ * ExprFactory::registerCache), and drops an entry, and a page once it is
+ * empty, when the key dies. A long-lived cache therefore holds only the
+ * results of live nodes. Caches of a concurrent factory are not registered,
+ * since other threads may release their keys; they grow until cleared.
+ */
+class DagVisitCache : boost::noncopyable {
+  static const unsigned PAGE_BITS = 6;
+  static const unsigned PAGE_SIZE = 1u << PAGE_BITS;
+
+  struct Page {
+    ENode *key[PAGE_SIZE];
+    Expr val[PAGE_SIZE];
+    /// bit i is set iff the result of key[i] is key[i] itself
+    uint64_t self;
+    unsigned used;
+    Page() : self(0), used(0) {
+      std::fill(std::begin(key), std::end(key), nullptr);
+    }
+  };
+
+  llvm::DenseMap<unsigned, std::unique_ptr<Page>> m_pages;
+  /// last page looked up; most lookups hit the page of a recent node
+  unsigned m_lastIdx;
+  Page *m_last;
+  size_t m_size;
+  /// factory this cache is registered with
+  ExprFactory *m_efac;
+  CacheStub *m_stub;
+
+  Page *findPage(unsigned idx) const {
+    if (m_last && idx == m_lastIdx)
+      return m_last;
+    auto it = m_pages.find(idx);
+    if (it == m_pages.end())
+      return nullptr;
+    const_cast<DagVisitCache *>(this)->m_lastIdx = idx;
+    return const_cast<DagVisitCache *>(this)->m_last = it->second.get();
+  }
+
+  void attach(ExprFactory &efac) {
+    if (m_efac || efac.isConcurrent())
+      return;
+    m_efac = &efac;
+    m_stub = efac.registerCache(*this);
+  }
+
+  void detach() {
+    if (m_efac)
+      m_efac->unregisterCache(m_stub);
+    m_efac = nullptr;
+    m_stub = nullptr;
+  }
+
+public:
+  DagVisitCache()
+      : m_lastIdx(0), m_last(nullptr), m_size(0), m_efac(nullptr),
+        m_stub(nullptr) {}
+  ~DagVisitCache() {
+    clear();
+    detach();
+  }
+
+  /// sets res to the cached result for n and returns true, if there is one
+  bool lookup(const ENode *n, Expr &res) const {
+    Page *p = findPage(n->getId() >> PAGE_BITS);
+    if (!p)
+      return false;
+    unsigned slot = n->getId() & (PAGE_SIZE - 1);
+    if (p->key[slot] != n)
+      return false;
+    res = (p->self >> slot) & 1 ? Expr(const_cast<ENode *>(n)) : p->val[slot];
+    return true;
+  }
+
+  void insert(ENode *n, Expr v) {
+    attach(n->efac());
+    unsigned idx = n->getId() >> PAGE_BITS;
+    Page *p = findPage(idx);
+    if (!p) {
+      auto &slot = m_pages[idx];
+      slot.reset(new Page());
+      p = m_last = slot.get();
+      m_lastIdx = idx;
+    }
+    unsigned slot = n->getId() & (PAGE_SIZE - 1);
+    if (!p->key[slot]) {
+      ++m_size;
+      ++p->used;
+    }
+    p->key[slot] = n;
+    if (v.get() == n) {
+      p->self |= uint64_t(1) << slot;
+      p->val[slot].reset();
+    } else {
+      p->self &= ~(uint64_t(1) << slot);
+      p->val[slot] = std::move(v);
+    }
+  }
+
+  /// drops the entry of n. Called by the factory when n dies
+  void erase(ENode *n) {
+    unsigned idx = n->getId() >> PAGE_BITS;
+    Page *p = findPage(idx);
+    unsigned slot = n->getId() & (PAGE_SIZE - 1);
+    if (!p || p->key[slot] != n)
+      return;
+    p->key[slot] = nullptr;
+    p->self &= ~(uint64_t(1) << slot);
+    // -- releasing the result may kill other keys of this cache
+    Expr val = std::move(p->val[slot]);
+    --m_size;
+    if (--p->used == 0) {
+      if (m_last == p)
+        m_last = nullptr;
+      m_pages.erase(idx);
+    }
+  }
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  void clear() {
+    // -- results are released after the cache is empty, since releasing
+    // -- them may kill other keys
+    llvm::DenseMap<unsigned, std::unique_ptr<Page>> pages;
+    pages.swap(m_pages);
+    m_last = nullptr;
+    m_size = 0;
+  }
+};
+
+inline void clearDagVisitCache(DagVisitCache &cache) { cache.clear(); }
+
+/**
+ * Work stack of the iterative visitor. Kept by DagVisit so that repeated
+ * visits do not re-allocate it.
+ */
+struct DagVisitStack {
+  struct Frame {
+    /// the node as passed to the visitor
+    Expr expr;
+    VisitAction va;
+    /// the node whose kids are visited
+    Expr res;
+    /// next kid of res to visit
+    unsigned next;
+    /// position of the first visited kid in results
+    size_t kidsBase;
+
+    Frame(Expr e, VisitAction &&a, Expr r, size_t base)
+        : expr(std::move(e)), va(std::move(a)), res(std::move(r)), next(0),
+          kidsBase(base) {}
+  };
+
+  std::vector<Frame> frames;
+  ExprVector results;
+};
 
+namespace visit_detail {
+/**
+ * Post-order visit of expr with an explicit stack.
+ *
+ * The visitor is called on a node before any of its kids, in the same order
+ * as a recursive traversal. The visitor may itself start new visits that
+ * share cache and stk, so nothing on the stack is held by reference across
+ * a call to it.
+ */
 template <typename ExprVisitor>
-Expr visit(ExprVisitor &v, Expr expr, DagVisitCache &cache) {
-  if (!expr)
-    return expr;
-
-  if (expr->use_count() > 1) {
-    DagVisitCache::const_iterator cit = cache.find(&*expr);
-    if (cit != cache.end())
-      return cit->second;
-  }
-
-  VisitAction va = v(expr);
-  Expr res;
-
-  if (va.isSkipKids())
-    res = expr;
-  else if (va.isChangeTo())
-    res = va.getExpr();
-  else {
-    res = va.isChangeDoKidsRewrite() ? va.getExpr() : expr;
-    if (res->arity() > 0) {
-      bool changed = false;
-      std::vector<Expr> kids;
-
-      for (ENode::args_iterator b = res->args_begin(), e = res->args_end();
-           b != e; ++b) {
-        Expr k = visit(v, *b, cache);
-        kids.push_back(k);
-        changed = (changed || k.get() != *b);
-      }
+Expr visit(ExprVisitor &v, Expr expr, DagVisitCache *cache,
+           DagVisitStack &stk) {
+  auto &frames = stk.frames;
+  auto &results = stk.results;
+  const size_t base = frames.size();
+
+  auto finish = [&](const Expr &e, Expr res) {
+    if (cache && e->use_count() > 1)
+      cache->insert(e.get(), res);
+    results.push_back(std::move(res));
+  };
 
-      if (changed) {
-        if (!res->isMutable())
-          res = res->getFactory().mkNary(res->op(), kids.begin(), kids.end());
-        else
-          res->renew_args(kids.begin(), kids.end());
+  // -- visit e, or start a frame for it if its kids need visiting
+  auto enter = [&](Expr e) {
+    if (!e) {
+      results.push_back(e);
+      return;
+    }
+    if (cache) {
+      Expr hit;
+      if (cache->lookup(e.get(), hit)) {
+        results.push_back(std::move(hit));
+        return;
       }
     }
 
-    res = va.rewrite(res);
-  }
+    VisitAction va = v(e);
+    if (va.isSkipKids())
+      finish(e, e);
+    else if (va.isChangeTo())
+      finish(e, va.getExpr());
+    else {
+      Expr res = va.isChangeDoKidsRewrite() ? va.getExpr() : e;
+      frames.emplace_back(std::move(e), std::move(va), std::move(res),
+                          results.size());
+    }
+  };
 
-  if (expr->use_count() > 1) {
-    expr->Ref();
-    cache[&*expr] = res;
+  enter(std::move(expr));
+  while (frames.size() > base) {
+    DagVisitStack::Frame &f = frames.back();
+    if (f.next < f.res->arity()) {
+      Expr kid(f.res->arg(f.next++));
+      enter(std::move(kid));
+      continue;
+    }
+
+    Expr res = std::move(f.res);
+    auto kids = results.begin() + f.kidsBase;
+    bool changed = false;
+    for (unsigned i = 0, sz = res->arity(); i < sz && !changed; ++i)
+      changed = kids[i].get() != res->arg(i);
+
+    if (changed) {
+      if (!res->isMutable())
+        res = res->getFactory().mkNary(res->op(), kids, results.end());
+      else
+        res->renew_args(kids, results.end());
+    }
+    results.erase(kids, results.end());
+
+    Expr e = std::move(f.expr);
+    VisitAction va = std::move(f.va);
+    frames.pop_back();
+    res = va.rewrite(res);
+    finish(e, std::move(res));
   }
 
+  Expr res = std::move(results.back());
+  results.pop_back();
   return res;
 }
+} // namespace visit_detail
 
-inline void clearDagVisitCache(DagVisitCache &cache) {
-  for (DagVisitCache::value_type &kv : cache)
-    kv.first->efac().Deref(kv.first);
-  cache.clear();
+template <typename ExprVisitor>
+Expr visit(ExprVisitor &v, Expr expr, DagVisitCache &cache) {
+  DagVisitStack stk;
+  return visit_detail::visit(v, expr, &cache, stk);
 }
 
 template <typename ExprVisitor>
 struct DagVisit : public std::unary_function<Expr, Expr> {
   ExprVisitor &m_v;
   DagVisitCache m_cache;
+  DagVisitStack m_stack;
 
   DagVisit(ExprVisitor &v) : m_v(v) {}
   DagVisit(const DagVisit &o) : m_v(o.m_v) {}
-  ~DagVisit() { clearDagVisitCache(m_cache); }
 
-  Expr operator()(Expr e) { return visit(m_v, e, m_cache); }
+  Expr operator()(Expr e) {
+    return visit_detail::visit(m_v, e, &m_cache, m_stack);
+  }
 };
 
 template <typename ExprVisitor> Expr dagVisit(ExprVisitor &v, Expr expr) {
@@ -1127,40 +1748,10 @@ void dagVisit(ExprVisitor &v, const ExprVector &vec) {
   }
 }
 
+/** Visits expr as a tree: shared sub-expressions are visited every time */
 template <typename ExprVisitor> Expr visit(ExprVisitor &v, Expr expr) {
-  VisitAction va = v(expr);
-
-  if (va.isSkipKids())
-    return expr;
-
-  if (va.isChangeTo())
-    return va.getExpr();
-
-  Expr res = va.isChangeDoKidsRewrite() ? va.getExpr() : expr;
-
-  if (res->arity() == 0)
-    return va.rewrite(res);
-
-  bool changed = false;
-  std::vector<Expr> kids;
-
-  for (ENode::args_iterator b = res->args_begin(), e = res->args_end(); b != e;
-       ++b) {
-    Expr k = visit(v, *b);
-    kids.push_back(k);
-    changed = (changed || k.get() != *b);
-  }
-
-  if (changed) {
-    if (!res->isMutable())
-      res = res->getFactory().mkNary(res->op(), kids.begin(), kids.end());
-    else
-      res->renew_args(kids.begin(), kids.end());
-  }
-
-  res = va.rewrite(res);
-
-  return res;
+  DagVisitStack stk;
+  return visit_detail::visit(v, expr, nullptr, stk);
 }
 
 /**********************************************************************/
@@ -1896,7 +2487,7 @@ namespace numeric {
 struct ITV_PS {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     OS << "[";
     args[0]->Print(OS, depth, false);
     OS << ",";
@@ -1939,7 +2530,7 @@ namespace variant {
 struct PS {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     args[1]->Print(OS, depth, true);
     OS << "_";
     args[0]->Print(OS, depth, true);
@@ -1949,7 +2540,7 @@ struct PS {
 struct PS_TAG {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     args[1]->Print(OS, depth, true);
     OS << "!";
     args[0]->Print(OS, depth, true);
@@ -2070,7 +2661,7 @@ namespace bind {
 struct SCOPE_PS {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     OS << "[" << name << " ";
     args[0]->Print(OS, depth + 2, false);
     OS << " in ";
@@ -2246,7 +2837,7 @@ inline Expr sortOf(Expr v) { return typeOf(v); }
 struct FAPP_PS {
   static inline void print(std::ostream &OS, int depth, int brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     if (args.size() > 1)
       OS << "(";
 
@@ -2407,7 +2998,7 @@ namespace bind {
 struct BINDER {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     OS << "(" << name << " ";
 
     OS << "(";
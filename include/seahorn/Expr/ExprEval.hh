@@ -0,0 +1,198 @@
+#pragma once
+
+#include "seahorn/Expr/ExprIdMap.hh"
+#include "seahorn/Expr/ExprInterp.hh"
+#include "seahorn/Expr/ExprSimplifier.hh"
+
+#include <memory>
+
+namespace expr {
+
+/**
+ * In-process evaluator of expressions under a concrete assignment.
+ *
+ * Every assigned constant is replaced by its value, and every operator
+ * whose arguments are values is folded. Values are true, false, integer
+ * and bit-vector numerals, and arrays built with CONST_ARRAY, STORE or a
+ * model table (mdl::ftable). Bit-vector, Boolean, ite, equality and array
+ * operators are folded by BvRewriter. Integer +, -, * and comparisons are
+ * folded here.
+ *
+ * eval() returns null when the result is not a value, i.e., when the
+ * expression has an unassigned constant or an operator that is not
+ * folded (integer division, quantifiers, uninterpreted functions, bit-vector
+ * division by zero, ...). Callers are expected to fall back to an SMT
+ * solver in that case. Results are memoized across calls.
+ */
+class ExprEvaluator {
+  /// folds a node whose arguments are already evaluated
+  class Folder : public std::unary_function<Expr, Expr> {
+    ExprFactory &m_efac;
+    BvRewriter m_bv;
+
+    static bool isBool(Expr e) { return isOpX<TRUE>(e) || isOpX<FALSE>(e); }
+
+    Expr mkBool(bool b) {
+      return b ? mk<TRUE>(m_efac) : mk<FALSE>(m_efac);
+    }
+
+    Expr foldBool(Expr e) {
+      for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it)
+        if (!isBool(*it))
+          return m_bv(e);
+
+      auto val = [](ENode *n) { return isOpX<TRUE>(n); };
+      if (isOpX<NEG>(e))
+        return mkBool(!val(e->left()));
+      if (isOpX<IMPL>(e))
+        return mkBool(!val(e->left()) || val(e->right()));
+      if (isOpX<IFF>(e))
+        return mkBool(val(e->left()) == val(e->right()));
+
+      bool res = isOpX<AND>(e);
+      for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it) {
+        if (isOpX<AND>(e))
+          res = res && val(*it);
+        else if (isOpX<OR>(e))
+          res = res || val(*it);
+        else if (isOpX<XOR>(e))
+          res = res != val(*it);
+        else
+          return m_bv(e);
+      }
+      return mkBool(res);
+    }
+
+    Expr foldInt(Expr e) {
+      std::vector<mpz_class> v;
+      for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it) {
+        if (!isOpX<MPZ>(*it))
+          return e;
+        v.push_back(getTerm<mpz_class>(*it));
+      }
+      if (v.empty())
+        return e;
+
+      if (isOpX<UN_MINUS>(e) && v.size() == 1)
+        return mkTerm<mpz_class>(-v[0], m_efac);
+      if (isOpX<PLUS>(e) || isOpX<MINUS>(e) || isOpX<MULT>(e)) {
+        mpz_class r = v[0];
+        for (unsigned i = 1, sz = v.size(); i < sz; ++i) {
+          if (isOpX<PLUS>(e))
+            r += v[i];
+          else if (isOpX<MINUS>(e))
+            r -= v[i];
+          else
+            r *= v[i];
+        }
+        return mkTerm<mpz_class>(r, m_efac);
+      }
+      if (v.size() != 2)
+        return e;
+      if (isOpX<LT>(e))
+        return mkBool(v[0] < v[1]);
+      if (isOpX<LEQ>(e))
+        return mkBool(v[0] <= v[1]);
+      if (isOpX<GT>(e))
+        return mkBool(v[0] > v[1]);
+      if (isOpX<GEQ>(e))
+        return mkBool(v[0] >= v[1]);
+      // -- div and mod are left to the solver
+      return e;
+    }
+
+    /// read from a function table of a model
+    Expr selectTable(Expr tbl, Expr idx) {
+      if (!isValue(idx))
+        return mk<SELECT>(tbl, idx);
+      for (unsigned i = 0, sz = op::mdl::ftableEntries(tbl); i < sz; ++i) {
+        Expr entry = op::mdl::ftableEntry(tbl, i);
+        if (op::mdl::fentryArity(entry) != 1)
+          return mk<SELECT>(tbl, idx);
+        if (op::mdl::fentryArg(entry, 0) == idx)
+          return op::mdl::fentryVal(entry);
+      }
+      return op::mdl::ftableElseV(tbl);
+    }
+
+  public:
+    Folder(ExprFactory &efac) : m_efac(efac), m_bv(efac) {}
+
+    Expr operator()(Expr e) {
+      if (isOpX<SELECT>(e) && isOpX<op::FTABLE>(e->left()))
+        return selectTable(e->left(), e->right());
+      if (isOpX<EQ>(e) || isOpX<NEQ>(e) || isOpX<ITE>(e))
+        return m_bv(e);
+      if (isOp<BoolOp>(e))
+        return foldBool(e);
+      if (isOp<NumericOp>(e) || isOp<ComparissonOp>(e))
+        return foldInt(e);
+      return m_bv(e);
+    }
+  };
+
+  struct Visitor : public std::unary_function<Expr, VisitAction> {
+    const ExprIdMap<Expr, true> &m_assignment;
+    std::shared_ptr<Folder> m_f;
+
+    Visitor(ExprFactory &efac, const ExprIdMap<Expr, true> &assignment)
+        : m_assignment(assignment), m_f(std::make_shared<Folder>(efac)) {}
+
+    VisitAction operator()(Expr e) {
+      if (const Expr *v = m_assignment.lookup(e))
+        return VisitAction::changeTo(*v);
+      if (e->arity() == 0 || isOpX<BIND>(e) || isOpX<FDECL>(e) ||
+          bind::isFapp(e) || isOpX<op::FTABLE>(e) || isOpX<FORALL>(e) ||
+          isOpX<EXISTS>(e) || isOpX<LAMBDA>(e))
+        return VisitAction::skipKids();
+      return VisitAction::changeDoKidsRewrite(e, m_f);
+    }
+  };
+
+  ExprIdMap<Expr, true> m_assignment;
+  Visitor m_visitor;
+  DagVisit<Visitor> m_dv;
+
+public:
+  ExprEvaluator(ExprFactory &efac)
+      : m_visitor(efac, m_assignment), m_dv(m_visitor) {}
+  ExprEvaluator(const ExprEvaluator &) = delete;
+
+  /// \brief Assigns value \p v to constant \p c
+  ///
+  /// All assignments must be made before the first call to eval()
+  void assign(Expr c, Expr v) {
+    assert(m_dv.m_cache.size() == 0 && "assignment after evaluation");
+    m_assignment.insert(c, v);
+  }
+
+  /// number of assigned constants
+  size_t size() const { return m_assignment.size(); }
+
+  /// \brief Value of \p e under the assignment, or null if \p e does not
+  /// evaluate to a value
+  Expr eval(Expr e) {
+    Expr v = m_dv(e);
+    return isValue(v) ? v : Expr();
+  }
+
+  /// true if \p e is a value
+  static bool isValue(Expr e) {
+    if (isOpX<TRUE>(e) || isOpX<FALSE>(e) || isOpX<MPZ>(e) || bv::isBvNum(e))
+      return true;
+    if (isOpX<CONST_ARRAY>(e))
+      return isValue(e->arg(1));
+    if (isOpX<STORE>(e)) {
+      // -- walk down the spine without recursion
+      while (isOpX<STORE>(e)) {
+        if (!isValue(e->arg(1)) || !isValue(e->arg(2)))
+          return false;
+        e = e->arg(0);
+      }
+      return isValue(e);
+    }
+    return isOpX<op::FTABLE>(e);
+  }
+};
+
+} // namespace expr
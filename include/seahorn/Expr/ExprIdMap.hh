@@ -0,0 +1,366 @@
+#pragma once
+
+#include "seahorn/Expr/Expr.hh"
+
+#include "llvm/Support/MathExtras.h"
+
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace expr {
+
+/**
+ * A map from expressions to T indexed by node id.
+ *
+ * Node ids are dense and never reused within a factory. Entries are stored
+ * in pages of PAGE_SIZE consecutive ids; pages are allocated on demand and
+ * are grouped in chunks so that the directory stays small even when the
+ * factory has handed out many ids. Lookup is two indexed loads.
+ *
+ * By default keys are held weakly. The map registers itself with the
+ * factory of its keys (see ExprFactory::registerCache), and an entry is
+ * erased when its key dies. This is the right choice for caches. A weak
+ * map must not outlive the factory of its keys. The entry is erased by the
+ * thread that releases the key, so weak maps are not suitable for keys of a
+ * concurrent factory that other threads may release.
+ *
+ * If OwnKeys is true, the map holds a reference on every key instead, and
+ * an entry lives until it is erased.
+ *
+ * All keys must come from the same factory. Iteration is in the order of
+ * node ids, i.e., in the order in which keys were created.
+ */
+template <typename T, bool OwnKeys = false> class ExprIdMap {
+  static const unsigned PAGE_BITS = 5;
+  static const unsigned PAGE_SIZE = 1u << PAGE_BITS;
+  static const unsigned CHUNK_BITS = 10;
+  static const unsigned CHUNK_SIZE = 1u << CHUNK_BITS;
+
+  struct Page {
+    /// bit i is set iff slot i is occupied
+    uint32_t used;
+    ENode *key[PAGE_SIZE];
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type val[PAGE_SIZE];
+
+    Page() : used(0) {}
+    ~Page() {
+      for (unsigned i = 0; i < PAGE_SIZE; ++i)
+        if (isUsed(i))
+          value(i).~T();
+    }
+
+    bool isUsed(unsigned i) const { return used & (1u << i); }
+    T &value(unsigned i) { return *reinterpret_cast<T *>(&val[i]); }
+    const T &value(unsigned i) const {
+      return *reinterpret_cast<const T *>(&val[i]);
+    }
+  };
+  typedef std::array<std::unique_ptr<Page>, CHUNK_SIZE> Chunk;
+
+  std::vector<std::unique_ptr<Chunk>> m_chunks;
+  size_t m_size;
+  /// factory this map is registered with. Only used for weak maps
+  ExprFactory *m_efac;
+  /// registration handle with m_efac
+  CacheStub *m_stub;
+
+  Page *getPage(unsigned id) const {
+    size_t c = id >> (PAGE_BITS + CHUNK_BITS);
+    if (c >= m_chunks.size() || !m_chunks[c])
+      return nullptr;
+    return (*m_chunks[c])[(id >> PAGE_BITS) & (CHUNK_SIZE - 1)].get();
+  }
+
+  Page &getOrCreatePage(unsigned id) {
+    size_t c = id >> (PAGE_BITS + CHUNK_BITS);
+    if (c >= m_chunks.size())
+      m_chunks.resize(c + 1);
+    if (!m_chunks[c])
+      m_chunks[c].reset(new Chunk());
+    auto &page = (*m_chunks[c])[(id >> PAGE_BITS) & (CHUNK_SIZE - 1)];
+    if (!page)
+      page.reset(new Page());
+    return *page;
+  }
+
+  static unsigned slotOf(const ENode *n) {
+    return n->getId() & (PAGE_SIZE - 1);
+  }
+
+  void attach(ExprFactory &efac) {
+    if (OwnKeys || m_efac)
+      return;
+    m_efac = &efac;
+    m_stub = m_efac->registerCache(*this);
+  }
+
+  void detach() {
+    if (m_efac)
+      m_efac->unregisterCache(m_stub);
+    m_efac = nullptr;
+    m_stub = nullptr;
+  }
+
+  /// removes slot i of page p. The value is destroyed after the entry
+  /// is gone since destroying it might kill other keys of this map
+  void eraseSlot(Page &p, unsigned i) {
+    ENode *key = p.key[i];
+    T val(std::move(p.value(i)));
+    (void)val;
+    p.value(i).~T();
+    p.used &= ~(1u << i);
+    --m_size;
+    if (OwnKeys)
+      key->efac().Deref(key);
+  }
+
+public:
+  typedef T mapped_type;
+  typedef std::pair<Expr, T &> reference;
+  typedef std::pair<Expr, const T &> const_reference;
+
+  template <bool IsConst>
+  class iterator_base
+      : public std::iterator<std::forward_iterator_tag,
+                             typename std::conditional<IsConst, const_reference,
+                                                       reference>::type> {
+    friend class ExprIdMap;
+    typedef typename std::conditional<IsConst, const ExprIdMap, ExprIdMap>::type
+        map_type;
+    typedef typename std::conditional<IsConst, const_reference,
+                                      reference>::type ref_type;
+
+    map_type *m_map;
+    /// id of the current entry, SIZE_MAX past the end
+    size_t m_id;
+
+    void settle() {
+      size_t maxId = m_map->m_chunks.size() << (PAGE_BITS + CHUNK_BITS);
+      while (m_id < maxId) {
+        Page *p = m_map->getPage(m_id);
+        if (!p) {
+          m_id = (m_id | (PAGE_SIZE - 1)) + 1;
+          continue;
+        }
+        uint32_t rest = p->used >> (m_id & (PAGE_SIZE - 1));
+        if (rest) {
+          m_id += llvm::countTrailingZeros(rest);
+          return;
+        }
+        m_id = (m_id | (PAGE_SIZE - 1)) + 1;
+      }
+      m_id = SIZE_MAX;
+    }
+
+    iterator_base(map_type *m, size_t id, bool doSettle)
+        : m_map(m), m_id(id) {
+      if (doSettle)
+        settle();
+    }
+
+  public:
+    struct pointer {
+      ref_type r;
+      ref_type *operator->() { return &r; }
+    };
+
+    iterator_base() : m_map(nullptr), m_id(SIZE_MAX) {}
+    template <bool C, typename = typename std::enable_if<IsConst && !C>::type>
+    iterator_base(const iterator_base<C> &o) : m_map(o.m_map), m_id(o.m_id) {}
+
+    Expr key() const {
+      return Expr(m_map->getPage(m_id)->key[m_id & (PAGE_SIZE - 1)]);
+    }
+    ref_type operator*() const {
+      auto *p = m_map->getPage(m_id);
+      unsigned i = m_id & (PAGE_SIZE - 1);
+      return ref_type(Expr(p->key[i]), p->value(i));
+    }
+    pointer operator->() const { return pointer{**this}; }
+
+    iterator_base &operator++() {
+      ++m_id;
+      settle();
+      return *this;
+    }
+    iterator_base operator++(int) {
+      iterator_base res = *this;
+      ++*this;
+      return res;
+    }
+
+    bool operator==(const iterator_base &o) const { return m_id == o.m_id; }
+    bool operator!=(const iterator_base &o) const { return m_id != o.m_id; }
+
+    template <bool> friend class iterator_base;
+  };
+
+  typedef iterator_base<false> iterator;
+  typedef iterator_base<true> const_iterator;
+
+  ExprIdMap() : m_size(0), m_efac(nullptr), m_stub(nullptr) {}
+  ExprIdMap(const ExprIdMap &o) : ExprIdMap() {
+    for (auto kv : o)
+      insert(kv.first, kv.second);
+  }
+  ExprIdMap &operator=(ExprIdMap o) {
+    swap(o);
+    return *this;
+  }
+  ~ExprIdMap() {
+    clear();
+    detach();
+  }
+
+  void swap(ExprIdMap &o) {
+    std::swap(m_chunks, o.m_chunks);
+    std::swap(m_size, o.m_size);
+    // -- registration is tied to the address of the map
+    ExprFactory *efac = m_efac, *oefac = o.m_efac;
+    if (efac != oefac) {
+      detach();
+      o.detach();
+      if (oefac)
+        attach(*oefac);
+      if (efac)
+        o.attach(*efac);
+    }
+  }
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  iterator begin() { return iterator(this, 0, true); }
+  iterator end() { return iterator(); }
+  const_iterator begin() const { return const_iterator(this, 0, true); }
+  const_iterator end() const { return const_iterator(); }
+
+  /// value of n, or nullptr if n is not in the map
+  T *lookup(const ENode *n) {
+    Page *p = getPage(n->getId());
+    if (!p)
+      return nullptr;
+    unsigned i = slotOf(n);
+    return p->isUsed(i) && p->key[i] == n ? &p->value(i) : nullptr;
+  }
+  const T *lookup(const ENode *n) const {
+    return const_cast<ExprIdMap *>(this)->lookup(n);
+  }
+  T *lookup(const Expr &e) { return lookup(e.get()); }
+  const T *lookup(const Expr &e) const { return lookup(e.get()); }
+
+  size_t count(const Expr &e) const { return lookup(e) ? 1 : 0; }
+
+  iterator find(const Expr &e) {
+    return lookup(e) ? iterator(this, e->getId(), false) : end();
+  }
+  const_iterator find(const Expr &e) const {
+    return lookup(e) ? const_iterator(this, e->getId(), false) : end();
+  }
+
+  T &at(const Expr &e) {
+    T *v = lookup(e);
+    assert(v && "key not in ExprIdMap");
+    return *v;
+  }
+  const T &at(const Expr &e) const {
+    return const_cast<ExprIdMap *>(this)->at(e);
+  }
+
+  /// inserts (e, v) unless e is already in the map
+  template <typename V> std::pair<iterator, bool> insert(const Expr &e, V &&v) {
+    assert(e);
+    Page &p = getOrCreatePage(e->getId());
+    unsigned i = slotOf(e.get());
+    iterator it(this, e->getId(), false);
+    if (p.isUsed(i)) {
+      assert(p.key[i] == e.get() && "ExprIdMap keys from different factories");
+      return std::make_pair(it, false);
+    }
+    attach(e->efac());
+    new (&p.val[i]) T(std::forward<V>(v));
+    p.key[i] = e.get();
+    p.used |= 1u << i;
+    ++m_size;
+    if (OwnKeys)
+      e->Ref();
+    return std::make_pair(it, true);
+  }
+
+  T &operator[](const Expr &e) {
+    if (T *v = lookup(e))
+      return *v;
+    return (*insert(e, T()).first).second;
+  }
+
+  size_t erase(const ENode *n) {
+    Page *p = getPage(n->getId());
+    unsigned i = slotOf(n);
+    if (!p || !p->isUsed(i) || p->key[i] != n)
+      return 0;
+    eraseSlot(*p, i);
+    return 1;
+  }
+  size_t erase(const Expr &e) { return erase(e.get()); }
+
+  void clear() {
+    if (OwnKeys) {
+      // -- release keys one by one: destroying a value may release keys
+      for (auto &c : m_chunks)
+        if (c)
+          for (auto &p : *c)
+            if (p)
+              for (unsigned i = 0; i < PAGE_SIZE; ++i)
+                if (p->isUsed(i))
+                  eraseSlot(*p, i);
+    }
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    chunks.swap(m_chunks);
+    m_size = 0;
+  }
+};
+
+/**
+ * A set of expressions indexed by node id. Keys are held weakly: an
+ * expression leaves the set when it dies. See ExprIdMap.
+ */
+class ExprIdSet {
+  struct Empty {};
+  ExprIdMap<Empty> m_map;
+
+public:
+  class const_iterator
+      : public std::iterator<std::forward_iterator_tag, Expr> {
+    ExprIdMap<Empty>::const_iterator m_it;
+
+  public:
+    const_iterator() {}
+    const_iterator(ExprIdMap<Empty>::const_iterator it) : m_it(it) {}
+    Expr operator*() const { return m_it.key(); }
+    const_iterator &operator++() {
+      ++m_it;
+      return *this;
+    }
+    bool operator==(const const_iterator &o) const { return m_it == o.m_it; }
+    bool operator!=(const const_iterator &o) const { return m_it != o.m_it; }
+  };
+  typedef const_iterator iterator;
+
+  size_t size() const { return m_map.size(); }
+  bool empty() const { return m_map.empty(); }
+  const_iterator begin() const { return m_map.begin(); }
+  const_iterator end() const { return m_map.end(); }
+
+  /// returns true if e was not already in the set
+  bool insert(const Expr &e) { return m_map.insert(e, Empty()).second; }
+  size_t count(const Expr &e) const { return m_map.count(e); }
+  size_t erase(const Expr &e) { return m_map.erase(e); }
+  void clear() { m_map.clear(); }
+};
+
+} // namespace expr
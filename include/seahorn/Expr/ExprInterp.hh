@@ -22,7 +22,7 @@ namespace mdl {
 struct FTAB_PS {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
     OS << "[";
     unsigned sz = args.size();
     assert(sz > 0);
@@ -44,7 +44,7 @@ struct FTAB_PS {
 struct FENT_PS {
   static inline void print(std::ostream &OS, int depth, bool brkt,
                            const std::string &name,
-                           const std::vector<ENode *> &args) {
+                           llvm::ArrayRef<ENode *> args) {
 
     if (args.size() == 1)
       args[0]->Print(OS, depth, false);
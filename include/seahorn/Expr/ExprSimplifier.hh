@@ -0,0 +1,592 @@
+#pragma once
+
+#include "seahorn/Expr/Expr.hh"
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <memory>
+
+namespace expr {
+
+/**
+ * Local rewrite rules for bit-vector, array, and Boolean expressions.
+ *
+ * A rewriter for changeDoKidsRewrite(): it is applied to a node whose
+ * arguments have already been rewritten, and only looks at the top of
+ * the node and its immediate arguments. The rules are
+ *
+ *  - constant folding of bit-vector operators and comparisons
+ *  - neutral and absorbing elements, x - x, x ^ x, x op x
+ *  - (x + c1) + c2 ==> x + (c1 + c2) and x - c ==> x + (-c)
+ *  - extract of a numeral, of an extract, of a concat, or of an extension
+ *  - concat of adjacent numerals and of adjacent extracts of one term
+ *  - read-over-write when the indices are numerals or differ by a numeral
+ *    offset from the same base, and store-over-store at the same index
+ *  - the Boolean rules of boolop::TrivialSimplifier and ite simplification
+ *
+ * Results are built with the expression factory and are therefore
+ * hash-consed.
+ */
+class BvRewriter : public std::unary_function<Expr, Expr> {
+  ExprFactory &m_efac;
+  boolop::TrivialSimplifier m_trivial;
+  Expr m_true;
+  Expr m_false;
+
+  /// width of bit-vector terms by node id. Ids are never reused
+  llvm::DenseMap<unsigned, unsigned> m_width;
+  /// number of nodes that were changed
+  unsigned m_rewrites;
+
+  static bool isNum(Expr e, mpz_class &v) {
+    if (!bv::is_bvnum(e))
+      return false;
+    v = norm(bv::toMpz(e), bv::width(e->arg(1)));
+    return true;
+  }
+
+  /// v modulo 2^w
+  static mpz_class norm(const mpz_class &v, unsigned w) {
+    mpz_class r;
+    mpz_fdiv_r_2exp(r.get_mpz_t(), v.get_mpz_t(), w);
+    return r;
+  }
+
+  /// v as a signed w-bit value
+  static mpz_class toSigned(const mpz_class &v, unsigned w) {
+    mpz_class r = norm(v, w);
+    if (w > 0 && mpz_tstbit(r.get_mpz_t(), w - 1)) {
+      mpz_class m;
+      mpz_ui_pow_ui(m.get_mpz_t(), 2, w);
+      r -= m;
+    }
+    return r;
+  }
+
+  /// true if e has the width of its first argument
+  static bool keepsWidth(Expr e) {
+    return e->arity() > 0 &&
+           (isOpX<BNOT>(e) || isOpX<BAND>(e) || isOpX<BOR>(e) ||
+            isOpX<BXOR>(e) || isOpX<BNAND>(e) || isOpX<BNOR>(e) ||
+            isOpX<BXNOR>(e) || isOpX<BNEG>(e) || isOpX<BADD>(e) ||
+            isOpX<BSUB>(e) || isOpX<BMUL>(e) || isOpX<BUDIV>(e) ||
+            isOpX<BSDIV>(e) || isOpX<BUREM>(e) || isOpX<BSREM>(e) ||
+            isOpX<BSMOD>(e) || isOpX<BSHL>(e) || isOpX<BLSHR>(e) ||
+            isOpX<BASHR>(e));
+  }
+
+  Expr mkNum(const mpz_class &v, unsigned w) {
+    return bv::bvnum(norm(v, w), w, m_efac);
+  }
+
+  Expr mkBool(bool b) { return b ? m_true : m_false; }
+
+  /// width of a bit-vector term, 0 if unknown
+  unsigned width(Expr e) {
+    if (bv::is_bvnum(e))
+      return bv::width(e->arg(1));
+    if (isOpX<BEXTRACT>(e))
+      return bv::high(e) - bv::low(e) + 1;
+    if (isOpX<BSEXT>(e) || isOpX<BZEXT>(e))
+      return bv::width(e->arg(1));
+
+    auto it = m_width.find(e->getId());
+    if (it != m_width.end())
+      return it->second;
+
+    unsigned w = 0;
+    Expr sort;
+    if (isOpX<FAPP>(e) && bind::isFdecl(bind::fname(e)))
+      sort = bind::rangeTy(bind::fname(e));
+    else if (isOpX<BIND>(e))
+      sort = bind::type(e);
+
+    if (sort && isOpX<BVSORT>(sort))
+      w = bv::width(sort);
+    else if (isOpX<BCONCAT>(e)) {
+      for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it) {
+        unsigned aw = width(*it);
+        if (aw == 0) {
+          w = 0;
+          break;
+        }
+        w += aw;
+      }
+    } else if (isOpX<ITE>(e))
+      w = width(e->arg(1));
+    else if (isOpX<BREDAND>(e) || isOpX<BREDOR>(e))
+      w = 1;
+    else if (isOpX<SELECT>(e)) {
+      // -- the width of a stored value, or of the array sort
+      Expr a = e->left();
+      while (isOpX<STORE>(a) || isOpX<ITE>(a))
+        a = isOpX<STORE>(a) ? a->left() : a->arg(1);
+      if (isOpX<STORE>(e->left()))
+        w = width(e->left()->arg(2));
+      else if (isOpX<CONST_ARRAY>(a))
+        w = width(a->arg(1));
+      else if (isOpX<FAPP>(a) && bind::isFdecl(bind::fname(a))) {
+        Expr s = bind::rangeTy(bind::fname(a));
+        if (isOpX<ARRAY_TY>(s) && isOpX<BVSORT>(sort::arrayValTy(s)))
+          w = bv::width(sort::arrayValTy(s));
+      }
+    } else if (keepsWidth(e))
+      w = width(e->arg(0));
+
+    if (w > 0)
+      m_width[e->getId()] = w;
+    return w;
+  }
+
+  /// decomposes a bit-vector term into base + offset. The base of a
+  /// numeral is null
+  static void baseOffset(Expr e, Expr &base, mpz_class &off) {
+    if (isNum(e, off))
+      base = Expr();
+    else if (isOpX<BADD>(e) && e->arity() == 2 && isNum(e->right(), off))
+      base = e->left();
+    else {
+      base = e;
+      off = 0;
+    }
+  }
+
+  /// true if the bit-vector terms i and j are known to be different
+  bool differ(Expr i, Expr j) {
+    if (i == j)
+      return false;
+    Expr bi, bj;
+    mpz_class oi, oj;
+    baseOffset(i, bi, oi);
+    baseOffset(j, bj, oj);
+    if (bi != bj)
+      return false;
+    unsigned w = width(i);
+    return w > 0 && norm(oi, w) != norm(oj, w);
+  }
+
+  /// folds a binary bit-vector operator over numerals
+  static bool foldBinary(Expr e, const mpz_class &a, const mpz_class &b,
+                         unsigned w, mpz_class &r) {
+    if (isOpX<BADD>(e))
+      r = a + b;
+    else if (isOpX<BSUB>(e))
+      r = a - b;
+    else if (isOpX<BMUL>(e))
+      r = a * b;
+    else if (isOpX<BAND>(e))
+      mpz_and(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+    else if (isOpX<BOR>(e))
+      mpz_ior(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+    else if (isOpX<BXOR>(e))
+      mpz_xor(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+    else if (isOpX<BSHL>(e) || isOpX<BLSHR>(e) || isOpX<BASHR>(e)) {
+      if (b >= w) {
+        bool neg = isOpX<BASHR>(e) && toSigned(a, w) < 0;
+        r = neg ? -1 : 0;
+      } else if (isOpX<BSHL>(e))
+        mpz_mul_2exp(r.get_mpz_t(), a.get_mpz_t(), b.get_ui());
+      else {
+        mpz_class s = isOpX<BASHR>(e) ? toSigned(a, w) : a;
+        mpz_fdiv_q_2exp(r.get_mpz_t(), s.get_mpz_t(), b.get_ui());
+      }
+    } else if (b == 0)
+      // -- division by zero is left to the solver
+      return false;
+    else if (isOpX<BUDIV>(e))
+      mpz_tdiv_q(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+    else if (isOpX<BUREM>(e))
+      mpz_tdiv_r(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+    else if (isOpX<BSDIV>(e) || isOpX<BSREM>(e) || isOpX<BSMOD>(e)) {
+      mpz_class sa = toSigned(a, w), sb = toSigned(b, w);
+      if (isOpX<BSDIV>(e))
+        mpz_tdiv_q(r.get_mpz_t(), sa.get_mpz_t(), sb.get_mpz_t());
+      else if (isOpX<BSREM>(e))
+        mpz_tdiv_r(r.get_mpz_t(), sa.get_mpz_t(), sb.get_mpz_t());
+      else
+        mpz_fdiv_r(r.get_mpz_t(), sa.get_mpz_t(), sb.get_mpz_t());
+    } else
+      return false;
+    return true;
+  }
+
+  /// evaluates a bit-vector comparison over numerals
+  static bool foldCmp(Expr e, const mpz_class &a, const mpz_class &b,
+                      unsigned w, bool &r) {
+    bool sgn = isOpX<BSLT>(e) || isOpX<BSLE>(e) || isOpX<BSGT>(e) ||
+               isOpX<BSGE>(e);
+    mpz_class x = sgn ? toSigned(a, w) : a;
+    mpz_class y = sgn ? toSigned(b, w) : b;
+    if (isOpX<BULT>(e) || isOpX<BSLT>(e))
+      r = x < y;
+    else if (isOpX<BULE>(e) || isOpX<BSLE>(e))
+      r = x <= y;
+    else if (isOpX<BUGT>(e) || isOpX<BSGT>(e))
+      r = x > y;
+    else if (isOpX<BUGE>(e) || isOpX<BSGE>(e))
+      r = x >= y;
+    else
+      return false;
+    return true;
+  }
+
+  static bool isBvCmp(Expr e) {
+    return isOpX<BULT>(e) || isOpX<BSLT>(e) || isOpX<BULE>(e) ||
+           isOpX<BSLE>(e) || isOpX<BUGT>(e) || isOpX<BSGT>(e) ||
+           isOpX<BUGE>(e) || isOpX<BSGE>(e);
+  }
+
+  /// numeral-aware equality. Returns null if nothing is known
+  Expr mkEq(Expr a, Expr b) {
+    if (a == b)
+      return m_true;
+    mpz_class x, y;
+    if (isNum(a, x) && isNum(b, y))
+      return mkBool(x == y);
+    if ((isOpX<TRUE>(a) || isOpX<FALSE>(a)) &&
+        (isOpX<TRUE>(b) || isOpX<FALSE>(b)))
+      return m_false;
+    if (isOpX<MPZ>(a) && isOpX<MPZ>(b))
+      return m_false;
+    if (isOpX<TRUE>(b))
+      return a;
+    if (isOpX<TRUE>(a))
+      return b;
+    if (isOpX<FALSE>(b))
+      return boolop::lneg(a);
+    if (isOpX<FALSE>(a))
+      return boolop::lneg(b);
+    // -- (ite c n1 n2) = n3 with numerals
+    if (isOpX<ITE>(b))
+      std::swap(a, b);
+    if (isOpX<ITE>(a) && isNum(b, y)) {
+      Expr t = mkEq(a->arg(1), b), f = mkEq(a->arg(2), b);
+      if (t && f && (isOpX<TRUE>(t) || isOpX<FALSE>(t)) &&
+          (isOpX<TRUE>(f) || isOpX<FALSE>(f)))
+        return mkIte(a->arg(0), t, f);
+    }
+    return Expr();
+  }
+
+  Expr mkIte(Expr c, Expr t, Expr f) {
+    if (isOpX<TRUE>(c) || t == f)
+      return t;
+    if (isOpX<FALSE>(c))
+      return f;
+    if (isOpX<TRUE>(t) && isOpX<FALSE>(f))
+      return c;
+    if (isOpX<FALSE>(t) && isOpX<TRUE>(f))
+      return boolop::lneg(c);
+    if (isOpX<NEG>(c))
+      return mk<ITE>(c->left(), f, t);
+    return mk<ITE>(c, t, f);
+  }
+
+  Expr mkExtract(unsigned h, unsigned l, Expr x) {
+    unsigned w = width(x);
+    mpz_class v;
+    if (isNum(x, v)) {
+      mpz_class r;
+      mpz_fdiv_q_2exp(r.get_mpz_t(), v.get_mpz_t(), l);
+      return mkNum(r, h - l + 1);
+    }
+    if (l == 0 && w == h + 1)
+      return x;
+    if (isOpX<BEXTRACT>(x))
+      return mkExtract(h + bv::low(x), l + bv::low(x), bv::earg(x));
+    if ((isOpX<BZEXT>(x) || isOpX<BSEXT>(x)) && width(x->left()) > 0) {
+      unsigned aw = width(x->left());
+      if (h < aw)
+        return mkExtract(h, l, x->left());
+      if (l >= aw && isOpX<BZEXT>(x))
+        return mkNum(0, h - l + 1);
+    }
+    if (isOpX<BCONCAT>(x)) {
+      // -- the first argument holds the most significant bits
+      ExprVector parts;
+      unsigned lo = w;
+      for (auto it = x->args_begin(), end = x->args_end(); it != end; ++it) {
+        unsigned aw = width(*it);
+        if (aw == 0 || aw > lo)
+          return bv::extract(h, l, x);
+        unsigned hi = lo - 1;
+        lo -= aw;
+        if (hi < l || lo > h)
+          continue;
+        parts.push_back(
+            mkExtract(std::min(h, hi) - lo, std::max(l, lo) - lo, *it));
+      }
+      if (lo == 0)
+        return parts.size() == 1 ? parts[0] : mkConcat(parts);
+    }
+    return bv::extract(h, l, x);
+  }
+
+  /// concat of args, the first argument holding the most significant bits
+  Expr mkConcat(const ExprVector &args) {
+    ExprVector res;
+    for (const Expr &a : args) {
+      if (res.empty()) {
+        res.push_back(a);
+        continue;
+      }
+      Expr &last = res.back();
+      mpz_class x, y;
+      if (isNum(last, x) && isNum(a, y)) {
+        unsigned aw = width(a);
+        mpz_mul_2exp(x.get_mpz_t(), x.get_mpz_t(), aw);
+        last = mkNum(x + y, width(last) + aw);
+      } else if (isOpX<BEXTRACT>(last) && isOpX<BEXTRACT>(a) &&
+                 bv::earg(last) == bv::earg(a) &&
+                 bv::low(last) == bv::high(a) + 1)
+        last = mkExtract(bv::high(last), bv::low(a), bv::earg(a));
+      else
+        res.push_back(a);
+    }
+    if (res.size() == 1)
+      return res[0];
+    return mknary<BCONCAT>(res);
+  }
+
+  /// sum of args with the numerals folded into the last argument
+  Expr mkAdd(Expr e) {
+    unsigned w = width(e);
+    mpz_class sum = 0, v;
+    ExprVector terms;
+    unsigned nums = 0;
+    for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it) {
+      Expr a = *it;
+      if (isNum(a, v)) {
+        sum += v;
+        ++nums;
+      } else if (isOpX<BADD>(a) && a->arity() == 2 && isNum(a->right(), v)) {
+        terms.push_back(a->left());
+        sum += v;
+        ++nums;
+      } else
+        terms.push_back(a);
+    }
+    if (w == 0 || (nums == 0 && terms.size() == e->arity()))
+      return e;
+    sum = norm(sum, w);
+    if (terms.empty())
+      return mkNum(sum, w);
+    if (sum != 0)
+      terms.push_back(mkNum(sum, w));
+    if (terms.size() == 1)
+      return terms[0];
+    return mknary<BADD>(terms);
+  }
+
+  Expr rewriteBv(Expr e) {
+    unsigned w = width(e);
+    mpz_class a, b;
+
+    if (isOpX<BEXTRACT>(e))
+      return mkExtract(bv::high(e), bv::low(e), bv::earg(e));
+    if (isOpX<BCONCAT>(e)) {
+      ExprVector args(e->args_begin(), e->args_end());
+      return mkConcat(args);
+    }
+    if (isOpX<BZEXT>(e) || isOpX<BSEXT>(e)) {
+      Expr x = e->left();
+      unsigned xw = width(x);
+      if (xw == w)
+        return x;
+      if (isNum(x, a))
+        return mkNum(isOpX<BSEXT>(e) ? toSigned(a, xw) : a, w);
+      return e;
+    }
+    if (isOpX<BADD>(e))
+      return mkAdd(e);
+
+    if (e->arity() == 1) {
+      Expr x = e->left();
+      if (isNum(x, a) && w > 0) {
+        if (isOpX<BNOT>(e)) {
+          mpz_class m;
+          mpz_ui_pow_ui(m.get_mpz_t(), 2, w);
+          return mkNum(m - 1 - a, w);
+        }
+        if (isOpX<BNEG>(e))
+          return mkNum(-a, w);
+      }
+      if ((isOpX<BNOT>(e) || isOpX<BNEG>(e)) && x->op() == e->op())
+        return x->left();
+      return e;
+    }
+
+    if (e->arity() != 2)
+      return e;
+    Expr x = e->left(), y = e->right();
+    bool nx = isNum(x, a), ny = isNum(y, b);
+
+    if (isBvCmp(e)) {
+      bool r;
+      unsigned xw = width(x);
+      if (nx && ny && xw > 0 && foldCmp(e, a, b, xw, r))
+        return mkBool(r);
+      if (x == y)
+        return mkBool(isOpX<BULE>(e) || isOpX<BSLE>(e) || isOpX<BUGE>(e) ||
+                      isOpX<BSGE>(e));
+      return e;
+    }
+
+    if (w == 0)
+      return e;
+    mpz_class r;
+    if (nx && ny && foldBinary(e, a, b, w, r))
+      return mkNum(r, w);
+
+    // -- x - c ==> x + (-c)
+    if (isOpX<BSUB>(e)) {
+      if (x == y)
+        return mkNum(0, w);
+      if (ny)
+        return b == 0 ? x : mkAdd(mk<BADD>(x, mkNum(-b, w)));
+      return e;
+    }
+
+    // -- neutral and absorbing elements of commutative operators
+    if (nx && !ny && (isOpX<BMUL>(e) || isOpX<BAND>(e) || isOpX<BOR>(e) ||
+                      isOpX<BXOR>(e))) {
+      std::swap(x, y);
+      std::swap(a, b);
+      std::swap(nx, ny);
+    }
+    mpz_class ones = norm(-1, w);
+    if (isOpX<BMUL>(e) && ny)
+      return b == 0 ? y : b == 1 ? x : e;
+    if (isOpX<BAND>(e)) {
+      if (x == y)
+        return x;
+      if (ny)
+        return b == 0 ? y : b == ones ? x : e;
+    }
+    if (isOpX<BOR>(e)) {
+      if (x == y)
+        return x;
+      if (ny)
+        return b == 0 ? x : b == ones ? y : e;
+    }
+    if (isOpX<BXOR>(e)) {
+      if (x == y)
+        return mkNum(0, w);
+      if (ny && b == 0)
+        return x;
+    }
+    if ((isOpX<BSHL>(e) || isOpX<BLSHR>(e) || isOpX<BASHR>(e)) && ny &&
+        b == 0)
+      return x;
+    if ((isOpX<BUDIV>(e) || isOpX<BSDIV>(e)) && ny && b == 1)
+      return x;
+    return e;
+  }
+
+  Expr mkSelect(Expr e) {
+    Expr a = e->left(), j = e->right();
+    while (isOpX<STORE>(a)) {
+      if (a->arg(1) == j)
+        return a->arg(2);
+      if (!differ(a->arg(1), j))
+        break;
+      a = a->left();
+    }
+    if (isOpX<CONST_ARRAY>(a))
+      return a->arg(1);
+    return a == e->left() ? e : mk<SELECT>(a, j);
+  }
+
+  Expr mkStore(Expr e) {
+    Expr a = e->arg(0), i = e->arg(1), v = e->arg(2);
+    if (isOpX<STORE>(a) && a->arg(1) == i)
+      return mk<STORE>(a->arg(0), i, v);
+    // -- storing what is already there
+    if (isOpX<SELECT>(v) && v->left() == a && v->right() == i)
+      return a;
+    return e;
+  }
+
+  Expr rewrite(Expr e) {
+    if (isOpX<ITE>(e))
+      return mkIte(e->arg(0), e->arg(1), e->arg(2));
+    if (isOp<BoolOp>(e))
+      return m_trivial(e);
+    if (isOpX<EQ>(e) || isOpX<NEQ>(e)) {
+      Expr r = mkEq(e->left(), e->right());
+      if (!r)
+        return e;
+      return isOpX<EQ>(e) ? r : m_trivial(mk<NEG>(r));
+    }
+    if (isOpX<SELECT>(e))
+      return mkSelect(e);
+    if (isOpX<STORE>(e))
+      return mkStore(e);
+    if (isOp<BvOp>(e))
+      return rewriteBv(e);
+    return e;
+  }
+
+public:
+  BvRewriter(ExprFactory &efac)
+      : m_efac(efac), m_trivial(efac), m_true(mk<TRUE>(efac)),
+        m_false(mk<FALSE>(efac)), m_rewrites(0) {}
+
+  Expr operator()(Expr e) {
+    Expr res = rewrite(e);
+    if (res != e)
+      ++m_rewrites;
+    // -- remember the width while the arguments are known
+    if (isOp<BvOp>(res))
+      width(res);
+    return res;
+  }
+
+  unsigned rewrites() const { return m_rewrites; }
+};
+
+/**
+ * In-process simplifier for bit-vector and array terms.
+ *
+ * Applies BvRewriter bottom-up. Results are memoized across calls, so
+ * sub-terms that are shared between successive calls are simplified once.
+ * Cheaper than a round-trip through an SMT solver, but only applies local
+ * rules.
+ */
+class BvSimplifier {
+  struct Visitor : public std::unary_function<Expr, VisitAction> {
+    std::shared_ptr<BvRewriter> m_r;
+
+    Visitor(ExprFactory &efac) : m_r(std::make_shared<BvRewriter>(efac)) {}
+
+    VisitAction operator()(Expr e) {
+      if (e->arity() == 0 || isOpX<BIND>(e) || isOpX<FDECL>(e))
+        return VisitAction::skipKids();
+      return VisitAction::changeDoKidsRewrite(e, m_r);
+    }
+  };
+
+  Visitor m_visitor;
+  DagVisit<Visitor> m_dv;
+  unsigned m_calls;
+
+public:
+  BvSimplifier(ExprFactory &efac)
+      : m_visitor(efac), m_dv(m_visitor), m_calls(0) {}
+  BvSimplifier(const BvSimplifier &) = delete;
+
+  Expr simplify(Expr e) {
+    ++m_calls;
+    return m_dv(e);
+  }
+  Expr operator()(Expr e) { return simplify(e); }
+
+  /// number of calls to simplify()
+  unsigned calls() const { return m_calls; }
+  /// number of nodes changed by a rule
+  unsigned rewrites() const { return m_visitor.m_r->rewrites(); }
+  /// number of simplified nodes that are kept for later calls
+  size_t cacheSize() const { return m_dv.m_cache.size(); }
+};
+
+} // namespace expr
@@ -0,0 +1,648 @@
+#pragma once
+
+#include "seahorn/Expr/Expr.hh"
+#include "seahorn/Expr/ExprIdMap.hh"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace expr {
+
+/// Raised by SmtLibWriter on an expression that has no SMT-LIB form
+struct SmtLibError : public std::runtime_error {
+  explicit SmtLibError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+/**
+ * Writes expressions in SMT-LIB2 format directly to a stream.
+ *
+ * Expressions are written without translating them to an SMT solver
+ * first. Closed sub-expressions that are used more than once are
+ * let-bound, so the output is linear in the size of the DAG. Both the
+ * traversal and the printing use explicit stacks, so expressions of any
+ * depth can be written. Output goes straight to the stream; pass a
+ * buffered stream (e.g. llvm::raw_fd_ostream) for large formulas.
+ *
+ * The writer remembers the symbols it has declared, so a script can be
+ * assembled from several calls. Operators are mapped to SMT-LIB as in
+ * the Z3 marshaller (see Smt/ZExprConverter.hh), including its naming of
+ * constants, except that every '!' in a symbol name is doubled so that no
+ * symbol can clash with the let-bound (a!N) or bound (x!N) names of the
+ * writer.
+ *
+ * An expression that cannot be written raises SmtLibError. The stream
+ * then holds a partial script and should be discarded.
+ */
+class SmtLibWriter {
+  struct Info {
+    /// references to the node from the DAG being written
+    unsigned uses = 0;
+    /// number of enclosing binders needed to close the node
+    unsigned free = 0;
+    /// let nesting depth that writing the node inline requires
+    unsigned level = 0;
+    /// id of the let-binding of the node, 0 if it is written inline
+    unsigned let = 0;
+    /// sort of the node, if it could be inferred
+    Expr sort;
+  };
+
+  llvm::raw_ostream &m_out;
+
+  /// nodes of the DAG being written. This and the maps below own their
+  /// keys: a weak map is updated by the thread that releases a key, and
+  /// the writer may run while other threads release nodes of a
+  /// concurrent factory
+  ExprIdMap<Info, true> m_info;
+  /// nodes of m_info in post-order
+  ExprVector m_order;
+  /// let-bound nodes grouped by nesting depth
+  std::vector<ExprVector> m_lets;
+
+  /// symbols seen so far. The value is false until the symbol is declared
+  ExprIdMap<bool, true> m_declared;
+  /// symbols of the last traversal that are not declared yet
+  ExprVector m_pending;
+  /// names of symbols
+  ExprIdMap<std::string, true> m_names;
+  /// names of the variables of the enclosing binders
+  std::vector<std::string> m_bound;
+
+  static bool isSort(Expr e) {
+    return isOpX<INT_TY>(e) || isOpX<REAL_TY>(e) || isOpX<BOOL_TY>(e) ||
+           isOpX<ARRAY_TY>(e) || isOpX<BVSORT>(e);
+  }
+
+  static bool isBinder(Expr e) {
+    return isOpX<FORALL>(e) || isOpX<EXISTS>(e) || isOpX<LAMBDA>(e);
+  }
+
+  /// e is a variable, a numeral, or a constant
+  static bool isLeaf(Expr e) {
+    return e->arity() == 0 || isOpX<BIND>(e) || isOpX<FDECL>(e) ||
+           isSort(e) || (isOpX<FAPP>(e) && e->arity() == 1);
+  }
+
+  /// arguments [first, second) of e are written as terms
+  static std::pair<unsigned, unsigned> termArgs(Expr e) {
+    unsigned n = e->arity();
+    if (isLeaf(e))
+      return {0, 0};
+    if (isOpX<FAPP>(e))
+      return {bind::isFdecl(bind::fname(e)) ? 1 : 0, n};
+    if (isBinder(e))
+      return {n - 1, n};
+    if (isOpX<BEXTRACT>(e))
+      return {2, 3};
+    if (isOpX<BSEXT>(e) || isOpX<BZEXT>(e))
+      return {0, 1};
+    if (isOpX<CONST_ARRAY>(e) || isOpX<ARRAY_MAP>(e))
+      return {1, n};
+    return {0, n};
+  }
+
+  [[noreturn]] static void fail(Expr e) {
+    throw SmtLibError("Cannot write to SMT-LIB: " +
+                      boost::lexical_cast<std::string>(*e));
+  }
+
+  Expr sortOf(Expr e) const {
+    const Info *i = m_info.lookup(e);
+    return i ? i->sort : Expr();
+  }
+
+  /// sort of e given the sorts of its arguments
+  Expr inferSort(Expr e) const {
+    ExprFactory &efac = e->efac();
+    if (isOpX<ITE>(e))
+      return sortOf(e->arg(1));
+    if (isOp<BoolOp>(e) || isOp<ComparissonOp>(e) || isOpX<FORALL>(e) ||
+        isOpX<EXISTS>(e) || isOpX<BULT>(e) || isOpX<BSLT>(e) ||
+        isOpX<BULE>(e) || isOpX<BSLE>(e) || isOpX<BUGE>(e) ||
+        isOpX<BSGE>(e) || isOpX<BUGT>(e) || isOpX<BSGT>(e))
+      return sort::boolTy(efac);
+    if (isOpX<MPZ>(e) || isOpX<IDIV>(e) || isOpX<BV2INT>(e))
+      return sort::intTy(efac);
+    // -- the marshaller makes int terminals real numerals
+    if (isOpX<MPQ>(e) || isOpX<INT>(e))
+      return sort::realTy(efac);
+    if (bv::is_bvnum(e))
+      return e->arg(1);
+    if (isOpX<BIND>(e))
+      return bind::type(e);
+    if (isOpX<FAPP>(e)) {
+      Expr f = bind::fname(e);
+      if (bind::isFdecl(f))
+        return bind::rangeTy(f);
+      Expr a = sortOf(f);
+      return a && isOpX<ARRAY_TY>(a) ? sort::arrayValTy(a) : Expr();
+    }
+    if (isOp<NumericOp>(e) && e->arity() > 0)
+      return sortOf(e->arg(0));
+    if (isOpX<SELECT>(e)) {
+      Expr a = sortOf(e->arg(0));
+      return a && isOpX<ARRAY_TY>(a) ? sort::arrayValTy(a) : Expr();
+    }
+    if (isOpX<STORE>(e))
+      return sortOf(e->arg(0));
+    if (isOpX<CONST_ARRAY>(e)) {
+      Expr v = sortOf(e->arg(1));
+      return v ? sort::arrayTy(e->arg(0), v) : Expr();
+    }
+    if (isOpX<LAMBDA>(e) && bind::numBound(e) == 1) {
+      Expr v = sortOf(bind::body(e));
+      return v ? sort::arrayTy(bind::boundSort(e, 0), v) : Expr();
+    }
+    if (isOpX<BREDAND>(e) || isOpX<BREDOR>(e))
+      return bv::bvsort(1, efac);
+    if (isOpX<BEXTRACT>(e))
+      return bv::bvsort(bv::high(e) - bv::low(e) + 1, efac);
+    if (isOpX<BSEXT>(e) || isOpX<BZEXT>(e))
+      return e->arg(1);
+    if (isOpX<BCONCAT>(e)) {
+      unsigned w = 0;
+      for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it) {
+        Expr s = sortOf(*it);
+        if (!s || !isOpX<BVSORT>(s))
+          return Expr();
+        w += bv::width(s);
+      }
+      return bv::bvsort(w, efac);
+    }
+    if (isOp<BvOp>(e) && !isOpX<INT2BV>(e) && e->arity() > 0)
+      return sortOf(e->arg(0));
+    return Expr();
+  }
+
+  /// records a symbol that the DAG being written uses
+  void useSymbol(Expr d) {
+    if (m_declared.insert(d, false).second)
+      m_pending.push_back(d);
+  }
+
+  /// computes uses, sorts, free variables and symbols of every node
+  /// reachable from roots
+  void analyze(const ExprVector &roots) {
+    m_info.clear();
+    m_order.clear();
+    m_lets.clear();
+    m_pending.clear();
+
+    std::vector<std::pair<Expr, unsigned>> stack;
+    for (const Expr &r : roots) {
+      if (m_info[r].uses++ > 0)
+        continue;
+      stack.emplace_back(r, termArgs(r).first);
+      while (!stack.empty()) {
+        Expr e = stack.back().first;
+        unsigned &next = stack.back().second;
+        if (next < termArgs(e).second) {
+          Expr c = e->arg(next++);
+          if (m_info[c].uses++ == 0)
+            stack.emplace_back(c, termArgs(c).first);
+          continue;
+        }
+        stack.pop_back();
+        finish(e);
+      }
+    }
+
+    // -- let-bind closed shared nodes, children before parents
+    unsigned numLets = 0;
+    for (const Expr &e : m_order) {
+      Info &i = m_info.at(e);
+      auto args = termArgs(e);
+      for (unsigned k = args.first; k < args.second; ++k) {
+        const Info &c = m_info.at(e->arg(k));
+        i.level = std::max(i.level, c.let ? c.level + 1 : c.level);
+      }
+      if (i.uses > 1 && i.free == 0 && args.first < args.second) {
+        i.let = ++numLets;
+        if (m_lets.size() <= i.level)
+          m_lets.resize(i.level + 1);
+        m_lets[i.level].push_back(e);
+      }
+    }
+  }
+
+  /// computes the information of e once its arguments are done
+  void finish(Expr e) {
+    Info &i = m_info.at(e);
+    auto args = termArgs(e);
+    for (unsigned k = args.first; k < args.second; ++k)
+      i.free = std::max(i.free, m_info.at(e->arg(k)).free);
+
+    if (bind::isBVar(e))
+      i.free = bind::bvarId(e) + 1;
+    else if (isBinder(e))
+      i.free = i.free > bind::numBound(e) ? i.free - bind::numBound(e) : 0;
+    else if (isOpX<FAPP>(e) && bind::isFdecl(bind::fname(e)))
+      useSymbol(bind::fname(e));
+    else if (isOpX<ARRAY_MAP>(e) && bind::isFdecl(e->arg(0)))
+      useSymbol(e->arg(0));
+    else if (bind::isBoolVar(e) || bind::isIntVar(e) || bind::isRealVar(e))
+      useSymbol(e);
+
+    i.sort = inferSort(e);
+    m_order.push_back(e);
+  }
+
+  static bool isSimpleSymbol(const std::string &s) {
+    if (s.empty() || std::isdigit(static_cast<unsigned char>(s[0])))
+      return false;
+    for (char c : s)
+      if (!std::isalnum(static_cast<unsigned char>(c)) &&
+          std::string("~!@$%^&*_-+=<>.?/").find(c) == std::string::npos)
+        return false;
+    return true;
+  }
+
+  /// name of a function declaration or of a variable
+  const std::string &name(Expr d) {
+    if (const std::string *n = m_names.lookup(d))
+      return *n;
+
+    std::string s;
+    if (bind::isFdecl(d)) {
+      Expr fname = bind::fname(d);
+      if (isOpX<STRING>(fname))
+        s = getTerm<std::string>(fname);
+      else
+        s = boost::lexical_cast<std::string>(*fname);
+    } else {
+      Expr n = bind::name(d);
+      if (isOpX<STRING>(n))
+        s = getTerm<std::string>(n);
+      else
+        s = (bind::isBoolVar(d) ? "E" : bind::isIntVar(d) ? "I" : "R") +
+            boost::lexical_cast<std::string, void *>(n.get());
+    }
+    // -- generated names (a!N, x!N) contain a single '!'. Doubling every
+    // '!' of a user name keeps the two apart
+    std::string::size_type pos = 0;
+    while ((pos = s.find('!', pos)) != std::string::npos) {
+      s.insert(pos, 1, '!');
+      pos += 2;
+    }
+    if (!isSimpleSymbol(s))
+      s = "|" + s + "|";
+    return m_names.insert(d, std::move(s)).first->second;
+  }
+
+  void writeDecls() {
+    for (const Expr &d : m_pending) {
+      m_out << "(declare-fun " << name(d) << " (";
+      if (bind::isFdecl(d)) {
+        for (unsigned k = 0, sz = bind::domainSz(d); k < sz; ++k) {
+          if (k > 0)
+            m_out << " ";
+          writeSort(bind::domainTy(d, k));
+        }
+        m_out << ") ";
+        writeSort(bind::rangeTy(d));
+      } else {
+        m_out << ") ";
+        writeSort(bind::type(d));
+      }
+      m_out << ")\n";
+      m_declared.at(d) = true;
+    }
+    m_pending.clear();
+  }
+
+  /// forgets the symbols of the last traversal that were not declared
+  void dropPending() {
+    for (const Expr &d : m_pending)
+      m_declared.erase(d);
+    m_pending.clear();
+  }
+
+  void writeNumeral(const mpz_class &v, const char *suffix = "") {
+    if (v < 0)
+      m_out << "(- " << mpz_class(-v).get_str() << suffix << ")";
+    else
+      m_out << v.get_str() << suffix;
+  }
+
+  void writeLeaf(Expr e) {
+    if (isOpX<TRUE>(e))
+      m_out << "true";
+    else if (isOpX<FALSE>(e))
+      m_out << "false";
+    else if (isOpX<MPZ>(e))
+      writeNumeral(getTerm<mpz_class>(e));
+    else if (isOpX<INT>(e))
+      writeNumeral(getTerm<int>(e), ".0");
+    else if (isOpX<MPQ>(e)) {
+      const mpq_class &v = getTerm<mpq_class>(e);
+      if (v.get_den() == 1)
+        writeNumeral(v.get_num(), ".0");
+      else {
+        m_out << "(/ ";
+        writeNumeral(v.get_num(), ".0");
+        m_out << " " << v.get_den().get_str() << ".0)";
+      }
+    } else if (bv::is_bvnum(e)) {
+      unsigned w = bv::width(e->arg(1));
+      mpz_class v = getTerm<mpz_class>(e->arg(0));
+      mpz_fdiv_r_2exp(v.get_mpz_t(), v.get_mpz_t(), w);
+      m_out << "(_ bv" << v.get_str() << " " << w << ")";
+    } else if (bind::isBVar(e)) {
+      unsigned id = bind::bvarId(e);
+      assert(id < m_bound.size());
+      m_out << m_bound[m_bound.size() - 1 - id];
+    } else if (bind::isBoolVar(e) || bind::isIntVar(e) || bind::isRealVar(e))
+      m_out << name(e);
+    else if (isOpX<FAPP>(e) && bind::isFdecl(bind::fname(e)))
+      m_out << name(bind::fname(e));
+    else
+      fail(e);
+  }
+
+  static const char *smtOp(Expr e) {
+    // -- BoolOp
+    if (isOpX<AND>(e))
+      return "and";
+    if (isOpX<OR>(e))
+      return "or";
+    if (isOpX<XOR>(e))
+      return "xor";
+    if (isOpX<NEG>(e))
+      return "not";
+    if (isOpX<IMPL>(e))
+      return "=>";
+    if (isOpX<ITE>(e))
+      return "ite";
+    if (isOpX<IFF>(e) || isOpX<EQ>(e))
+      return "=";
+    // -- NumericOp
+    if (isOpX<PLUS>(e))
+      return "+";
+    if (isOpX<MINUS>(e) || isOpX<UN_MINUS>(e))
+      return "-";
+    if (isOpX<MULT>(e))
+      return "*";
+    if (isOpX<IDIV>(e))
+      return "div";
+    if (isOpX<MOD>(e))
+      return "mod";
+    if (isOpX<REM>(e))
+      return "rem";
+    // -- ComparissonOp
+    if (isOpX<LEQ>(e))
+      return "<=";
+    if (isOpX<GEQ>(e))
+      return ">=";
+    if (isOpX<LT>(e))
+      return "<";
+    if (isOpX<GT>(e))
+      return ">";
+    // -- ArrayOp
+    if (isOpX<SELECT>(e))
+      return "select";
+    if (isOpX<STORE>(e))
+      return "store";
+    if (isOpX<ARRAY_DEFAULT>(e))
+      return "default";
+    return nullptr;
+  }
+
+  /// bit-vector operators whose names are their SMT-LIB names
+  static bool isSmtBvOp(Expr e) {
+    return isOp<BvOp>(e) && !isOpX<BEXTRACT>(e) && !isOpX<BSEXT>(e) &&
+           !isOpX<BZEXT>(e) && !isOpX<BREPEAT>(e) &&
+           !isOpX<BROTATE_LEFT>(e) && !isOpX<BROTATE_RIGHT>(e) &&
+           !isOpX<BEXT_ROTATE_LEFT>(e) && !isOpX<BEXT_ROTATE_RIGHT>(e) &&
+           !isOpX<INT2BV>(e);
+  }
+
+  struct Frame {
+    Expr e;
+    unsigned next;
+    unsigned end;
+    /// number of binary applications of a right-nested n-ary operator
+    /// that are still open
+    unsigned nest;
+  };
+
+  /// writes the head of e and returns false if e is written completely
+  bool writeHead(Expr e, Frame &f) {
+    f.nest = 0;
+    if (isLeaf(e)) {
+      writeLeaf(e);
+      return false;
+    }
+
+    if (isOpX<FAPP>(e)) {
+      Expr fn = bind::fname(e);
+      if (bind::isFdecl(fn))
+        m_out << "(" << name(fn);
+      else
+        // -- lambdas are arrays, and their application is a select
+        m_out << "(select";
+    } else if (isBinder(e)) {
+      m_out << (isOpX<FORALL>(e) ? "(forall (" :
+                isOpX<EXISTS>(e) ? "(exists (" : "(lambda (");
+      for (unsigned k = 0, sz = bind::numBound(e); k < sz; ++k) {
+        m_bound.push_back("x!" + std::to_string(m_bound.size()));
+        m_out << (k > 0 ? " (" : "(") << m_bound.back() << " ";
+        writeSort(bind::boundSort(e, k));
+        m_out << ")";
+      }
+      m_out << ")";
+    } else if (isOpX<NEQ>(e))
+      m_out << "(distinct";
+    else if (isOpX<DIV>(e)) {
+      Expr s = sortOf(e->arg(0));
+      m_out << (s && isOpX<INT_TY>(s) ? "(div" : "(/");
+    } else if (isOpX<BEXTRACT>(e))
+      m_out << "((_ extract " << bv::high(e) << " " << bv::low(e) << ")";
+    else if (isOpX<BSEXT>(e) || isOpX<BZEXT>(e)) {
+      Expr s = sortOf(e->arg(0));
+      if (!s || !isOpX<BVSORT>(s)) {
+        fail(e);
+        return false;
+      }
+      m_out << (isOpX<BSEXT>(e) ? "((_ sign_extend " : "((_ zero_extend ")
+            << bv::width(e->arg(1)) - bv::width(s) << ")";
+    } else if (isOpX<CONST_ARRAY>(e)) {
+      Expr v = sortOf(e->arg(1));
+      if (!v) {
+        fail(e);
+        return false;
+      }
+      m_out << "((as const ";
+      writeSort(sort::arrayTy(e->arg(0), v));
+      m_out << ")";
+    } else if (isOpX<ARRAY_MAP>(e)) {
+      if (!bind::isFdecl(e->arg(0))) {
+        fail(e);
+        return false;
+      }
+      m_out << "((_ map " << name(e->arg(0)) << ")";
+    } else if (const char *op = smtOp(e))
+      m_out << "(" << op;
+    else if (isSmtBvOp(e)) {
+      // -- concat and bvadd are binary in the marshaller
+      m_out << "(" << e->op().name();
+      if ((isOpX<BCONCAT>(e) || isOpX<BADD>(e)) && e->arity() > 2)
+        f.nest = e->arity() - 2;
+    } else {
+      fail(e);
+      return false;
+    }
+    return true;
+  }
+
+  /// writes e. Let-bound nodes other than e itself are written by name
+  void writeTerm(Expr root, bool define) {
+    std::vector<Frame> stack;
+    auto enter = [&](Expr e, bool isDef) {
+      const Info *i = m_info.lookup(e);
+      if (!isDef && i && i->let) {
+        m_out << "a!" << i->let;
+        return;
+      }
+      Frame f;
+      f.e = e;
+      std::tie(f.next, f.end) = termArgs(e);
+      if (writeHead(e, f))
+        stack.push_back(f);
+    };
+
+    enter(root, define);
+    while (!stack.empty()) {
+      Frame &f = stack.back();
+      if (f.next < f.end) {
+        Expr c = f.e->arg(f.next++);
+        // -- (op a b c) is written as (op a (op b c))
+        if (f.nest > 0 && f.next > 1 + termArgs(f.e).first &&
+            f.next < f.end) {
+          m_out << " (" << f.e->op().name();
+        }
+        m_out << " ";
+        enter(c, false);
+        continue;
+      }
+      unsigned close = 1;
+      if (f.nest > 0)
+        close += f.end - termArgs(f.e).first - 2;
+      if (isBinder(f.e))
+        m_bound.resize(m_bound.size() - bind::numBound(f.e));
+      for (unsigned k = 0; k < close; ++k)
+        m_out << ")";
+      stack.pop_back();
+    }
+  }
+
+  /// writes the conjunction of the analyzed roots inside their let-bindings
+  void writeBody(const ExprVector &roots) {
+    for (const ExprVector &group : m_lets) {
+      m_out << "(let (";
+      bool first = true;
+      for (const Expr &e : group) {
+        m_out << (first ? "(a!" : " (a!") << m_info.at(e).let << " ";
+        writeTerm(e, true);
+        m_out << ")";
+        first = false;
+      }
+      m_out << ")\n";
+    }
+
+    if (roots.empty())
+      m_out << "true";
+    else if (roots.size() == 1)
+      writeTerm(roots[0], false);
+    else {
+      m_out << "(and";
+      for (const Expr &r : roots) {
+        m_out << " ";
+        writeTerm(r, false);
+      }
+      m_out << ")";
+    }
+
+    for (unsigned k = 0; k < m_lets.size(); ++k)
+      m_out << ")";
+  }
+
+  template <typename Range> static ExprVector toVector(const Range &rng) {
+    ExprVector res;
+    for (const Expr &e : rng)
+      res.push_back(e);
+    return res;
+  }
+
+public:
+  explicit SmtLibWriter(llvm::raw_ostream &out) : m_out(out) {}
+
+  llvm::raw_ostream &out() { return m_out; }
+
+  /// Writes the declarations of all symbols of rng that have not been
+  /// declared by this writer
+  template <typename Range> void declare(const Range &rng) {
+    analyze(toVector(rng));
+    writeDecls();
+  }
+  void declare(Expr e) { declare(ExprVector{e}); }
+
+  /// Writes (assert (and rng)) preceded by the declarations it needs
+  template <typename Range> void assertExprs(const Range &rng) {
+    ExprVector roots = toVector(rng);
+    analyze(roots);
+    writeDecls();
+    m_out << "(assert ";
+    writeBody(roots);
+    m_out << ")\n";
+  }
+  void assertExpr(Expr e) { assertExprs(ExprVector{e}); }
+
+  /// Writes e as a term. Symbols of e are not declared
+  void write(Expr e) {
+    ExprVector roots{e};
+    analyze(roots);
+    dropPending();
+    assert(m_info.at(e).free == 0 && "cannot write an open term");
+    writeBody(roots);
+  }
+
+  /// Writes a sort
+  void writeSort(Expr s) {
+    if (isOpX<INT_TY>(s))
+      m_out << "Int";
+    else if (isOpX<REAL_TY>(s))
+      m_out << "Real";
+    else if (isOpX<BOOL_TY>(s))
+      m_out << "Bool";
+    else if (isOpX<BVSORT>(s))
+      m_out << "(_ BitVec " << bv::width(s) << ")";
+    else if (isOpX<ARRAY_TY>(s)) {
+      m_out << "(Array ";
+      writeSort(sort::arrayIndexTy(s));
+      m_out << " ";
+      writeSort(sort::arrayValTy(s));
+      m_out << ")";
+    } else
+      fail(s);
+  }
+
+  /// Writes the name of a function declaration, a constant, or a variable
+  void writeSymbol(Expr e) {
+    if (isOpX<FAPP>(e))
+      e = bind::fname(e);
+    m_out << name(e);
+  }
+
+  void checkSat() { m_out << "(check-sat)\n"; }
+};
+
+} // namespace expr
@@ -24,7 +24,10 @@
 #include <boost/range/algorithm/sort.hpp>
 
 #include "seahorn/Expr/Expr.hh"
+#include "seahorn/Expr/ExprEval.hh"
+#include "seahorn/Expr/ExprIdMap.hh"
 #include "seahorn/Expr/ExprInterp.hh"
+#include "seahorn/Support/Stats.hh"
 
 namespace z3 {
 struct ast_ptr_hash : public std::unary_function<ast, std::size_t> {
@@ -175,7 +178,9 @@ typedef std::unordered_map<z3::ast, Expr, z3::ast_ptr_hash,
                            z3::ast_ptr_equal_to>
     ast_expr_map;
 
-typedef std::unordered_map<Expr, z3::ast> expr_ast_map;
+/// computed table of marshal. Owns its keys, so it is never touched by
+/// other threads releasing nodes of a concurrent factory
+typedef expr::ExprIdMap<z3::ast, true> expr_ast_map;
 
 template <typename V> void z3n_set_param(char const *p, V v) {
   z3::set_param(p, v);
@@ -204,20 +209,45 @@ private:
 
   cache_type cache;
 
-  void init() { Z3_set_ast_print_mode(ctx, Z3_PRINT_SMTLIB2_COMPLIANT); }
+  /// expressions marshalled in this context. Persists across calls and
+  /// is shared by all solvers, models, etc. of the context. Holds its
+  /// keys and ASTs alive, so it is dropped when it grows past
+  /// m_ast_cache_limit
+  expr_ast_map m_ast_cache;
+  /// number of entries of m_ast_cache that triggers a clear. 0 for no limit
+  size_t m_ast_cache_limit;
+  /// number of toAst() calls answered by, and not answered by, m_ast_cache
+  /// since the last flushMarshalStats()
+  unsigned m_ast_hits;
+  unsigned m_ast_misses;
+
+  void init() {
+    m_ast_cache_limit = 1u << 20;
+    m_ast_hits = m_ast_misses = 0;
+    Z3_set_ast_print_mode(ctx, Z3_PRINT_SMTLIB2_COMPLIANT);
+  }
 
 protected:
   z3::context &get_ctx() { return ctx; }
 
   z3::ast toAst(Expr e) {
-    expr_ast_map seen;
-    return M::marshal(e, get_ctx(), cache.left, seen);
+    if (const z3::ast *a = m_ast_cache.lookup(e)) {
+      ++m_ast_hits;
+      return *a;
+    }
+    ++m_ast_misses;
+    if (m_ast_cache_limit && m_ast_cache.size() >= m_ast_cache_limit)
+      m_ast_cache.clear();
+    return M::marshal(e, get_ctx(), cache.left, m_ast_cache);
   }
   Expr toExpr(z3::ast a) {
+    ast_expr_map seen;
+    return toExpr(a, seen);
+  }
+  /// unmarshals \p a reusing, and adding to, the translations in \p seen
+  Expr toExpr(z3::ast a, ast_expr_map &seen) {
     if (!a)
       return Expr();
-
-    ast_expr_map seen;
     return U::unmarshal(a, get_efac(), cache.right, seen);
   }
 
@@ -250,7 +280,33 @@ public:
   ZContext(ExprFactory &ef) : efac(ef), ctx(m_c) { init(); }
   ZContext(ExprFactory &ef, z3::config &c) : efac(ef), ctx(c) { init(); }
 
-  ~ZContext() { cache.clear(); }
+  ~ZContext() {
+    m_ast_cache.clear();
+    cache.clear();
+  }
+
+  /// number of expressions in the marshal cache
+  size_t marshalCacheSize() const { return m_ast_cache.size(); }
+  unsigned marshalCacheHits() const { return m_ast_hits; }
+  unsigned marshalCacheMisses() const { return m_ast_misses; }
+
+  /// drops the marshal cache, releasing the expressions and ASTs in it
+  void clearMarshalCache() { m_ast_cache.clear(); }
+  /// sets the size at which the marshal cache is dropped. 0 for no limit
+  void setMarshalCacheLimit(size_t limit) { m_ast_cache_limit = limit; }
+
+  /// Adds the hits and misses of the marshal cache since the last call to
+  /// Stats under z3.marshal.cache.hit and z3.marshal.cache.miss. Stats is
+  /// not thread-safe, so this must be called by the thread that owns it
+  void flushMarshalStats() {
+    seahorn::Stats::uset("z3.marshal.cache.hit",
+                         seahorn::Stats::get("z3.marshal.cache.hit") +
+                             m_ast_hits);
+    seahorn::Stats::uset("z3.marshal.cache.miss",
+                         seahorn::Stats::get("z3.marshal.cache.miss") +
+                             m_ast_misses);
+    m_ast_hits = m_ast_misses = 0;
+  }
 
   template <typename V> void set(char const *p, V v) { ctx.set(p, v); }
 
@@ -302,6 +358,10 @@ private:
 
   ExprFactory &efac;
 
+  /// evaluator over the constants of the model. Built on first use and
+  /// shared by copies of the model
+  std::shared_ptr<expr::ExprEvaluator> m_native;
+
   bool isAsArray(const z3::ast &v) {
     if (v.kind() != Z3_APP_AST)
       return false;
@@ -332,6 +392,61 @@ private:
     return res;
   }
 
+  /// translates a value of the model. Tables of arrays are expanded
+  Expr valueToExpr(const z3::ast &val, ast_expr_map &seen) {
+    if (!isAsArray(val))
+      return z3.toExpr(val, seen);
+
+    Z3_func_decl fdecl = Z3_get_as_array_func_decl(ctx, val);
+    z3::func_interp zfunc(ctx, Z3_model_get_func_interp(ctx, model, fdecl));
+    ctx.check_error();
+    return finterpToExpr(zfunc);
+  }
+
+  /// value of \p ast in the model. Values are translated with \p seen
+  Expr evalAst(const z3::ast &ast, bool completion, ast_expr_map &seen) {
+    Z3_ast raw_val = NULL;
+    if (Z3_model_eval(ctx, model, ast, completion, &raw_val) && raw_val) {
+      z3::ast val(ctx, raw_val);
+      ctx.check_error();
+      return valueToExpr(val, seen);
+    }
+    ctx.check_error();
+    return mk<NONDET>(efac);
+  }
+
+  /// \brief Value of \p e computed without Z3, or null
+  ///
+  /// The interpretation of all constants is read from the model once, on
+  /// first use, and expressions are then evaluated by ExprEvaluator. Only
+  /// Boolean and numeric values are returned; arrays, and everything the
+  /// evaluator does not fold, are left to Z3 so that results are the same
+  /// as those of Z3_model_eval.
+  Expr evalNative(Expr e) {
+    if (!m_native) {
+      m_native = std::make_shared<expr::ExprEvaluator>(efac);
+      ast_expr_map seen;
+      for (unsigned i = 0, sz = Z3_model_get_num_consts(ctx, model); i < sz;
+           ++i) {
+        Z3_func_decl fdecl = Z3_model_get_const_decl(ctx, model, i);
+        Z3_ast raw_val = Z3_model_get_const_interp(ctx, model, fdecl);
+        ctx.check_error();
+        if (!raw_val)
+          continue;
+        z3::ast c(ctx, Z3_mk_app(ctx, fdecl, 0, nullptr));
+        z3::ast val(ctx, raw_val);
+        m_native->assign(z3.toExpr(c, seen), valueToExpr(val, seen));
+      }
+    }
+    Expr v = m_native->eval(e);
+    return v && isValue(v) ? v : Expr();
+  }
+
+  static bool isValue(Expr e) {
+    return isOpX<TRUE>(e) || isOpX<FALSE>(e) || isOpX<MPZ>(e) ||
+           bv::isBvNum(e);
+  }
+
 public:
   ZModel(Z &z) : z3(z), ctx(z.get_ctx()), model(nullptr), efac(z.get_efac()) {}
 
@@ -341,7 +456,8 @@ public:
   }
 
   ZModel(const this_type &o)
-      : z3(o.z3), ctx(z3.get_ctx()), model(o.model), efac(z3.get_efac()) {
+      : z3(o.z3), ctx(z3.get_ctx()), model(o.model), efac(z3.get_efac()),
+        m_native(o.m_native) {
     if (model)
       Z3_model_inc_ref(ctx, model);
   }
@@ -361,26 +477,50 @@ public:
     // -- only allow swap between models from the same context
     assert(&src.z3 == &dst.z3);
     swap(src.model, dst.model);
+    swap(src.m_native, dst.m_native);
   }
 
+  /// \brief Value of \p e in the model
+  ///
+  /// Expressions over constants of the model are evaluated in-process;
+  /// Z3 is only called for operators that are not folded, and for
+  /// constants without a value in the model
   Expr eval(Expr e, bool completion = false) {
     assert(model);
-    z3::ast ast(z3.toAst(e));
+    if (Expr v = evalNative(e))
+      return v;
+    ast_expr_map seen;
+    return evalAst(z3.toAst(e), completion, seen);
+  }
 
-    Z3_ast raw_val = NULL;
-    if (Z3_model_eval(ctx, model, ast, completion, &raw_val) && raw_val) {
-      z3::ast val(ctx, raw_val);
-      ctx.check_error();
-      if (!isAsArray(val))
-        return z3.toExpr(val);
+  /// \brief Evaluates every expression of \p es into \p out
+  ///
+  /// Same as calling eval() on each expression, but in one pass: repeated
+  /// expressions are evaluated once, values are not sent to Z3, and
+  /// values are translated back from Z3 with a shared cache. A null
+  /// expression evaluates to null.
+  void eval(const ExprVector &es, ExprVector &out, bool completion = false) {
+    assert(model);
+    out.clear();
+    out.reserve(es.size());
 
-      Z3_func_decl fdecl = Z3_get_as_array_func_decl(ctx, val);
-      z3::func_interp zfunc(ctx, Z3_model_get_func_interp(ctx, model, fdecl));
-      ctx.check_error();
-      return finterpToExpr(zfunc);
+    expr::ExprIdMap<Expr, true> done;
+    ast_expr_map seen;
+    for (const Expr &e : es) {
+      if (!e || isValue(e)) {
+        out.push_back(e);
+        continue;
+      }
+      if (const Expr *v = done.lookup(e)) {
+        out.push_back(*v);
+        continue;
+      }
+      Expr v = evalNative(e);
+      if (!v)
+        v = evalAst(z3.toAst(e), completion, seen);
+      done.insert(e, v);
+      out.push_back(v);
     }
-    ctx.check_error();
-    return mk<NONDET>(efac);
   }
 
   ExprFactory &getExprFactory() { return z3.getExprFactory(); }
@@ -558,6 +698,10 @@ public:
   void push() { solver.push(); }
   void pop(unsigned n = 1) { solver.pop(n); }
   void reset() { solver.reset(); }
+
+  /// Cancels a running solve(). The only method that may be called from
+  /// another thread; the interrupted call returns indeterminate
+  void interrupt() { Z3_interrupt(ctx); }
 };
 
 template <typename Z> class ZFixedPoint {
@@ -659,6 +803,10 @@ public:
     return res;
   }
 
+  /// Cancels a running query(). The only method that may be called from
+  /// another thread; the interrupted call returns indeterminate
+  void interrupt() { Z3_interrupt(ctx); }
+
   std::string toString(Expr query = Expr()) {
     if (query)
       m_queries.push_back(query);
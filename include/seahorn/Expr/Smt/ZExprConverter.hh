@@ -51,9 +51,8 @@ template <typename M> struct BasicExprMarshal {
 
     /** check computed table */
     {
-      typename expr_ast_map::const_iterator it = seen.find(e);
-      if (it != seen.end())
-        return it->second;
+      if (const z3::ast *a = seen.lookup(e))
+        return *a;
     }
 
     Z3_ast res = nullptr;
@@ -456,7 +455,7 @@ template <typename M> struct BasicExprMarshal {
 
     assert(res != nullptr);
     z3::ast final(ctx, res);
-    seen.insert(expr_ast_map::value_type(e, final));
+    seen.insert(e, final);
 
     return final;
   }
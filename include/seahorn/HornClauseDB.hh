@@ -10,10 +10,13 @@
 #include <boost/container/flat_set.hpp>
 
 #include "ufo/Expr.hpp"
+#include "ufo/ExprIdMap.hpp"
 #include "seahorn/Support/Stats.hh"
 
 #include <algorithm>
+#include <list>
 #include <map>
+#include <unordered_map>
 
 namespace seahorn
 {
@@ -23,15 +26,19 @@ namespace seahorn
   class HornClauseDB;
   class HornRule
   {
+    friend class HornClauseDB;
+
     ExprVector m_vars;
     Expr m_head;
     Expr m_body;
+    /// id of the rule in its database. 0 if it was never added to one
+    unsigned m_id;
 
   public:
     template <typename Range>
     HornRule (Range &v, Expr b) :
       m_vars (boost::begin (v), boost::end (v)),
-      m_head (b), m_body (mk<TRUE>(b->efac ()))
+      m_head (b), m_body (mk<TRUE>(b->efac ())), m_id (0)
     {
       if ((b->arity () == 2) && isOpX<IMPL> (b))
       {
@@ -45,12 +52,12 @@ namespace seahorn
     template <typename Range>
     HornRule (Range &v, Expr head, Expr body) :
       m_vars (boost::begin (v), boost::end (v)),
-      m_head (head), m_body (body)
+      m_head (head), m_body (body), m_id (0)
     { }
 
     HornRule (const HornRule &r) :
       m_vars (r.m_vars),
-      m_head (r.m_head), m_body (r.m_body)
+      m_head (r.m_head), m_body (r.m_body), m_id (r.m_id)
     {}
 
     size_t hash () const
@@ -88,6 +95,10 @@ namespace seahorn
 
     const ExprVector &vars () const {return m_vars;}
 
+    /// id given by the database when the rule was added. Stays the same
+    /// while the rule is in the database, and is never reused by it
+    unsigned id () const {return m_id;}
+
     template<typename OutputIterator>
     void used_relations (HornClauseDB &db, OutputIterator out);
   };
@@ -98,7 +109,9 @@ namespace seahorn
     friend class HornRule;
   public:
 
-    typedef std::vector<HornRule> RuleVector;
+    /// rules are never moved, so pointers to them stay valid until they
+    /// are removed
+    typedef std::list<HornRule> RuleVector;
     typedef boost::container::flat_set<Expr> expr_set_type;
     struct IsRelation : public std::unary_function<Expr, bool>
     {
@@ -112,13 +125,23 @@ namespace seahorn
 
     ExprFactory &m_efac;
     expr_set_type m_rels;
-    mutable ExprVector m_vars;
     RuleVector m_rules;
+    /// last rule id given
+    unsigned m_last_id;
+    /// position of every rule by id
+    std::unordered_map<unsigned, RuleVector::iterator> m_rule_pos;
+    /// ids of the rules by hash, to remove rules that are not from this db
+    std::unordered_multimap<size_t, unsigned> m_rule_hash;
+    /// variables of all rules, with the number of rules they appear in
+    std::map<Expr, unsigned> m_var_count;
+    /// keys of m_var_count. Recomputed on demand
+    mutable ExprVector m_vars;
+    mutable bool m_vars_dirty;
     ExprVector m_queries;
-    std::map<Expr, ExprVector> m_constraints;
-    std::map<Expr, ExprVector> m_invariants;
+    ExprIdMap<ExprVector, true> m_constraints;
+    ExprIdMap<ExprVector, true> m_invariants;
 
-    /// indexes
+    /// indexes. Kept up to date by addRule() and removeRule()
 
 
     typedef boost::container::flat_set<HornRule*> horn_set_type;
@@ -128,33 +151,45 @@ namespace seahorn
     /// maps a relation to rules it appears in the head
     index_type m_head_idx;
 
-    const ExprVector &getVars () const;
-
     /// empty set sentinel
     static horn_set_type m_empty_set;
 
     /// resets all indexes
     void resetIndexes ();
+    /// adds r to, or removes r from, the indexes
+    void indexRule (HornRule &r);
+    void unindexRule (HornRule &r);
+    /// removes the rule at it
+    void eraseRule (RuleVector::iterator it);
 
   public:
 
-    HornClauseDB (ExprFactory &efac) : m_efac (efac) {}
+    HornClauseDB (ExprFactory &efac) :
+      m_efac (efac), m_last_id (0), m_vars_dirty (false) {}
+
+    /// -- indexes point into m_rules. Use copyHornClauseDB() to copy
+    HornClauseDB (const HornClauseDB &) = delete;
+    HornClauseDB &operator= (const HornClauseDB &) = delete;
 
     ExprFactory &getExprFactory () {return m_efac;}
 
     void registerRelation (Expr fdecl) {m_rels.insert (fdecl);}
+    /// -- unregisters fdecl. fdecl must not appear in any rule and must
+    /// -- have no constraints or invariants
+    void removeRelation (Expr fdecl);
     const expr_set_type& getRelations () const {return m_rels;}
     bool hasRelation (Expr fdecl) const
     { return m_rels.count (fdecl) > 0; }
     /// number of relational predicates
     unsigned relSize () { return m_rels.size ();}
 
-    /// -- build use/def indexes
+    /// -- rebuild all indexes from scratch. Indexes are maintained by
+    /// -- addRule() and removeRule(), so this is only needed after rules
+    /// -- are changed in place through getRules()
     void buildIndexes ();
 
     /// -- returns rules that use fdecl
     /// -- i.e., rules in which fdecl appears in the body
-    /// -- requires indexes (see buildIndexes())
     const horn_set_type &use (Expr fdecl) const
     {
       auto it = m_body_idx.find (fdecl);
@@ -164,7 +199,6 @@ namespace seahorn
 
     /// -- returns rules that define fdecl
     /// -- i.e., rules in which fdecl appears in the head
-    /// -- requires indexes (see buildIndexes())
     const horn_set_type &def (Expr fdecl) const
     {
       auto it = m_head_idx.find (fdecl);
@@ -181,31 +215,25 @@ namespace seahorn
       addRule (HornRule (vars, rule));
     }
 
-    void addRule (const HornRule &rule)
-    {
-      m_rules.push_back (rule);
-      boost::copy (rule.vars (), std::back_inserter (m_vars));
-      resetIndexes ();
+    /// -- adds a copy of rule with a new id
+    void addRule (const HornRule &rule);
 
-    }
+    /// -- variables of all rules, sorted and without duplicates
+    const ExprVector &getVars () const;
 
-    const ExprVector &getVars ()
-    {
-      // -- remove duplicates
-      std::sort (m_vars.begin (), m_vars.end ());
-      m_vars.erase (std::unique (m_vars.begin (), m_vars.end ()), m_vars.end ());
+    /// -- removes r. If r is a rule of this database (or a copy of one),
+    /// -- the rule with the id of r is removed. Otherwise, a rule equal
+    /// -- to r is removed, if any
+    void removeRule (const HornRule &r);
 
-      return m_vars;
-    }
-
-    void removeRule (const HornRule &r)
-    {
-      m_rules.erase (std::remove (m_rules.begin(), m_rules.end(), r));
-      resetIndexes ();
-    }
+    /// -- number of rules
+    size_t ruleSize () const {return m_rules.size ();}
 
 
     const RuleVector &getRules () const {return m_rules;}
+    /// -- rules changed in place must be re-indexed with buildIndexes()
+    /// -- before any other rule is added or removed. Removing a rule
+    /// -- that is not re-indexed asserts
     RuleVector &getRules () {return m_rules;}
 
     void addQuery (Expr q) {m_queries.push_back (q);}
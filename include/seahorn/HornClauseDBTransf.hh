@@ -2,6 +2,10 @@
 #define _HORN_CLAUSE_DB_TRANSFORMATIONS__H_
 
 #include "seahorn/HornClauseDB.hh"
+#include "seahorn/HornModelConverter.hh"
+
+#include <memory>
+#include <vector>
 
 namespace seahorn
 {
@@ -9,6 +13,46 @@ namespace seahorn
   // Ensure all horn clause heads have only variables
   void normalizeHornClauseHeads (HornClauseDB &db);
 
+  // Copy relations, rules, queries, constraints and invariants of src to dst
+  void copyHornClauseDB (const HornClauseDB &src, HornClauseDB &dst);
+
+  /*
+   * Preprocessing stages. Each stage transforms db in place and returns a
+   * converter from models of the result to models of the original
+   * database, or null if db is unchanged. Relations that appear in a
+   * query or have constraints or invariants are never eliminated or
+   * changed.
+   */
+
+  // Remove rules of relations from which no query and no relation with
+  // constraints or invariants is reachable
+  std::unique_ptr<HornModelConverter> sliceHornClauses (HornClauseDB &db);
+
+  // Inline non-recursive relations with a single defining rule into their
+  // uses. zctx is used to project the model of an inlined relation
+  std::unique_ptr<HornModelConverter>
+  inlineSingleDefRelations (HornClauseDB &db, EZ3 &zctx);
+
+  // Drop arguments that are never constrained, i.e., arguments that are a
+  // variable that occurs nowhere else in every rule that uses the relation
+  std::unique_ptr<HornModelConverter> reduceRelationArity (HornClauseDB &db);
+
+  // Merge non-recursive relations that are used by a single linear rule
+  // into that rule
+  std::unique_ptr<HornModelConverter>
+  mergeLinearChains (HornClauseDB &db, EZ3 &zctx);
+
+  // Split db into one database per query and per rule that defines the
+  // relation of the query. Each part is sliced. parts is left empty if
+  // there is a single such rule, or if the relation of a query is used in
+  // the body of a rule
+  void splitHornClauseDB (HornClauseDB &db,
+                          std::vector<std::unique_ptr<HornClauseDB>> &parts);
+
+  // Run all stages on db. Converters are added to conv in the order the
+  // stages are applied
+  void preprocessHornClauses (HornClauseDB &db, EZ3 &zctx,
+                              HornModelConverterSeq &conv);
 }
 
 
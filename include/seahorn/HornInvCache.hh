@@ -0,0 +1,60 @@
+#ifndef HORN_INV_CACHE__HH_
+#define HORN_INV_CACHE__HH_
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+#include "seahorn/HornClauseDB.hh"
+#include "seahorn/HornDbModel.hh"
+#include "seahorn/HornifyModule.hh"
+
+#include <map>
+#include <string>
+
+namespace seahorn
+{
+  using namespace llvm;
+
+  /**
+   * On-disk cache of the invariants of the basic block predicates of each
+   * function.
+   *
+   * The invariants of a function are stored in <dir>/<key>.smt2. The key
+   * is an MD5 fingerprint of every clause the predicates of the function
+   * depend on: the clauses of the function and, transitively, the clauses
+   * of the predicates in their bodies (callee summaries, and callers when
+   * they pass a context). Invariants are an over-approximation of the
+   * least model of these clauses, so they stay valid in any run in which
+   * the fingerprint is the same. The file has one section per predicate,
+   * headed by the name of the predicate, so the invariants do not depend
+   * on the order of the basic blocks.
+   */
+  class HornInvCache
+  {
+    HornifyModule &m_hm;
+    std::string m_dir;
+    /// -- fingerprint of every function with predicates
+    std::map<const Function*, std::string> m_keys;
+
+    void computeKeys (Module &M);
+    std::string path (const Function &F) const;
+    /// -- application of rel to the constants used in the files
+    Expr mkArgApp (Expr rel) const;
+
+  public:
+    HornInvCache (HornifyModule &hm, const std::string &dir);
+
+    /// -- directory given by -horn-inv-cache. Empty if the cache is off
+    static std::string defaultDir ();
+
+    /// -- adds the cached invariants of the functions of M to db. Only
+    /// -- predicates that are relations of db get an invariant.
+    /// -- Returns the number of predicates with a cached invariant
+    unsigned load (Module &M, HornClauseDB &db);
+
+    /// -- stores the definitions of model for the functions of M
+    void store (Module &M, HornDbModel &model);
+  };
+}
+
+#endif /* HORN_INV_CACHE__HH_ */
@@ -8,6 +8,9 @@
 #include "ufo/Expr.hpp"
 #include "ufo/Smt/EZ3.hh"
 
+#include <memory>
+#include <vector>
+
 namespace seahorn
 {
   class HornModelConverter
@@ -17,6 +20,22 @@ namespace seahorn
     virtual bool convert (HornDbModel &in, HornDbModel &out) = 0;
     virtual ~HornModelConverter() {}
   };
+
+  /// Converter for a sequence of transformations. Converters are added in
+  /// the order the transformations were applied, and run in reverse
+  class HornModelConverterSeq : public HornModelConverter
+  {
+    std::vector<std::unique_ptr<HornModelConverter>> m_convs;
+  public:
+    HornModelConverterSeq () {}
+    virtual ~HornModelConverterSeq () {}
+
+    void add (std::unique_ptr<HornModelConverter> conv)
+    { if (conv) m_convs.push_back (std::move (conv)); }
+    bool empty () const { return m_convs.empty (); }
+
+    bool convert (HornDbModel &in, HornDbModel &out);
+  };
 }
 
 #endif
@@ -8,6 +8,9 @@
 
 #include "ufo/Smt/EZ3.hh"
 
+#include <memory>
+#include <vector>
+
 namespace seahorn
 {
   using namespace llvm;
@@ -15,10 +18,22 @@ namespace seahorn
   class HornSolver : public llvm::ModulePass
   {
     boost::tribool m_result;
+    /// true if a counterexample over the clauses of HornifyModule is
+    /// needed after solving. Disables preprocessing
+    bool m_cex;
+    /// context of m_fp when it is not the context of HornifyModule
+    std::unique_ptr<ufo::EZ3> m_zctx;
     std::unique_ptr<ufo::ZFixedPoint <ufo::EZ3> >  m_fp;
     
     void printCex ();
-    void estimateSizeInvars (Module &M);
+    /// invariants are read from model if given, and from m_fp otherwise
+    void estimateSizeInvars (Module &M, HornDbModel *model = nullptr);
+
+    /// solves every part on its own thread and context. On unsat, model
+    /// is a model of the database the parts were split from. On sat, m_fp
+    /// is the fixed point of a part with a counterexample
+    void solveParts (std::vector<std::unique_ptr<HornClauseDB>> &parts,
+                     HornDbModel &model);
 
     void printInvars(Function &F, HornDbModel &model);
     void printInvars(Module &M, HornDbModel &model);
@@ -26,7 +41,8 @@ namespace seahorn
   public:
     static char ID;
     
-    HornSolver () : ModulePass(ID), m_result(boost::indeterminate) {}
+    HornSolver (bool cex = false)
+      : ModulePass(ID), m_result(boost::indeterminate), m_cex(cex) {}
     virtual ~HornSolver() {}
     
     virtual bool runOnModule (Module &M);
@@ -35,7 +51,7 @@ namespace seahorn
     ufo::ZFixedPoint<ufo::EZ3>& getZFixedPoint () {return *m_fp;}
     
     boost::tribool getResult () {return m_result;}
-    void releaseMemory () {m_fp.reset (nullptr);}
+    void releaseMemory () {m_fp.reset (nullptr); m_zctx.reset (nullptr);}
     
   };
 
@@ -106,6 +106,49 @@ namespace seahorn
 	  bool validateRule(HornRule r, ZSolver<EZ3> &solver);
 	  std::map<Expr, ZSolver<EZ3>> assignEachRelationASolver();
   };
+
+  /*
+   * Houdini with one persistent solver per rule. The transition relation of
+   * a rule is asserted once, and every candidate conjunct of a body
+   * predicate is guarded by an assumption literal, so weakening a candidate
+   * only changes the assumptions of the next query. All candidates falsified
+   * by a model are dropped together.
+   *
+   * Rules are validated in rounds against the candidates at the start of the
+   * round, in the order of the wto. The rules of a round are split among
+   * jobs threads, each with its own Z3 context; this requires a concurrent
+   * expression factory.
+   */
+  class Houdini_Parallel : public HoudiniContext
+  {
+  private:
+	  struct RuleSolver;
+	  struct Worker;
+
+	  unsigned m_jobs;
+	  // -- candidate conjuncts of every relation, over bound variables
+	  std::map<Expr, ExprVector> m_cands;
+	  // -- false for candidates that are already dropped
+	  std::map<Expr, std::vector<bool>> m_alive;
+	  // -- position of every relation in the wto
+	  std::map<Expr, unsigned> m_wtoPos;
+	  // -- workers are declared first so that the solvers of the rules are
+	  // -- released before the contexts they belong to
+	  std::vector<std::unique_ptr<Worker>> m_workers;
+	  std::vector<std::unique_ptr<RuleSolver>> m_rules;
+	  std::map<HornRule, RuleSolver*> m_ruleToSolver;
+
+	  void initCandidates();
+	  void initSolvers();
+	  void validateRound(Worker &w);
+	  boost::tribool check(RuleSolver &rs, std::vector<bool> &head_alive);
+	  void updateCandidateModel();
+  public:
+	  Houdini_Parallel(Houdini& houdini, HornClauseDBWto &db_wto, std::list<HornRule> &workList, unsigned jobs);
+	  ~Houdini_Parallel();
+	  void run();
+	  bool validateRule(HornRule r, ZSolver<EZ3> &solver);
+  };
 }
 
 #endif /* HOUDNINI__HH_ */
@@ -149,6 +149,39 @@ public:
   virtual OpSemContextPtr fork(SymStore &values, ExprVector &side) {
     return OpSemContextPtr(new OpSemContext(values, side, *this));
   }
+
+  /// \brief State of a context that is not kept in its store or side
+  /// condition
+  struct Checkpoint {
+    Expr pathCond;
+    size_t rely = 0;
+    size_t guarantee = 0;
+    virtual ~Checkpoint() = default;
+  };
+  using CheckpointPtr = std::unique_ptr<Checkpoint>;
+
+  /// \brief Saves the state of the context so that the encoding that
+  /// follows can be undone by \c restore
+  ///
+  /// The store and the side condition are saved by the caller
+  virtual CheckpointPtr checkpoint() const {
+    CheckpointPtr cp(new Checkpoint());
+    saveCheckpoint(*cp);
+    return cp;
+  }
+  /// \brief Restores a state saved by \c checkpoint of this context
+  virtual void restore(const Checkpoint &cp) {
+    m_pathCond = cp.pathCond;
+    m_rely.resize(cp.rely);
+    m_guarantee.resize(cp.guarantee);
+  }
+
+protected:
+  void saveCheckpoint(Checkpoint &cp) const {
+    cp.pathCond = m_pathCond;
+    cp.rely = m_rely.size();
+    cp.guarantee = m_guarantee.size();
+  }
 };
 
 /// \brief Tracks information about a function
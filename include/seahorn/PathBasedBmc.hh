@@ -8,6 +8,7 @@
 #include "boost/unordered_set.hpp"
 //#include "boost/unordered_map.hpp"
 
+#include <memory>
 #include <queue>
 
 namespace llvm {
@@ -82,8 +83,12 @@ private:
   // Boolean literals that active the implicant: used to produce
   // blocking clauses for the Boolean abstraction.
   ExprVector m_active_bool_lits;
-  // model of a path formula
-  ufo::ZModel<ufo::EZ3> m_model;
+  // Threads that solve path formulas (with --horn-bmc-path-jobs > 1)
+  class PathSolverPool;
+  std::unique_ptr<PathSolverPool> m_pool;
+  // model of a path formula. Might belong to the Z3 context of a thread
+  // of m_pool
+  std::unique_ptr<ufo::ZModel<ufo::EZ3>> m_model;
   // live symbols
   LiveSymbols *m_ls;
 #ifdef HAVE_CRAB_LLVM
@@ -120,6 +125,11 @@ private:
   void assert_invariants(const invariants_map_t &invariants, SymStore &s);
 #endif
 
+  // Apply the outcome of path formulas solved by m_pool: refine the
+  // Boolean abstraction with their unsat cores. If block then wait for at
+  // least one outcome. Return false if a path is satisfiable.
+  bool apply_path_results(bool block);
+
   // Return false if a blocking clause has been generated twice.
   bool add_blocking_clauses();
 
@@ -1,8 +1,18 @@
 #ifndef __SYM_STORE_HH_
 #define __SYM_STORE_HH_
 /// A symbolic store is a map from symbolic registers to symbolic values.
+///
+/// Copies of a store are cheap. Copying freezes the writes of the source
+/// into an immutable layer that is shared by both stores, and each store
+/// keeps its later writes to itself. Layers of similar size are merged so
+/// that a lookup visits a logarithmic number of layers.
+///
+/// Freezing and flattening move writes between the layers of a store
+/// without changing its contents. Both invalidate the iterators of the
+/// store, so a store must not be copied while it is being iterated over.
 
 #include "ufo/Expr.hpp"
+#include "ufo/ExprIdMap.hpp"
 
 #include "llvm/Support/raw_ostream.h"
 #include <map>
@@ -38,16 +48,28 @@ class SymStore : public std::unary_function<Expr, Expr> {
 
 public:
   typedef std::shared_ptr<SymStore> SymStorePtr;
-  typedef std::unordered_map<Expr, Expr> ExprExprMap;
+  typedef ExprIdMap<Expr, true> ExprExprMap;
 
 protected:
+  /// \brief Writes frozen by a copy, on top of older frozen writes
+  struct Layer {
+    ExprExprMap m_map;
+    std::shared_ptr<const Layer> m_below;
+  };
+  typedef std::shared_ptr<const Layer> LayerPtr;
+
   /// Parent store, if any
   SymStore *m_Parent;
   /// shared pointer for a parent if owned by this object
   SymStorePtr m_ownedParent;
 
-  /// The store
-  ExprExprMap m_Store;
+  /// Writes since the store was last copied. Mutable since copying a
+  /// store freezes them without changing its contents
+  mutable ExprExprMap m_Store;
+  /// Frozen writes, shared with copies of the store
+  mutable LayerPtr m_frozen;
+  /// Number of keys in m_Store and m_frozen together
+  size_t m_size;
 
   ExprFactory &m_efac;
 
@@ -65,15 +87,15 @@ public:
   /// trackUse indicates whether the store should keep track of all
   /// reads and writes.
   SymStore(SymStore &parent, bool trackUse)
-      : m_Parent(&parent), m_efac(m_Parent->getExprFactory()),
+      : m_Parent(&parent), m_size(0), m_efac(m_Parent->getExprFactory()),
         m_trackUse(trackUse), m_uses(), m_defs(), m_defs_sz(m_defs.size()),
         m_evalVisitor(*this) {}
 
   /// Create a SymStore. If globalParent is true, the created store has no
   /// parent.
   SymStore(ExprFactory &efac, bool trackUse = false, bool globalParent = false)
-      : m_Parent(NULL), m_efac(efac), m_trackUse(trackUse), m_uses(), m_defs(),
-        m_defs_sz(m_defs.size()), m_evalVisitor(*this) {
+      : m_Parent(NULL), m_size(0), m_efac(efac), m_trackUse(trackUse),
+        m_uses(), m_defs(), m_defs_sz(m_defs.size()), m_evalVisitor(*this) {
     if (!globalParent) {
       // -- create our own parent
       m_ownedParent = std::make_shared<SymStore>(efac, false, true);
@@ -81,9 +103,11 @@ public:
     }
   }
 
+  /// Shares the writes of other with the new store. Freezes the recent
+  /// writes of other, which invalidates iterators over other.
   SymStore(const SymStore &other)
       : m_Parent(other.m_Parent), m_ownedParent(other.m_ownedParent),
-        m_Store(other.m_Store), m_efac(other.m_efac),
+        m_frozen(other.freeze()), m_size(other.m_size), m_efac(other.m_efac),
         m_trackUse(other.m_trackUse), m_uses(other.m_uses),
         m_defs(other.m_defs), m_defs_sz(other.m_defs_sz),
         m_evalVisitor(*this) // create new m_evalVisitor
@@ -96,31 +120,39 @@ public:
 
   void swap(SymStore &o);
   void print(llvm::raw_ostream &out);
-  size_t size() { return m_Store.size(); }
+  size_t size() { return m_size; }
 
   ExprFactory &getExprFactory() { return m_efac; }
 
-  bool isDefined(Expr key) const { return m_Store.count(key) > 0; }
+  bool isDefined(Expr key) const { return lookup(key) != nullptr; }
 
   Expr at(Expr key) const {
-    if (isDefined(key))
-      return m_Store.at(key);
-    return Expr(0);
+    const Expr *val = lookup(key);
+    return val ? *val : Expr(0);
   }
 
   Expr eval(Expr exp) { return expr::dagVisit(m_evalVisitor, exp); }
   Expr operator()(Expr exp) { return eval(exp); }
 
+  /// Iteration flattens the store, which unshares its frozen writes
   typedef ExprExprMap::iterator iterator;
   typedef ExprExprMap::const_iterator const_iterator;
-  iterator begin() { return m_Store.begin(); }
+  iterator begin() {
+    flatten();
+    return m_Store.begin();
+  }
   iterator end() { return m_Store.end(); }
-  const_iterator begin() const { return m_Store.begin(); }
+  const_iterator begin() const {
+    flatten();
+    return m_Store.begin();
+  }
   const_iterator end() const { return m_Store.end(); }
 
   void clear() { reset(); }
   void reset() {
     m_Store.clear();
+    m_frozen.reset();
+    m_size = 0;
     m_uses.clear();
     m_defs.clear();
     m_defs_sz = 0;
@@ -139,6 +171,14 @@ public:
   void write(Expr key, Expr val);
   Expr havoc(Expr key);
   Expr read(Expr key);
+
+private:
+  /// value of key, or nullptr if key is not defined
+  const Expr *lookup(const Expr &key) const;
+  /// moves recent writes into a new frozen layer and returns the layers
+  LayerPtr freeze() const;
+  /// moves frozen writes back into m_Store
+  void flatten() const;
 };
 
 } // namespace seahorn
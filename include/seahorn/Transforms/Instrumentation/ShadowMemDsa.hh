@@ -185,5 +185,58 @@ inline bool isShadowMem(const Value &V, const Value **out) {
   assert(0);
   return false;
 }
+
+/// \brief Returns the shadow.mem call that defines \p V, or null
+///
+/// Follows phi and gamma nodes to the shadow.mem call that defines \p V
+inline const CallInst *getShadowMemDef(const Value &V) {
+  std::queue<const Value *> wl;
+  llvm::DenseSet<const Value *> visited;
+
+  wl.push(&V);
+  while (!wl.empty()) {
+    const Value *val = wl.front();
+    wl.pop();
+
+    if (!visited.insert(val).second)
+      continue;
+
+    if (const CallInst *ci = dyn_cast<const CallInst>(val)) {
+      const Function *fn = ci->getCalledFunction();
+      if (fn && fn->getName().startswith("shadow.mem"))
+        return ci;
+    } else if (const PHINode *phi = dyn_cast<const PHINode>(val)) {
+      for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i)
+        wl.push(phi->getIncomingValue(i));
+    } else if (const SelectInst *gamma = dyn_cast<const SelectInst>(val)) {
+      wl.push(gamma->getTrueValue());
+      wl.push(gamma->getFalseValue());
+    }
+  }
+  return nullptr;
+}
+
+/// \brief Returns the id of the memory region defined by \p V, or -1
+inline int64_t getShadowMemId(const Value &V) {
+  const CallInst *ci = getShadowMemDef(V);
+  return ci ? getShadowId(ci) : -1;
+}
+
+/// \brief Returns the size in bytes of the single object of the memory
+/// region defined by \p V, or 0 if the region may have several objects
+///
+/// The size is recorded by ShadowMemSeaDsa on the calls that define a
+/// region whose DSA node provably abstracts a single object
+inline uint64_t getShadowMemNodeSize(const Value &V) {
+  const CallInst *ci = getShadowMemDef(V);
+  if (!ci)
+    return 0;
+  if (MDNode *meta = ci->getMetadata("shadow.mem.node.size"))
+    if (meta->getNumOperands() > 0)
+      if (auto *c = dyn_cast<ConstantAsMetadata>(meta->getOperand(0)))
+        if (auto *cInt = dyn_cast<ConstantInt>(c->getValue()))
+          return cInt->getZExtValue();
+  return 0;
+}
 } // namespace shadow_dsa
 } // namespace seahorn
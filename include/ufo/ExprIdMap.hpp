@@ -0,0 +1,6 @@
+#pragma once
+#ifdef USE_SEAHORN_EXPR
+#include "seahorn/Expr/ExprIdMap.hh"
+#else
+#include "ufo/deprecated/ExprIdMap.hpp"
+#endif
@@ -0,0 +1,92 @@
+#ifndef __EXPR__ID__MAP__HPP_
+#define __EXPR__ID__MAP__HPP_
+
+#include "Expr.hpp"
+
+#include <map>
+#include <set>
+#include <utility>
+
+namespace expr {
+
+/**
+ * Interface of seahorn/Expr/ExprIdMap.hh over std::map for the deprecated
+ * Expr library, which cannot notify a map when a key dies. Every key is
+ * held by reference, so a weak map (OwnKeys = false) keeps its keys alive
+ * until they are erased. Iteration is in the order of node ids.
+ */
+template <typename T, bool OwnKeys = false> class ExprIdMap {
+  struct IdLess {
+    bool operator()(const Expr &x, const Expr &y) const {
+      return x->getId() < y->getId();
+    }
+  };
+  typedef std::map<Expr, T, IdLess> map_type;
+  map_type m_map;
+
+public:
+  typedef T mapped_type;
+  typedef typename map_type::iterator iterator;
+  typedef typename map_type::const_iterator const_iterator;
+
+  void swap(ExprIdMap &o) { m_map.swap(o.m_map); }
+
+  size_t size() const { return m_map.size(); }
+  bool empty() const { return m_map.empty(); }
+
+  iterator begin() { return m_map.begin(); }
+  iterator end() { return m_map.end(); }
+  const_iterator begin() const { return m_map.begin(); }
+  const_iterator end() const { return m_map.end(); }
+
+  T *lookup(const Expr &e) {
+    auto it = m_map.find(e);
+    return it == m_map.end() ? nullptr : &it->second;
+  }
+  const T *lookup(const Expr &e) const {
+    return const_cast<ExprIdMap *>(this)->lookup(e);
+  }
+
+  size_t count(const Expr &e) const { return m_map.count(e); }
+  iterator find(const Expr &e) { return m_map.find(e); }
+  const_iterator find(const Expr &e) const { return m_map.find(e); }
+
+  T &at(const Expr &e) { return m_map.at(e); }
+  const T &at(const Expr &e) const { return m_map.at(e); }
+
+  template <typename V> std::pair<iterator, bool> insert(const Expr &e, V &&v) {
+    return m_map.insert(std::make_pair(e, T(std::forward<V>(v))));
+  }
+
+  T &operator[](const Expr &e) { return m_map[e]; }
+
+  size_t erase(const Expr &e) { return m_map.erase(e); }
+  void clear() { m_map.clear(); }
+};
+
+/** A set of expressions with the interface of seahorn's ExprIdSet */
+class ExprIdSet {
+  struct IdLess {
+    bool operator()(const Expr &x, const Expr &y) const {
+      return x->getId() < y->getId();
+    }
+  };
+  std::set<Expr, IdLess> m_set;
+
+public:
+  typedef std::set<Expr, IdLess>::const_iterator const_iterator;
+  typedef const_iterator iterator;
+
+  size_t size() const { return m_set.size(); }
+  bool empty() const { return m_set.empty(); }
+  const_iterator begin() const { return m_set.begin(); }
+  const_iterator end() const { return m_set.end(); }
+
+  bool insert(const Expr &e) { return m_set.insert(e).second; }
+  size_t count(const Expr &e) const { return m_set.count(e); }
+  size_t erase(const Expr &e) { return m_set.erase(e); }
+  void clear() { m_set.clear(); }
+};
+
+} // namespace expr
+#endif
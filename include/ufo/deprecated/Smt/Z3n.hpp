@@ -559,6 +559,10 @@ public:
   void push() { solver.push(); }
   void pop(unsigned n = 1) { solver.pop(n); }
   void reset() { solver.reset(); }
+
+  /// Cancels a running solve(). The only method that may be called from
+  /// another thread; the interrupted call returns indeterminate
+  void interrupt() { Z3_interrupt(ctx); }
 };
 
 template <typename Z> class ZFixedPoint {
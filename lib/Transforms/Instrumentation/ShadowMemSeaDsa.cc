@@ -19,6 +19,8 @@
 
 #include "boost/range/algorithm/set_algorithm.hpp"
 
+#include <limits>
+
 #include "sea_dsa/AllocSiteInfo.hh"
 #include "sea_dsa/CallSite.hh"
 #include "sea_dsa/DsaAnalysis.hh"
@@ -381,6 +383,41 @@ class ShadowDsaImpl : public InstVisitor<ShadowDsaImpl> {
     ci->setMetadata(m_memUseTag, mkMetaConstant(accessedBytes));
   }
 
+  /// \brief Records on the definition \p ci the size of the object of the
+  /// node of \p c, if the node provably abstracts a single object
+  ///
+  /// A single object has one allocation site: a global, or a static alloca
+  /// of main, which is executed once. Any other node, such as the blocks of
+  /// a malloc in a loop or the cells of a list, may cover objects that are
+  /// far apart, and has no size
+  void markNodeSize(CallInst *ci, const dsa::Cell &c) {
+    const dsa::Node *n = c.getNode();
+    if (n->isArray() || n->isOffsetCollapsed() || n->isHeap() ||
+        n->isExternal() || n->isIntToPtr() || n->isIncomplete())
+      return;
+    if (n->getAllocSites().size() != 1)
+      return;
+
+    const Value *site = *n->getAllocSites().begin();
+    uint64_t sz = 0;
+    if (auto *gv = dyn_cast<const GlobalVariable>(site)) {
+      if (gv->isDeclaration())
+        return;
+      sz = m_dl->getTypeAllocSize(gv->getValueType());
+    } else if (auto *a = dyn_cast<const AllocaInst>(site)) {
+      if (!a->isStaticAlloca() || !a->getFunction()->getName().equals("main"))
+        return;
+      sz = m_dl->getTypeAllocSize(a->getAllocatedType()) *
+           cast<ConstantInt>(a->getArraySize())->getZExtValue();
+    } else {
+      return;
+    }
+    sz = std::max<uint64_t>(sz, n->size());
+    if (sz > std::numeric_limits<unsigned>::max())
+      return;
+    ci->setMetadata(m_nodeSizeTag, mkMetaConstant(unsigned(sz)));
+  }
+
   CallInst &mkShadowAllocInit(IRBuilder<> &B, Constant *fn, AllocaInst *a,
                               const dsa::Cell &c) {
     B.Insert(a, "shadow.mem." + Twine(getFieldId(c)));
@@ -388,6 +425,7 @@ class ShadowDsaImpl : public InstVisitor<ShadowDsaImpl> {
     Value *us = getUniqueScalar(*m_llvmCtx, B, c);
     ci = B.CreateCall(fn, {B.getInt32(getFieldId(c)), us}, "sm");
     markDefCall(ci, llvm::None);
+    markNodeSize(ci, c);
     B.CreateStore(ci, a);
     return *ci;
   }
@@ -407,6 +445,7 @@ class ShadowDsaImpl : public InstVisitor<ShadowDsaImpl> {
                              getUniqueScalar(*m_llvmCtx, B, c)},
                             "sm");
     markDefCall(ci, bytes);
+    markNodeSize(ci, c);
     return *ci;
   }
 
@@ -426,6 +465,7 @@ class ShadowDsaImpl : public InstVisitor<ShadowDsaImpl> {
         m_memGlobalVarInitFn,
         {m_B->getInt32(getFieldId(c)), m_B->CreateLoad(v), u}, "sm");
     markDefCall(ci, bytes);
+    markNodeSize(ci, c);
     B.CreateStore(ci, v);
     return ci;
   }
@@ -475,6 +515,7 @@ class ShadowDsaImpl : public InstVisitor<ShadowDsaImpl> {
                             "sh");
     B.CreateStore(ci, v);
     markDefCall(ci, bytes);
+    markNodeSize(ci, c);
     return *ci;
   }
 
@@ -484,6 +525,7 @@ class ShadowDsaImpl : public InstVisitor<ShadowDsaImpl> {
         B.CreateCall(m_markIn, {B.getInt32(getFieldId(c)), v, B.getInt32(idx),
                                 getUniqueScalar(*m_llvmCtx, B, c)});
     markDefCall(ci, bytes);
+    markNodeSize(ci, c);
     return *ci;
   }
 
@@ -593,6 +635,8 @@ public:
   const llvm::StringRef m_memDefTag = "shadow.mem.def";
   const llvm::StringRef m_memUseTag = "shadow.mem.use";
   const llvm::StringRef m_memPhiTag = "shadow.mem.phi";
+  /// read by shadow_dsa::getShadowMemNodeSize
+  const llvm::StringRef m_nodeSizeTag = "shadow.mem.node.size";
 };
 
 bool ShadowDsaImpl::runOnFunction(Function &F) {
@@ -1,12 +1,46 @@
 #include "seahorn/Bmc.hh"
+#include "seahorn/Expr/ExprSmtLib.hh"
 #include "seahorn/Transforms/Instrumentation/ShadowMemDsa.hh"
 #include "seahorn/UfoOpSem.hh"
 
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DebugLoc.h"
 
+#include "llvm/Support/CommandLine.h"
+
 #include "boost/container/flat_set.hpp"
 #include "seahorn/Support/SeaDebug.h"
+#include "seahorn/Support/Stats.hh"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+static llvm::cl::opt<unsigned> PortfolioSize(
+    "horn-bmc-portfolio",
+    llvm::cl::desc("Number of differently configured SMT solvers that race "
+                   "on the BMC formula"),
+    llvm::cl::init(1u));
+
+namespace {
+/// Varies the search of the k-th solver of a portfolio. Solver 0 keeps the
+/// default configuration
+void configurePortfolioSolver(ufo::ZSolver<ufo::EZ3> &solver, unsigned k) {
+  if (k == 0)
+    return;
+  // -- Z3 numbering. phase selection: 3 caching (default), 5 random,
+  // -- 6 occurrences, 0 always false. restarts: 1 inner-outer (default),
+  // -- 2 luby, 0 geometric
+  static const unsigned phases[] = {3u, 5u, 6u, 0u};
+  static const unsigned restarts[] = {1u, 2u, 0u};
+  ufo::ZParams<ufo::EZ3> params(solver.getContext());
+  params.set("random_seed", k);
+  params.set("smt.phase_selection", phases[k % 4]);
+  params.set("smt.restart_strategy", restarts[k % 3]);
+  solver.set(params);
+}
+} // namespace
 
 namespace seahorn {
 void BmcEngine::addCutPoint(const CutPoint &cp) {
@@ -21,44 +55,186 @@ void BmcEngine::addCutPoint(const CutPoint &cp) {
 
 boost::tribool BmcEngine::solve() {
   encode();
-  m_result = m_smt_solver.solve();
+  m_portfolio_solver.reset();
+  m_portfolio_zctx.reset();
+  if (PortfolioSize > 1)
+    m_result = solvePortfolio(PortfolioSize);
+  else
+    m_result = m_smt_solver.solve();
   return m_result;
 }
 
+boost::tribool BmcEngine::solvePortfolio(unsigned n) {
+  typedef ufo::ZSolver<ufo::EZ3> solver_type;
+
+  // -- worker 0 is m_smt_solver. The formula is marshalled into the
+  // -- contexts of the other workers here, so that the workers never
+  // -- touch the expression factory
+  std::vector<std::unique_ptr<ufo::EZ3>> zctxs;
+  std::vector<std::unique_ptr<solver_type>> solvers;
+  std::vector<solver_type *> workers(1, &m_smt_solver);
+  for (unsigned k = 1; k < n; ++k) {
+    zctxs.emplace_back(new ufo::EZ3(m_efac));
+    solvers.emplace_back(new solver_type(*zctxs.back()));
+    configurePortfolioSolver(*solvers.back(), k);
+    for (Expr v : m_side)
+      solvers.back()->assertExpr(v);
+    workers.push_back(solvers.back().get());
+  }
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::vector<bool> done(n, false);
+  unsigned running = n;
+  int winner = -1;
+  boost::tribool res = boost::indeterminate;
+
+  std::vector<std::thread> threads;
+  for (unsigned k = 0; k < n; ++k)
+    threads.emplace_back([&, k]() {
+      boost::tribool r = boost::indeterminate;
+      try {
+        r = workers[k]->solve();
+      } catch (z3::exception &e) {
+        LOG("bmc", errs() << "portfolio solver " << k << ": " << e.msg()
+                          << "\n";);
+      }
+      std::lock_guard<std::mutex> guard(lock);
+      done[k] = true;
+      --running;
+      if (winner < 0 && !boost::indeterminate(r)) {
+        winner = k;
+        res = r;
+      }
+      changed.notify_all();
+    });
+
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [&]() { return winner >= 0 || running == 0; });
+    // -- cancel the rest. An interrupt that arrives before a worker has
+    // -- entered its check is lost, so keep interrupting until all are done
+    while (running > 0) {
+      for (unsigned k = 0; k < n; ++k)
+        if (!done[k])
+          workers[k]->interrupt();
+      changed.wait_for(guard, std::chrono::milliseconds(10));
+    }
+  }
+  for (auto &t : threads)
+    t.join();
+  for (auto &z : zctxs)
+    z->flushMarshalStats();
+
+  if (winner >= 0) {
+    Stats::uset("BMC_portfolio_winner", winner);
+    LOG("bmc",
+        errs() << "portfolio: solver " << winner << " answered first\n";);
+  }
+  if (winner > 0) {
+    // -- keep the winner for getModel() and getTrace()
+    m_portfolio_zctx = std::move(zctxs[winner - 1]);
+    m_portfolio_solver = std::move(solvers[winner - 1]);
+  }
+  // -- release the losers before their contexts
+  solvers.clear();
+  zctxs.clear();
+  return res;
+}
+
 void BmcEngine::encode(bool assert_formula) {
 
   // -- only run the encoding once
-  if (m_semCtx)
-    return;
+  if (!m_semCtx)
+    encodeNewEdges();
+
+  // -- the formula might have been encoded without asserting it
+  if (assert_formula && !m_side_asserted) {
+    for (Expr v : m_side)
+      m_smt_solver.assertExpr(v);
+    m_side_asserted = true;
+  }
+}
 
+boost::tribool BmcEngine::solveIncremental(const CutPoint &query) {
+  assert(!m_cps.empty());
+  m_portfolio_solver.reset();
+  m_portfolio_zctx.reset();
+
+  // -- the trace up to the last cut-point is asserted for good
+  encodeNewEdges();
+  for (unsigned sz = m_side.size(); m_side_inc < sz; ++m_side_inc)
+    m_smt_solver.assertExpr(m_side[m_side_inc]);
+
+  // -- retract the query of the previous depth. Clauses learned from it
+  // -- are weakened by its literal and remain valid
+  if (m_query_lit)
+    m_smt_solver.assertExpr(mk<NEG>(m_query_lit));
+
+  // -- encode the query edge from a snapshot of the state, so that the
+  // -- next depth continues from the last cut-point of the trace. The
+  // -- checkpoint keeps the allocations of the trace: the constraints that
+  // -- order the allocations of the query edge are retracted with it
+  SymStore snapshot(m_ctxState);
+  OpSemContext::CheckpointPtr checkpoint = m_semCtx->checkpoint();
+  addCutPoint(query);
+  encodeNewEdges();
+  m_query_lit = bind::boolConst(mkTerm<std::string>(
+      "bmc.query." + std::to_string(m_edges.size()), m_efac));
+  for (unsigned i = m_side_inc, sz = m_side.size(); i < sz; ++i)
+    m_smt_solver.assertExpr(mk<IMPL>(m_query_lit, m_side[i]));
+
+  ExprVector assumptions(1, m_query_lit);
+  m_result = m_smt_solver.solveAssuming(assumptions);
+  Stats::uset("BMC_depth", m_edges.size());
+  LOG("bmc", errs() << "depth " << m_edges.size() << ": "
+                    << (m_result ? "sat" : !m_result ? "unsat" : "unknown")
+                    << "\n";);
+  if (m_result)
+    return m_result;
+
+  // -- drop the query edge from the trace
+  m_cps.pop_back();
+  m_edges.pop_back();
+  m_states.pop_back();
+  m_state_side_sz.pop_back();
+  m_side.resize(m_side_inc);
+  m_ctxState = snapshot;
+  m_semCtx->restore(*checkpoint);
+  return m_result;
+}
+
+raw_ostream &BmcEngine::toSmtLib(raw_ostream &out) {
+  encode(/*assert_formula=*/false);
+  SmtLibWriter writer(out);
+  writer.assertExprs(m_side);
+  writer.checkSat();
+  return out;
+}
+
+void BmcEngine::encodeNewEdges() {
   assert(m_cpg);
   assert(m_fn);
 
-  m_semCtx = m_sem.mkContext(m_ctxState, m_side);
-  VCGen vcgen(m_sem);
-
-  // first state is the state in which execution starts
-  m_states.push_back(m_semCtx->values());
-
-  // -- for every pair of cut-points
-  const CutPoint *prev = nullptr;
-  for (const CutPoint *cp : m_cps) {
-    if (prev) {
-      const CpEdge *edg = m_cpg->getEdge(*prev, *cp);
-      assert(edg);
-      m_edges.push_back(edg);
-
-      // generate vc for current edge
-      vcgen.genVcForCpEdge(*m_semCtx, *edg);
-      // store a copy of the state at the end of execution
-      m_states.push_back(m_semCtx->values());
-    }
-    prev = cp;
+  if (!m_semCtx) {
+    m_semCtx = m_sem.mkContext(m_ctxState, m_side);
+    // first state is the state in which execution starts
+    m_states.push_back(m_semCtx->values());
+    m_state_side_sz.push_back(m_side.size());
   }
 
-  if (assert_formula) {
-    for (Expr v : m_side)
-      m_smt_solver.assertExpr(v);
+  VCGen vcgen(m_sem);
+  // -- for every pair of cut-points that is not encoded yet
+  for (unsigned i = m_edges.size() + 1; i < m_cps.size(); ++i) {
+    const CpEdge *edg = m_cpg->getEdge(*m_cps[i - 1], *m_cps[i]);
+    assert(edg);
+    m_edges.push_back(edg);
+
+    // generate vc for current edge
+    vcgen.genVcForCpEdge(*m_semCtx, *edg);
+    // store a copy of the state at the end of execution
+    m_states.push_back(m_semCtx->values());
+    m_state_side_sz.push_back(m_side.size());
   }
 }
 
@@ -67,9 +243,16 @@ void BmcEngine::reset() {
   m_cpg = nullptr;
   m_fn = nullptr;
   m_smt_solver.reset();
+  m_portfolio_solver.reset();
+  m_portfolio_zctx.reset();
+  m_semCtx.reset();
 
   m_side.clear();
+  m_side_asserted = false;
+  m_side_inc = 0;
+  m_query_lit = Expr();
   m_states.clear();
+  m_state_side_sz.clear();
   m_edges.clear();
 }
 
@@ -80,23 +263,58 @@ void BmcEngine::unsatCore(ExprVector &out) {
 
 BmcTrace BmcEngine::getTrace() {
   assert((bool)m_result);
-  auto model = m_smt_solver.getModel();
+  auto model = resultSolver().getModel();
   return BmcTrace(*this, model);
 }
 
 BmcTrace::BmcTrace(BmcEngine &bmc, ufo::ZModel<ufo::EZ3> &model)
-    : m_bmc(bmc), m_model(model /*m_bmc.zctx()*/) {
-  // assert ((bool)bmc.result ());
-  // m_model = bmc.getModel ();
+    : m_bmc(bmc), m_model(model /*m_bmc.zctx()*/), m_has_implicant(false),
+      m_has_bbs(false) {}
+
+BmcTrace::ImplicantSetPtr BmcTrace::mkImplicant(unsigned begin,
+                                                unsigned end) const {
+  const ExprVector &f = m_bmc.getFormula();
+  ExprVector part(f.begin() + begin, f.begin() + end);
+  ExprVector lits;
+  ImplicantBoolMap bool_map /*unused*/;
+  bmc_impl::get_model_implicant(part, m_model, lits, bool_map);
+  return std::make_shared<const ImplicantSet>(lits.begin(), lits.end());
+}
 
-  // construct an implicant of the side condition
-  m_trace.reserve(m_bmc.getFormula().size());
-  ExprMap bool_map /*unused*/;
-  bmc_impl::get_model_implicant(m_bmc.getFormula(), m_model, m_trace,
-                                m_bool_map);
-  boost::container::flat_set<Expr> implicant(m_trace.begin(), m_trace.end());
+bool BmcTrace::inEdgeImplicant(unsigned id, Expr lit) const {
+  const std::vector<unsigned> &sz = m_bmc.getStateFormulaSizes();
+  const ExprVector &f = m_bmc.getFormula();
+  // -- without a side condition per edge, all of it is the rest
+  bool hasEdges = sz.size() == m_bmc.getStates().size() && !sz.empty();
+
+  if (!m_rest_implicant) {
+    if (!hasEdges)
+      m_rest_implicant = mkImplicant(0, f.size());
+    else {
+      // -- side condition of the initial state and after the last edge
+      ImplicantSetPtr pre = mkImplicant(0, sz.front());
+      ImplicantSetPtr post = mkImplicant(sz.back(), f.size());
+      auto rest = std::make_shared<ImplicantSet>(*pre);
+      rest->insert(post->begin(), post->end());
+      m_rest_implicant = rest;
+    }
+  }
+  if (m_rest_implicant->count(lit))
+    return true;
+  if (!hasEdges)
+    return false;
+
+  if (m_edge_implicants.size() <= id)
+    m_edge_implicants.resize(id + 1);
+  if (!m_edge_implicants[id])
+    m_edge_implicants[id] = mkImplicant(sz[id], sz[id + 1]);
+  return m_edge_implicants[id]->count(lit) > 0;
+}
 
-  // construct the trace
+void BmcTrace::computeBbs() const {
+  if (m_has_bbs)
+    return;
+  m_has_bbs = true;
 
   // -- reference to the first state
   auto st = m_bmc.getStates().begin();
@@ -113,7 +331,7 @@ BmcTrace::BmcTrace(BmcEngine &bmc, ufo::ZModel<ufo::EZ3> &model)
       const BasicBlock &BB = *it;
 
       if (it != edg->begin() &&
-          implicant.count(s.eval(m_bmc.getSymbReg(BB))) <= 0)
+          !inEdgeImplicant(id, s.eval(m_bmc.getSymbReg(BB))))
         continue;
 
       m_bbs.push_back(&BB);
@@ -138,22 +356,55 @@ BmcTrace::BmcTrace(BmcEngine &bmc, ufo::ZModel<ufo::EZ3> &model)
   }
 }
 
-Expr BmcTrace::symb(unsigned loc, const llvm::Value &val) {
-  // assert (cast<Instruction>(&val)->getParent () == bb(loc));
+void BmcTrace::computeImplicant() const {
+  if (m_has_implicant)
+    return;
+  m_has_implicant = true;
 
-  if (!m_bmc.sem().isTracked(val))
+  // construct an implicant of the side condition
+  m_trace.reserve(m_bmc.getFormula().size());
+  bmc_impl::get_model_implicant(m_bmc.getFormula(), m_model, m_trace,
+                                m_bool_map);
+}
+
+Expr BmcTrace::evalInState(unsigned stateidx, Expr u, bool complete) {
+  // -- out of bounds, no value in the model
+  if (stateidx >= m_bmc.getStates().size())
     return Expr();
+
+  auto key = std::make_tuple(stateidx, u, complete);
+  auto it = m_values.find(key);
+  if (it != m_values.end())
+    return it->second;
+
+  SymStore &store = m_bmc.getStates()[stateidx];
+  Expr v = m_model.eval(store.eval(u), complete);
+  m_values.insert(std::make_pair(key, v));
+  return v;
+}
+
+bool BmcTrace::symbState(unsigned loc, const llvm::Value &val,
+                         unsigned &stateidx, Expr &u) {
+  if (!m_bmc.sem().isTracked(val))
+    return false;
   if (isa<Instruction>(val) && bmc_impl::isCallToVoidFn(cast<Instruction>(val)))
-    return Expr();
-  Expr u = m_bmc.getSymbReg(val);
+    return false;
+  u = m_bmc.getSymbReg(val);
 
-  unsigned stateidx = cpid(loc);
+  stateidx = cpid(loc);
   // -- all registers except for PHI nodes at the entry to an edge
   // -- get their value at the end of the edge
   if (!(isa<PHINode>(val) && isFirstOnEdge(loc)))
     stateidx++;
   // -- out of bounds, no value in the model
-  if (stateidx >= m_bmc.getStates().size())
+  return stateidx < m_bmc.getStates().size();
+}
+
+Expr BmcTrace::symb(unsigned loc, const llvm::Value &val) {
+  // assert (cast<Instruction>(&val)->getParent () == bb(loc));
+  unsigned stateidx;
+  Expr u;
+  if (!symbState(loc, val, stateidx, u))
     return Expr();
 
   SymStore &store = m_bmc.getStates()[stateidx];
@@ -161,27 +412,69 @@ Expr BmcTrace::symb(unsigned loc, const llvm::Value &val) {
 }
 
 Expr BmcTrace::eval(unsigned loc, const llvm::Value &val, bool complete) {
-  Expr v = symb(loc, val);
-  if (v)
-    v = m_model.eval(v, complete);
-  return v;
+  unsigned stateidx;
+  Expr u;
+  if (!symbState(loc, val, stateidx, u))
+    return Expr();
+  return evalInState(stateidx, u, complete);
 }
 
 Expr BmcTrace::eval(unsigned loc, Expr u, bool complete) {
+  return evalInState(cpid(loc) + 1, u, complete);
+}
 
-  unsigned stateidx = cpid(loc);
-  stateidx++;
-  // -- out of bounds, no value in the model
-  if (stateidx >= m_bmc.getStates().size())
-    return Expr();
+void BmcTrace::eval(const std::vector<EvalQuery> &queries, ExprVector &out,
+                    bool complete) {
+  out.assign(queries.size(), Expr());
+
+  // -- symbolic values of the queries that are not known yet
+  std::vector<std::tuple<unsigned, Expr, bool>> keys;
+  std::vector<unsigned> pending;
+  ExprVector symbs;
+  for (unsigned i = 0, sz = queries.size(); i < sz; ++i) {
+    const EvalQuery &q = queries[i];
+    unsigned stateidx;
+    Expr u;
+    if (q.val) {
+      if (!symbState(q.loc, *q.val, stateidx, u))
+        continue;
+    } else {
+      stateidx = cpid(q.loc) + 1;
+      u = q.expr;
+      if (stateidx >= m_bmc.getStates().size())
+        continue;
+    }
 
-  SymStore &store = m_bmc.getStates()[stateidx];
-  Expr v = store.eval(u);
-  return m_model.eval(v, complete);
+    auto key = std::make_tuple(stateidx, u, complete);
+    auto it = m_values.find(key);
+    if (it != m_values.end()) {
+      out[i] = it->second;
+      continue;
+    }
+    keys.push_back(key);
+    pending.push_back(i);
+    symbs.push_back(m_bmc.getStates()[stateidx].eval(u));
+  }
+
+  ExprVector vals;
+  m_model.eval(symbs, vals, complete);
+  for (unsigned j = 0, sz = pending.size(); j < sz; ++j) {
+    out[pending[j]] = vals[j];
+    m_values.insert(std::make_pair(keys[j], vals[j]));
+  }
 }
 
 // template <typename Out> Out &BmcTrace::print (Out &out)
 template <> raw_ostream &BmcTrace::print(raw_ostream &out) {
+  // -- evaluate every instruction of the trace in one pass. Values are
+  // -- kept and looked up again below
+  std::vector<EvalQuery> queries;
+  for (unsigned loc = 0; loc < size(); ++loc)
+    for (auto &I : *bb(loc))
+      queries.push_back({loc, &I, Expr()});
+  ExprVector values;
+  eval(queries, values);
+
   out << "Begin trace \n";
   for (unsigned loc = 0; loc < size(); ++loc) {
     const BasicBlock &BB = *bb(loc);
@@ -268,7 +561,8 @@ bool isCallToVoidFn(const llvm::Instruction &I) {
 }
 
 void get_model_implicant(const ExprVector &f, ufo::ZModel<ufo::EZ3> &model,
-                         ExprVector &out, ExprMap &active_bool_map) {
+                         ExprVector &out,
+                         ImplicantBoolMap &active_bool_map) {
   // XXX This is a partial implementation. Specialized to the
   // constraints expected to occur in m_side.
 
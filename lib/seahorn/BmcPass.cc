@@ -1,8 +1,10 @@
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "seahorn/config.h"
@@ -17,6 +19,7 @@
 #include "seahorn/Bmc.hh"
 #include "seahorn/BvOpSem.hh"
 #include "seahorn/BvOpSem2.hh"
+#include "seahorn/Expr/ExprSmtLib.hh"
 #include "seahorn/PathBasedBmc.hh"
 // prerequisite for CrabLlvm
 #include "seahorn/Support/SeaDebug.h"
@@ -35,10 +38,20 @@ static llvm::cl::opt<bool> HornGSA("horn-gsa",
                                    llvm::cl::desc("Use Gated SSA for bmc"),
                                    llvm::cl::init(false), llvm::cl::Hidden);
 
+static llvm::cl::opt<unsigned> HornBmcDeepen(
+    "horn-bmc-deepen",
+    llvm::cl::desc("Check the exit of main at every depth up to the given "
+                   "number of loop iterations with incremental BMC. Expects "
+                   "a single loop and is only used by the mono engine. "
+                   "Reports unknown if the bound is reached. 0 disables it"),
+    llvm::cl::init(0u));
+
 namespace seahorn {
 // Defined in PathBasedBmc.cc
 // True if PathBasedBmc asks for crab.
 extern bool XHornBmcCrab;
+// Number of threads that PathBasedBmc uses to solve path formulas.
+extern unsigned XHornBmcPathJobs;
 } // namespace seahorn
 
 namespace {
@@ -160,6 +173,9 @@ public:
       return false;
     }
 
+    if (HornBmcDeepen > 0 && m_engine == mono_bmc && m_solve)
+      return runIncremental(F, src, *dst);
+
     if (!cpg.getEdge(src, *dst)) {
       ERR << "No direct entry-to-exit path in " << F.getName() << ". "
           << "Commonly caused by loops. Ensure the input to BMC is loop-free";
@@ -168,7 +184,9 @@ public:
       return false;
     }
 
-    ExprFactory efac;
+    // -- path-based BMC shares the factory with the threads that solve
+    // -- path formulas
+    ExprFactory efac(m_engine == path_bmc && XHornBmcPathJobs > 1);
 
     std::unique_ptr<OperationalSemantics> sem;
     if (HornBv2)
@@ -218,7 +236,8 @@ public:
                       << dst->bb().getName() << "\n";);
 
     Stats::resume("BMC");
-    bmc->encode();
+    // -- a formula that is only dumped is never translated to the solver
+    bmc->encode(/*assert_formula=*/m_solve);
 
     Stats::uset("BMC_DAG_SIZE", bmc->getFormulaDagSize());
     Stats::uset("BMC_CIRCUIT_SIZE", bmc->getFormulaCircuitSize());
@@ -232,8 +251,13 @@ public:
                      << "Simplified VC:\n"
                      << z3_to_smtlib(bmc->zctx(), vc_simpl) << "\n");
 
-    if (m_out)
-      bmc->toSmtLib(*m_out);
+    if (m_out) {
+      try {
+        bmc->toSmtLib(*m_out);
+      } catch (SmtLibError &e) {
+        report_fatal_error(e.what());
+      }
+    }
 
     if (!m_solve) {
       LOG("bmc", errs() << "Stopping before solving\n";);
@@ -243,6 +267,7 @@ public:
 
     auto res = bmc->solve();
     Stats::stop("BMC");
+    zctx.flushMarshalStats();
 
     if (res)
       outs() << "sat";
@@ -280,6 +305,102 @@ public:
     return false;
   }
 
+  /// Iterative deepening: extends the trace from \p src by one loop
+  /// iteration at a time and checks at each depth whether \p dst is
+  /// reachable from the last cut-point
+  ///
+  /// The cut-point graph must be a single path from \p src, possibly ending
+  /// in a cycle, with edges to \p dst. The result is unsat only if the trace
+  /// cannot be extended any further, and unknown if it reaches the bound
+  bool runIncremental(Function &F, const CutPoint &src, const CutPoint &dst) {
+    // -- every cut-point other than dst must have a unique successor other
+    // -- than dst
+    llvm::SmallPtrSet<const CutPoint *, 8> seen;
+    for (const CutPoint *cp = &src; cp && seen.insert(cp).second;) {
+      const CutPoint *next = nullptr;
+      for (const CpEdge *edg :
+           boost::make_iterator_range(succ_begin(*cp), succ_end(*cp))) {
+        if (&edg->target() == &dst)
+          continue;
+        if (next && next != &edg->target()) {
+          ERR << "More than one loop in " << F.getName() << ". "
+              << "--horn-bmc-deepen expects a single loop";
+          LOG("cpg_bmc", cp->parent().print(llvm::errs(), F.getParent()));
+          return false;
+        }
+        next = &edg->target();
+      }
+      cp = next;
+    }
+
+    ExprFactory efac;
+    std::unique_ptr<OperationalSemantics> sem;
+    if (HornBv2)
+      sem = llvm::make_unique<Bv2OpSem>(efac, *this,
+                                        F.getParent()->getDataLayout(), MEM);
+    else
+      sem = llvm::make_unique<BvOpSem>(efac, *this,
+                                       F.getParent()->getDataLayout(), MEM);
+
+    ufo::EZ3 zctx(efac);
+    BmcEngine bmc(*sem, zctx);
+    bmc.addCutPoint(src);
+
+    Stats::resume("BMC");
+    const CutPoint *last = &src;
+    boost::tribool res = false;
+    for (unsigned depth = 0;; ++depth) {
+      if (last->parent().getEdge(*last, dst)) {
+        res = bmc.solveIncremental(dst);
+        if (res || boost::indeterminate(res))
+          break;
+      }
+
+      // -- the next cut-point of the trace is the unique one other than dst
+      const CutPoint *next = nullptr;
+      for (const CpEdge *edg :
+           boost::make_iterator_range(succ_begin(*last), succ_end(*last)))
+        if (&edg->target() != &dst)
+          next = &edg->target();
+      if (!next)
+        break;
+      // -- dst may still be reachable through longer traces
+      if (depth == HornBmcDeepen) {
+        LOG("bmc", errs() << "reached the bound of " << depth
+                          << " iterations\n";);
+        res = boost::indeterminate;
+        break;
+      }
+      bmc.addCutPoint(*next);
+      last = next;
+    }
+    Stats::stop("BMC");
+    zctx.flushMarshalStats();
+
+    if (res)
+      outs() << "sat";
+    else if (!res)
+      outs() << "unsat";
+    else
+      outs() << "unknown";
+    outs() << "\n";
+
+    if (res)
+      Stats::sset("BMC_result", "FALSE");
+    else if (!res)
+      Stats::sset("BMC_result", "TRUE");
+    else
+      Stats::sset("BMC_result", "UNKNOWN");
+
+    LOG("cex", if (res) {
+      errs() << "Analyzed Function:\n" << F << "\n";
+      BmcTrace trace(bmc.getTrace());
+      errs() << "Trace \n";
+      trace.print(errs());
+    });
+    return false;
+  }
+
   StringRef getPassName() const override { return "BmcPass"; }
 };
 
@@ -6,6 +6,7 @@
 #include "llvm/Support/Format.h"
 #include "llvm/Support/MathExtras.h"
 
+#include "seahorn/Expr/ExprSmtLib.hh"
 #include "seahorn/Support/CFG.hh"
 #include "seahorn/Support/SeaDebug.h"
 #include "seahorn/Support/SeaLog.hh"
@@ -16,7 +17,6 @@
 
 #include "BvOpSem2Context.hh"
 
-#include <fstream>
 #include <memory>
 
 using namespace seahorn;
@@ -70,6 +70,18 @@ static llvm::cl::opt<bool> SimplifyOnWrite(
     llvm::cl::desc("Simplify expressions as they are written to memory"),
     llvm::cl::init(false));
 
+static llvm::cl::opt<bool> ModelMalloc(
+    "horn-bv2-malloc",
+    llvm::cl::desc("Allocate a fresh heap block for every call to malloc()"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> BbSummaries(
+    "horn-bv2-bb-summaries",
+    llvm::cl::desc("Execute every basic block once over fresh inputs and "
+                   "reuse the result for all later executions of the block "
+                   "and of blocks of the same shape"),
+    llvm::cl::init(false));
+
 namespace {
 const Value *extractUniqueScalar(CallSite &cs) {
   if (!EnableUniqueScalars2)
@@ -470,6 +482,11 @@ public:
       return;
     }
 
+    if (ModelMalloc && f->getName().equals("malloc") && CS.arg_size() == 1) {
+      visitMallocCall(CS);
+      return;
+    }
+
     if (CS.getInstruction()->getMetadata("shadow.mem")) {
       visitShadowMemCall(CS);
       return;
@@ -539,9 +556,10 @@ public:
       LOG("opsem", WARN << "allowing calloc() to "
                            "zero initialize ALL of its memory region\n";);
       // TODO: move into MemManager
-      m_ctx.addDef(
-          m_ctx.read(m_ctx.getMemWriteRegister()),
-          op::array::constArray(m_ctx.mem().ptrSort(), m_ctx.mem().nullPtr()));
+      Expr memReg = m_ctx.getMemWriteRegister();
+      Expr idxTy = sort::arrayIndexTy(bind::rangeTy(bind::fname(memReg)));
+      m_ctx.addDef(m_ctx.read(memReg),
+                   op::array::constArray(idxTy, m_ctx.mem().nullPtr()));
     }
 
     // get a fresh pointer
@@ -549,6 +567,21 @@ public:
     setValue(inst, havoc(inst));
   }
 
+  void visitMallocCall(CallSite CS) {
+    const Instruction &inst = *CS.getInstruction();
+    if (m_sem.isSkipped(inst))
+      return;
+
+    const Value &size = *CS.getArgument(0);
+    Expr bytes = lookup(size);
+    if (!bytes) {
+      setValue(inst, Expr());
+      return;
+    }
+    bytes = lengthToPtrSz(bytes, size, m_ctx);
+    setValue(inst, m_ctx.mem().halloc(bytes));
+  }
+
   void visitShadowMemCall(CallSite CS) {
     const Instruction &inst = *CS.getInstruction();
 
@@ -1182,6 +1215,17 @@ public:
     return res;
   }
 
+  /// \brief Converts the length of a memory transfer to pointer width
+  Expr lengthToPtrSz(Expr len, const Value &length, Bv2OpSemContext &ctx) {
+    unsigned lenSz = m_sem.sizeInBits(length);
+    unsigned ptrSz = ctx.ptrSzInBits();
+    if (lenSz > ptrSz)
+      return ctx.alu().doTrunc(len, ptrSz);
+    if (lenSz < ptrSz)
+      return ctx.alu().doZext(len, ptrSz, lenSz);
+    return len;
+  }
+
   Expr executeMemSetInst(const Value &dst, const Value &val,
                          const Value &length, unsigned alignment,
                          Bv2OpSemContext &ctx) {
@@ -1207,8 +1251,10 @@ public:
     if (v && addr) {
       if (const ConstantInt *ci = dyn_cast<const ConstantInt>(&length)) {
         res = m_ctx.MemSet(addr, v, ci->getZExtValue(), alignment);
-      } else
-        llvm_unreachable("Unsupported memset with symbolic length");
+      } else if (len) {
+        res = m_ctx.MemSet(addr, v, lengthToPtrSz(len, length, ctx),
+                           alignment);
+      }
     }
 
     if (!res)
@@ -1242,8 +1288,10 @@ public:
     if (dstAddr && srcAddr) {
       if (const ConstantInt *ci = dyn_cast<const ConstantInt>(&length)) {
         res = m_ctx.MemCpy(dstAddr, srcAddr, ci->getZExtValue(), alignment);
-      } else
-        llvm_unreachable("Unsupported memcpy with symbolic length");
+      } else if (len) {
+        res = m_ctx.MemCpy(dstAddr, srcAddr, lengthToPtrSz(len, length, ctx),
+                           alignment);
+      }
     }
 
     if (!res)
@@ -1400,35 +1448,94 @@ Bv2OpSemContext::Bv2OpSemContext(SymStore &values, ExprVector &side,
       m_scalar(o.m_scalar), m_trfrReadReg(o.m_trfrReadReg),
       m_fparams(o.m_fparams), m_ignored(o.m_ignored),
       m_registers(o.m_registers), m_alu(nullptr), m_memManager(nullptr),
-      m_parent(&o), zeroE(o.zeroE), oneE(o.oneE), m_z3(o.m_z3) {
+      m_parent(&o), zeroE(o.zeroE), oneE(o.oneE),
+      m_simplifier(o.m_simplifier) {
   setPathCond(o.getPathCond());
 }
 
+struct Bv2OpSemContext::MachineCheckpoint : public OpSemContext::Checkpoint {
+  const Function *func;
+  const BasicBlock *bb;
+  BasicBlock::const_iterator inst;
+  const BasicBlock *prev;
+  Expr readRegister;
+  Expr writeRegister;
+  bool scalar;
+  Expr trfrReadReg;
+  ExprVector fparams;
+  OpSemAllocator::State alloc;
+};
+
+OpSemContext::CheckpointPtr Bv2OpSemContext::checkpoint() const {
+  std::unique_ptr<MachineCheckpoint> cp(new MachineCheckpoint());
+  saveCheckpoint(*cp);
+  cp->func = m_func;
+  cp->bb = m_bb;
+  cp->inst = m_inst;
+  cp->prev = m_prev;
+  cp->readRegister = m_readRegister;
+  cp->writeRegister = m_writeRegister;
+  cp->scalar = m_scalar;
+  cp->trfrReadReg = m_trfrReadReg;
+  cp->fparams = m_fparams;
+  // -- forks share the memory of their parent, and so does the checkpoint
+  cp->alloc = mem().getAllocState();
+  return CheckpointPtr(std::move(cp));
+}
+
+void Bv2OpSemContext::restore(const Checkpoint &_cp) {
+  OpSemContext::restore(_cp);
+  auto &cp = static_cast<const MachineCheckpoint &>(_cp);
+  m_func = cp.func;
+  m_bb = cp.bb;
+  m_inst = cp.inst;
+  m_prev = cp.prev;
+  m_readRegister = cp.readRegister;
+  m_writeRegister = cp.writeRegister;
+  m_scalar = cp.scalar;
+  m_trfrReadReg = cp.trfrReadReg;
+  m_fparams = cp.fparams;
+  mem().setAllocState(cp.alloc);
+}
+
 void Bv2OpSemContext::write(Expr v, Expr u) {
   if (SimplifyOnWrite) {
     ScopedStats _st_("opsem.simplify");
-    if (!m_z3)
-      m_z3.reset(new ufo::EZ3(efac()));
-
-    ufo::ZParams<ufo::EZ3> params(*m_z3);
-    params.set("ctrl_c", true);
-    // params.set("timeout", 10000U /*ms*/);
-    // params.set("flat", false);
-    // params.set("ite_extra_rules", false /*default=false*/);
-    Expr _u = z3_simplify(*m_z3, u, params);
+    if (!m_simplifier)
+      m_simplifier = std::make_shared<BvSimplifier>(efac());
+
+    unsigned rewrites = m_simplifier->rewrites();
+    Expr _u = m_simplifier->simplify(u);
+    Stats::uset("opsem.simplify.rewrites",
+                Stats::get("opsem.simplify.rewrites") +
+                    (m_simplifier->rewrites() - rewrites));
+    Stats::uset("opsem.simplify.cache", m_simplifier->cacheSize());
     LOG("opsem.simplify",
         //
         if (!isOpX<LAMBDA>(_u) && !isOpX<ITE>(_u) && dagSize(_u) > 100) {
-          errs() << "Term after simplification:\n"
-                 << m_z3->toSmtLib(_u) << "\n";
+          errs() << "Term after simplification:\n";
+          // -- a log line must not abort the run
+          try {
+            SmtLibWriter(errs()).write(_u);
+          } catch (SmtLibError &e) {
+            errs() << "\n" << e.what();
+          }
+          errs() << "\n";
         });
 
     LOG("opsem.dump.subformulae",
         if ((isOpX<EQ>(_u) || isOpX<NEG>(_u)) && dagSize(_u) > 100) {
           static unsigned cnt = 0;
-          std::ofstream file("assert." + std::to_string(++cnt) + ".smt2");
-          file << m_z3->toSmtLibDecls(_u) << "\n";
-          file << "(assert " << m_z3->toSmtLib(_u) << ")\n";
+          std::error_code EC;
+          raw_fd_ostream file("assert." + std::to_string(++cnt) + ".smt2", EC,
+                              sys::fs::F_Text);
+          if (!EC) {
+            try {
+              SmtLibWriter(file).assertExpr(_u);
+            } catch (SmtLibError &e) {
+              WARN << e.what();
+            }
+          }
         });
     u = _u;
   }
@@ -1498,6 +1605,24 @@ Expr Bv2OpSemContext::MemCpy(Expr dPtr, Expr sPtr, unsigned len,
                               align);
 }
 
+Expr Bv2OpSemContext::MemSet(Expr ptr, Expr val, Expr len, uint32_t align) {
+  assert(m_memManager);
+  assert(getMemReadRegister());
+  assert(getMemWriteRegister());
+  return m_memManager->MemSet(ptr, val, len, getMemReadRegister(),
+                              getMemWriteRegister(), align);
+}
+
+Expr Bv2OpSemContext::MemCpy(Expr dPtr, Expr sPtr, Expr len, uint32_t align) {
+  assert(m_memManager);
+  assert(getMemTrsfrReadReg());
+  assert(getMemReadRegister());
+  assert(getMemWriteRegister());
+  return m_memManager->MemCpy(dPtr, sPtr, len, getMemTrsfrReadReg(),
+                              getMemReadRegister(), getMemWriteRegister(),
+                              align);
+}
+
 Expr Bv2OpSemContext::MemFill(Expr dPtr, char *sPtr, unsigned len,
                               uint32_t align) {
   assert(m_memManager);
@@ -1715,9 +1840,82 @@ Expr Bv2OpSem::errorFlag(const BasicBlock &BB) {
   return this->OperationalSemantics::errorFlag(BB);
 }
 
+/// A summary of the effect of a basic block on a context.
+///
+/// A summary is obtained by executing the block in an empty store, so that
+/// every register that is read before it is written has a fresh value
+/// (called a placeholder), and with a fresh path condition. Applying the
+/// summary replaces the placeholders by the current values of the
+/// registers, and every non-deterministic value by a new one.
+///
+/// A summary is shared by all blocks of the same shape. The registers it
+/// mentions are those of the first block. They are renamed to the registers
+/// of the values that fill the same slots in the block it is applied to.
+///
+/// Memory is a placeholder when the block is summarized. Loads are resolved
+/// (see OpSemMemArrayRepr) only against stores of the block itself. Loads
+/// from stores of earlier blocks remain array selects.
+struct Bv2OpSem::BbSummary {
+  /// registers read by the block before being written
+  ExprVector inputs;
+  /// placeholder value of each input
+  ExprVector placeholders;
+  /// havocs done by the block, in order, as (register, value) pairs
+  std::vector<std::pair<Expr, Expr>> havocs;
+  /// registers written by the block
+  ExprVector outputs;
+  /// final value of each output
+  ExprVector values;
+  /// side conditions added by the block
+  ExprVector side;
+  /// placeholder for the path condition
+  Expr pathCond;
+
+  /// register of the value in each slot that has one, as (slot, register)
+  std::vector<std::pair<unsigned, Expr>> slotRegs;
+  /// globals and functions used by the block that have a register
+  std::vector<const Value *> regs;
+
+  /// memory registers at the end of the block, null if not set by it
+  Expr readReg;
+  Expr writeReg;
+  Expr trfrReadReg;
+  bool memScalar = false;
+};
+
+Bv2OpSem::~Bv2OpSem() = default;
+
 void Bv2OpSem::exec(const BasicBlock &bb, details::Bv2OpSemContext &ctx) {
+  if (!BbSummaries || !isSummarizable(bb)) {
+    ctx.onBasicBlockEntry(bb);
+    execInsts(bb, ctx);
+    return;
+  }
+
+  BbInstance &inst = m_bbInstances[&bb];
+  if (!inst.sum) {
+    BbShape shape;
+    shapeOf(bb, shape, inst.slots);
+    auto &sum = m_bbSummaries[shape];
+    if (!sum) {
+      Stats::count("opsem.bb.summary.miss");
+      sum = summarize(bb, inst.slots, ctx);
+      inst.sum = sum.get();
+      applySummary(*inst.sum, inst.slots, ctx);
+      return;
+    }
+    // -- a copy of a block that is already summarized
+    Stats::count("opsem.bb.summary.shared");
+    inst.sum = sum.get();
+  }
+
+  Stats::count("opsem.bb.summary.hit");
   ctx.onBasicBlockEntry(bb);
+  ctx.setInstruction(*bb.getTerminator());
+  applySummary(*inst.sum, inst.slots, ctx);
+}
 
+void Bv2OpSem::execInsts(const BasicBlock &bb, details::Bv2OpSemContext &ctx) {
   details::OpSemVisitor v(ctx, *this);
   v.visitBasicBlock(const_cast<BasicBlock &>(bb));
   // skip PHI instructions
@@ -1729,6 +1927,220 @@ void Bv2OpSem::exec(const BasicBlock &bb, details::Bv2OpSemContext &ctx) {
   }
 }
 
+bool Bv2OpSem::isSummarizable(const BasicBlock &bb) const {
+  // -- true once the memory registers used by loads and stores are set
+  bool hasMemRegs = false;
+  for (const Instruction &inst : bb) {
+    if (isSkipped(inst))
+      continue;
+
+    if (isa<PHINode>(inst) || isa<BinaryOperator>(inst) ||
+        isa<ICmpInst>(inst) || isa<CastInst>(inst) || isa<SelectInst>(inst) ||
+        isa<GetElementPtrInst>(inst) || isa<BranchInst>(inst) ||
+        isa<ReturnInst>(inst) || isa<UnreachableInst>(inst))
+      continue;
+
+    if (isa<LoadInst>(inst) || isa<StoreInst>(inst)) {
+      // -- the block must not depend on memory registers set by others
+      if (!hasMemRegs)
+        return false;
+      continue;
+    }
+
+    // -- calls that only read and write registers. In particular, no
+    // -- allocation since the memory manager keeps its own state
+    if (isa<CallInst>(inst) && !isa<IntrinsicInst>(inst)) {
+      CallSite CS(const_cast<Instruction *>(&inst));
+      const Function *fn = getCalledFunction(CS);
+      if (!fn)
+        return false;
+      if (fn->getName().equals("shadow.mem.load") ||
+          fn->getName().equals("shadow.mem.store")) {
+        hasMemRegs = true;
+        continue;
+      }
+      if (fn->getName().equals("shadow.mem.trsfr.load") ||
+          fn->getName().equals("verifier.assume") ||
+          fn->getName().equals("verifier.assume.not"))
+        continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+/// The shape of a block lists, for every instruction, its opcode, types
+/// and attributes, and its operands. A constant operand is listed as
+/// itself. Any other operand is listed by its slot: the instructions of the
+/// block come first, in order, followed by the other operands in order of
+/// first use. Each slot also lists what the semantics looks up about its
+/// value: whether it is skipped, and its shadow memory region.
+void Bv2OpSem::shapeOf(const BasicBlock &bb, BbShape &shape,
+                       std::vector<const Value *> &slots) const {
+  DenseMap<const Value *, unsigned> slotOf;
+  auto slot = [&](const Value *v) {
+    auto it = slotOf.insert({v, unsigned(slots.size())});
+    if (it.second)
+      slots.push_back(v);
+    return it.first->second;
+  };
+  auto ptr = [](const void *p) { return reinterpret_cast<uintptr_t>(p); };
+
+  for (const Instruction &inst : bb)
+    slot(&inst);
+
+  for (const Instruction &inst : bb) {
+    shape.push_back(inst.getOpcode());
+    shape.push_back(ptr(inst.getType()));
+    shape.push_back(inst.getRawSubclassOptionalData());
+    if (auto *cmp = dyn_cast<CmpInst>(&inst))
+      shape.push_back(cmp->getPredicate());
+    else if (auto *load = dyn_cast<LoadInst>(&inst))
+      shape.push_back(load->getAlignment());
+    else if (auto *store = dyn_cast<StoreInst>(&inst))
+      shape.push_back(store->getAlignment());
+    else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst))
+      shape.push_back(ptr(gep->getSourceElementType()));
+    else if (isa<ReturnInst>(&inst))
+      shape.push_back(bb.getParent()->getName().equals("main"));
+
+    // -- incoming values are read by execPhi, not by the block
+    if (isa<PHINode>(&inst))
+      continue;
+
+    shape.push_back(inst.getNumOperands());
+    for (const Value *op : inst.operand_values()) {
+      // -- successors are followed by execBr, not by the block
+      if (isa<BasicBlock>(op)) {
+        shape.push_back(0);
+      } else if (isa<Constant>(op)) {
+        shape.push_back(1);
+        shape.push_back(ptr(op));
+      } else {
+        shape.push_back(2);
+        shape.push_back(slot(op));
+        shape.push_back(ptr(op->getType()));
+      }
+    }
+  }
+
+  for (const Value *v : slots) {
+    shape.push_back(isSkipped(*v));
+    shape.push_back(shadow_dsa::getShadowMemId(*v));
+    shape.push_back(shadow_dsa::getShadowMemNodeSize(*v));
+  }
+}
+
+std::unique_ptr<Bv2OpSem::BbSummary>
+Bv2OpSem::summarize(const BasicBlock &bb,
+                    const std::vector<const Value *> &slots,
+                    details::Bv2OpSemContext &ctx) {
+  std::unique_ptr<BbSummary> sum(new BbSummary());
+  sum->pathCond =
+      bind::boolConst(mkTerm<std::string>("sea.bb.pc", ctx.efac()));
+
+  // -- execute bb in an empty store that tracks uses and definitions
+  SymStore store(ctx.efac(), /*trackUse=*/true);
+  Expr pathCond = ctx.getPathCond();
+  Expr readReg = ctx.getMemReadRegister();
+  Expr writeReg = ctx.getMemWriteRegister();
+  Expr trfrReadReg = ctx.getMemTrsfrReadReg();
+  ctx.values().swap(store);
+  ctx.side().swap(sum->side);
+  ctx.setPathCond(sum->pathCond);
+  ctx.setMemReadRegister(Expr());
+  ctx.setMemWriteRegister(Expr());
+  ctx.setMemTrsfrReadReg(Expr());
+  ctx.recordHavocs(&sum->havocs);
+
+  ctx.onBasicBlockEntry(bb);
+  execInsts(bb, ctx);
+
+  ctx.recordHavocs(nullptr);
+  ctx.setPathCond(pathCond);
+  ctx.side().swap(sum->side);
+  ctx.values().swap(store);
+
+  sum->readReg = ctx.getMemReadRegister();
+  sum->writeReg = ctx.getMemWriteRegister();
+  sum->trfrReadReg = ctx.getMemTrsfrReadReg();
+  sum->memScalar = ctx.isMemScalar();
+  ctx.setMemReadRegister(readReg);
+  ctx.setMemWriteRegister(writeReg);
+  ctx.setMemTrsfrReadReg(trfrReadReg);
+
+  for (const Expr &reg : store.uses()) {
+    // -- the value that an empty store assigns to a register on first read
+    Expr fdecl = bind::fname(reg);
+    Expr fname = variant::variant(0, bind::fname(fdecl));
+    sum->inputs.push_back(reg);
+    sum->placeholders.push_back(bind::reapp(reg, bind::rename(fdecl, fname)));
+  }
+  for (const Expr &reg : store.defs()) {
+    sum->outputs.push_back(reg);
+    sum->values.push_back(store.at(reg));
+  }
+
+  for (unsigned i = 0, sz = slots.size(); i < sz; ++i)
+    if (Expr reg = ctx.getRegister(*slots[i]))
+      sum->slotRegs.emplace_back(i, reg);
+  for (const Instruction &inst : bb)
+    for (const Value *op : inst.operand_values())
+      if ((isa<GlobalVariable>(op) || isa<Function>(op)) &&
+          ctx.getRegister(*op))
+        sum->regs.push_back(op);
+  return sum;
+}
+
+void Bv2OpSem::applySummary(const BbSummary &sum,
+                            const std::vector<const Value *> &slots,
+                            details::Bv2OpSemContext &ctx) {
+  // -- registers are declared per context
+  for (const Value *v : sum.regs)
+    ctx.mkRegister(*v);
+
+  // -- registers of the summarized block to registers of this one
+  ExprMap rename;
+  for (auto &sr : sum.slotRegs) {
+    const Value &v = *slots[sr.first];
+    Expr reg = isa<Argument>(v) ? ctx.getRegister(v) : ctx.mkRegister(v);
+    if (reg && reg != sr.second)
+      rename[sr.second] = reg;
+  }
+  auto regOf = [&rename](Expr reg) {
+    auto it = rename.find(reg);
+    return it == rename.end() ? reg : it->second;
+  };
+
+  // -- map placeholders to current values and havocs to new values
+  SymStore sub(ctx.efac(), false, /*globalParent=*/true);
+  for (unsigned i = 0, sz = sum.inputs.size(); i < sz; ++i)
+    sub.write(sum.placeholders[i], ctx.read(regOf(sum.inputs[i])));
+  for (auto &h : sum.havocs)
+    sub.write(h.second, ctx.havoc(regOf(h.first)));
+  sub.write(sum.pathCond, ctx.getPathCond());
+
+  seahorn::detail::SymStoreEvalVisitor ev(sub);
+  DagVisit<seahorn::detail::SymStoreEvalVisitor> instantiate(ev);
+  for (unsigned i = 0, sz = sum.outputs.size(); i < sz; ++i)
+    ctx.write(regOf(sum.outputs[i]), instantiate(sum.values[i]));
+  for (const Expr &s : sum.side) {
+    if (isOpX<IMPL>(s) && s->left() == sum.pathCond)
+      ctx.addScopedSide(instantiate(s->right()));
+    else
+      ctx.addSide(instantiate(s));
+  }
+
+  if (sum.readReg) {
+    ctx.setMemReadRegister(regOf(sum.readReg));
+    ctx.setMemScalar(sum.memScalar);
+  }
+  if (sum.writeReg)
+    ctx.setMemWriteRegister(regOf(sum.writeReg));
+  if (sum.trfrReadReg)
+    ctx.setMemTrsfrReadReg(regOf(sum.trfrReadReg));
+}
+
 void Bv2OpSem::execPhi(const BasicBlock &bb, const BasicBlock &from,
                        details::Bv2OpSemContext &ctx) {
   ctx.onBasicBlockEntry(bb);
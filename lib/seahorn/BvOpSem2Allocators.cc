@@ -3,12 +3,43 @@
 #include "llvm/IR/GetElementPtrTypeIterator.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
 
 #include "seahorn/Support/SeaDebug.h"
 #include "seahorn/Support/SeaLog.hh"
+#include "seahorn/Support/Stats.hh"
 #include "ufo/ExprLlvm.hpp"
 
+#include <algorithm>
+
+static llvm::cl::opt<unsigned>
+    MaxStackAddr("sea-opsem-stack-top",
+                 llvm::cl::desc("Highest address of the stack"),
+                 llvm::cl::init(0xC0000000));
+
+static llvm::cl::opt<unsigned>
+    StackSize("sea-opsem-stack-size",
+              llvm::cl::desc("Size of the stack in bytes. The heap ends "
+                             "where the stack begins"),
+              llvm::cl::init(9437184));
+
+static llvm::cl::opt<bool> MallocCanFail(
+    "sea-opsem-malloc-can-fail",
+    llvm::cl::desc("Let malloc() return NULL nondeterministically, and on "
+                   "a request that does not fit in the heap. Otherwise "
+                   "malloc() never fails, and paths on which a request does "
+                   "not fit are dropped"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> TextSegmentStart(
+    "sea-opsem-text-start",
+    llvm::cl::desc("Start address of the code segment. Code is followed by "
+                   "globals and then by the heap"),
+    llvm::cl::init(0x08048000));
+
 namespace seahorn {
 namespace details {
 
@@ -74,10 +105,28 @@ struct OpSemAllocator::GlobalAllocInfo {
 
 OpSemAllocator::OpSemAllocator(OpSemMemManager &mem)
     : m_mem(mem), m_ctx(mem.ctx()), m_sem(mem.sem()),
-      m_efac(m_ctx.getExprFactory()) {}
+      m_efac(m_ctx.getExprFactory()), MAX_STACK_ADDR(MaxStackAddr),
+      MIN_STACK_ADDR(MaxStackAddr - StackSize),
+      TEXT_SEGMENT_START(TextSegmentStart) {
+  if (StackSize > MaxStackAddr || MIN_STACK_ADDR <= TEXT_SEGMENT_START)
+    report_fatal_error("sea-opsem: the stack must be above the code segment");
+}
 
 OpSemAllocator::~OpSemAllocator() = default;
 
+OpSemAllocator::State OpSemAllocator::getState() const {
+  State s;
+  s.heapEnd = m_heapEnd;
+  s.allocas = m_allocas.size();
+  return s;
+}
+
+void OpSemAllocator::setState(const State &s) {
+  m_heapEnd = s.heapEnd;
+  if (s.allocas < m_allocas.size())
+    m_allocas.erase(m_allocas.begin() + s.allocas, m_allocas.end());
+}
+
 /// \brief Address at which heap starts (initial value of \c brk)
 unsigned OpSemAllocator::brk0Addr() {
   if (!m_globals.empty())
@@ -87,6 +136,66 @@ unsigned OpSemAllocator::brk0Addr() {
   return TEXT_SEGMENT_START;
 }
 
+/// \brief Allocates memory on the heap and returns a pointer to it
+///
+/// Heap blocks are not placed at concrete addresses. Each block has a fresh
+/// start, aligned to \p align (and at least to a word), and a fresh end
+/// address. Blocks are laid out in allocation order
+/// between brk0 and the stack. This ordering only relates fresh constants,
+/// so it is asserted unconditionally. The size of a block depends on the
+/// program and is assumed only under the current path condition. Blocks are
+/// disjoint without any pairwise constraints, and the encoding does not
+/// grow with the size of a block.
+///
+/// With --sea-opsem-malloc-can-fail, the allocation may fail, and must fail
+/// if the block does not fit; a failed allocation is empty and returns
+/// null. Otherwise a path on which the block does not fit is infeasible.
+Expr OpSemAllocator::halloc(Expr bytes, unsigned align) {
+  unsigned id = m_heapAllocs++;
+  // -- at least word aligned, and a power of two as mkAlignedPtr expects
+  uint32_t blockAlign = llvm::PowerOf2Ceil(
+      std::max(align, m_mem.wordSzInBytes()));
+  Expr start = m_mem.mkAlignedPtr(
+      op::variant::variant(id, mkTerm<std::string>("sea.heap.start", m_efac)),
+      blockAlign);
+  Expr end = bind::mkConst(
+      op::variant::variant(id, mkTerm<std::string>("sea.heap.end", m_efac)),
+      m_mem.ptrSort());
+
+  if (m_heapEnd)
+    m_ctx.addSide(m_mem.ptrUle(m_heapEnd, start));
+  else
+    m_ctx.addSide(m_mem.ptrUlt(m_mem.brk0Ptr(), start));
+  m_ctx.addSide(m_mem.ptrUle(start, end));
+  m_ctx.addSide(
+      m_mem.ptrUle(end, m_ctx.alu().si(MIN_STACK_ADDR, m_mem.ptrSzInBits())));
+  // -- since end cannot wrap around, the block fits in the heap
+  Expr fits = mk<EQ>(end, m_mem.ptrAdd(start, bytes));
+  m_heapEnd = end;
+
+  if (MallocCanFail) {
+    Expr fail = bind::boolConst(
+        op::variant::variant(id, mkTerm<std::string>("sea.heap.fail", m_efac)));
+    m_ctx.addScopedRely(mk<ITE>(fail, mk<EQ>(end, start), fits));
+    return mk<ITE>(fail, m_mem.nullPtr(), start);
+  }
+
+  // -- a request that might not fit removes the paths on which it does not
+  unsigned heapSz = MIN_STACK_ADDR - brk0Addr();
+  if (!m_ctx.alu().isNum(bytes) || m_ctx.alu().toNum(bytes) > heapSz) {
+    Stats::count("opsem.heap.unchecked");
+    if (!m_warnedHeap) {
+      WARN << "malloc() of a symbolic or oversized block never fails; "
+              "paths on which the block does not fit in the heap are "
+              "dropped. Use --sea-opsem-malloc-can-fail to return NULL "
+              "instead";
+      m_warnedHeap = true;
+    }
+  }
+  m_ctx.addScopedRely(fits);
+  return start;
+}
+
 /// \brief Allocates memory in global (data/bss) segment for given global
 AddrInterval OpSemAllocator::galloc(const GlobalVariable &gv, uint64_t bytes,
                                     unsigned align) {
@@ -200,6 +309,10 @@ class StaticOpSemAllocator : public OpSemAllocator {
 public:
   StaticOpSemAllocator(OpSemMemManager &mem) : OpSemAllocator(mem) {}
 
+  /// \brief The stack is laid out per function, not per path. Only the heap
+  /// is restored
+  void setState(const State &s) override { m_heapEnd = s.heapEnd; }
+
   void onModuleEntry(const Module &M) override {
     // TODO: pre-allocate all globals of M
 
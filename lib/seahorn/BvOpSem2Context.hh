@@ -1,10 +1,11 @@
 #pragma once
 
 #include "seahorn/BvOpSem2.hh"
+#include "seahorn/Expr/ExprSimplifier.hh"
 #include "seahorn/Support/SeaDebug.h"
 #include "seahorn/Support/SeaLog.hh"
 
-#include "ufo/Smt/EZ3.hh"
+#include "ufo/ExprIdMap.hpp"
 
 namespace seahorn {
 namespace details {
@@ -81,6 +82,9 @@ private:
 
   /// \brief ALU for basic instructions
   OpSemAluPtr m_alu;
+  /// \brief Checkpoint of the machine state. \sa checkpoint
+  struct MachineCheckpoint;
+
   /// \brief Pointer to the parent a parent context
   ///
   /// If not null, then the current context is a fork of the parent context
@@ -94,8 +98,13 @@ private:
   /// \brief Numeric one
   Expr oneE;
 
-  /// \brief local simplifier
-  std::shared_ptr<ufo::EZ3> m_z3;
+  /// \brief local simplifier. Shared with forks of this context so that
+  /// its memo is reused across paths
+  std::shared_ptr<expr::BvSimplifier> m_simplifier;
+
+  /// \brief If not null, every havoc is appended to it as a (register,
+  /// value) pair
+  std::vector<std::pair<Expr, Expr>> *m_havocs = nullptr;
 
 public:
   /// \brief Create a new context with given semantics, values, and side
@@ -109,6 +118,18 @@ public:
 
   /// \brief Writes value \p u into symbolic register \p v
   void write(Expr v, Expr u);
+  /// \brief Writes a non-deterministic value into register \p v
+  Expr havoc(Expr v) {
+    Expr h = OpSemContext::havoc(v);
+    if (m_havocs)
+      m_havocs->emplace_back(v, h);
+    return h;
+  }
+  /// \brief Records all subsequent havocs in \p havocs. Recording stops
+  /// when \p havocs is null
+  void recordHavocs(std::vector<std::pair<Expr, Expr>> *havocs) {
+    m_havocs = havocs;
+  }
   /// \brief Returns size of a memory word
   unsigned wordSzInBytes() const;
   /// \brief Returns size in bits of a memory word
@@ -193,6 +214,16 @@ public:
   /// \brief Perform symbolic memcpy
   Expr MemCpy(Expr dPtr, Expr sPtr, unsigned len, uint32_t align);
 
+  /// \brief Perform symbolic memset with a symbolic length
+  ///
+  /// \p len is a pointer-sized bit-vector
+  Expr MemSet(Expr ptr, Expr val, Expr len, uint32_t align);
+
+  /// \brief Perform symbolic memcpy with a symbolic length
+  ///
+  /// \p len is a pointer-sized bit-vector
+  Expr MemCpy(Expr dPtr, Expr sPtr, Expr len, uint32_t align);
+
   /// \brief Copy concrete memory into symbolic memory
   Expr MemFill(Expr dPtr, char *sPtr, unsigned len, uint32_t align = 0);
 
@@ -266,6 +297,10 @@ public:
     return OpSemContextPtr(new Bv2OpSemContext(values, side, *this));
   }
 
+  /// \brief Saves the machine state, including the allocations made so far
+  CheckpointPtr checkpoint() const override;
+  void restore(const Checkpoint &cp) override;
+
 private:
   static Bv2OpSemContext &ctx(OpSemContext &ctx) {
     return static_cast<Bv2OpSemContext &>(ctx);
@@ -356,10 +391,19 @@ protected:
   /// \brief All known global allocations
   std::vector<GlobalAllocInfo> m_globals;
 
-  // TODO: turn into user-controlled parameters
-  unsigned MAX_STACK_ADDR = 0xC0000000;
-  unsigned MIN_STACK_ADDR = (MAX_STACK_ADDR - 9437184);
-  unsigned TEXT_SEGMENT_START = 0x08048000;
+  /// \brief Highest address of the stack
+  unsigned MAX_STACK_ADDR;
+  /// \brief Lowest address of the stack. The heap ends here
+  unsigned MIN_STACK_ADDR;
+  /// \brief Address of the first function (and of the code segment)
+  unsigned TEXT_SEGMENT_START;
+
+  /// \brief End of the last heap allocation, or null if there is none
+  Expr m_heapEnd;
+  /// \brief Number of heap allocations so far
+  unsigned m_heapAllocs = 0;
+  /// \brief True once halloc warned about dropped paths
+  bool m_warnedHeap = false;
 
 public:
   using AddrInterval = std::pair<unsigned, unsigned>;
@@ -367,6 +411,18 @@ public:
 
   virtual ~OpSemAllocator();
 
+  /// \brief Allocation state that depends on the executed path
+  struct State {
+    /// \brief End of the last heap allocation
+    Expr heapEnd;
+    /// \brief Number of stack allocations
+    size_t allocas = 0;
+  };
+  /// \brief Returns the current allocation state
+  virtual State getState() const;
+  /// \brief Forgets all allocations made since \p s was returned by getState
+  virtual void setState(const State &s);
+
   /// \brief Allocates memory on the stack and returns a pointer to it
   /// \param align is requested alignment. If 0, default alignment is used
   virtual AddrInterval salloc(unsigned bytes, uint32_t align) = 0;
@@ -393,9 +449,9 @@ public:
   virtual void onFunctionEntry(const Function &fn) {}
 
   /// \brief Allocates memory on the heap and returns a pointer to it
-  virtual AddrInterval halloc(unsigned _bytes, unsigned align) {
-    llvm_unreachable("not implemented");
-  }
+  ///
+  /// \param bytes is a pointer-sized symbolic number of bytes to allocate
+  virtual Expr halloc(Expr bytes, unsigned align);
 
   /// \brief Allocates memory in global (data/bss) segment for given global
   /// \param bytes is the expected size of allocation
@@ -463,6 +519,10 @@ class OpSemMemManager {
   /// \brief A null pointer expression (cache)
   Expr m_nullPtr;
 
+  /// \brief Width of the index of a region of a single object, or 0 if
+  /// memory is indexed by pointers
+  unsigned m_idxBits;
+
 public:
   OpSemMemManager(Bv2OpSem &sem, Bv2OpSemContext &ctx, unsigned ptrSz,
                   unsigned wordSz, bool useLambdas = false);
@@ -482,6 +542,15 @@ public:
   unsigned wordSzInBytes() const { return m_wordSz; }
   unsigned wordSzInBits() const { return m_wordSz * 8; }
 
+  /// \brief Width of the index of the memory region defined by \p v
+  ///
+  /// Less than the pointer width only for a region of a single object that
+  /// fits in the region index. Such a region is indexed by the offset from
+  /// its start. Any other region is indexed by pointers
+  unsigned idxSzInBits(const Value &v) const;
+  /// \brief True if some memory regions may have their own index space
+  bool hasRegionIndex() const { return m_idxBits != 0; }
+
   /// \brief Allocates memory on the stack and returns a pointer to it
   /// \param align is requested alignment. If 0, default alignment is used
   PtrTy salloc(unsigned bytes, uint32_t align = 0);
@@ -636,6 +705,14 @@ public:
   Expr MemCpy(PtrTy dPtr, PtrTy sPtr, unsigned len, Expr memTrsfrReadReg,
               Expr memReadReg, Expr memWriteReg, uint32_t align);
 
+  /// \brief Executes symbolic memset with a symbolic length
+  Expr MemSet(PtrTy ptr, Expr _val, Expr len, Expr memReadReg,
+              Expr memWriteReg, uint32_t align);
+
+  /// \brief Executes symbolic memcpy with a symbolic length
+  Expr MemCpy(PtrTy dPtr, PtrTy sPtr, Expr len, Expr memTrsfrReadReg,
+              Expr memReadReg, Expr memWriteReg, uint32_t align);
+
   /// \brief Executes symbolic memcpy from physical memory with concrete length
   Expr MemFill(PtrTy dPtr, char *sPtr, unsigned len, uint32_t align = 0);
 
@@ -685,6 +762,15 @@ public:
     return m_allocator->getGlobalVariableInitValue(gv);
   }
 
+  /// \brief Returns the allocation state of memory
+  OpSemAllocator::State getAllocState() const {
+    return m_allocator->getState();
+  }
+  /// \brief Restores an allocation state returned by getAllocState
+  void setAllocState(const OpSemAllocator::State &s) {
+    m_allocator->setState(s);
+  }
+
   uint32_t getAlignment(const llvm::Value &v) const { return m_alignment; }
 };
 
@@ -701,6 +787,9 @@ public:
       : m_memManager(memManager), m_ctx(ctx), m_efac(ctx.getExprFactory()) {}
   virtual ~OpSemMemRepr() = default;
 
+  /// \brief Called before accessing the memory region of register \p memReg
+  virtual void setRegion(Expr memReg) {}
+
   virtual Expr coerce(Expr reg, Expr val) = 0;
   virtual Expr loadAlignedWordFromMem(Expr ptr, Expr mem) = 0;
   virtual Expr storeAlignedWordToMem(Expr val, Expr ptr, Expr ptrSort,
@@ -715,24 +804,86 @@ public:
   virtual Expr MemFill(Expr dPtr, char *sPtr, unsigned len,
                        unsigned wordSzInBytes, Expr ptrSort,
                        uint32_t align) = 0;
+
+  /// \brief memset and memcpy with a symbolic, pointer-sized, length
+  virtual Expr MemSet(Expr ptr, Expr _val, Expr len, Expr memReadReg,
+                      Expr memWriteReg, unsigned wordSzInBytes, Expr ptrSort,
+                      uint32_t align) = 0;
+  virtual Expr MemCpy(Expr dPtr, Expr sPtr, Expr len, Expr memTrsfrReadReg,
+                      Expr memReadReg, Expr memWriteReg, unsigned wordSzInBytes,
+                      Expr ptrSort, uint32_t align) = 0;
 };
 
 /// \brief Represent memory regions by logical arrays
+///
+/// Loads are resolved while encoding whenever the address is provably equal
+/// to, or provably different from, the addresses of the stores that precede
+/// it. Addresses are compared as a symbolic base plus a numeric offset.
+/// Stores of memset, memcpy and memfill are indexed by offset so that a load
+/// skips or resolves all of them in one step.
+///
+/// With a region index (see OpSemMemManager::idxSzInBits), a memory region
+/// of a single object is an array over a narrow index: the offset of a
+/// pointer from the symbolic start of the region. Every access assumes that
+/// the offset fits in the index. Since the object fits, the assumption only
+/// drops accesses out of its bounds. All other regions are indexed by
+/// pointers.
 class OpSemMemArrayRepr : public OpSemMemRepr {
+  /// \brief Stores of a single memory transfer to addresses with a common
+  /// base
+  struct StoreRun {
+    /// \brief memory before the stores
+    Expr below;
+    /// \brief common base of all addresses, null for numeric addresses
+    Expr base;
+    /// \brief stored value by offset from \c base
+    std::map<mpz_class, Expr> vals;
+  };
+
+  /// \brief Store runs by the memory after the last store of the run
+  ExprIdMap<std::unique_ptr<StoreRun>, true> m_runs;
+  /// \brief Most store runs kept in \c m_runs. A run keeps its memory
+  /// alive, but a load resolves without it by walking the stores. All runs
+  /// are dropped once there are more
+  static const size_t MAX_STORE_RUNS = 4096;
+
+  /// \brief Start of the region being accessed, null if the region is
+  /// indexed by pointers (see setRegion)
+  Expr m_regionStart;
+  /// \brief Width of the index of the region being accessed
+  unsigned m_regionBits = 0;
+  /// \brief Start and index width of the region of each memory value, by
+  /// the value
+  DenseMap<const Value *, std::pair<Expr, unsigned>> m_regions;
+
+  /// \brief Decomposes \p ptr into a base and a numeric offset modulo
+  /// 2^\p bits
+  void ptrBaseOffset(Expr ptr, Expr &base, mpz_class &offset, unsigned bits);
+  /// \brief Returns the array index of \p ptr in the current region
+  Expr index(Expr ptr);
+  /// \brief Returns the width of the array index of the current region
+  unsigned idxBits() const {
+    return m_regionStart ? m_regionBits : m_memManager.ptrSzInBits();
+  }
+  /// \brief Records the stores of \p vals at \p ptrs between \p below and
+  /// \p mem
+  void addStoreRun(Expr mem, Expr below, const ExprVector &ptrs,
+                   const ExprVector &vals);
+
 public:
   OpSemMemArrayRepr(OpSemMemManager &memManager, Bv2OpSemContext &ctx)
       : OpSemMemRepr(memManager, ctx) {}
 
+  void setRegion(Expr memReg) override;
+
   Expr coerce(Expr _, Expr val) override { return val; }
 
-  Expr loadAlignedWordFromMem(Expr ptr, Expr mem) override {
-    return op::array::select(mem, ptr);
-  }
+  Expr loadAlignedWordFromMem(Expr ptr, Expr mem) override;
 
   Expr storeAlignedWordToMem(Expr val, Expr ptr, Expr ptrSort,
                              Expr mem) override {
     (void)ptrSort;
-    return op::array::store(mem, ptr, val);
+    return op::array::store(mem, index(ptr), val);
   }
 
   Expr MemSet(Expr ptr, Expr _val, unsigned len, Expr memReadReg,
@@ -743,9 +894,19 @@ public:
               Expr ptrSort, uint32_t align) override;
   Expr MemFill(Expr dPtr, char *sPtr, unsigned len, unsigned wordSzInBytes,
                Expr ptrSort, uint32_t align) override;
+  Expr MemSet(Expr ptr, Expr _val, Expr len, Expr memReadReg,
+              Expr memWriteReg, unsigned wordSzInBytes, Expr ptrSort,
+              uint32_t align) override;
+  Expr MemCpy(Expr dPtr, Expr sPtr, Expr len, Expr memTrsfrReadReg,
+              Expr memReadReg, Expr memWriteReg, unsigned wordSzInBytes,
+              Expr ptrSort, uint32_t align) override;
 };
 
 /// \brief Represent memory regions by lambda functions
+///
+/// memset and memcpy are a single lambda that checks whether its argument is
+/// in the destination range. Their size does not depend on the length, which
+/// may be symbolic.
 class OpSemMemLambdaRepr : public OpSemMemRepr {
 public:
   OpSemMemLambdaRepr(OpSemMemManager &memManager, Bv2OpSemContext &ctx)
@@ -769,8 +930,17 @@ public:
               Expr ptrSort, uint32_t align) override;
   Expr MemFill(Expr dPtr, char *sPtr, unsigned len, unsigned wordSzInBytes,
                Expr ptrSort, uint32_t align) override;
+  Expr MemSet(Expr ptr, Expr _val, Expr len, Expr memReadReg,
+              Expr memWriteReg, unsigned wordSzInBytes, Expr ptrSort,
+              uint32_t align) override;
+  Expr MemCpy(Expr dPtr, Expr sPtr, Expr len, Expr memTrsfrReadReg,
+              Expr memReadReg, Expr memWriteReg, unsigned wordSzInBytes,
+              Expr ptrSort, uint32_t align) override;
 
 private:
+  /// \brief Checks if the word of \p wordSzInBytes bytes at \p ptr is in
+  /// the \p len bytes starting at \p base
+  Expr inRangeCheck(Expr base, Expr ptr, Expr len, unsigned wordSzInBytes);
   Expr coerceArrayToLambda(Expr arrVal);
   Expr makeLinearITE(Expr addr, const ExprVector &ptrKeys,
                      const ExprVector &vals, Expr fallback);
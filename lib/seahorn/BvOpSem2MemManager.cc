@@ -5,6 +5,7 @@
 
 #include "seahorn/Support/SeaDebug.h"
 #include "seahorn/Support/SeaLog.hh"
+#include "seahorn/Transforms/Instrumentation/ShadowMemDsa.hh"
 #include "ufo/ExprLlvm.hpp"
 
 namespace seahorn {
@@ -22,6 +23,14 @@ static llvm::cl::opt<enum seahorn::details::MemAllocatorKind> MemAllocatorOpt(
                    "static", "Static pre-allocation")),
     llvm::cl::init(seahorn::details::MemAllocatorKind::NORMAL_ALLOCATOR));
 
+static llvm::cl::opt<unsigned> RegionIndexBits(
+    "horn-bv2-region-index-bits",
+    llvm::cl::desc("Index every memory region of a single object that fits "
+                   "in the given number of bits by the offset from its start "
+                   "(0 to index all regions by pointers). Executions that "
+                   "access such a region out of bounds are ignored"),
+    llvm::cl::init(0));
+
 namespace seahorn {
 namespace details {
 
@@ -32,7 +41,8 @@ OpSemMemManager::OpSemMemManager(Bv2OpSem &sem, Bv2OpSemContext &ctx,
                                  bool useLambdas)
     : m_sem(sem), m_ctx(ctx), m_efac(ctx.getExprFactory()), m_ptrSz(ptrSz),
       m_wordSz(wordSz), m_alignment(m_wordSz),
-      m_freshPtrName(mkTerm<std::string>("sea.ptr", m_efac)), m_id(0) {
+      m_freshPtrName(mkTerm<std::string>("sea.ptr", m_efac)), m_id(0),
+      m_idxBits(0) {
   assert((m_wordSz == 1 || m_wordSz == 4 || m_wordSz == 8) &&
          "Untested word size");
   assert((m_ptrSz == 4) && "Untested pointer size");
@@ -52,6 +62,16 @@ OpSemMemManager::OpSemMemManager(Bv2OpSem &sem, Bv2OpSemContext &ctx,
     m_memRepr = llvm::make_unique<OpSemMemLambdaRepr>(*this, ctx);
   else
     m_memRepr = llvm::make_unique<OpSemMemArrayRepr>(*this, ctx);
+
+  if (RegionIndexBits > 0) {
+    if (RegionIndexBits >= ptrSzInBits())
+      report_fatal_error("horn-bv2-region-index-bits must be smaller than "
+                         "the pointer width");
+    if (useLambdas)
+      WARN << "horn-bv2-region-index-bits is ignored with lambda memory";
+    else
+      m_idxBits = RegionIndexBits;
+  }
 }
 
 /// \brief Creates a non-deterministic pointer that is aligned
@@ -86,11 +106,24 @@ Expr OpSemMemManager::mkPtrRegisterSort(const Function &fn) const {
   return m_ctx.alu().intTy(ptrSzInBits());
 }
 
+/// \brief Returns width of the index of the memory region defined by \p v
+///
+/// ShadowMemSeaDsa records the size of a region only if its DSA node
+/// provably abstracts a single object
+unsigned OpSemMemManager::idxSzInBits(const Value &v) const {
+  if (!hasRegionIndex())
+    return ptrSzInBits();
+  uint64_t sz = shadow_dsa::getShadowMemNodeSize(v);
+  if (sz == 0 || sz > (uint64_t(1) << m_idxBits))
+    return ptrSzInBits();
+  return m_idxBits;
+}
+
 /// \brief Returns sort of memory-holding register for an instruction
 Expr OpSemMemManager::mkMemRegisterSort(const Instruction &inst) const {
-  Expr ptrTy = m_ctx.alu().intTy(ptrSzInBits());
+  Expr idxTy = m_ctx.alu().intTy(idxSzInBits(inst));
   Expr valTy = m_ctx.alu().intTy(wordSzInBits());
-  return sort::arrayTy(ptrTy, valTy);
+  return sort::arrayTy(idxTy, valTy);
 }
 
 /// \brief Returns a fresh aligned pointer value
@@ -153,29 +186,13 @@ PtrTy OpSemMemManager::brk0Ptr() {
 
 /// \brief Allocates memory on the heap and returns a pointer to it
 PtrTy OpSemMemManager::halloc(unsigned _bytes, unsigned align) {
-  Expr res = freshPtr();
-
   unsigned bytes = llvm::alignTo(_bytes, std::max(align, m_alignment));
-
-  auto stackRange = m_allocator->getStackRange();
-  // -- pointer is in the heap: between brk at the beginning and end of stack
-  m_ctx.addSide(
-      ptrUlt(res, m_ctx.alu().si(stackRange.first - bytes, ptrSzInBits())));
-  m_ctx.addSide(ptrUgt(res, brk0Ptr()));
-  return res;
+  return halloc(m_ctx.alu().si(bytes, ptrSzInBits()), align);
 }
 
 /// \brief Allocates memory on the heap and returns pointer to it
 PtrTy OpSemMemManager::halloc(Expr bytes, unsigned align) {
-  Expr res = freshPtr();
-
-  auto stackRange = m_allocator->getStackRange();
-  // -- pointer is in the heap: between brk at the beginning and end of stack
-  m_ctx.addSide(ptrUlt(res, m_ctx.alu().si(stackRange.first, ptrSzInBits())));
-  m_ctx.addSide(ptrUgt(res, brk0Ptr()));
-  // TODO: take size of pointer into account,
-  // it cannot be that close to the stack
-  return res;
+  return m_allocator->halloc(bytes, std::max(align, m_alignment));
 }
 
 /// \brief Allocates memory in global (data/bss) segment for given global
@@ -275,6 +292,7 @@ Expr OpSemMemManager::extractUnalignedByte(Expr mem, PtrTy address,
 Expr OpSemMemManager::loadIntFromMem(PtrTy ptr, Expr memReg, unsigned byteSz,
                                      uint64_t align) {
   Expr mem = m_ctx.read(memReg);
+  m_memRepr->setRegion(memReg);
   SmallVector<Expr, 16> words;
   unsigned offsetBits = getByteAlignmentBits();
   if (offsetBits != 0 && align % wordSzInBytes() != 0) {
@@ -338,6 +356,7 @@ Expr OpSemMemManager::storeIntToMem(Expr _val, PtrTy ptr, Expr memReadReg,
                                     unsigned byteSz, uint64_t align) {
   Expr val = _val;
   Expr mem = m_ctx.read(memReadReg);
+  m_memRepr->setRegion(memReadReg);
 
   unsigned offsetBits = getByteAlignmentBits();
   bool wordAligned = offsetBits == 0 || align % wordSzInBytes() == 0;
@@ -524,6 +543,21 @@ Expr OpSemMemManager::MemCpy(PtrTy dPtr, PtrTy sPtr, unsigned len,
                            memWriteReg, wordSzInBytes(), ptrSort(), align);
 }
 
+/// \brief Executes symbolic memset with a symbolic length
+Expr OpSemMemManager::MemSet(PtrTy ptr, Expr _val, Expr len, Expr memReadReg,
+                             Expr memWriteReg, uint32_t align) {
+  return m_memRepr->MemSet(ptr, _val, len, memReadReg, memWriteReg,
+                           wordSzInBytes(), ptrSort(), align);
+}
+
+/// \brief Executes symbolic memcpy with a symbolic length
+Expr OpSemMemManager::MemCpy(PtrTy dPtr, PtrTy sPtr, Expr len,
+                             Expr memTrsfrReadReg, Expr memReadReg,
+                             Expr memWriteReg, uint32_t align) {
+  return m_memRepr->MemCpy(dPtr, sPtr, len, memTrsfrReadReg, memReadReg,
+                           memWriteReg, wordSzInBytes(), ptrSort(), align);
+}
+
 /// \brief Executes symbolic memcpy from physical memory with concrete length
 Expr OpSemMemManager::MemFill(PtrTy dPtr, char *sPtr, unsigned len,
                               uint32_t align) {
@@ -610,6 +644,11 @@ void OpSemMemManager::onModuleEntry(const Module &M) {
 
 /// \brief Called when a function is entered for the first time
 void OpSemMemManager::onFunctionEntry(const Function &fn) {
+  // -- region ids are local to a function, a region index is only sound
+  // -- when the whole program is inlined into main
+  if (hasRegionIndex() && !fn.getName().equals("main"))
+    report_fatal_error("horn-bv2-region-index-bits requires a program "
+                       "inlined into main");
   m_allocator->onFunctionEntry(fn);
 
   Expr res = m_ctx.read(m_sp0);
@@ -1,5 +1,20 @@
 #include "BvOpSem2Context.hh"
 
+#include "llvm/Support/CommandLine.h"
+
+#include "seahorn/Support/SeaLog.hh"
+#include "seahorn/Support/Stats.hh"
+#include "seahorn/Transforms/Instrumentation/ShadowMemDsa.hh"
+#include "ufo/ExprLlvm.hpp"
+
+#include <tuple>
+
+static llvm::cl::opt<bool> ResolveLoads(
+    "horn-bv2-resolve-loads",
+    llvm::cl::desc("Resolve loads from array memory at provably equal or "
+                   "different addresses while encoding"),
+    llvm::cl::init(true));
+
 namespace {
 template <typename T, typename... Rest>
 auto as_std_array(const T &t, const Rest &... rest) ->
@@ -11,6 +26,149 @@ auto as_std_array(const T &t, const Rest &... rest) ->
 namespace seahorn {
 namespace details {
 
+void OpSemMemArrayRepr::ptrBaseOffset(Expr ptr, Expr &base, mpz_class &offset,
+                                      unsigned bits) {
+  offset = 0;
+  base = ptr;
+  while (base && isOpX<BADD>(base) && base->arity() == 2 &&
+         bv::isBvNum(base->right())) {
+    offset += bv::toMpz(base->right());
+    base = base->left();
+  }
+  if (base && bv::isBvNum(base)) {
+    offset += bv::toMpz(base);
+    base = Expr();
+  }
+  // -- offsets wrap around like pointer arithmetic does
+  mpz_fdiv_r_2exp(offset.get_mpz_t(), offset.get_mpz_t(), bits);
+}
+
+void OpSemMemArrayRepr::setRegion(Expr memReg) {
+  if (!m_memManager.hasRegionIndex())
+    return;
+
+  m_regionStart = Expr();
+  m_regionBits = m_memManager.ptrSzInBits();
+  Expr name = bind::fname(bind::fname(memReg));
+  if (!isOpX<VALUE>(name))
+    return;
+  const Value *v = getTerm<const Value *>(name);
+
+  auto it = m_regions.find(v);
+  if (it != m_regions.end()) {
+    std::tie(m_regionStart, m_regionBits) = it->second;
+    return;
+  }
+
+  // -- must agree with the sort of the register (see mkMemRegisterSort)
+  unsigned bits = m_memManager.idxSzInBits(*v);
+  int64_t id = shadow_dsa::getShadowMemId(*v);
+  if (bits < m_memManager.ptrSzInBits() && id >= 0) {
+    m_regionStart = shadow_dsa::memStartVar(id, m_memManager.ptrSort());
+    m_regionBits = bits;
+  }
+  m_regions[v] = std::make_pair(m_regionStart, m_regionBits);
+}
+
+Expr OpSemMemArrayRepr::index(Expr ptr) {
+  if (!m_regionStart)
+    return ptr;
+
+  unsigned bits = m_regionBits;
+  unsigned ptrBits = m_memManager.ptrSzInBits();
+  // -- the access must stay within the index space of the region. The
+  // -- region is a single object that fits, so only accesses out of its
+  // -- bounds are dropped
+  mpz_class size = 1;
+  mpz_mul_2exp(size.get_mpz_t(), size.get_mpz_t(), bits);
+  m_ctx.addScopedRely(
+      m_memManager.ptrUlt(m_memManager.ptrSub(ptr, m_regionStart),
+                          m_ctx.alu().si(size, ptrBits)));
+
+  // -- keep the numeric offset of ptr on top so that indices of the same
+  // -- base are compared by offset
+  Expr base;
+  mpz_class offset;
+  ptrBaseOffset(ptr, base, offset, bits);
+  Expr idx = bv::extract(
+      bits - 1, 0,
+      m_memManager.ptrSub(base ? base : m_memManager.nullPtr(), m_regionStart));
+  if (offset != 0)
+    idx = mk<BADD>(idx, bv::bvnum(offset, bits, m_efac));
+  return idx;
+}
+
+void OpSemMemArrayRepr::addStoreRun(Expr mem, Expr below,
+                                    const ExprVector &ptrs,
+                                    const ExprVector &vals) {
+  if (ptrs.empty() || m_runs.count(mem))
+    return;
+
+  std::unique_ptr<StoreRun> run(new StoreRun());
+  run->below = below;
+  for (unsigned i = 0, sz = ptrs.size(); i < sz; ++i) {
+    Expr base;
+    mpz_class offset;
+    ptrBaseOffset(ptrs[i], base, offset, idxBits());
+    if (i == 0)
+      run->base = base;
+    else if (base != run->base)
+      return;
+    run->vals[offset] = vals[i];
+  }
+  if (m_runs.size() >= MAX_STORE_RUNS) {
+    Stats::count("opsem.mem.store.runs.dropped");
+    m_runs.clear();
+  }
+  m_runs.insert(mem, std::move(run));
+}
+
+Expr OpSemMemArrayRepr::loadAlignedWordFromMem(Expr ptr, Expr mem) {
+  ptr = index(ptr);
+  if (!ResolveLoads)
+    return op::array::select(mem, ptr);
+
+  unsigned bits = idxBits();
+  Expr base;
+  mpz_class offset;
+  ptrBaseOffset(ptr, base, offset, bits);
+
+  while (true) {
+    if (const std::unique_ptr<StoreRun> *p = m_runs.lookup(mem)) {
+      const StoreRun &run = **p;
+      if (run.base != base)
+        break;
+      auto it = run.vals.find(offset);
+      if (it != run.vals.end()) {
+        Stats::count("opsem.mem.load.resolved");
+        return it->second;
+      }
+      mem = run.below;
+      continue;
+    }
+
+    if (!isOpX<STORE>(mem))
+      break;
+    Expr idx = mem->arg(1);
+    if (idx == ptr) {
+      Stats::count("opsem.mem.load.resolved");
+      return mem->arg(2);
+    }
+    Expr idxBase;
+    mpz_class idxOffset;
+    ptrBaseOffset(idx, idxBase, idxOffset, bits);
+    if (idxBase != base)
+      break;
+    if (idxOffset == offset) {
+      Stats::count("opsem.mem.load.resolved");
+      return mem->arg(2);
+    }
+    mem = mem->arg(0);
+  }
+
+  return op::array::select(mem, ptr);
+}
+
 Expr OpSemMemArrayRepr::MemSet(Expr ptr, Expr _val, unsigned len,
                                Expr memReadReg, Expr memWriteReg,
                                unsigned wordSzInBytes, Expr ptrSort,
@@ -24,12 +182,18 @@ Expr OpSemMemArrayRepr::MemSet(Expr ptr, Expr _val, unsigned len,
     unsigned long val = 0;
     memset(&val, byte, wordSzInBytes);
 
-    res = m_ctx.read(memReadReg);
+    Expr mem = m_ctx.read(memReadReg);
+    setRegion(memReadReg);
+    Expr bvVal = bv::bvnum(val, wordSzInBytes * m_BitsPerByte, m_efac);
+    ExprVector ptrs, vals;
+    res = mem;
     for (unsigned i = 0; i < len; i += wordSzInBytes) {
-      Expr idx = m_memManager.ptrAdd(ptr, i);
-      res = op::array::store(
-          res, idx, bv::bvnum(val, wordSzInBytes * m_BitsPerByte, m_efac));
+      Expr idx = index(m_memManager.ptrAdd(ptr, i));
+      res = op::array::store(res, idx, bvVal);
+      ptrs.push_back(idx);
+      vals.push_back(bvVal);
     }
+    addStoreRun(res, mem, ptrs, vals);
     m_ctx.write(memWriteReg, res);
   }
 
@@ -40,36 +204,67 @@ Expr OpSemMemArrayRepr::MemCpy(Expr dPtr, Expr sPtr, unsigned len,
                                Expr memTrsfrReadReg, Expr memReadReg,
                                Expr memWriteReg, unsigned wordSzInBytes,
                                Expr ptrSort, uint32_t align) {
-  (void)memReadReg, ptrSort;
+  (void)ptrSort;
 
   Expr res;
 
   if (wordSzInBytes == 1 || (wordSzInBytes == 4 && align == 4)) {
     Expr srcMem = m_ctx.read(memTrsfrReadReg);
-    res = srcMem;
-    for (unsigned i = 0; i < len; i += wordSzInBytes) {
-      Expr dIdx = m_memManager.ptrAdd(dPtr, i);
-      Expr sIdx = m_memManager.ptrAdd(sPtr, i);
-
-      Expr val = op::array::select(srcMem, sIdx);
-      res = op::array::store(res, dIdx, val);
+    ExprVector ptrs, vals;
+    // -- resolved against the source, which is never the partial result
+    setRegion(memTrsfrReadReg);
+    for (unsigned i = 0; i < len; i += wordSzInBytes)
+      vals.push_back(
+          loadAlignedWordFromMem(m_memManager.ptrAdd(sPtr, i), srcMem));
+
+    setRegion(memReadReg);
+    // -- with a region index, the regions may have different index sorts
+    res = m_memManager.hasRegionIndex() ? m_ctx.read(memReadReg) : srcMem;
+    for (unsigned i = 0, j = 0; i < len; i += wordSzInBytes, ++j) {
+      Expr dIdx = index(m_memManager.ptrAdd(dPtr, i));
+      res = op::array::store(res, dIdx, vals[j]);
+      ptrs.push_back(dIdx);
     }
+    addStoreRun(res, srcMem, ptrs, vals);
     m_ctx.write(memWriteReg, res);
   }
   return res;
 }
 
+Expr OpSemMemArrayRepr::MemSet(Expr ptr, Expr _val, Expr len,
+                               Expr memReadReg, Expr memWriteReg,
+                               unsigned wordSzInBytes, Expr ptrSort,
+                               uint32_t align) {
+  if (bv::isBvNum(len))
+    return MemSet(ptr, _val, bv::toMpz(len).get_ui(), memReadReg, memWriteReg,
+                  wordSzInBytes, ptrSort, align);
+  report_fatal_error("memset with symbolic length requires --horn-bv2-lambdas");
+}
+
+Expr OpSemMemArrayRepr::MemCpy(Expr dPtr, Expr sPtr, Expr len,
+                               Expr memTrsfrReadReg, Expr memReadReg,
+                               Expr memWriteReg, unsigned wordSzInBytes,
+                               Expr ptrSort, uint32_t align) {
+  if (bv::isBvNum(len))
+    return MemCpy(dPtr, sPtr, bv::toMpz(len).get_ui(), memTrsfrReadReg,
+                  memReadReg, memWriteReg, wordSzInBytes, ptrSort, align);
+  report_fatal_error("memcpy with symbolic length requires --horn-bv2-lambdas");
+}
+
 Expr OpSemMemArrayRepr::MemFill(Expr dPtr, char *sPtr, unsigned len,
                                 unsigned wordSzInBytes, Expr ptrSort,
                                 uint32_t align) {
-  Expr res = m_ctx.read(m_ctx.getMemReadRegister());
+  Expr mem = m_ctx.read(m_ctx.getMemReadRegister());
+  setRegion(m_ctx.getMemReadRegister());
+  Expr res = mem;
   const unsigned sem_word_sz = wordSzInBytes;
 
   // 8 bytes because assumed largest supported sem_word_sz = 8
   assert(sizeof(unsigned long) >= sem_word_sz);
 
+  ExprVector ptrs, vals;
   for (unsigned i = 0; i < len; i += sem_word_sz) {
-    Expr dIdx = m_memManager.ptrAdd(dPtr, i);
+    Expr dIdx = index(m_memManager.ptrAdd(dPtr, i));
     // copy bytes from buffer to word - word must accommodate largest
     // supported word size
     // 8 bytes because assumed largest supported sem_word_sz = 8
@@ -77,7 +272,10 @@ Expr OpSemMemArrayRepr::MemFill(Expr dPtr, char *sPtr, unsigned len,
     std::memcpy(&word, sPtr + i, sem_word_sz);
     Expr val = bv::bvnum(word, wordSzInBytes * m_BitsPerByte, m_efac);
     res = op::array::store(res, dIdx, val);
+    ptrs.push_back(dIdx);
+    vals.push_back(val);
   }
+  addStoreRun(res, mem, ptrs, vals);
   m_ctx.write(m_ctx.getMemWriteRegister(), res);
   return res;
 }
@@ -98,6 +296,15 @@ Expr OpSemMemLambdaRepr::MemSet(Expr ptr, Expr _val, unsigned len,
                                 Expr memReadReg, Expr memWriteReg,
                                 unsigned wordSzInBytes, Expr ptrSort,
                                 uint32_t align) {
+  Expr lenE = m_ctx.alu().si(len, m_memManager.ptrSzInBits());
+  return MemSet(ptr, _val, lenE, memReadReg, memWriteReg, wordSzInBytes,
+                ptrSort, align);
+}
+
+Expr OpSemMemLambdaRepr::MemSet(Expr ptr, Expr _val, Expr len,
+                                Expr memReadReg, Expr memWriteReg,
+                                unsigned wordSzInBytes, Expr ptrSort,
+                                uint32_t align) {
   Expr res;
 
   unsigned width;
@@ -109,11 +316,10 @@ Expr OpSemMemLambdaRepr::MemSet(Expr ptr, Expr _val, unsigned len,
 
     res = m_ctx.read(memReadReg);
 
-    Expr last = m_memManager.ptrAdd(ptr, len - wordSzInBytes);
     Expr bvVal = bv::bvnum(val, wordSzInBytes * m_BitsPerByte, m_efac);
     Expr b0 = bind::bvar(0, ptrSort);
 
-    Expr cmp = m_memManager.ptrInRangeCheck(ptr, b0, last);
+    Expr cmp = inRangeCheck(ptr, b0, len, wordSzInBytes);
     Expr fappl = op::bind::fapp(res, b0);
     Expr ite = boolop::lite(cmp, bvVal, fappl);
 
@@ -132,36 +338,61 @@ Expr OpSemMemLambdaRepr::MemCpy(Expr dPtr, Expr sPtr, unsigned len,
                                 Expr memTrsfrReadReg, Expr memReadReg,
                                 Expr memWriteReg, unsigned wordSzInBytes,
                                 Expr ptrSort, uint32_t align) {
+  Expr lenE = m_ctx.alu().si(len, m_memManager.ptrSzInBits());
+  return MemCpy(dPtr, sPtr, lenE, memTrsfrReadReg, memReadReg, memWriteReg,
+                wordSzInBytes, ptrSort, align);
+}
+
+Expr OpSemMemLambdaRepr::MemCpy(Expr dPtr, Expr sPtr, Expr len,
+                                Expr memTrsfrReadReg, Expr memReadReg,
+                                Expr memWriteReg, unsigned wordSzInBytes,
+                                Expr ptrSort, uint32_t align) {
   Expr res;
 
-  if (wordSzInBytes == 1 || (wordSzInBytes == 4 && align == 4)) {
+  // -- words of source and destination line up when both are word aligned
+  if (wordSzInBytes == 1 || (align > 0 && align % wordSzInBytes == 0)) {
     Expr srcMem = m_ctx.read(memTrsfrReadReg);
 
-    if (len > 0) {
-      unsigned bytesToCpy = len - wordSzInBytes;
-      Expr dstLast = m_memManager.ptrAdd(dPtr, bytesToCpy);
-
-      Expr b0 = bind::bvar(0, ptrSort);
-      Expr cmp = m_memManager.ptrInRangeCheck(dPtr, b0, dstLast);
-      Expr offset = m_memManager.ptrOffsetFromBase(dPtr, sPtr);
-      Expr readPtrInSrc = m_memManager.ptrAdd(b0, offset);
+    Expr b0 = bind::bvar(0, ptrSort);
+    Expr cmp = inRangeCheck(dPtr, b0, len, wordSzInBytes);
+    Expr offset = m_memManager.ptrOffsetFromBase(dPtr, sPtr);
+    Expr readPtrInSrc = m_memManager.ptrAdd(b0, offset);
 
-      // Both reads are from the same memory but must not overlap.
-      Expr readFromSrc = op::bind::fapp(srcMem, readPtrInSrc);
-      Expr readFromDst = op::bind::fapp(srcMem, b0);
+    // Both reads are from the same memory but must not overlap.
+    Expr readFromSrc = op::bind::fapp(srcMem, readPtrInSrc);
+    Expr readFromDst = op::bind::fapp(srcMem, b0);
 
-      Expr ite = boolop::lite(cmp, readFromSrc, readFromDst);
-      Expr addr = bind::mkConst(mkTerm<std::string>("addr", m_efac), ptrSort);
-      Expr decl = bind::fname(addr);
-      res = mk<LAMBDA>(decl, ite);
-      LOG("opsem.lambda", errs() << "MemCpy " << *res << "\n");
-    }
+    Expr ite = boolop::lite(cmp, readFromSrc, readFromDst);
+    Expr addr = bind::mkConst(mkTerm<std::string>("addr", m_efac), ptrSort);
+    Expr decl = bind::fname(addr);
+    res = mk<LAMBDA>(decl, ite);
+    LOG("opsem.lambda", errs() << "MemCpy " << *res << "\n");
 
     m_ctx.write(memWriteReg, res);
   }
   return res;
 }
 
+Expr OpSemMemLambdaRepr::inRangeCheck(Expr base, Expr ptr, Expr len,
+                                      unsigned wordSzInBytes) {
+  // -- a word is in range if it starts at most at base + len - wordSz, so a
+  // -- partial last word is not written. An unsigned comparison is correct
+  // -- even if base + len wraps around
+  Expr offset = m_memManager.ptrSub(ptr, base);
+  unsigned ptrBits = m_memManager.ptrSzInBits();
+  if (bv::isBvNum(len)) {
+    mpz_class n = bv::toMpz(len);
+    if (n < wordSzInBytes)
+      return mk<FALSE>(m_efac);
+    return m_memManager.ptrUlt(
+        offset, m_ctx.alu().si(n - wordSzInBytes + 1, ptrBits));
+  }
+  Expr last = m_ctx.alu().si(wordSzInBytes - 1, ptrBits);
+  return boolop::land(
+      m_memManager.ptrUlt(last, len),
+      m_memManager.ptrUlt(offset, m_memManager.ptrSub(len, last)));
+}
+
 Expr OpSemMemLambdaRepr::coerceArrayToLambda(Expr arrVal) {
   assert(bind::isArrayConst(arrVal));
 
@@ -30,6 +30,19 @@ Expr BmcTraceWrapper::eval(unsigned loc, Expr e, bool complete) {
   return v;
 }
 
+void BmcTraceWrapper::eval(const std::vector<BmcTrace::EvalQuery> &queries,
+                           ExprVector &out, bool complete) {
+  m_trace.eval(queries, out, complete);
+  LOG("cex-eval", for (unsigned i = 0, sz = queries.size(); i < sz; ++i) {
+    errs() << "Eval loc=" << queries[i].loc << " ";
+    if (queries[i].val)
+      errs() << *queries[i].val;
+    else
+      errs() << queries[i].expr;
+    errs() << " --> " << out[i] << "\n";
+  });
+}
+
 Expr BmcTraceMemSim::eval(unsigned loc, const llvm::Instruction &inst,
                           bool complete) {
   Expr v = m_mem_sim.eval(loc, inst, complete);
@@ -46,6 +59,15 @@ Expr BmcTraceMemSim::eval(unsigned loc, Expr e, bool complete) {
   return v;
 }
 
+void BmcTraceMemSim::eval(const std::vector<BmcTrace::EvalQuery> &queries,
+                          ExprVector &out, bool complete) {
+  // -- MemSimulator has its own model, one query at a time
+  out.clear();
+  for (const BmcTrace::EvalQuery &q : queries)
+    out.push_back(q.val ? eval(q.loc, cast<Instruction>(*q.val), complete)
+                        : eval(q.loc, q.expr, complete));
+}
+
 Constant *exprToLlvm(Type *ty, Expr e, LLVMContext &ctx, const DataLayout &dl) {
   if (isOpX<TRUE>(e)) {
     // JN: getTypeStoreSizeInBits returns 8 for i1.
@@ -128,6 +150,16 @@ std::unique_ptr<Module> createCexHarness(BmcTraceWrapper &trace,
   // and a map from index to value)
   std::map<unsigned, std::pair<Expr, std::map<Expr, Expr>>> DsaContentMap;
 
+  // -- calls of the trace that make up the harness. Their values are
+  // -- evaluated in one batch, starting with query number query
+  struct HarnessCall {
+    const Function *CF;
+    unsigned id;
+    unsigned query;
+  };
+  std::vector<HarnessCall> Calls;
+  std::vector<BmcTrace::EvalQuery> Queries;
+
   // Look for calls in the trace
   for (unsigned loc = 0; loc < trace.size(); loc++) {
     const BasicBlock &BB = *trace.bb(loc);
@@ -150,23 +182,12 @@ std::unique_ptr<Module> createCexHarness(BmcTraceWrapper &trace,
           unsigned id = shadow_dsa::getShadowId(CS);
           ExprFactory &efac = trace.efac();
           Expr sort = bv::bvsort(dl.getPointerSizeInBits(), efac);
-          Expr startE = shadow_dsa::memStartVar(id, sort);
-          Expr endE = shadow_dsa::memEndVar(id, sort);
-          Expr startV = trace.eval(loc, startE, true);
-          Expr endV = trace.eval(loc, endE, true);
-          DsaAllocMap.insert(std::make_pair(id, std::make_pair(startV, endV)));
+          Calls.push_back({CF, id, (unsigned)Queries.size()});
+          Queries.push_back({loc, nullptr, shadow_dsa::memStartVar(id, sort)});
+          Queries.push_back({loc, nullptr, shadow_dsa::memEndVar(id, sort)});
           // 2) Get the contents of the lhs of shadow.mem.init
           //    list of (offset,value) plus default value ?
-          Expr arrayE = trace.eval(loc, *ci, true);
-          auto &p = DsaContentMap[id];
-          bool res = extractArrayContents(arrayE, p.second, p.first);
-          if (!res) {
-            DsaContentMap.erase(id);
-          }
-          // we generate the harness even if we fail extracting the
-          // array contents
-          LOG("cex", errs()
-                         << "Producing harness for " << CF->getName() << "\n";);
+          Queries.push_back({loc, ci, Expr()});
           continue;
         }
 
@@ -199,16 +220,40 @@ std::unique_ptr<Module> createCexHarness(BmcTraceWrapper &trace,
         if (tli.getLibFunc(CF->getName(), libfn))
           continue;
 
-        Expr V = trace.eval(loc, I, true);
-        if (!V)
-          continue;
-        LOG("cex",
-            errs() << "Producing harness for " << CF->getName() << "\n";);
-        FuncValueMap[CF].push_back(V);
+        Calls.push_back({CF, 0, (unsigned)Queries.size()});
+        Queries.push_back({loc, &I, Expr()});
       }
     }
   }
 
+  ExprVector Values;
+  trace.eval(Queries, Values, true);
+  for (const HarnessCall &C : Calls) {
+    if (C.CF->getName().equals("shadow.mem.init")) {
+      Expr startV = Values[C.query];
+      Expr endV = Values[C.query + 1];
+      DsaAllocMap.insert(std::make_pair(C.id, std::make_pair(startV, endV)));
+      Expr arrayE = Values[C.query + 2];
+      auto &p = DsaContentMap[C.id];
+      bool res = extractArrayContents(arrayE, p.second, p.first);
+      if (!res) {
+        DsaContentMap.erase(C.id);
+      }
+      // we generate the harness even if we fail extracting the
+      // array contents
+      LOG("cex", errs() << "Producing harness for " << C.CF->getName()
+                        << "\n";);
+      continue;
+    }
+
+    Expr V = Values[C.query];
+    if (!V)
+      continue;
+    LOG("cex",
+        errs() << "Producing harness for " << C.CF->getName() << "\n";);
+    FuncValueMap[C.CF].push_back(V);
+  }
+
   // Build harness functions
   for (auto CFV : FuncValueMap) {
 
@@ -10,6 +10,7 @@
 #include "llvm/IR/ValueMap.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/ToolOutputFile.h"
 
@@ -26,6 +27,7 @@
 #include "seahorn/HornifyModule.hh"
 
 #include "seahorn/Bmc.hh"
+#include "seahorn/Expr/ExprSmtLib.hh"
 #include "seahorn/PathBasedBmc.hh"
 #include "seahorn/Support/CFG.hh"
 #include "seahorn/Transforms/Utils/Local.hh"
@@ -288,9 +290,13 @@ bool HornCex::runOnFunction(Module &M, Function &F) {
   if (!HornCexSmtFilename.empty()) {
     std::error_code EC;
     raw_fd_ostream file(HornCexSmtFilename, EC, sys::fs::F_Text);
-    if (!EC)
-      bmc->toSmtLib(file);
-    else
+    if (!EC) {
+      try {
+        bmc->toSmtLib(file);
+      } catch (SmtLibError &e) {
+        report_fatal_error(e.what());
+      }
+    } else
       errs() << "Could not open: " << HornCexSmtFilename << "\n";
   }
 
@@ -23,20 +23,121 @@ namespace seahorn
   void HornClauseDB::buildIndexes ()
   {
     resetIndexes ();
-      
+    m_rule_hash.clear ();
+    m_var_count.clear ();
+    m_vars_dirty = true;
+
     /// update indexes
     for (HornRule &r : m_rules)
     {
-      // -- update head index
-      m_head_idx [bind::fname (r.head ())].insert (&r);
-      // -- update body index
-      ExprVector use;
-      r.used_relations (*this, std::back_inserter (use));
-      for (Expr decl : use) m_body_idx[decl].insert (&r);
+      indexRule (r);
+      m_rule_hash.insert (std::make_pair (r.hash (), r.m_id));
+      for (Expr v : r.vars ()) ++m_var_count[v];
+    }
+  }
+
+  void HornClauseDB::indexRule (HornRule &r)
+  {
+    // -- update head index
+    m_head_idx [bind::fname (r.head ())].insert (&r);
+    // -- update body index
+    ExprVector use;
+    r.used_relations (*this, std::back_inserter (use));
+    for (Expr decl : use) m_body_idx[decl].insert (&r);
+  }
+
+  void HornClauseDB::unindexRule (HornRule &r)
+  {
+    auto unindex = [&r] (index_type &idx, Expr decl)
+    {
+      auto it = idx.find (decl);
+      if (it == idx.end ()) return;
+      it->second.erase (&r);
+      if (it->second.empty ()) idx.erase (it);
+    };
+
+    unindex (m_head_idx, bind::fname (r.head ()));
+    ExprVector use;
+    r.used_relations (*this, std::back_inserter (use));
+    for (Expr decl : use) unindex (m_body_idx, decl);
+  }
+
+  void HornClauseDB::addRule (const HornRule &rule)
+  {
+    m_rules.push_back (rule);
+    auto it = std::prev (m_rules.end ());
+    HornRule &r = *it;
+    r.m_id = ++m_last_id;
+    m_rule_pos.insert (std::make_pair (r.m_id, it));
+    m_rule_hash.insert (std::make_pair (r.hash (), r.m_id));
+
+    for (Expr v : r.vars ())
+      if (m_var_count[v]++ == 0) m_vars_dirty = true;
+
+    indexRule (r);
+  }
+
+  void HornClauseDB::eraseRule (RuleVector::iterator it)
+  {
+    HornRule &r = *it;
+    unindexRule (r);
+
+    for (Expr v : r.vars ())
+    {
+      auto vit = m_var_count.find (v);
+      assert (vit != m_var_count.end () &&
+              "rule changed in place without buildIndexes ()");
+      if (vit == m_var_count.end ()) continue;
+      if (--vit->second == 0)
+      {
+        m_var_count.erase (vit);
+        m_vars_dirty = true;
+      }
+    }
+
+    auto range = m_rule_hash.equal_range (r.hash ());
+    auto hit = range.first;
+    while (hit != range.second && hit->second != r.m_id) ++hit;
+    assert (hit != range.second &&
+            "rule changed in place without buildIndexes ()");
+    if (hit != range.second) m_rule_hash.erase (hit);
+    m_rule_pos.erase (r.m_id);
+    m_rules.erase (it);
+  }
+
+  void HornClauseDB::removeRule (const HornRule &r)
+  {
+    // -- by id, if r comes from this database
+    auto it = m_rule_pos.find (r.id ());
+    if (it != m_rule_pos.end () && *it->second == r)
+    {
+      eraseRule (it->second);
+      return;
+    }
 
+    // -- otherwise, by value
+    auto range = m_rule_hash.equal_range (r.hash ());
+    for (auto hit = range.first; hit != range.second; ++hit)
+    {
+      auto pit = m_rule_pos.find (hit->second);
+      assert (pit != m_rule_pos.end ());
+      if (pit != m_rule_pos.end () && *pit->second == r)
+      {
+        eraseRule (pit->second);
+        return;
+      }
     }
   }
 
+  void HornClauseDB::removeRelation (Expr fdecl)
+  {
+    assert (def (fdecl).empty () && use (fdecl).empty ());
+    assert (!hasConstraints (fdecl) && !hasInvariants (fdecl));
+    m_rels.erase (fdecl);
+    m_head_idx.erase (fdecl);
+    m_body_idx.erase (fdecl);
+  }
+
   void HornClauseDBCallGraph::buildCallGraph ()
   {
     // indexes must be first computed
@@ -99,10 +200,13 @@ namespace seahorn
 
   const ExprVector &HornClauseDB::getVars () const
   {
-    boost::sort (m_vars);
-    m_vars.resize (std::distance (m_vars.begin (),
-                                  std::unique (m_vars.begin (),
-                                               m_vars.end ())));
+    if (m_vars_dirty)
+    {
+      m_vars.clear ();
+      m_vars.reserve (m_var_count.size ());
+      for (auto &kv : m_var_count) m_vars.push_back (kv.first);
+      m_vars_dirty = false;
+    }
     return m_vars;
   }
 
@@ -1,5 +1,10 @@
 #include "seahorn/HornClauseDBTransf.hh"
+#include "seahorn/Support/SeaDebug.h"
+#include "seahorn/Support/Stats.hh"
 #include "ufo/Expr.hpp"
+#include "ufo/Smt/EZ3.hh"
+
+#include <set>
 
 namespace seahorn {
 using namespace expr;
@@ -58,4 +63,570 @@ void normalizeHornClauseHeads(HornClauseDB &db) {
     db.addRule(new_rule);
   }
 }
+
+namespace {
+/// copies relations, constraints and invariants of src to dst
+void copyRelations(const HornClauseDB &src, HornClauseDB &dst) {
+  for (Expr rel : src.getRelations())
+    dst.registerRelation(rel);
+
+  for (Expr rel : src.getRelations()) {
+    if (!src.hasConstraints(rel) && !src.hasInvariants(rel))
+      continue;
+    ExprVector args;
+    for (unsigned i = 0, sz = bind::domainSz(rel); i < sz; ++i)
+      args.push_back(bind::mkConst(
+          variant::variant(i, mkTerm<std::string>("arg", rel->efac())),
+          bind::domainTy(rel, i)));
+    Expr pred = bind::fapp(rel, args);
+    if (src.hasConstraints(rel))
+      dst.addConstraint(pred, src.getConstraints(pred));
+    if (src.hasInvariants(rel))
+      dst.addInvariant(pred, src.getInvariants(pred));
+  }
+}
+} // namespace
+
+void copyHornClauseDB(const HornClauseDB &src, HornClauseDB &dst) {
+  copyRelations(src, dst);
+  for (const HornRule &rule : src.getRules())
+    dst.addRule(rule);
+  for (Expr q : src.getQueries())
+    dst.addQuery(q);
+}
+
+namespace {
+struct IsAppOf : public std::unary_function<Expr, bool> {
+  Expr m_rel;
+  IsAppOf(Expr rel) : m_rel(rel) {}
+  bool operator()(Expr e) { return bind::isFapp(e) && bind::fname(e) == m_rel; }
+};
+
+struct HasDef : public std::unary_function<Expr, bool> {
+  HornDbModel &m_model;
+  HasDef(HornDbModel &model) : m_model(model) {}
+  bool operator()(Expr e) { return bind::isFapp(e) && m_model.hasDef(e); }
+};
+
+/// relations that must be kept as they are: relations of the queries and
+/// relations with constraints or invariants
+HornClauseDB::expr_set_type fixedRelations(HornClauseDB &db) {
+  HornClauseDB::expr_set_type res;
+  for (Expr q : db.getQueries()) {
+    ExprVector apps;
+    get_all_pred_apps(q, db, std::back_inserter(apps));
+    for (Expr app : apps)
+      res.insert(bind::fname(app));
+  }
+  for (Expr rel : db.getRelations())
+    if (db.hasConstraints(rel) || db.hasInvariants(rel))
+      res.insert(rel);
+  return res;
+}
+
+bool isVarOf(const HornRule &r, Expr e) {
+  return std::find(r.vars().begin(), r.vars().end(), e) != r.vars().end();
+}
+
+bool isRecursive(const HornRule &r, Expr rel) {
+  ExprVector apps;
+  filter(r.body(), IsAppOf(rel), std::back_inserter(apps));
+  return !apps.empty();
+}
+
+/// application of rel to bound variables, as used by HornDbModel
+Expr mkBVarApp(Expr rel) {
+  ExprVector args;
+  for (unsigned i = 0, sz = bind::domainSz(rel); i < sz; ++i)
+    args.push_back(bind::bvar(i, bind::domainTy(rel, i)));
+  return bind::fapp(rel, args);
+}
+
+/// copies the definition of every relation in rels from in to out
+void copyDefs(const ExprVector &rels, HornDbModel &in, HornDbModel &out) {
+  for (Expr rel : rels) {
+    Expr app = mkBVarApp(rel);
+    out.addDef(app, in.getDef(app));
+  }
+}
+
+/// Replaces every application of rel in the body of u by the body of d, a
+/// rule that defines rel. Variables of d that are not bound by the head of
+/// d are renamed apart using tag and fresh
+HornRule inlineRule(const HornRule &u, Expr rel, const HornRule &d,
+                    const std::string &tag, unsigned &fresh) {
+  ExprFactory &efac = rel->efac();
+  ExprVector apps;
+  filter(u.body(), IsAppOf(rel), std::back_inserter(apps));
+
+  ExprVector vars(u.vars());
+  ExprMap inst;
+  Expr h = d.head();
+  for (Expr app : apps) {
+    // -- variables in the head of d are bound to the actual arguments
+    ExprMap sub;
+    for (unsigned i = 0, sz = bind::domainSz(rel); i < sz; ++i) {
+      Expr x = h->arg(i + 1);
+      if (sub.count(x) == 0 && isVarOf(d, x))
+        sub[x] = app->arg(i + 1);
+    }
+    for (Expr v : d.vars()) {
+      if (sub.count(v) > 0)
+        continue;
+      Expr name = variant::tag(bind::fname(bind::fname(v)),
+                               tag + std::to_string(fresh++));
+      Expr nv = bind::mkConst(name, bind::typeOf(v));
+      sub[v] = nv;
+      vars.push_back(nv);
+    }
+
+    // -- remaining head arguments become equalities
+    ExprVector conj;
+    for (unsigned i = 0, sz = bind::domainSz(rel); i < sz; ++i) {
+      Expr x = replace(h->arg(i + 1), sub);
+      if (x != app->arg(i + 1))
+        conj.push_back(mk<EQ>(x, app->arg(i + 1)));
+    }
+    conj.push_back(replace(d.body(), sub));
+    inst[app] = mknary<AND>(mk<TRUE>(efac), conj.begin(), conj.end());
+  }
+
+  return HornRule(vars, u.head(), replace(u.body(), inst));
+}
+
+/// Model converter for slicing. Sliced relations are true
+class SliceModelConverter : public HornModelConverter {
+  ExprVector m_kept;
+  ExprVector m_sliced;
+
+public:
+  SliceModelConverter(const ExprVector &kept, const ExprVector &sliced)
+      : m_kept(kept), m_sliced(sliced) {}
+
+  bool convert(HornDbModel &in, HornDbModel &out) {
+    copyDefs(m_kept, in, out);
+    for (Expr rel : m_sliced)
+      out.addDef(mkBVarApp(rel), mk<TRUE>(rel->efac()));
+    return true;
+  }
+};
+
+/// Model converter for inlining and merging. An eliminated relation is
+/// the strongest post-condition of its defining rules, i.e., the
+/// disjunction of their bodies, with the local variables projected away
+class InlineModelConverter : public HornModelConverter {
+  EZ3 &m_zctx;
+  /// relations before the transformation
+  ExprVector m_rels;
+  /// eliminated relations with their defining rules, in elimination order
+  std::vector<std::pair<Expr, std::vector<HornRule>>> m_elim;
+
+  void post(Expr rel, const std::vector<HornRule> &rules, HornDbModel &out) {
+    ExprFactory &efac = rel->efac();
+    ExprVector args;
+    for (unsigned i = 0, sz = bind::domainSz(rel); i < sz; ++i)
+      args.push_back(bind::mkConst(
+          variant::variant(i, mkTerm<std::string>("arg", efac)),
+          bind::domainTy(rel, i)));
+
+    ExprVector disj;
+    for (const HornRule &r : rules) {
+      // -- relations in the body are replaced by their definitions
+      ExprVector apps;
+      filter(r.body(), HasDef(out), std::back_inserter(apps));
+      ExprMap defs;
+      for (Expr app : apps)
+        defs[app] = out.getDef(app);
+
+      ExprVector conj;
+      for (unsigned i = 0, sz = args.size(); i < sz; ++i)
+        conj.push_back(mk<EQ>(args[i], r.head()->arg(i + 1)));
+      conj.push_back(replace(r.body(), defs));
+      Expr fml = mknary<AND>(mk<TRUE>(efac), conj.begin(), conj.end());
+
+      // -- exists vars . fml  <=>  !(forall vars . !fml)
+      ExprSet vars(r.vars().begin(), r.vars().end());
+      if (!vars.empty())
+        fml = boolop::lneg(z3_forall_elim(m_zctx, boolop::lneg(fml), vars));
+      disj.push_back(fml);
+    }
+    out.addDef(bind::fapp(rel, args),
+               mknary<OR>(mk<FALSE>(efac), disj.begin(), disj.end()));
+  }
+
+public:
+  InlineModelConverter(EZ3 &zctx, const HornClauseDB &db)
+      : m_zctx(zctx),
+        m_rels(db.getRelations().begin(), db.getRelations().end()) {}
+
+  void eliminate(Expr rel, const std::vector<HornRule> &rules) {
+    m_elim.push_back(std::make_pair(rel, rules));
+  }
+  size_t size() const { return m_elim.size(); }
+
+  bool convert(HornDbModel &in, HornDbModel &out) {
+    std::set<Expr> elim;
+    for (auto &kv : m_elim)
+      elim.insert(kv.first);
+    for (Expr rel : m_rels)
+      if (elim.count(rel) == 0) {
+        Expr app = mkBVarApp(rel);
+        out.addDef(app, in.getDef(app));
+      }
+
+    // -- rules of a relation only use relations that are eliminated later
+    try {
+      for (auto it = m_elim.rbegin(), end = m_elim.rend(); it != end; ++it)
+        post(it->first, it->second, out);
+    } catch (z3::exception &e) {
+      LOG("horn-preprocess", errs() << "Z3 EXCEPTION: " << e.msg() << "\n";);
+      return false;
+    }
+    return true;
+  }
+};
+
+/// Model converter for arity reduction
+class ArityModelConverter : public HornModelConverter {
+  /// relations before the transformation
+  ExprVector m_rels;
+  /// maps a reduced relation to its original relation and the positions of
+  /// the arguments of the original relation it keeps
+  std::map<Expr, std::pair<Expr, std::vector<unsigned>>> m_orig;
+
+public:
+  ArityModelConverter(const HornClauseDB &db)
+      : m_rels(db.getRelations().begin(), db.getRelations().end()) {}
+
+  void reduce(Expr rel, Expr newRel, const std::vector<unsigned> &kept) {
+    auto it = m_orig.find(rel);
+    if (it == m_orig.end()) {
+      m_orig[newRel] = std::make_pair(rel, kept);
+      return;
+    }
+    // -- rel was already reduced, compose with the previous reduction
+    std::vector<unsigned> pos;
+    for (unsigned k : kept)
+      pos.push_back(it->second.second[k]);
+    m_orig[newRel] = std::make_pair(it->second.first, pos);
+    m_orig.erase(it);
+  }
+  bool empty() const { return m_orig.empty(); }
+
+  bool convert(HornDbModel &in, HornDbModel &out) {
+    std::set<Expr> reduced;
+    for (auto &kv : m_orig) {
+      Expr rel = kv.second.first;
+      reduced.insert(rel);
+      ExprVector args;
+      for (unsigned i : kv.second.second)
+        args.push_back(bind::bvar(i, bind::domainTy(rel, i)));
+      out.addDef(mkBVarApp(rel), in.getDef(bind::fapp(kv.first, args)));
+    }
+    for (Expr rel : m_rels)
+      if (reduced.count(rel) == 0) {
+        Expr app = mkBVarApp(rel);
+        out.addDef(app, in.getDef(app));
+      }
+    return true;
+  }
+};
+} // namespace
+
+namespace {
+/// removes the rules of relations from which no query and no fixed
+/// relation is reachable. Returns the number of removed rules
+unsigned slice(HornClauseDB &db, ExprVector &kept, ExprVector &sliced) {
+  // -- relations from which a query or a fixed relation is reachable.
+  // -- The relations of the queries are fixed
+  HornClauseDB::expr_set_type reach;
+  ExprVector wl;
+  for (Expr rel : fixedRelations(db))
+    if (reach.insert(rel).second)
+      wl.push_back(rel);
+  while (!wl.empty()) {
+    Expr rel = wl.back();
+    wl.pop_back();
+    for (const HornRule *r : db.def(rel)) {
+      ExprVector apps;
+      get_all_pred_apps(r->body(), db, std::back_inserter(apps));
+      for (Expr app : apps)
+        if (reach.insert(bind::fname(app)).second)
+          wl.push_back(bind::fname(app));
+    }
+  }
+
+  unsigned rules = 0;
+  ExprVector rels(db.getRelations().begin(), db.getRelations().end());
+  for (Expr rel : rels) {
+    if (reach.count(rel) > 0) {
+      kept.push_back(rel);
+      continue;
+    }
+    std::vector<HornRule> defs;
+    for (const HornRule *r : db.def(rel))
+      defs.push_back(*r);
+    for (const HornRule &r : defs)
+      db.removeRule(r);
+    rules += defs.size();
+    sliced.push_back(rel);
+  }
+  // -- once all rules are removed, unreachable relations are unused
+  for (Expr rel : sliced)
+    db.removeRelation(rel);
+  return rules;
+}
+} // namespace
+
+std::unique_ptr<HornModelConverter> sliceHornClauses(HornClauseDB &db) {
+  if (!db.hasQuery())
+    return nullptr;
+
+  ExprVector kept, sliced;
+  unsigned rules = slice(db, kept, sliced);
+  Stats::uset("HornPreprocess.slice.rels", sliced.size());
+  Stats::uset("HornPreprocess.slice.rules", rules);
+  if (sliced.empty())
+    return nullptr;
+  return std::unique_ptr<HornModelConverter>(
+      new SliceModelConverter(kept, sliced));
+}
+
+std::unique_ptr<HornModelConverter> inlineSingleDefRelations(HornClauseDB &db,
+                                                             EZ3 &zctx) {
+  HornClauseDB::expr_set_type fixed = fixedRelations(db);
+  std::unique_ptr<InlineModelConverter> conv(
+      new InlineModelConverter(zctx, db));
+  unsigned fresh = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    ExprVector rels(db.getRelations().begin(), db.getRelations().end());
+    for (Expr rel : rels) {
+      if (fixed.count(rel) > 0 || db.def(rel).size() != 1)
+        continue;
+      HornRule d(**db.def(rel).begin());
+      if (isRecursive(d, rel))
+        continue;
+
+      std::vector<HornRule> uses;
+      for (const HornRule *r : db.use(rel))
+        uses.push_back(*r);
+
+      // -- a definition with relations in the body is only inlined into a
+      // -- single application, so that rules do not become non-linear
+      ExprVector bodyApps;
+      get_all_pred_apps(d.body(), db, std::back_inserter(bodyApps));
+      if (!bodyApps.empty()) {
+        if (uses.size() != 1)
+          continue;
+        ExprVector apps;
+        filter(uses[0].body(), IsAppOf(rel), std::back_inserter(apps));
+        if (apps.size() != 1)
+          continue;
+      }
+
+      db.removeRule(d);
+      for (const HornRule &u : uses) {
+        db.removeRule(u);
+        db.addRule(inlineRule(u, rel, d, "inl", fresh));
+      }
+      db.removeRelation(rel);
+      conv->eliminate(rel, std::vector<HornRule>(1, d));
+      changed = true;
+    }
+  }
+
+  Stats::uset("HornPreprocess.inline.rels", conv->size());
+  if (conv->size() == 0)
+    return nullptr;
+  return std::move(conv);
+}
+
+std::unique_ptr<HornModelConverter> mergeLinearChains(HornClauseDB &db,
+                                                      EZ3 &zctx) {
+  HornClauseDB::expr_set_type fixed = fixedRelations(db);
+  std::unique_ptr<InlineModelConverter> conv(
+      new InlineModelConverter(zctx, db));
+  unsigned fresh = 0;
+  unsigned rules = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    ExprVector rels(db.getRelations().begin(), db.getRelations().end());
+    for (Expr rel : rels) {
+      if (fixed.count(rel) > 0 || db.use(rel).size() != 1 ||
+          db.def(rel).empty())
+        continue;
+      HornRule u(**db.use(rel).begin());
+      if (!bind::isFapp(u.head()) || bind::fname(u.head()) == rel)
+        continue;
+      // -- u must be linear, i.e., rel is the only relation in its body
+      ExprVector apps;
+      get_all_pred_apps(u.body(), db, std::back_inserter(apps));
+      if (apps.size() != 1)
+        continue;
+
+      std::vector<HornRule> defs;
+      for (const HornRule *r : db.def(rel))
+        defs.push_back(*r);
+      if (std::any_of(defs.begin(), defs.end(),
+                      [rel](const HornRule &d) { return isRecursive(d, rel); }))
+        continue;
+
+      db.removeRule(u);
+      for (const HornRule &d : defs) {
+        db.removeRule(d);
+        db.addRule(inlineRule(u, rel, d, "mrg", fresh));
+      }
+      db.removeRelation(rel);
+      conv->eliminate(rel, defs);
+      rules += defs.size();
+      changed = true;
+    }
+  }
+
+  Stats::uset("HornPreprocess.merge.rels", conv->size());
+  Stats::uset("HornPreprocess.merge.rules", rules);
+  if (conv->size() == 0)
+    return nullptr;
+  return std::move(conv);
+}
+
+std::unique_ptr<HornModelConverter> reduceRelationArity(HornClauseDB &db) {
+  HornClauseDB::expr_set_type fixed = fixedRelations(db);
+  std::unique_ptr<ArityModelConverter> conv(new ArityModelConverter(db));
+  unsigned dropped = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    ExprVector rels(db.getRelations().begin(), db.getRelations().end());
+    for (Expr rel : rels) {
+      unsigned sz = bind::domainSz(rel);
+      if (fixed.count(rel) > 0 || sz == 0 || db.use(rel).empty())
+        continue;
+
+      // -- an argument is dropped if, in every application of rel in a
+      // -- body, it is a variable that occurs nowhere else in the rule
+      std::vector<bool> drop(sz, true);
+      for (const HornRule *r : db.use(rel)) {
+        ExprVector apps;
+        filter(r->body(), IsAppOf(rel), std::back_inserter(apps));
+        for (Expr app : apps) {
+          ExprMap sub;
+          sub[app] = mk<TRUE>(rel->efac());
+          Expr rest = replace(r->body(), sub);
+          for (unsigned i = 0; i < sz; ++i) {
+            if (!drop[i])
+              continue;
+            Expr a = app->arg(i + 1);
+            bool local = isVarOf(*r, a) && !contains(r->head(), a) &&
+                         !contains(rest, a);
+            for (unsigned j = 0; local && j < sz; ++j)
+              if (j != i && contains(app->arg(j + 1), a))
+                local = false;
+            drop[i] = local;
+          }
+        }
+      }
+      if (std::none_of(drop.begin(), drop.end(), [](bool b) { return b; }))
+        continue;
+
+      ExprVector sorts;
+      std::vector<unsigned> kept;
+      for (unsigned i = 0; i < sz; ++i)
+        if (!drop[i]) {
+          sorts.push_back(bind::domainTy(rel, i));
+          kept.push_back(i);
+        }
+      sorts.push_back(bind::rangeTy(rel));
+      Expr newRel = bind::fdecl(variant::tag(bind::fname(rel), "ar"), sorts);
+      db.registerRelation(newRel);
+
+      // -- rewrite every rule in which rel appears
+      std::map<unsigned, HornRule> rules;
+      for (const HornRule *r : db.def(rel))
+        rules.insert(std::make_pair(r->id(), *r));
+      for (const HornRule *r : db.use(rel))
+        rules.insert(std::make_pair(r->id(), *r));
+      for (auto &kv : rules) {
+        const HornRule &r = kv.second;
+        ExprVector apps;
+        filter(r.head(), IsAppOf(rel), std::back_inserter(apps));
+        filter(r.body(), IsAppOf(rel), std::back_inserter(apps));
+        ExprMap sub;
+        for (Expr app : apps) {
+          ExprVector args;
+          for (unsigned i : kept)
+            args.push_back(app->arg(i + 1));
+          sub[app] = bind::fapp(newRel, args);
+        }
+        db.removeRule(r);
+        db.addRule(
+            HornRule(r.vars(), replace(r.head(), sub), replace(r.body(), sub)));
+      }
+      db.removeRelation(rel);
+      conv->reduce(rel, newRel, kept);
+      dropped += sz - kept.size();
+      changed = true;
+    }
+  }
+
+  Stats::uset("HornPreprocess.arity.args", dropped);
+  if (conv->empty())
+    return nullptr;
+  return std::move(conv);
+}
+
+void splitHornClauseDB(HornClauseDB &db,
+                       std::vector<std::unique_ptr<HornClauseDB>> &parts) {
+  // -- a query and a rule that defines the relation of the query
+  std::vector<std::pair<Expr, const HornRule *>> splits;
+  for (Expr q : db.getQueries()) {
+    if (!bind::isFapp(q) || !db.hasRelation(bind::fname(q)))
+      return;
+    // -- a model of a part only accounts for some rules of the relation
+    // -- of the query, and so cannot be used for rules that use it
+    if (!db.use(bind::fname(q)).empty())
+      return;
+    for (const HornRule *r : db.def(bind::fname(q)))
+      splits.push_back(std::make_pair(q, r));
+  }
+  if (splits.size() < 2)
+    return;
+
+  for (auto &s : splits) {
+    Expr rel = bind::fname(s.first);
+    std::unique_ptr<HornClauseDB> part(new HornClauseDB(db.getExprFactory()));
+    copyRelations(db, *part);
+    for (const HornRule &r : db.getRules())
+      if (&r == s.second || !bind::isFapp(r.head()) ||
+          bind::fname(r.head()) != rel)
+        part->addRule(r);
+    part->addQuery(s.first);
+
+    ExprVector kept, sliced;
+    slice(*part, kept, sliced);
+    parts.push_back(std::move(part));
+  }
+}
+
+void preprocessHornClauses(HornClauseDB &db, EZ3 &zctx,
+                           HornModelConverterSeq &conv) {
+  ScopedStats _st_("HornPreprocess");
+  Stats::uset("HornPreprocess.rules.before", db.ruleSize());
+  Stats::uset("HornPreprocess.rels.before", db.relSize());
+
+  conv.add(sliceHornClauses(db));
+  conv.add(inlineSingleDefRelations(db, zctx));
+  conv.add(mergeLinearChains(db, zctx));
+  conv.add(reduceRelationArity(db));
+
+  Stats::uset("HornPreprocess.rules.after", db.ruleSize());
+  Stats::uset("HornPreprocess.rels.after", db.relSize());
+  LOG("horn-preprocess", errs() << "Preprocessed clauses:\n" << db << "\n";);
+}
 } // namespace seahorn
@@ -0,0 +1,240 @@
+#include "seahorn/HornInvCache.hh"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "ufo/Smt/EZ3.hh"
+
+#include "seahorn/Support/SeaDebug.h"
+#include "seahorn/Support/Stats.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+
+static llvm::cl::opt<std::string> InvCacheDir(
+    "horn-inv-cache",
+    llvm::cl::desc("Directory of the invariant cache. Invariants found by "
+                   "HornSolver and Houdini are stored there, and reused by "
+                   "HornSolver in the next run"),
+    llvm::cl::init(""));
+
+namespace seahorn {
+namespace {
+std::string md5(StringRef s) {
+  MD5 h;
+  h.update(s);
+  MD5::MD5Result res;
+  h.final(res);
+  SmallString<32> str;
+  MD5::stringifyResult(res, str);
+  return str.str().str();
+}
+
+const char *PredTag = "; pred ";
+
+/// name of the predicate \p rel, as it is written in the cache
+std::string predName(Expr rel) {
+  std::ostringstream os;
+  os << *bind::fname(rel);
+  return os.str();
+}
+} // namespace
+
+std::string HornInvCache::defaultDir() { return InvCacheDir; }
+
+HornInvCache::HornInvCache(HornifyModule &hm, const std::string &dir)
+    : m_hm(hm), m_dir(dir) {}
+
+void HornInvCache::computeKeys(Module &M) {
+  if (!m_keys.empty())
+    return;
+
+  HornClauseDB &db = m_hm.getHornClauseDB();
+  // -- fingerprint of a single rule. Expressions are printed, so that the
+  // -- fingerprint does not depend on addresses
+  std::unordered_map<const HornRule *, std::string> ruleKeys;
+  auto ruleKey = [&](const HornRule *r) -> const std::string & {
+    auto it = ruleKeys.find(r);
+    if (it != ruleKeys.end())
+      return it->second;
+    std::ostringstream os;
+    for (Expr v : r->vars())
+      os << *v << " ";
+    os << "\n" << *r->get();
+    return ruleKeys[r] = md5(os.str());
+  };
+
+  for (const Function &F : M) {
+    ExprVector wl;
+    for (const BasicBlock &BB : F)
+      if (m_hm.hasBbPredicate(BB))
+        wl.push_back(m_hm.bbPredicate(BB));
+    if (wl.empty())
+      continue;
+
+    // -- all rules that the predicates of F depend on
+    std::set<Expr> seen(wl.begin(), wl.end());
+    std::set<std::string> keys;
+    while (!wl.empty()) {
+      Expr rel = wl.back();
+      wl.pop_back();
+      for (const HornRule *r : db.def(rel)) {
+        keys.insert(ruleKey(r));
+        ExprVector apps;
+        get_all_pred_apps(r->body(), db, std::back_inserter(apps));
+        for (Expr app : apps)
+          if (seen.insert(bind::fname(app)).second)
+            wl.push_back(bind::fname(app));
+      }
+    }
+
+    std::string all;
+    for (const std::string &k : keys)
+      all += k;
+    m_keys[&F] = md5(all);
+  }
+}
+
+std::string HornInvCache::path(const Function &F) const {
+  SmallString<256> p(m_dir);
+  sys::path::append(p, m_keys.at(&F) + ".smt2");
+  return p.str().str();
+}
+
+Expr HornInvCache::mkArgApp(Expr rel) const {
+  ExprVector args;
+  for (unsigned i = 0, sz = bind::domainSz(rel); i < sz; ++i) {
+    Expr name = mkTerm<std::string>("arg_" + std::to_string(i), rel->efac());
+    args.push_back(bind::mkConst(name, bind::domainTy(rel, i)));
+  }
+  return bind::fapp(rel, args);
+}
+
+unsigned HornInvCache::load(Module &M, HornClauseDB &db) {
+  ScopedStats _st_("HornInvCache.load");
+  computeKeys(M);
+
+  EZ3 &zctx = m_hm.getZContext();
+  unsigned loaded = 0;
+  for (const Function &F : M) {
+    if (m_keys.count(&F) == 0)
+      continue;
+    auto buf = MemoryBuffer::getFile(path(F));
+    if (!buf) {
+      Stats::count("HornInvCache.miss");
+      continue;
+    }
+    Stats::count("HornInvCache.hit");
+
+    // -- predicates of F that db still has
+    std::map<std::string, Expr> preds;
+    for (const BasicBlock &BB : F)
+      if (m_hm.hasBbPredicate(BB)) {
+        Expr rel = m_hm.bbPredicate(BB);
+        if (db.hasRelation(rel))
+          preds[predName(rel)] = rel;
+      }
+
+    // -- split the file into one SMT-LIB script per predicate. A section
+    // -- of any other predicate is skipped
+    std::map<Expr, std::string> scripts;
+    std::istringstream in((*buf)->getBuffer().str());
+    std::string line;
+    Expr rel;
+    while (std::getline(in, line)) {
+      if (line.compare(0, strlen(PredTag), PredTag) == 0) {
+        auto it = preds.find(line.substr(strlen(PredTag)));
+        rel = it == preds.end() ? Expr() : it->second;
+      }
+      else if (rel)
+        scripts[rel] += line + "\n";
+    }
+
+    for (auto &kv : scripts) {
+      Expr pred = mkArgApp(kv.first);
+      Expr lemma;
+      try {
+        lemma = z3_from_smtlib(zctx, kv.second);
+      } catch (z3::exception &e) {
+        LOG("inv-cache", errs() << "cannot parse invariant of "
+                                << F.getName() << ": " << e.msg() << "\n";);
+        continue;
+      }
+
+      // -- the lemma may only use the arguments of the predicate
+      ExprVector consts;
+      filter(lemma, bind::IsConst(), std::back_inserter(consts));
+      ExprSet args(++pred->args_begin(), pred->args_end());
+      if (std::any_of(consts.begin(), consts.end(),
+                      [&args](Expr c) { return args.count(c) == 0; }))
+        continue;
+
+      db.addInvariant(pred, lemma);
+      ++loaded;
+    }
+  }
+  Stats::uset("HornInvCache.preds", loaded);
+  return loaded;
+}
+
+void HornInvCache::store(Module &M, HornDbModel &model) {
+  ScopedStats _st_("HornInvCache.store");
+  computeKeys(M);
+
+  if (std::error_code EC = sys::fs::create_directories(m_dir)) {
+    errs() << "Warning: cannot create invariant cache " << m_dir << ": "
+           << EC.message() << "\n";
+    return;
+  }
+
+  EZ3 &zctx = m_hm.getZContext();
+  for (const Function &F : M) {
+    if (m_keys.count(&F) == 0)
+      continue;
+
+    std::string str;
+    raw_string_ostream out(str);
+    for (const BasicBlock &BB : F) {
+      if (!m_hm.hasBbPredicate(BB))
+        continue;
+      Expr rel = m_hm.bbPredicate(BB);
+      Expr lemma = model.getDef(mkArgApp(rel));
+      if (!isOpX<TRUE>(lemma))
+        out << PredTag << predName(rel) << "\n"
+            << zctx.toSmtLibDecls(lemma) << "(assert "
+            << zctx.toSmtLib(lemma) << ")\n";
+    }
+    out.flush();
+    if (str.empty())
+      continue;
+
+    // -- write to a temporary file first, so that runs that share the
+    // -- cache never read a partial file
+    std::string p = path(F);
+    std::string tmp =
+        p + ".tmp" + std::to_string(sys::Process::getProcessId());
+    std::error_code EC;
+    {
+      raw_fd_ostream file(tmp, EC, sys::fs::OF_Text);
+      if (EC) {
+        errs() << "Warning: cannot write " << tmp << ": " << EC.message()
+               << "\n";
+        continue;
+      }
+      file << "; invariants of " << F.getName() << "\n" << str;
+    }
+    if ((EC = sys::fs::rename(tmp, p)))
+      errs() << "Warning: cannot write " << p << ": " << EC.message() << "\n";
+    Stats::count("HornInvCache.store");
+  }
+}
+} // namespace seahorn
@@ -10,5 +10,23 @@
 
 namespace seahorn
 {
+  bool HornModelConverterSeq::convert (HornDbModel &in, HornDbModel &out)
+  {
+    if (m_convs.empty ())
+    {
+      out = in;
+      return true;
+    }
 
+    // -- the model of the last transformation is converted first
+    HornDbModel cur = in;
+    for (auto it = m_convs.rbegin (), end = m_convs.rend (); it != end; ++it)
+    {
+      HornDbModel next;
+      if (!(*it)->convert (cur, next)) return false;
+      cur = next;
+    }
+    out = cur;
+    return true;
+  }
 }
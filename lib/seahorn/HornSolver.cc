@@ -1,6 +1,8 @@
 #include "seahorn/HornSolver.hh"
 #include "seahorn/HornClauseDBTransf.hh"
 #include "seahorn/HornDbModel.hh"
+#include "seahorn/HornInvCache.hh"
+#include "seahorn/HornModelConverter.hh"
 #include "seahorn/HornifyModule.hh"
 
 #include "seahorn/Support/Stats.hh"
@@ -9,7 +11,13 @@
 
 #include "boost/range/algorithm/reverse.hpp"
 
+#include <chrono>
 #include <climits>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #include "seahorn/Support/SeaDebug.h"
 
 using namespace llvm;
@@ -63,6 +71,28 @@ static llvm::cl::opt<unsigned>
     // 3: use additive IUC plugin
     IUCArith("horn-iuc-arith", cl::Hidden, cl::init(1));
 
+namespace seahorn {
+  // Defined here, read by HornifyModule to create a concurrent
+  // expression factory when queries are solved on several threads.
+  unsigned XHornSolverJobs;
+}
+
+static llvm::cl::opt<unsigned, true> SolverJobs(
+    "horn-solver-jobs",
+    llvm::cl::desc("Number of threads that solve the Horn clauses. More "
+                   "than one solves a sliced problem per query and error "
+                   "rule in parallel"),
+    llvm::cl::location(seahorn::XHornSolverJobs), llvm::cl::init(1u));
+
+static llvm::cl::opt<bool> Preprocess(
+    "horn-preprocess",
+    cl::desc("Slice, inline and reduce Horn clauses before solving. "
+             "Disabled when a counterexample is requested by "
+             "--horn-cex-pass. With --horn-answer, invariants are mapped "
+             "back to the original clauses but a counterexample is not "
+             "printed"),
+    cl::init(false));
+
 namespace solver_detail {
 enum invariant_usage_t {
     INACTIVE // add them but without using them (only debugging purposes)
@@ -93,18 +123,10 @@ static llvm::cl::opt<bool>
 namespace seahorn {
   char HornSolver::ID = 0;
 
-  bool HornSolver::runOnModule(Module &M) {
-    Stats::sset ("Result", "UNKNOWN");
-
-    HornifyModule &hm = getAnalysis<HornifyModule> ();
-
-    // Load the Horn clause database
-    auto &db = hm.getHornClauseDB ();
-
-    m_fp.reset (new ZFixedPoint<EZ3> (hm.getZContext ()));
-    ZFixedPoint<EZ3> &fp = *m_fp;
-
-    ZParams<EZ3> params (hm.getZContext ());
+  /// sets the parameters of fp and loads db into it
+  static void loadFixedPoint(ZFixedPoint<EZ3> &fp, EZ3 &zctx,
+                             HornClauseDB &db) {
+    ZParams<EZ3> params (zctx);
     params.set(":engine", ChcEngine);
     // -- disable slicing so that we can use cover
     params.set (":xform.slice", false);
@@ -140,10 +162,73 @@ namespace seahorn {
       params.set(":spacer.use_bg_invs", false);
       fp.set(params);
     }
-    
-    Stats::resume ("Horn");
-    m_result = fp.query ();
-    Stats::stop ("Horn");
+  }
+
+  bool HornSolver::runOnModule(Module &M) {
+    Stats::sset ("Result", "UNKNOWN");
+
+    HornifyModule &hm = getAnalysis<HornifyModule> ();
+
+    // Load the Horn clause database
+    auto &db = hm.getHornClauseDB ();
+
+    // -- preprocessing works on a copy so that the clauses of hm are kept.
+    // -- A counterexample of the preprocessed clauses is over relations
+    // -- that are inlined, merged or renamed, so it cannot be used
+    bool preprocess = Preprocess && !m_cex;
+    HornClauseDB ppDb (db.getExprFactory ());
+    HornModelConverterSeq ppConv;
+    if (preprocess) {
+      copyHornClauseDB (db, ppDb);
+      preprocessHornClauses (ppDb, hm.getZContext (), ppConv);
+    }
+    HornClauseDB &solveDb = preprocess ? ppDb : db;
+
+    // -- invariants of previous runs on the same clauses. Loaded after
+    // -- preprocessing, since a relation with invariants is never
+    // -- eliminated, and only for the relations that are left
+    std::unique_ptr<HornInvCache> cache;
+    if (!HornInvCache::defaultDir ().empty ()) {
+      cache.reset (new HornInvCache (hm, HornInvCache::defaultDir ()));
+      cache->load (M, solveDb);
+    }
+
+    // -- one part per query and error rule, solved in parallel
+    std::vector<std::unique_ptr<HornClauseDB>> parts;
+    if (XHornSolverJobs > 1) {
+      if (db.getExprFactory ().isConcurrent ())
+        splitHornClauseDB (solveDb, parts);
+      else
+        errs() << "HornSolver: --horn-solver-jobs requires a concurrent "
+                  "expression factory. Solving sequentially.\n";
+    }
+    Stats::uset ("HornSolver.parts", parts.size ());
+
+    HornDbModel dbModel;
+    m_zctx.reset (nullptr);
+    m_fp.reset (nullptr);
+    if (!parts.empty()) {
+      Stats::resume ("Horn");
+      solveParts (parts, dbModel);
+      Stats::stop ("Horn");
+    } else {
+      m_fp.reset (new ZFixedPoint<EZ3> (hm.getZContext ()));
+      ZFixedPoint<EZ3> &fp = *m_fp;
+      loadFixedPoint (fp, hm.getZContext (), solveDb);
+
+      Stats::resume ("Horn");
+      m_result = fp.query ();
+      Stats::stop ("Horn");
+      hm.getZContext ().flushMarshalStats ();
+
+      LOG("answer",
+          if (m_result || !m_result) errs() << fp.getAnswer() << "\n";);
+      // -- the fixed point only knows the preprocessed relations, so the
+      // -- size of the invariants is estimated on the converted model
+      if ((PrintAnswer || cache || (EstimateSizeInvars && preprocess)) &&
+          !m_result)
+        initDBModelFromFP(dbModel, solveDb, fp);
+    }
 
     if (m_result)
       outs() << "sat";
@@ -158,21 +243,185 @@ namespace seahorn {
     else if (!m_result)
       Stats::sset("Result", "TRUE");
 
-    LOG("answer", if (m_result || !m_result) errs() << fp.getAnswer() << "\n";);
+    bool hasModel = static_cast<bool> (!m_result);
+    if ((PrintAnswer || cache || EstimateSizeInvars) && !m_result &&
+        !ppConv.empty()) {
+      HornDbModel origModel;
+      if (ppConv.convert(dbModel, origModel))
+        dbModel = origModel;
+      else {
+        errs() << "Warning: could not convert the model of the "
+                  "preprocessed clauses\n";
+        hasModel = false;
+      }
+    }
+    if (cache && hasModel)
+      cache->store(M, dbModel);
 
-    if (PrintAnswer && !m_result) {
-      HornDbModel dbModel;
-      initDBModelFromFP(dbModel, db, fp);
+    // -- an unconverted model has no definitions of the eliminated
+    // -- relations, and would print them as true
+    if (PrintAnswer && !m_result && hasModel)
       printInvars(M, dbModel);
-    } else if (PrintAnswer && m_result)
+    else if (PrintAnswer && m_result && preprocess)
+      errs() << "Warning: no counterexample is printed with "
+                "--horn-preprocess\n";
+    else if (PrintAnswer && m_result)
       printCex ();
 
     if (EstimateSizeInvars)
-      estimateSizeInvars(M);
+      estimateSizeInvars(M, parts.empty() && !preprocess ? nullptr : &dbModel);
 
     return false;
   }
 
+  void HornSolver::solveParts(std::vector<std::unique_ptr<HornClauseDB>> &parts,
+                              HornDbModel &model) {
+    ExprFactory &efac = parts[0]->getExprFactory ();
+    unsigned n = parts.size ();
+    unsigned jobs = std::min (XHornSolverJobs, n);
+
+    // -- relations of the queries. Their definitions in a part only
+    // -- account for some of their rules
+    std::set<Expr> queryRels;
+    for (auto &part : parts)
+      for (Expr q : part->getQueries ())
+        queryRels.insert (bind::fname (q));
+
+    std::mutex lock;
+    std::condition_variable changed;
+    unsigned next = 0;
+    // -- parts taken by a thread and not finished yet
+    unsigned running = 0;
+    bool cex = false;
+    std::vector<boost::tribool> res (n, boost::indeterminate);
+    std::vector<bool> finished (n, false);
+    std::vector<HornDbModel> models (n);
+    std::vector<std::unique_ptr<EZ3>> zctxs (n);
+    std::vector<std::unique_ptr<ZFixedPoint<EZ3>>> fps (n);
+    // -- invariants proved by finished parts, as (application, lemma)
+    std::vector<std::pair<Expr, Expr>> lemmas;
+
+    auto work = [&]() {
+      while (true) {
+        unsigned i;
+        std::vector<std::pair<Expr, Expr>> known;
+        {
+          std::lock_guard<std::mutex> guard (lock);
+          if (cex || next >= n) return;
+          i = next++;
+          ++running;
+          known = lemmas;
+          zctxs[i].reset (new EZ3 (efac));
+          fps[i].reset (new ZFixedPoint<EZ3> (*zctxs[i]));
+        }
+
+        HornClauseDB &part = *parts[i];
+        // -- lemmas of other parts are invariants of this one
+        for (auto &l : known)
+          if (part.hasRelation (bind::fname (l.first)))
+            part.addInvariant (l.first, l.second);
+
+        boost::tribool r = boost::indeterminate;
+        try {
+          loadFixedPoint (*fps[i], *zctxs[i], part);
+          // -- another part may have found a counterexample while this
+          // -- one was loaded
+          bool stop;
+          {
+            std::lock_guard<std::mutex> guard (lock);
+            stop = cex;
+          }
+          if (!stop) {
+            r = fps[i]->query ();
+            if (!r) initDBModelFromFP (models[i], part, *fps[i]);
+          }
+        } catch (z3::exception &e) {
+          LOG("horn", errs() << "part " << i << ": " << e.msg() << "\n";);
+          r = boost::indeterminate;
+        }
+
+        std::lock_guard<std::mutex> guard (lock);
+        res[i] = r;
+        finished[i] = true;
+        --running;
+        if (r) {
+          // -- one counterexample is enough, the other parts are stopped
+          cex = true;
+        } else if (!r) {
+          for (Expr rel : part.getRelations ()) {
+            if (queryRels.count (rel) > 0) continue;
+            ExprVector args;
+            for (unsigned k = 0, sz = bind::domainSz (rel); k < sz; ++k)
+              args.push_back (bind::mkConst
+                              (variant::variant
+                               (k, mkTerm<std::string> ("arg", efac)),
+                               bind::domainTy (rel, k)));
+            Expr app = bind::fapp (rel, args);
+            lemmas.push_back (std::make_pair (app, models[i].getDef (app)));
+          }
+        }
+        changed.notify_all ();
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned k = 0; k < jobs; ++k)
+      threads.emplace_back (work);
+    {
+      std::unique_lock<std::mutex> guard (lock);
+      changed.wait (guard, [&] () {
+        return cex || (running == 0 && next >= n);
+      });
+      // -- an interrupt that arrives before a part has entered its query
+      // -- is lost, so keep interrupting until all started parts are done
+      while (running > 0) {
+        for (unsigned j = 0; j < n; ++j)
+          if (fps[j] && !finished[j]) fps[j]->interrupt ();
+        changed.wait_for (guard, std::chrono::milliseconds (10));
+      }
+    }
+    for (auto &t : threads)
+      t.join ();
+    for (auto &z : zctxs)
+      if (z) z->flushMarshalStats ();
+
+    // -- sat if some part is sat, unsat if all parts are unsat
+    m_result = false;
+    for (unsigned i = 0; i < n; ++i) {
+      if (res[i]) {
+        m_result = true;
+        m_zctx = std::move (zctxs[i]);
+        m_fp = std::move (fps[i]);
+        break;
+      }
+      if (!res[i]) continue;
+      m_result = boost::indeterminate;
+    }
+    Stats::uset ("HornSolver.lemmas", lemmas.size ());
+    if (m_result || boost::indeterminate (m_result)) return;
+
+    // -- a relation is the conjunction of its definitions in the parts,
+    // -- a relation of a query is their disjunction
+    std::map<Expr, ExprVector> defs;
+    for (unsigned i = 0; i < n; ++i)
+      for (Expr rel : parts[i]->getRelations ()) {
+        ExprVector args;
+        for (unsigned k = 0, sz = bind::domainSz (rel); k < sz; ++k)
+          args.push_back (bind::bvar (k, bind::domainTy (rel, k)));
+        defs[rel].push_back (models[i].getDef (bind::fapp (rel, args)));
+      }
+    for (auto &kv : defs) {
+      Expr rel = kv.first;
+      ExprVector args;
+      for (unsigned k = 0, sz = bind::domainSz (rel); k < sz; ++k)
+        args.push_back (bind::bvar (k, bind::domainTy (rel, k)));
+      Expr def = queryRels.count (rel) > 0
+        ? mknary<OR> (mk<FALSE> (efac), kv.second.begin (), kv.second.end ())
+        : mknary<AND> (mk<TRUE> (efac), kv.second.begin (), kv.second.end ());
+      model.addDef (bind::fapp (rel, args), def);
+    }
+  }
+
 void HornSolver::getAnalysisUsage(AnalysisUsage &AU) const {
     AU.addRequired<HornifyModule> ();
     AU.setPreservesAll ();
@@ -211,9 +460,8 @@ void HornSolver::printCex() {
     }
   }
 
-void HornSolver::estimateSizeInvars(Module &M) {
+void HornSolver::estimateSizeInvars(Module &M, HornDbModel *model) {
     HornifyModule &hm = getAnalysis<HornifyModule> ();
-    ZFixedPoint<EZ3> fp = *m_fp;
 
     Expr allInvars;
     bool first = true;
@@ -226,7 +474,8 @@ void HornSolver::estimateSizeInvars(Module &M) {
         continue;
         Expr bbPred = hm.bbPredicate (BB);
         const ExprVector &live = hm.live (BB);
-        Expr invars = fp.getCoverDelta (bind::fapp (bbPred, live));
+        Expr invars = model ? model->getDef (bind::fapp (bbPred, live))
+                            : m_fp->getCoverDelta (bind::fapp (bbPred, live));
         numBlocks++;
         if (first) {
           allInvars = invars;
@@ -255,8 +504,6 @@ void HornSolver::printInvars(Function &F, HornDbModel &model) {
     // -- not used for now
     Expr summary = hm.summaryPredicate (F);
 
-    ZFixedPoint<EZ3> fp = *m_fp;
-
   for (auto &BB : F) {
     if (!hm.hasBbPredicate(BB))
       continue;
@@ -3,10 +3,12 @@
 #include "seahorn/HornClauseDBTransf.hh"
 #include "seahorn/ClpWrite.hh"
 #include "seahorn/McMtWriter.hh"
+#include "seahorn/Expr/ExprSmtLib.hh"
 
 #include "seahorn/config.h"
 
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 
 static llvm::cl::opt<bool>
 InternalWriter("horn-fp-internal-writer",
@@ -44,6 +46,57 @@ namespace seahorn
         << " \"" << val << "\"" << ")\n";
   }
   
+  template <typename Out>
+  static void writeHeader (Out &out, Module &M)
+  {
+    setInfo (out, "original", M.getModuleIdentifier ());
+    std::string version ("SeaHorn v.");
+    version += SEAHORN_VERSION_INFO;
+    setInfo (out, "authors", version);
+  }
+
+  /// Writes db in the SMT2 dialect of the Z3 fixedpoint engine. Unlike
+  /// ZFixedPoint, does not translate the clauses to Z3
+  static void writeFixedPoint (HornClauseDB &db, raw_ostream &out)
+  {
+    SmtLibWriter writer (out);
+    for (Expr decl : db.getRelations ())
+    {
+      out << "(declare-rel ";
+      writer.writeSymbol (decl);
+      out << " (";
+      for (unsigned i = 0, sz = bind::domainSz (decl); i < sz; ++i)
+      {
+        writer.writeSort (bind::domainTy (decl, i));
+        out << " ";
+      }
+      out << "))\n";
+    }
+
+    for (const Expr &v : db.getVars ())
+    {
+      out << "(declare-var ";
+      writer.writeSymbol (v);
+      out << " ";
+      writer.writeSort (bind::typeOf (v));
+      out << ")\n";
+    }
+
+    for (auto &rule : db.getRules ())
+    {
+      out << "(rule ";
+      writer.write (rule.get ());
+      out << ")\n";
+    }
+
+    for (const Expr &q : db.getQueries ())
+    {
+      out << "(query ";
+      writer.write (q);
+      out << ")\n";
+    }
+  }
+
   bool HornWrite::runOnModule (Module &M)
   {
     ScopedStats _st_("HornWrite");
@@ -64,6 +117,19 @@ namespace seahorn
       McMtWriter<llvm::raw_fd_ostream> writer (db, hm.getZContext ());
       writer.write (m_out);
     }
+    else if (HornClauseFormat == SMT2 && InternalWriter)
+    {
+      writeHeader (m_out, M);
+      try
+      {
+        writeFixedPoint (db, m_out);
+      }
+      catch (SmtLibError &e)
+      {
+        llvm::report_fatal_error (e.what ());
+      }
+      m_out << "\n";
+    }
     else 
     {
       // Use local ZFixedPoint object to translate to SMT2. 
@@ -84,16 +150,9 @@ namespace seahorn
         fp.set (params);
       }
       
-      // -- write header
-      setInfo (m_out, "original", M.getModuleIdentifier ());
-      std::string version ("SeaHorn v.");
-      version += SEAHORN_VERSION_INFO;
-      setInfo (m_out, "authors", version);
+      writeHeader (m_out, M);
       
-      if (HornClauseFormat == PURESMT2 || !InternalWriter)
-        m_out << fp.toString () << "\n";
-      else
-        m_out << fp << "\n";
+      m_out << fp.toString () << "\n";
     }
     
     m_out.flush ();
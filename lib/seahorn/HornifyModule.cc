@@ -92,6 +92,13 @@ static llvm::cl::list<std::string>
                       llvm::cl::ZeroOrMore, llvm::cl::CommaSeparated);
 
 namespace seahorn {
+// Defined in Houdini.cc
+// Number of threads that Houdini uses to validate rules.
+extern unsigned XHornHoudiniJobs;
+// Defined in HornSolver.cc
+// Number of threads that solve the Horn clauses.
+extern unsigned XHornSolverJobs;
+
 char HornifyModule::ID = 0;
 
 struct FunctionNameMatcher
@@ -122,7 +129,9 @@ bool shouldBeAbstracted(const Function &fn) {
 }
 
 HornifyModule::HornifyModule()
-    : ModulePass(ID), m_zctx(m_efac), m_db(m_efac), m_td(0), m_canFail(0) {}
+    : ModulePass(ID), m_efac(XHornHoudiniJobs > 1 || XHornSolverJobs > 1),
+      m_zctx(m_efac),
+      m_db(m_efac), m_td(0), m_canFail(0) {}
 
 bool HornifyModule::runOnModule(Module &M) {
   ScopedStats _st("HornifyModule");
@@ -2,6 +2,7 @@
 #include "seahorn/HornifyModule.hh"
 #include "seahorn/HornClauseDBTransf.hh"
 #include "seahorn/HornClauseDB.hh"
+#include "seahorn/HornInvCache.hh"
 #include "seahorn/GuessCandidates.hh"
 
 #include "llvm/IR/Function.h"
@@ -16,8 +17,25 @@
 
 #include "seahorn/Support/Stats.hh"
 
+#include <memory>
+#include <set>
+#include <thread>
+
 using namespace llvm;
 
+namespace seahorn
+{
+  // Defined here, read by HornifyModule to create a concurrent
+  // expression factory when Houdini runs on several threads.
+  unsigned XHornHoudiniJobs;
+}
+
+static llvm::cl::opt<unsigned, true> HoudiniJobs(
+    "horn-houdini-jobs",
+    llvm::cl::desc("Number of threads that validate rules in Houdini. "
+                   "More than one selects the parallel Houdini"),
+    llvm::cl::location(seahorn::XHornHoudiniJobs), llvm::cl::init(1u));
+
 namespace seahorn
 {
   #define SAT_OR_INDETERMIN true
@@ -26,6 +44,7 @@ namespace seahorn
   #define NAIVE 0
   #define EACH_RULE_A_SOLVER 1
   #define EACH_RELATION_A_SOLVER 2
+  #define PARALLEL 3
 
   /*HoudiniPass methods begin*/
 
@@ -36,13 +55,19 @@ namespace seahorn
     HornifyModule &hm = getAnalysis<HornifyModule> ();
 
     //Use commandline option to replace it.
-    int config = EACH_RULE_A_SOLVER;
+    int config = HoudiniJobs > 1 ? PARALLEL : EACH_RULE_A_SOLVER;
 
     Stats::resume ("Houdini inv");
     Houdini houdini(hm);
     houdini.guessCandidates(hm.getHornClauseDB());
     houdini.runHoudini(config);
     Stats::stop ("Houdini inv");
+    hm.getZContext ().flushMarshalStats ();
+
+    // -- the candidates left are inductive, keep them for later runs
+    if (!HornInvCache::defaultDir ().empty ())
+      HornInvCache (hm, HornInvCache::defaultDir ())
+	.store (M, houdini.getCandidateModel ());
 
     return false;
   }
@@ -171,6 +196,11 @@ namespace seahorn
 		  Houdini_Naive houdini_naive(*this, db_wto, workList);
 		  houdini_naive.run();
 	  }
+	  else if (config == PARALLEL)
+	  {
+		  Houdini_Parallel houdini_parallel(*this, db_wto, workList, HoudiniJobs);
+		  houdini_parallel.run();
+	  }
 
 	  addInvarCandsToProgramSolver();
   }
@@ -435,6 +465,410 @@ namespace seahorn
   	  return relationToSolverMap;
   }
 
+  /*Houdini_Parallel methods begin*/
+
+  struct Houdini_Parallel::RuleSolver
+  {
+	  HornRule m_rule;
+	  // -- relation of the head
+	  Expr m_rel;
+	  // -- candidates of the head relation applied to the head of the rule
+	  ExprVector m_head;
+	  // -- assumption literals of the candidates of the body, and the
+	  // -- relation and index of the candidate each one guards
+	  ExprVector m_lits;
+	  std::vector<std::pair<Expr, unsigned>> m_litToCand;
+	  std::unique_ptr<ZSolver<EZ3>> m_solver;
+	  // -- index of the worker whose context owns m_solver
+	  unsigned m_worker;
+	  // -- head candidates falsified in the current round
+	  std::vector<unsigned> m_dropped;
+
+	  RuleSolver(HornRule r, unsigned worker) :
+		  m_rule(r), m_rel(bind::fname(r.head())), m_worker(worker) {}
+  };
+
+  struct Houdini_Parallel::Worker
+  {
+	  std::unique_ptr<EZ3> m_zctx;
+	  // -- rules of this worker to validate in the current round
+	  std::vector<RuleSolver*> m_batch;
+  };
+
+  /*
+   * Replaces the bound variables of a candidate by the arguments of fapp
+   */
+  static Expr applyCand(Expr cand, Expr fapp)
+  {
+	  Expr fdecl = bind::fname(fapp);
+	  ExprMap bvarToArgMap;
+	  for(unsigned i=0; i<bind::domainSz(fdecl); i++)
+	  {
+		  Expr bvar_i = bind::bvar(i, bind::domainTy(fdecl, i));
+		  bvarToArgMap.insert(std::make_pair(bvar_i, fapp->arg(i+1)));
+	  }
+	  return replace(cand, bvarToArgMap);
+  }
+
+  /*
+   * Numbers the relations in the order of the wto
+   */
+  class WtoPositionVisitor : public WtoElementVisitor<Expr>
+  {
+	  std::map<Expr, unsigned> &m_pos;
+  public:
+	  WtoPositionVisitor(std::map<Expr, unsigned> &pos) : m_pos(pos) {}
+	  virtual void visit(const wto_singleton_t &s)
+	  {
+		  m_pos.insert(std::make_pair(s.get(), m_pos.size()));
+	  }
+	  virtual void visit(const wto_component_t &c)
+	  {
+		  m_pos.insert(std::make_pair(c.head(), m_pos.size()));
+		  for(auto &e : c)
+		  {
+			  e.accept(this);
+		  }
+	  }
+  };
+
+  Houdini_Parallel::Houdini_Parallel(Houdini& houdini, HornClauseDBWto &db_wto, std::list<HornRule> &workList, unsigned jobs) :
+	  HoudiniContext(houdini, db_wto, workList), m_jobs(std::max(jobs, 1u))
+  {
+	  ExprFactory &efac = m_houdini.getHornifyModule().getExprFactory();
+	  if(m_jobs > 1 && !efac.isConcurrent())
+	  {
+		  errs() << "Houdini: --horn-houdini-jobs requires a concurrent "
+				    "expression factory. Validating rules sequentially.\n";
+		  m_jobs = 1;
+	  }
+
+	  WtoPositionVisitor vis(m_wtoPos);
+	  for(auto &c : m_db_wto)
+	  {
+		  c.accept(&vis);
+	  }
+
+	  initCandidates();
+	  initSolvers();
+  }
+
+  Houdini_Parallel::~Houdini_Parallel() {}
+
+  /*
+   * Splits the candidate of every relation into its conjuncts
+   */
+  void Houdini_Parallel::initCandidates()
+  {
+	  auto &db = m_houdini.getHornifyModule().getHornClauseDB();
+	  for(Expr rel : db.getRelations())
+	  {
+		  ExprVector bvars;
+		  for(unsigned i=0; i<bind::domainSz(rel); i++)
+		  {
+			  bvars.push_back(bind::bvar(i, bind::domainTy(rel, i)));
+		  }
+		  Expr cand = m_houdini.getCandidateModel().getDef(bind::fapp(rel, bvars));
+
+		  ExprVector &conjs = m_cands[rel];
+		  if(isOpX<AND>(cand))
+		  {
+			  conjs.insert(conjs.end(), cand->args_begin(), cand->args_end());
+		  }
+		  else if(!isOpX<TRUE>(cand))
+		  {
+			  conjs.push_back(cand);
+		  }
+		  m_alive[rel].assign(conjs.size(), true);
+	  }
+  }
+
+  /*
+   * Creates the solver of every rule in the context of the worker that
+   * validates it. Everything is marshalled here, before any thread runs.
+   */
+  void Houdini_Parallel::initSolvers()
+  {
+	  auto &db = m_houdini.getHornifyModule().getHornClauseDB();
+	  ExprFactory &efac = db.getExprFactory();
+
+	  for(unsigned i = 0; i < m_jobs; ++i)
+	  {
+		  std::unique_ptr<Worker> w(new Worker());
+		  w->m_zctx.reset(new EZ3(efac));
+		  m_workers.push_back(std::move(w));
+	  }
+
+	  Expr litName = mkTerm<std::string>("houdini_cand", efac);
+	  unsigned litCount = 0;
+	  for(HornRule &r : db.getRules())
+	  {
+		  std::unique_ptr<RuleSolver> rs(new RuleSolver(r, m_rules.size() % m_jobs));
+		  rs->m_solver.reset(new ZSolver<EZ3>(*m_workers[rs->m_worker]->m_zctx));
+		  rs->m_solver->assertExpr(extractTransitionRelation(r, db));
+
+		  ExprVector body_pred_apps;
+		  get_all_pred_apps(r.body(), db, std::back_inserter(body_pred_apps));
+		  for(Expr body_app : body_pred_apps)
+		  {
+			  Expr rel = bind::fname(body_app);
+			  const ExprVector &conjs = m_cands[rel];
+			  for(unsigned k = 0; k < conjs.size(); ++k)
+			  {
+				  Expr lit = bind::boolConst(variant::variant(litCount++, litName));
+				  rs->m_solver->assertExpr(mk<IMPL>(lit, applyCand(conjs[k], body_app)));
+				  rs->m_lits.push_back(lit);
+				  rs->m_litToCand.push_back(std::make_pair(rel, k));
+			  }
+		  }
+
+		  for(Expr conj : m_cands[rs->m_rel])
+		  {
+			  rs->m_head.push_back(applyCand(conj, r.head()));
+		  }
+
+		  m_ruleToSolver[r] = rs.get();
+		  m_rules.push_back(std::move(rs));
+	  }
+  }
+
+  /*
+   * Checks a rule once under the candidates in m_alive for the body and in
+   * head_alive for the head. If sat, every head candidate that is false in
+   * the model is removed from head_alive and recorded in m_dropped. If the
+   * solver gives up, the first live head candidate is dropped instead.
+   */
+  boost::tribool Houdini_Parallel::check(RuleSolver &rs, std::vector<bool> &head_alive)
+  {
+	  ExprVector assumptions;
+	  for(unsigned i = 0; i < rs.m_lits.size(); ++i)
+	  {
+		  const std::pair<Expr, unsigned> &cand = rs.m_litToCand[i];
+		  if(m_alive.find(cand.first)->second[cand.second])
+		  {
+			  assumptions.push_back(rs.m_lits[i]);
+		  }
+	  }
+
+	  std::vector<unsigned> idx;
+	  ExprVector heads, negs;
+	  for(unsigned k = 0; k < rs.m_head.size(); ++k)
+	  {
+		  if(!head_alive[k]) continue;
+		  idx.push_back(k);
+		  heads.push_back(rs.m_head[k]);
+		  negs.push_back(mk<NEG>(rs.m_head[k]));
+	  }
+	  if(heads.empty())
+	  {
+		  return false;
+	  }
+
+	  ZSolver<EZ3> &solver = *rs.m_solver;
+	  solver.push();
+	  solver.assertExpr(negs.size() == 1 ? negs[0] : mknary<OR>(negs.begin(), negs.end()));
+	  boost::tribool isSat = boost::indeterminate;
+	  try
+	  {
+		  isSat = solver.solveAssuming(assumptions);
+	  }
+	  catch (z3::exception &e)
+	  {
+		  LOG("houdini", errs() << "Z3 EXCEPTION: " << e.msg() << "\n";);
+	  }
+
+	  if(!isSat)
+	  {
+		  solver.pop();
+		  return isSat;
+	  }
+
+	  unsigned num_dropped = rs.m_dropped.size();
+	  if(isSat)
+	  {
+		  ZModel<EZ3> m = solver.getModel();
+		  ExprVector vals;
+		  // -- with completion, at least one head is FALSE in the model
+		  m.eval(heads, vals, /*completion=*/true);
+		  for(unsigned i = 0; i < vals.size(); ++i)
+		  {
+			  if(isOpX<FALSE>(vals[i]))
+			  {
+				  head_alive[idx[i]] = false;
+				  rs.m_dropped.push_back(idx[i]);
+			  }
+		  }
+	  }
+	  // -- indeterminate, or no candidate is decided by the model
+	  if(rs.m_dropped.size() == num_dropped)
+	  {
+		  LOG("houdini", errs() << "INDETERMINATE REACHED" << "\n");
+		  head_alive[idx[0]] = false;
+		  rs.m_dropped.push_back(idx[0]);
+	  }
+	  solver.pop();
+	  return isSat;
+  }
+
+  /*
+   * Validates the batch of a worker until every rule in it holds under the
+   * body candidates at the start of the round
+   */
+  void Houdini_Parallel::validateRound(Worker &w)
+  {
+	  for(RuleSolver *rs : w.m_batch)
+	  {
+		  rs->m_dropped.clear();
+		  std::vector<bool> head_alive = m_alive.find(rs->m_rel)->second;
+		  for(;;)
+		  {
+			  boost::tribool isSat = check(*rs, head_alive);
+			  if(!isSat) break;
+		  }
+	  }
+  }
+
+  bool Houdini_Parallel::validateRule(HornRule r, ZSolver<EZ3> &solver)
+  {
+	  assert(m_ruleToSolver.find(r) != m_ruleToSolver.end());
+	  RuleSolver &rs = *m_ruleToSolver.find(r)->second;
+	  assert(&solver == rs.m_solver.get());
+	  std::vector<bool> head_alive = m_alive.find(rs.m_rel)->second;
+	  boost::tribool isSat = check(rs, head_alive);
+	  if(!isSat)
+	  {
+		  return UNSAT;
+	  }
+	  return SAT_OR_INDETERMIN;
+  }
+
+  void Houdini_Parallel::run()
+  {
+	  auto &db = m_houdini.getHornifyModule().getHornClauseDB();
+	  auto wtoPos = [this](const RuleSolver *rs) {
+		  auto it = m_wtoPos.find(rs->m_rel);
+		  return it == m_wtoPos.end() ? m_wtoPos.size() : it->second;
+	  };
+
+	  unsigned rounds = 0;
+	  while(!m_workList.empty())
+	  {
+		  ++rounds;
+		  LOG("houdini", errs() << "ROUND " << rounds << " WORKLIST SIZE: " << m_workList.size() << "\n";);
+
+		  // -- the rules of the round, in the order of the wto
+		  std::vector<RuleSolver*> batch;
+		  for(HornRule &r : m_workList)
+		  {
+			  assert(m_ruleToSolver.find(r) != m_ruleToSolver.end());
+			  batch.push_back(m_ruleToSolver.find(r)->second);
+		  }
+		  m_workList.clear();
+		  std::stable_sort(batch.begin(), batch.end(),
+				  [&wtoPos](const RuleSolver *a, const RuleSolver *b) { return wtoPos(a) < wtoPos(b); });
+
+		  for(auto &w : m_workers)
+		  {
+			  w->m_batch.clear();
+		  }
+		  for(RuleSolver *rs : batch)
+		  {
+			  m_workers[rs->m_worker]->m_batch.push_back(rs);
+		  }
+
+		  if(m_jobs == 1)
+		  {
+			  validateRound(*m_workers[0]);
+		  }
+		  else
+		  {
+			  // -- candidates are only read by the workers until they join
+			  std::vector<std::thread> threads;
+			  for(auto &w : m_workers)
+			  {
+				  if(w->m_batch.empty()) continue;
+				  Worker *wp = w.get();
+				  threads.emplace_back([this, wp]() { validateRound(*wp); });
+			  }
+			  for(auto &t : threads)
+			  {
+				  t.join();
+			  }
+		  }
+
+		  // -- drop the falsified candidates, and revisit the rules that
+		  // -- use a weakened relation
+		  std::set<Expr> weakened;
+		  for(RuleSolver *rs : batch)
+		  {
+			  std::vector<bool> &alive = m_alive.find(rs->m_rel)->second;
+			  for(unsigned k : rs->m_dropped)
+			  {
+				  if(!alive[k]) continue;
+				  alive[k] = false;
+				  weakened.insert(rs->m_rel);
+			  }
+		  }
+		  for(Expr rel : weakened)
+		  {
+			  LOG("houdini", errs() << "WEAKENED: " << *rel << "\n";);
+			  for(HornRule *r : db.use(rel))
+			  {
+				  if(std::find(m_workList.begin(), m_workList.end(), *r) == m_workList.end())
+				  {
+					  m_workList.push_back(*r);
+				  }
+			  }
+		  }
+	  }
+	  Stats::uset("Houdini_rounds", rounds);
+	  for(auto &w : m_workers)
+	  {
+		  w->m_zctx->flushMarshalStats();
+	  }
+
+	  updateCandidateModel();
+  }
+
+  /*
+   * Writes the live candidates back to the candidate model
+   */
+  void Houdini_Parallel::updateCandidateModel()
+  {
+	  for(auto &kv : m_cands)
+	  {
+		  Expr rel = kv.first;
+		  const std::vector<bool> &alive = m_alive.find(rel)->second;
+		  ExprVector conjs;
+		  for(unsigned k = 0; k < kv.second.size(); ++k)
+		  {
+			  if(alive[k]) conjs.push_back(kv.second[k]);
+		  }
+
+		  ExprVector bvars;
+		  for(unsigned i=0; i<bind::domainSz(rel); i++)
+		  {
+			  bvars.push_back(bind::bvar(i, bind::domainTy(rel, i)));
+		  }
+		  Expr cand;
+		  if(conjs.empty())
+		  {
+			  cand = mk<TRUE>(rel->efac());
+		  }
+		  else if(conjs.size() == 1)
+		  {
+			  cand = conjs[0];
+		  }
+		  else
+		  {
+			  cand = mknary<AND>(conjs.begin(), conjs.end());
+		  }
+		  m_houdini.getCandidateModel().addDef(bind::fapp(rel, bvars), cand);
+	  }
+  }
+
+  /*Houdini_Parallel methods end*/
+
   /*
    * Given a rule, weaken its head's candidate
    */
@@ -1,5 +1,6 @@
 #include "seahorn/PathBasedBmc.hh"
 #include "seahorn/Analysis/CutPointGraph.hh"
+#include "seahorn/Expr/ExprSmtLib.hh"
 #include "seahorn/Support/CFG.hh"
 #include "seahorn/UfoOpSem.hh"
 #include "seahorn/config.h"
@@ -21,6 +22,12 @@
 
 #include "boost/unordered_map.hpp"
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 /**
   Certain parts of this implementation is VC encoding-dependent. For
   instance, the generation of blocking clauses and the boolean
@@ -30,6 +37,8 @@
 namespace seahorn {
 // To tell BmcPass if we want crab enabled.
 bool XHornBmcCrab;
+// To tell BmcPass if path formulas are solved by several threads.
+unsigned XHornBmcPathJobs;
 } // namespace seahorn
 
 static llvm::cl::opt<bool, true>
@@ -99,6 +108,12 @@ static llvm::cl::opt<unsigned> MucTimeout(
     llvm::cl::desc("Timeout (sec) for SMT query during MUC in Path-based BMC"),
     llvm::cl::init(5u));
 
+static llvm::cl::opt<unsigned, true> PathJobs(
+    "horn-bmc-path-jobs",
+    llvm::cl::desc("Number of threads that solve path formulas in Path-based "
+                   "BMC while the Boolean abstraction enumerates paths"),
+    llvm::cl::location(seahorn::XHornBmcPathJobs), llvm::cl::init(1u));
+
 static llvm::cl::opt<std::string> SmtOutDir(
     "horn-bmc-smt-outdir",
     llvm::cl::desc("Directory to dump path formulas in SMT-LIB format"),
@@ -933,6 +948,234 @@ bool PathBasedBmcEngine::path_encoding_and_solve_with_ai(
 }
 #endif
 
+/*
+  Solves path_formula on solver. If the path formula is unsat then
+  core is a (minimal) unsat subset of it. If the solver gave up then
+  core is the whole path formula.
+
+  Only touches solver, so it can run on any thread that owns the
+  solver's context, provided that the expression factory is concurrent.
+*/
+static boost::tribool solve_path_formula(ufo::ZSolver<ufo::EZ3> &solver,
+                                         const ExprVector &path_formula,
+                                         ExprVector &core) {
+  /*****************************************************************
+   * This check might be expensive if path_formula contains complex
+   * bitvector/floating point expressions.
+   * TODO: make decisions `a la` mcsat to solve faster. We will use
+   * here invariants to make only those decisions which are
+   * consistent with the invariants.
+   *****************************************************************/
+  solver.reset();
+  // TODO: add here path_constraints to help
+  for (Expr e : path_formula) {
+    solver.assertExpr(e);
+  }
+
+  boost::tribool res;
+  {
+    scoped_solver ss(solver, PathTimeout);
+    res = ss.get().solve();
+  }
+  if (res)
+    return res;
+
+  // --- Compute minimal unsat core of the path formula
+  bmc_detail::muc_method_t muc_method = MucMethod;
+  if (boost::indeterminate(res))
+    muc_method = bmc_detail::MUC_NONE;
+
+  switch (muc_method) {
+  case bmc_detail::MUC_NONE: {
+    core.assign(path_formula.begin(), path_formula.end());
+    break;
+  }
+  case bmc_detail::MUC_DELETION: {
+    deletion_muc muc(solver);
+    muc.run(path_formula, core);
+    LOG("bmc-unsat-core", errs() << "\n"; muc.print_stats(errs()));
+    break;
+  }
+  case bmc_detail::MUC_BINARY_SEARCH: {
+    binary_search_muc muc(solver);
+    muc.run(path_formula, core);
+    LOG("bmc-unsat-core", errs() << "\n"; muc.print_stats(errs()));
+    break;
+  }
+  case bmc_detail::MUC_ASSUMPTIONS:
+  default: {
+    muc_with_assumptions muc(solver);
+    muc.run(path_formula, core);
+    LOG("bmc-unsat-core", errs() << "\n"; muc.print_stats(errs()));
+    break;
+  }
+  }
+  return res;
+}
+
+// Boolean literals that enable the literals of core
+static void get_active_bool_lits(const ExprVector &core,
+                                 const ImplicantBoolMap &active_bool_map,
+                                 ExprVector &out) {
+  ExprSet active_bool_set;
+  for (Expr e : core) {
+    // It's possible that an implicant has no active booleans.
+    // For instance, corner cases where the whole program is a
+    // single block.
+    if (const Expr *b = active_bool_map.lookup(e)) {
+      active_bool_set.insert(*b);
+    }
+  }
+  out.assign(active_bool_set.begin(), active_bool_set.end());
+}
+
+/*
+  Solves path formulas on a pool of threads. Every thread has its own
+  Z3 context, and all of them share the expression factory, which must
+  be concurrent.
+
+  Results are collected by the thread that submits the jobs. A model
+  in a result belongs to the context of the thread that produced it,
+  and must not be used before stop().
+*/
+class PathBasedBmcEngine::PathSolverPool {
+public:
+  struct Job {
+    // number of the path
+    unsigned id;
+    ExprVector formula;
+    ImplicantBoolMap bool_map;
+  };
+
+  struct Result {
+    Job job;
+    boost::tribool res;
+    // unsat core of job.formula if not sat
+    ExprVector core;
+    // model of job.formula if sat
+    std::unique_ptr<ufo::ZModel<ufo::EZ3>> model;
+  };
+
+private:
+  struct Worker {
+    std::unique_ptr<ufo::EZ3> zctx;
+    std::unique_ptr<ufo::ZSolver<ufo::EZ3>> solver;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+
+  std::mutex m_lock;
+  std::condition_variable m_changed;
+  std::deque<Job> m_jobs;
+  std::deque<Result> m_results;
+  // number of jobs being solved
+  unsigned m_running;
+  bool m_stop;
+
+  void run(Worker &w) {
+    for (;;) {
+      Result r;
+      {
+        std::unique_lock<std::mutex> guard(m_lock);
+        m_changed.wait(guard, [this]() { return m_stop || !m_jobs.empty(); });
+        if (m_stop)
+          return;
+        r.job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        ++m_running;
+      }
+
+      try {
+        r.res = solve_path_formula(*w.solver, r.job.formula, r.core);
+        if (r.res)
+          r.model.reset(new ufo::ZModel<ufo::EZ3>(w.solver->getModel()));
+      } catch (z3::exception &e) {
+        r.res = boost::indeterminate;
+        r.core = r.job.formula;
+      }
+
+      std::lock_guard<std::mutex> guard(m_lock);
+      --m_running;
+      m_results.push_back(std::move(r));
+      m_changed.notify_all();
+    }
+  }
+
+public:
+  PathSolverPool(ExprFactory &efac, unsigned n) : m_running(0), m_stop(false) {
+    assert(efac.isConcurrent());
+    for (unsigned i = 0; i < n; ++i) {
+      std::unique_ptr<Worker> w(new Worker());
+      w->zctx.reset(new ufo::EZ3(efac));
+      w->solver.reset(new ufo::ZSolver<ufo::EZ3>(*w->zctx));
+      m_workers.push_back(std::move(w));
+    }
+    for (auto &w : m_workers)
+      w->thread = std::thread(&PathSolverPool::run, this, std::ref(*w));
+  }
+
+  ~PathSolverPool() {
+    stop();
+    // -- release models before the contexts they belong to
+    m_results.clear();
+  }
+
+  unsigned size() const { return m_workers.size(); }
+
+  void submit(Job job) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    assert(!m_stop);
+    m_jobs.push_back(std::move(job));
+    m_changed.notify_one();
+  }
+
+  // number of jobs whose result has not been collected yet
+  unsigned pending() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_jobs.size() + m_running + m_results.size();
+  }
+
+  // Collect a result. If block, then wait until one is available.
+  // Return false if there is none.
+  bool collect(Result &out, bool block) {
+    std::unique_lock<std::mutex> guard(m_lock);
+    if (block)
+      m_changed.wait(guard, [this]() {
+        return !m_results.empty() || (m_jobs.empty() && m_running == 0);
+      });
+    if (m_results.empty())
+      return false;
+    out = std::move(m_results.front());
+    m_results.pop_front();
+    return true;
+  }
+
+  // Drop all queued jobs, cancel the running ones, and wait for all
+  // threads to finish. Afterwards, the contexts of the threads can be
+  // used by the calling thread.
+  void stop() {
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_stop = true;
+      m_jobs.clear();
+      m_changed.notify_all();
+      // -- an interrupt that arrives between two queries of a job is
+      // -- lost, so keep interrupting until all jobs are done
+      while (m_running > 0) {
+        for (auto &w : m_workers)
+          w->solver->interrupt();
+        m_changed.wait_for(guard, std::chrono::milliseconds(10));
+      }
+    }
+    for (auto &w : m_workers)
+      if (w->thread.joinable())
+        w->thread.join();
+    for (auto &w : m_workers)
+      w->zctx->flushMarshalStats();
+  }
+};
+
 /*
   First, it builds an implicant of the precise encoding (m_side)
   with respect to the model. This implicant should correspond to a
@@ -952,7 +1195,7 @@ boost::tribool PathBasedBmcEngine::path_encoding_and_solve_with_smt(
     const invariants_map_t & /*path_constraints*/) {
 
   const ExprVector &path_formula = trace.get_implicant_formula();
-  const ExprMap &active_bool_map = trace.get_implicant_bools_map();
+  const ImplicantBoolMap &active_bool_map = trace.get_implicant_bools_map();
 
 #if 0
     // remove redundant literals
@@ -971,38 +1214,19 @@ boost::tribool PathBasedBmcEngine::path_encoding_and_solve_with_smt(
   //   toSmtLib(path_formula);
   // }
 
-  /*****************************************************************
-   * This check might be expensive if path_formula contains complex
-   * bitvector/floating point expressions.
-   * TODO: make decisions `a la` mcsat to solve faster. We will use
-   * here invariants to make only those decisions which are
-   * consistent with the invariants.
-   *****************************************************************/
-  m_aux_smt_solver.reset();
-  // TODO: add here path_constraints to help
-  for (Expr e : path_formula) {
-    m_aux_smt_solver.assertExpr(e);
-  }
-
-  boost::tribool res;
-  {
-    scoped_solver ss(m_aux_smt_solver, PathTimeout);
-    res = ss.get().solve();
-  }
+  ExprVector unsat_core;
+  boost::tribool res =
+      solve_path_formula(m_aux_smt_solver, path_formula, unsat_core);
   if (res) {
-    m_model = m_aux_smt_solver.getModel();
+    m_model.reset(new ufo::ZModel<ufo::EZ3>(m_aux_smt_solver.getModel()));
     if (SmtOutDir != "") {
       toSmtLib(path_formula, "sat");
     }
   } else {
-    // Stats::resume ("BMC path-based: SMT unsat core");
-    // --- Compute minimal unsat core of the path formula
-    bmc_detail::muc_method_t muc_method = MucMethod;
     if (!res) {
       LOG("bmc", get_os() << "SMT proved unsat. Size of path formula="
                           << path_formula.size() << ". ");
     } else {
-      muc_method = bmc_detail::MUC_NONE;
       res = false;
       m_incomplete = true;
       LOG("bmc", get_os() << "SMT returned unknown. Size of path formula="
@@ -1018,34 +1242,6 @@ boost::tribool PathBasedBmcEngine::path_encoding_and_solve_with_smt(
       }
     }
 
-    ExprVector unsat_core;
-    switch (muc_method) {
-    case bmc_detail::MUC_NONE: {
-      unsat_core.assign(path_formula.begin(), path_formula.end());
-      break;
-    }
-    case bmc_detail::MUC_DELETION: {
-      deletion_muc muc(m_aux_smt_solver);
-      muc.run(path_formula, unsat_core);
-      LOG("bmc-unsat-core", errs() << "\n"; muc.print_stats(errs()));
-      break;
-    }
-    case bmc_detail::MUC_BINARY_SEARCH: {
-      binary_search_muc muc(m_aux_smt_solver);
-      muc.run(path_formula, unsat_core);
-      LOG("bmc-unsat-core", errs() << "\n"; muc.print_stats(errs()));
-      break;
-    }
-    case bmc_detail::MUC_ASSUMPTIONS:
-    default: {
-      muc_with_assumptions muc(m_aux_smt_solver);
-      muc.run(path_formula, unsat_core);
-      LOG("bmc-unsat-core", errs() << "\n"; muc.print_stats(errs()));
-      break;
-    }
-    }
-    // Stats::stop ("BMC path-based: SMT unsat core");
-
     LOG("bmc", get_os() << "Size of unsat core=" << unsat_core.size() << "\n";
         // errs() << "unsat core=\n";
         // for (auto e: unsat_core) {
@@ -1053,20 +1249,8 @@ boost::tribool PathBasedBmcEngine::path_encoding_and_solve_with_smt(
         // }
     );
 
-    // Stats::resume ("BMC path-based: blocking clause");
     // -- Refine the Boolean abstraction using the unsat core
-    ExprSet active_bool_set;
-    for (Expr e : unsat_core) {
-      auto it = active_bool_map.find(e);
-      // It's possible that an implicant has no active booleans.
-      // For instance, corner cases where the whole program is a
-      // single block.
-      if (it != active_bool_map.end()) {
-        active_bool_set.insert(it->second);
-      }
-    }
-    m_active_bool_lits.assign(active_bool_set.begin(), active_bool_set.end());
-    // Stats::stop ("BMC path-based: blocking clause");
+    get_active_bool_lits(unsat_core, active_bool_map, m_active_bool_lits);
   }
 
   return res;
@@ -1078,8 +1262,8 @@ PathBasedBmcEngine::PathBasedBmcEngine(LegacyOperationalSemantics &sem,
                                        crab_llvm::CrabLlvmPass *crab,
                                        const TargetLibraryInfo &tli)
     : BmcEngine(sem, zctx), m_incomplete(false), m_num_paths(0),
-      m_aux_smt_solver(zctx), m_tli(tli), m_model(zctx), m_ls(nullptr),
-      m_crab_global(crab), m_crab_path(nullptr) {
+      m_aux_smt_solver(zctx), m_tli(tli), m_ls(nullptr), m_crab_global(crab),
+      m_crab_path(nullptr) {
   // Tuning m_aux_smt_solver
   ufo::z3n_set_param(":model_compress", false);
   ufo::z3n_set_param(":proof", false);
@@ -1093,7 +1277,7 @@ PathBasedBmcEngine::PathBasedBmcEngine(LegacyOperationalSemantics &sem,
                                        ufo::EZ3 &zctx,
                                        const TargetLibraryInfo &tli)
     : BmcEngine(sem, zctx), m_incomplete(false), m_num_paths(0),
-      m_aux_smt_solver(zctx), m_tli(tli), m_model(zctx), m_ls(nullptr) {
+      m_aux_smt_solver(zctx), m_tli(tli), m_ls(nullptr) {
   // Tuning m_aux_smt_solver
   ufo::z3n_set_param(":model_compress", false);
   ufo::z3n_set_param(":proof", false);
@@ -1156,23 +1340,17 @@ void PathBasedBmcEngine::toSmtLib(const ExprVector &f, std::string prefix) {
   }
 
   // dump the formula to the file descriptor
-  m_aux_smt_solver.reset();
-  for (Expr e : f) {
-    m_aux_smt_solver.assertExpr(e);
-  }
-  m_aux_smt_solver.toSmtLib(fd);
-  m_aux_smt_solver.reset();
+  SmtLibWriter writer(fd);
+  writer.assertExprs(f);
+  writer.checkSat();
 }
 
 raw_ostream &PathBasedBmcEngine::toSmtLib(raw_ostream &o) {
   encode(false);
 
-  m_aux_smt_solver.reset();
-  for (Expr e : m_side) {
-    m_aux_smt_solver.assertExpr(e);
-  }
-  m_aux_smt_solver.toSmtLib(o);
-  m_aux_smt_solver.reset();
+  SmtLibWriter writer(o);
+  writer.assertExprs(m_side);
+  writer.checkSat();
   return o;
 }
 
@@ -1280,12 +1458,29 @@ boost::tribool PathBasedBmcEngine::solve() {
   }
 #endif
 
+  // -- a model of an earlier call may belong to a context of the old pool
+  m_model.reset();
+  m_pool.reset();
+  if (PathJobs > 1) {
+    if (m_efac.isConcurrent()) {
+      m_pool.reset(new PathSolverPool(m_efac, PathJobs));
+    } else {
+      errs() << "Path-based BMC: --horn-bmc-path-jobs requires a concurrent "
+                "expression factory. Solving paths sequentially.\n";
+    }
+  }
+
   /**
    * Main loop
    *
    * Use boolean abstraction to enumerate paths. Each time a path is
    * unsat, blocking clauses are added to avoid exploring the same
    * path.
+   *
+   * With m_pool, path formulas are solved by the threads of the pool
+   * while the enumeration continues. A path is blocked as a whole as
+   * soon as it is submitted, and the clause is strengthened once its
+   * unsat core is known.
    **/
   while ((bool)(m_result = path_solver(m_smt_solver))) {
     ++m_num_paths;
@@ -1341,6 +1536,25 @@ boost::tribool PathBasedBmcEngine::solve() {
       }
     }
 #endif
+    if (m_pool) {
+      get_active_bool_lits(trace.get_implicant_formula(),
+                           trace.get_implicant_bools_map(), m_active_bool_lits);
+      if (!add_blocking_clauses()) {
+        errs() << "Path-based BMC ERROR: same blocking clause again "
+               << __LINE__ << "\n";
+        m_result = boost::indeterminate;
+        return m_result;
+      }
+      m_pool->submit({m_num_paths, trace.get_implicant_formula(),
+                      trace.get_implicant_bools_map()});
+      // -- do not run too far ahead of the solvers: their unsat cores
+      // -- prune the enumeration
+      if (!apply_path_results(m_pool->pending() >= 2 * m_pool->size())) {
+        return m_result;
+      }
+      continue;
+    }
+
     Stats::resume("BMC path-based: solving path + learning clauses with SMT");
     // XXX: the semantics of invariants and path_constraints (e.g.,
     // linear integer arithmetic) might differ from the semantics used
@@ -1371,6 +1585,16 @@ boost::tribool PathBasedBmcEngine::solve() {
     }
   }
 
+  if (m_pool) {
+    // -- wait for the paths that are still being solved
+    while (m_pool->pending() > 0) {
+      if (!apply_path_results(true)) {
+        return m_result;
+      }
+    }
+    m_pool->stop();
+  }
+
   if (m_incomplete) {
     m_result = indeterminate;
 
@@ -1406,7 +1630,7 @@ boost::tribool PathBasedBmcEngine::solve() {
         res = ss.get().solve();
       }
       if (res) {
-        m_model = m_aux_smt_solver.getModel();
+        m_model.reset(new ufo::ZModel<ufo::EZ3>(m_aux_smt_solver.getModel()));
         if (SmtOutDir != "") {
           toSmtLib(kv.second, "sat");
         }
@@ -1446,6 +1670,46 @@ boost::tribool PathBasedBmcEngine::solve() {
   return m_result;
 }
 
+bool PathBasedBmcEngine::apply_path_results(bool block) {
+  PathSolverPool::Result r;
+  while (m_pool->collect(r, block)) {
+    block = false;
+    if (r.res) {
+      // -- the contexts of the pool are ours once it is stopped
+      m_pool->stop();
+      m_model = std::move(r.model);
+      if (SmtOutDir != "") {
+        toSmtLib(r.job.formula, "sat");
+      }
+      LOG("bmc", get_os(true) << "Path " << r.job.id << " proved sat!\n";);
+      m_result = (bool)true;
+      return false;
+    }
+
+    if (!r.res) {
+      LOG("bmc", get_os(true) << "Path " << r.job.id
+                              << " proved unsat. Size of unsat core="
+                              << r.core.size() << "\n";);
+      Stats::count("BMC number symbolic paths discharged by SMT");
+    } else {
+      m_incomplete = true;
+      LOG("bmc", get_os(true) << "Path " << r.job.id
+                              << ": SMT returned unknown\n";);
+      Stats::count("BMC total number of unknown symbolic paths");
+      if (SmtOutDir != "") {
+        toSmtLib(r.job.formula, "unknown");
+      }
+      m_unknown_path_formulas.push(std::make_pair(r.job.id, r.job.formula));
+    }
+
+    // -- the clause repeats the one that blocked the whole path when the
+    // -- core is the whole path formula. That is expected here.
+    get_active_bool_lits(r.core, r.job.bool_map, m_active_bool_lits);
+    add_blocking_clauses();
+  }
+  return true;
+}
+
 bool PathBasedBmcEngine::add_blocking_clauses() {
   Stats::resume("BMC path-based: adding blocking clauses");
 
@@ -1470,13 +1734,13 @@ bool PathBasedBmcEngine::add_blocking_clauses() {
 
 BmcTrace PathBasedBmcEngine::getTrace() {
   assert((bool)m_result);
-  BmcTrace trace(*this, m_model);
+  BmcTrace trace(*this, *m_model);
   return trace;
 }
 
 ufo::ZModel<ufo::EZ3> PathBasedBmcEngine::getModel() {
   assert((bool)m_result);
-  return m_model;
+  return *m_model;
 }
 
 // This is intending only for debugging purposes
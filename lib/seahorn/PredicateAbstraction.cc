@@ -113,6 +113,7 @@ namespace seahorn
     }
     outs () << "\n";
     Stats::stop("Pabs solve");
+    hm.getZContext ().flushMarshalStats ();
     return false;
   }
   
@@ -19,17 +19,61 @@ namespace seahorn
       
     std::swap (m_Parent, o.m_Parent);
     std::swap (m_ownedParent, o.m_ownedParent);
-    std::swap (m_Store, o.m_Store);
+    m_Store.swap (o.m_Store);
+    std::swap (m_frozen, o.m_frozen);
+    std::swap (m_size, o.m_size);
     std::swap (m_trackUse, o.m_trackUse);
     std::swap (m_uses, o.m_uses);
     std::swap (m_defs, o.m_defs);
     std::swap (m_defs_sz, o.m_defs_sz);
   }  
   
+  const Expr *SymStore::lookup (const Expr &key) const
+  {
+    if (const Expr *val = m_Store.lookup (key)) return val;
+    for (const Layer *l = m_frozen.get (); l; l = l->m_below.get ())
+      if (const Expr *val = l->m_map.lookup (key)) return val;
+    return nullptr;
+  }
+
+  SymStore::LayerPtr SymStore::freeze () const
+  {
+    if (m_Store.empty ()) return m_frozen;
+
+    std::shared_ptr<Layer> top = std::make_shared<Layer> ();
+    top->m_map.swap (m_Store);
+    top->m_below = m_frozen;
+
+    // -- every layer is more than twice the size of the layer above it.
+    // -- Layers below are shared, so merging copies them
+    while (top->m_below &&
+           top->m_below->m_map.size () <= 2 * top->m_map.size ())
+    {
+      std::shared_ptr<Layer> merged = std::make_shared<Layer> ();
+      merged->m_map = top->m_below->m_map;
+      for (auto kv : top->m_map) merged->m_map[kv.first] = kv.second;
+      merged->m_below = top->m_below->m_below;
+      top = merged;
+    }
+
+    m_frozen = top;
+    return m_frozen;
+  }
+
+  void SymStore::flatten () const
+  {
+    if (!m_frozen) return;
+    for (const Layer *l = m_frozen.get (); l; l = l->m_below.get ())
+      for (auto kv : l->m_map)
+        // -- writes in upper layers take precedence
+        m_Store.insert (kv.first, kv.second);
+    m_frozen.reset ();
+  }
+  
   void SymStore::print (llvm::raw_ostream &out)
   {
     out << "SYMSTORE BEGIN\n";
-    for (auto p : m_Store)
+    for (auto p : *this)
       out << *p.first << ": " << *p.second << "\n";
     out << "SYMSTORE END\n";
   }
@@ -39,6 +83,7 @@ namespace seahorn
   { 
     assert (!isValue (key));
     
+    if (!isDefined (key)) ++m_size;
     m_Store[key] = val; 
     if (m_trackUse) m_defs.push_back (key);
   }
@@ -123,8 +168,8 @@ namespace seahorn
   {
     VisitAction seahorn::detail::SymStoreEvalVisitor::operator() (Expr exp) const
     {
-      if (m_store.isDefined (exp))
-        return VisitAction::changeTo (m_store.at (exp));
+      if (Expr val = m_store.at (exp))
+        return VisitAction::changeTo (val);
       
       else if (expr::op::bind::isFdecl (exp) || isOpX<BIND> (exp))
         return VisitAction::skipKids ();
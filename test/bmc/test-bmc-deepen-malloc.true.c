@@ -0,0 +1,27 @@
+// RUN: %sea bpf -O0 --bmc=mono --horn-bv2=true --horn-bmc-deepen=3 --inline "%s" 2>&1 | OutputCheck %s
+// CHECK: ^unknown$
+
+/* The block allocated after the loop is encoded at every depth and then
+   dropped. Blocks allocated by later iterations must still be disjoint from
+   the first one */
+
+#include <stdlib.h>
+
+extern int nd(void);
+extern void __VERIFIER_error(void) __attribute__((noreturn));
+#define assert(X) if(!(X)){__VERIFIER_error();}
+
+int main(){
+  int *first = (int *)malloc(sizeof(int));
+  int *p = first;
+  *first = 42;
+  while(nd()) {
+    p = (int *)malloc(sizeof(int));
+    *p = 0;
+  }
+  int *r = (int *)malloc(sizeof(int));
+  *r = *p;
+
+  assert (*first == 42);
+  return 0;
+}
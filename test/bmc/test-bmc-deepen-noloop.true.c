@@ -0,0 +1,18 @@
+// RUN: %sea bpf -O0 --bmc=mono --horn-bmc-deepen=5 --horn-stats --inline "%s" 2>&1 | OutputCheck %s
+// CHECK: ^unsat$
+
+/* Without a loop, the first depth covers every execution */
+
+extern int nd(void);
+extern void __VERIFIER_error(void) __attribute__((noreturn));
+#define assert(X) if(!(X)){__VERIFIER_error();}
+
+int main(){
+  int x;
+  x=nd();
+  if (x < 0)
+    x = -x;
+
+  assert (x != -1);
+  return 0;
+}
@@ -0,0 +1,23 @@
+// RUN: %sea bpf -O0 --bmc=mono --horn-bmc-deepen=5 --inline "%s" 2>&1 | OutputCheck %s
+// CHECK: expects a single loop
+// CHECK-NOT: ^unsat$
+
+/* Two loops in sequence are rejected */
+
+extern int nd(void);
+extern void __VERIFIER_error(void) __attribute__((noreturn));
+#define assert(X) if(!(X)){__VERIFIER_error();}
+
+int main(){
+  int x,y;
+  x=0; y=0;
+  while(nd()) {
+    x++;
+  }
+  while(nd()) {
+    y++;
+  }
+
+  assert (x>=0 && y>=0);
+  return 0;
+}
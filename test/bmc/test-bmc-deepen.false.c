@@ -0,0 +1,19 @@
+// RUN: %sea bpf -O0 --bmc=mono --horn-bmc-deepen=5 --horn-stats --inline "%s" 2>&1 | OutputCheck %s
+// CHECK: ^sat$
+
+/* Incremental BMC finds the error in the third iteration */
+
+extern int nd(void);
+extern void __VERIFIER_error(void) __attribute__((noreturn));
+#define assert(X) if(!(X)){__VERIFIER_error();}
+
+int main(){
+  int x;
+  x=0;
+  while(nd()) {
+    x++;
+  }
+
+  assert (x<3);
+  return 0;
+}
@@ -0,0 +1,25 @@
+// RUN: %sea bpf -O0 --bmc=mono --horn-bmc-deepen=5 --horn-stats --inline "%s" 2>&1 | OutputCheck %s
+// CHECK: ^unknown$
+
+/* No error within 5 iterations, but the loop may run longer */
+
+extern int nd(void);
+extern void __VERIFIER_error(void) __attribute__((noreturn));
+#define assert(X) if(!(X)){__VERIFIER_error();}
+
+int main(){
+  int x,y;
+  x=1; y=1;
+  while(nd()) {
+    if (nd()) {
+      x++;
+      y++;
+    }
+    if (nd()) {
+      x++;
+    }
+  }
+
+  assert (x>=y);
+  return 0;
+}
@@ -0,0 +1,48 @@
+// RUN: %sea bpf -O0 --horn-bmc-crab=false --bmc=path --bound=10 --horn-stats --inline "%s" 2>&1 | OutputCheck %s
+// RUN: %sea bpf -O0 --horn-bmc-crab=false --bmc=path --horn-bmc-path-jobs=4 --bound=10 --horn-stats --inline "%s" 2>&1 | OutputCheck %s
+// CHECK: ^sat$
+
+/**
+ * Path-based BMC gives the same answer when path formulas are solved by
+ * a pool of threads.
+ **/
+
+extern int nd(void);
+extern void __VERIFIER_error(void) __attribute__((noreturn));
+#define assert(X) if(!(X)){__VERIFIER_error();}
+
+#define ENSURE_DIFFERENT_BLOCK while(nd()){}
+
+int main(){
+  int x,y;
+  x=1; y=1;
+
+  if (nd()) {
+    x++;
+    y++;
+  }
+
+  ENSURE_DIFFERENT_BLOCK;;
+
+  if (nd()) {
+    x++;
+    y++;
+  }
+
+  ENSURE_DIFFERENT_BLOCK;;
+
+  if (nd()) {
+    x++;
+    y++;
+  }
+
+  ENSURE_DIFFERENT_BLOCK;;
+
+  if (nd()) {
+    x++;
+    y++;
+  }
+
+  assert (x>y);
+  return 0;
+}
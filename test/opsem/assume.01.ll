@@ -1,5 +1,6 @@
 ; RUN: %seabmc "%s" 2>&1 | %oc %s
 ; RUN: %seabmc --horn-bv2-lambdas --log=opsem3 "%s" 2>&1 | %oc %s
+; RUN: %seabmc --horn-bv2-bb-summaries "%s" 2>&1 | %oc %s
 
 ; CHECK: ^sat$
 ; ModuleID = 'assume.01.ll'
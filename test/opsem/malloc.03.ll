@@ -0,0 +1,54 @@
+; RUN: %seabmc --horn-bv2-malloc --sea-opsem-malloc-can-fail "%s" 2>&1 | %oc %s
+; CHECK: ^unsat$
+; malloc() of a block larger than the heap returns NULL
+target datalayout = "e-m:e-p:32:32-f64:32:64-f80:32-n8:16:32-S128"
+target triple = "i386-unknown-linux-gnu"
+
+
+; Function Attrs: nounwind
+declare noalias i8* @malloc(i32) local_unnamed_addr #2
+
+declare void @verifier.assume(i1)
+
+declare void @verifier.assume.not(i1)
+
+declare void @seahorn.fail()
+
+; Function Attrs: noreturn
+declare void @verifier.error() #3
+
+declare void @seahorn.fn.enter() local_unnamed_addr
+
+declare void @verifier.assert(i1)
+
+
+; Function Attrs: nounwind
+define i32 @main() local_unnamed_addr #0 {
+entry:
+  call void @seahorn.fn.enter() #4
+  %p = call noalias i8* @malloc(i32 -268435456) #4
+  %0 = icmp eq i8* %p, null
+  call void @verifier.assume.not(i1 %0)
+  br label %verifier.error
+
+verifier.error:                                   ; preds = %entry
+  call void @seahorn.fail()
+  ret i32 42
+}
+
+declare i1 @nondet.bool()
+
+declare i32 @nondet.int()
+
+attributes #0 = { nounwind "correctly-rounded-divide-sqrt-fp-math"="false" "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="false" "no-infs-fp-math"="false" "no-jump-tables"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "no-trapping-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="pentium4" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+attributes #1 = { argmemonly nounwind }
+attributes #2 = { "correctly-rounded-divide-sqrt-fp-math"="false" "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="false" "no-infs-fp-math"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "no-trapping-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="pentium4" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+attributes #3 = { noreturn }
+attributes #4 = { nounwind }
+
+!llvm.module.flags = !{!0, !1}
+!llvm.ident = !{!2}
+
+!0 = !{i32 1, !"NumRegisterParameters", i32 0}
+!1 = !{i32 1, !"wchar_size", i32 4}
+!2 = !{!"clang version 5.0.1 (tags/RELEASE_501/final)"}
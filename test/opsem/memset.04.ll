@@ -0,0 +1,50 @@
+; RUN: %seabmc --horn-bv2-lambdas "%s" 2>&1 | %oc %s
+
+; memset of a length that is not a multiple of the word size writes only
+; the words that fit in the range
+; CHECK: ^unsat$
+target datalayout = "e-m:e-p:32:32-f64:32:64-f80:32-n8:16:32-S128"
+target triple = "i386-unknown-linux-gnu"
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.memset.p0i8.i32(i8* nocapture writeonly, i8, i32, i32, i1) #1
+
+declare void @verifier.assume(i1)
+
+declare void @verifier.assume.not(i1)
+
+declare void @seahorn.fail()
+
+; Function Attrs: noreturn
+declare void @verifier.error() #2
+
+declare void @seahorn.fn.enter() local_unnamed_addr
+
+; Function Attrs: nounwind
+define i32 @main() local_unnamed_addr #0 {
+entry:
+  %buf = alloca [16 x i8], align 4
+  call void @seahorn.fn.enter() #3
+  %0 = getelementptr inbounds [16 x i8], [16 x i8]* %buf, i32 0, i32 0
+  %1 = getelementptr inbounds [16 x i8], [16 x i8]* %buf, i32 0, i32 4
+  %2 = bitcast i8* %1 to i32*
+  store i32 7, i32* %2, align 4
+  call void @llvm.memset.p0i8.i32(i8* %0, i8 12, i32 6, i32 4, i1 false) #3
+  %3 = bitcast i8* %0 to i32*
+  %4 = load i32, i32* %3, align 4
+  %5 = load i32, i32* %2, align 4
+  %6 = icmp eq i32 %4, 202116108  ; 0x0C0C0C0C
+  %7 = icmp eq i32 %5, 7
+  %8 = and i1 %6, %7
+  call void @verifier.assume.not(i1 %8)
+  br label %verifier.error
+
+verifier.error:                                   ; preds = %entry
+  call void @seahorn.fail()
+  ret i32 42
+}
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+attributes #2 = { noreturn }
+attributes #3 = { nounwind }
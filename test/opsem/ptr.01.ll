@@ -1,6 +1,8 @@
 ; Confuse pointers to the stack. Write to them. Expect no aliasing
 ; RUN: %seabmc "%s" 2>&1 | %oc %s
 ; RUN: %seabmc --horn-bv2-lambdas --log=opsem3 "%s" 2>&1 | %oc %s
+; RUN: %seabmc --horn-bv2-region-index-bits=16 "%s" 2>&1 | %oc %s
+; RUN: %seabmc --horn-bv2-bb-summaries "%s" 2>&1 | %oc %s
 
 ; CHECK: ^unsat$
 ; ModuleID = 'ptr.01.ll'
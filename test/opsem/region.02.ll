@@ -0,0 +1,49 @@
+; A memory region of a single object that fits in the region index is
+; indexed by offset
+; RUN: %seabmc "%s" 2>&1 | %oc %s
+; RUN: %seabmc --horn-bv2-region-index-bits=4 "%s" 2>&1 | %oc %s
+
+; CHECK: ^unsat$
+; ModuleID = 'region.02.ll'
+source_filename = "../test/bmc/test-bmc-1.false.c"
+target datalayout = "e-m:o-p:32:32-f64:32:64-f80:128-n8:16:32-S128"
+target triple = "i386-apple-macosx10.13.0"
+
+declare i32 @nd() local_unnamed_addr #0
+
+declare void @verifier.assume(i1)
+declare void @verifier.assume.not(i1)
+declare void @seahorn.fail()
+
+; Function Attrs: noreturn
+declare void @verifier.error() #1
+
+; Function Attrs: nounwind ssp uwtable
+define i32 @main() local_unnamed_addr #2 {
+entry:
+  %x = alloca [4 x i32], align 4
+  %p0 = getelementptr inbounds [4 x i32], [4 x i32]* %x, i32 0, i32 0
+  %p1 = getelementptr inbounds [4 x i32], [4 x i32]* %x, i32 0, i32 1
+  store i32 1, i32* %p0, align 4
+  store i32 2, i32* %p1, align 4
+  %v = load i32, i32* %p0, align 4
+  %ok = icmp eq i32 %v, 1
+  call void @verifier.assume.not(i1 %ok)
+  br label %verifier.error
+
+verifier.error:
+  call void @seahorn.fail()
+  ret i32 42
+}
+
+attributes #0 = { "correctly-rounded-divide-sqrt-fp-math"="false" "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "no-trapping-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="penryn" "target-features"="+cx16,+fxsr,+mmx,+sse,+sse2,+sse3,+sse4.1,+ssse3,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+attributes #1 = { noreturn }
+attributes #2 = { nounwind ssp uwtable "correctly-rounded-divide-sqrt-fp-math"="false" "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-jump-tables"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "no-trapping-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="penryn" "target-features"="+cx16,+fxsr,+mmx,+sse,+sse2,+sse3,+sse4.1,+ssse3,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+
+!llvm.module.flags = !{!0, !1, !2}
+!llvm.ident = !{!3}
+
+!0 = !{i32 1, !"NumRegisterParameters", i32 0}
+!1 = !{i32 1, !"wchar_size", i32 4}
+!2 = !{i32 7, !"PIC Level", i32 2}
+!3 = !{!"clang version 5.0.2 (tags/RELEASE_502/final)"}
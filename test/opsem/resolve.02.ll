@@ -0,0 +1,60 @@
+; Resolve loads while encoding: a forward from a store to the same address,
+; a skip over a store to another offset of the same base, and a stop at a
+; store to an unknown base. The first two loads cannot read other values
+; RUN: %seabmc "%s" 2>&1 | %oc %s
+; RUN: %seabmc --horn-bv2-resolve-loads=false "%s" 2>&1 | %oc %s
+; RUN: %seabmc --horn-stats "%s" 2>&1 | grep "BRUNCH_STAT opsem.mem.load.resolved"
+
+; CHECK: ^unsat$
+; ModuleID = 'resolve.02.ll'
+source_filename = "../test/bmc/test-bmc-1.false.c"
+target datalayout = "e-m:o-p:32:32-f64:32:64-f80:128-n8:16:32-S128"
+target triple = "i386-apple-macosx10.13.0"
+
+declare i32 @nd() local_unnamed_addr #0
+
+declare void @verifier.assume(i1)
+declare void @verifier.assume.not(i1)
+declare void @seahorn.fail()
+
+; Function Attrs: noreturn
+declare void @verifier.error() #1
+
+; Function Attrs: nounwind ssp uwtable
+define i32 @main() local_unnamed_addr #2 {
+entry:
+  %a = alloca [4 x i32], align 4
+  %p = getelementptr inbounds [4 x i32], [4 x i32]* %a, i32 0, i32 0
+  %q = getelementptr inbounds [4 x i32], [4 x i32]* %a, i32 0, i32 1
+  %nd1 = call i32 @nd()
+  %r = getelementptr inbounds [4 x i32], [4 x i32]* %a, i32 0, i32 %nd1
+  store i32 1, i32* %p, align 4
+  %l1 = load i32, i32* %p, align 4
+  store i32 2, i32* %q, align 4
+  %l2 = load i32, i32* %p, align 4
+  store i32 3, i32* %r, align 4
+  %l3 = load i32, i32* %p, align 4
+  %c1 = icmp eq i32 %l1, 1
+  %c2 = icmp eq i32 %l2, 1
+  %c3 = icmp eq i32 %l3, 3
+  %c12 = and i1 %c1, %c2
+  call void @verifier.assume(i1 %c3)
+  call void @verifier.assume.not(i1 %c12)
+  br label %verifier.error
+
+verifier.error:
+  call void @seahorn.fail()
+  ret i32 42
+}
+
+attributes #0 = { "correctly-rounded-divide-sqrt-fp-math"="false" "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "no-trapping-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="penryn" "target-features"="+cx16,+fxsr,+mmx,+sse,+sse2,+sse3,+sse4.1,+ssse3,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+attributes #1 = { noreturn }
+attributes #2 = { nounwind ssp uwtable "correctly-rounded-divide-sqrt-fp-math"="false" "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-jump-tables"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "no-trapping-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="penryn" "target-features"="+cx16,+fxsr,+mmx,+sse,+sse2,+sse3,+sse4.1,+ssse3,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+
+!llvm.module.flags = !{!0, !1, !2}
+!llvm.ident = !{!3}
+
+!0 = !{i32 1, !"NumRegisterParameters", i32 0}
+!1 = !{i32 1, !"wchar_size", i32 4}
+!2 = !{i32 7, !"PIC Level", i32 2}
+!3 = !{!"clang version 5.0.2 (tags/RELEASE_502/final)"}
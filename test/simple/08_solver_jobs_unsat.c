@@ -0,0 +1,22 @@
+// RUN: %sea pf "%s" --horn-solver-jobs=1 2>&1 | OutputCheck %s
+// RUN: %sea pf "%s" --horn-solver-jobs=4 2>&1 | OutputCheck %s
+// CHECK: ^unsat$
+
+#include "seahorn/seahorn.h"
+extern int unknown1();
+
+// -- an assertion before and one after the loop give two error rules,
+// -- which --horn-solver-jobs solves as separate parts
+int main() {
+  int x = unknown1();
+  int y = 1;
+  sassert(y == 1);
+  if (x < 0)
+    x = 0;
+  while (unknown1()) {
+    x++;
+    y++;
+  }
+  sassert(y >= 1);
+  sassert(x >= 0);
+}
@@ -0,0 +1,20 @@
+// RUN: %sea pf "%s" --horn-solver-jobs=1 2>&1 | OutputCheck %s
+// RUN: %sea pf "%s" --horn-solver-jobs=4 2>&1 | OutputCheck %s
+// CHECK: ^sat$
+
+#include "seahorn/seahorn.h"
+extern int unknown1();
+
+// -- only the part of the second error rule is sat
+int main() {
+  int x = unknown1();
+  int y = 1;
+  sassert(y == 1);
+  if (x < 0)
+    x = 0;
+  while (unknown1()) {
+    x++;
+    y++;
+  }
+  sassert(y < 8);
+}
@@ -0,0 +1,22 @@
+// RUN: rm -rf %t.cache
+// RUN: %sea pf "%s" --horn-inv-cache=%t.cache 2>&1 | OutputCheck %s
+// RUN: %sea pf "%s" --horn-inv-cache=%t.cache 2>&1 | OutputCheck %s
+// RUN: %sea pf "%s" --horn-inv-cache=%t.cache --horn-stats 2>&1 | grep "BRUNCH_STAT HornInvCache.hit"
+// CHECK: ^unsat$
+
+#include "seahorn/seahorn.h"
+extern int unknown1();
+
+// -- the first run stores the invariant of the loop, the others load it
+int main() {
+  int x = 1;
+  int y = 1;
+  while (unknown1()) {
+    int t1 = x;
+    int t2 = y;
+    x = t1 + t2;
+    y = t1 + t2;
+  }
+  sassert(y >= 1);
+  sassert(x == y || x == 1);
+}
@@ -0,0 +1,22 @@
+// RUN: %sea pf "%s" --horn-answer 2>&1 | OutputCheck %s
+// RUN: %sea pf "%s" --horn-preprocess --horn-answer 2>&1 | OutputCheck %s
+// RUN: %sea pf "%s" --horn-preprocess --horn-stats 2>&1 | grep "BRUNCH_STAT HornPreprocess.rules.after"
+// CHECK: ^unsat$
+// CHECK-NOT: ^Warning: could not convert
+// CHECK: ^Function: main$
+// CHECK: ^main@[^:]*:( \(|$)
+
+#include "seahorn/seahorn.h"
+extern int unknown1();
+
+// -- with --horn-preprocess the model of the preprocessed clauses is
+// -- converted back, so the loop of main still gets an invariant
+int main() {
+  int x = 0;
+  int y = 0;
+  while (unknown1()) {
+    x++;
+    y = y + 2;
+  }
+  sassert(y == 2 * x);
+}
@@ -398,7 +398,7 @@ int main(int argc, char **argv) {
     if (PredAbs)
       pass_manager.add(new seahorn::PredicateAbstraction());
     if (Solve) {
-      pass_manager.add(new seahorn::HornSolver());
+      pass_manager.add(new seahorn::HornSolver(Cex));
       if (Cex)
         pass_manager.add(new seahorn::HornCex(BmcEngine));
     }
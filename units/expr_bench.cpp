@@ -0,0 +1,198 @@
+/**
+   Micro-benchmarks for the Expr library.
+
+   Not a test. Build with `make expr_bench` and run by hand; each benchmark
+   prints a single line with its throughput.
+ */
+#include "seahorn/Expr/Expr.hh"
+#include "seahorn/Expr/ExprIdMap.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+using namespace expr;
+
+namespace {
+class BenchTimer {
+  std::chrono::steady_clock::time_point m_start;
+
+public:
+  BenchTimer() : m_start(std::chrono::steady_clock::now()) {}
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         m_start)
+        .count();
+  }
+};
+
+void report(const char *name, size_t ops, double secs) {
+  std::printf("%-28s %12zu ops %8.3f s %12.0f ops/s\n", name, ops, secs,
+              ops / secs);
+}
+
+void mkVars(unsigned n, ExprFactory &efac, ExprVector &out) {
+  for (unsigned i = 0; i < n; ++i)
+    out.push_back(
+        bind::intConst(mkTerm<std::string>("v" + std::to_string(i), efac)));
+}
+
+/// Creates fresh nodes: every mk<> is a miss in the unique table
+void benchMkFresh(unsigned numVars, unsigned rounds) {
+  ExprFactory efac;
+  ExprVector vars;
+  mkVars(numVars, efac, vars);
+
+  ExprVector live;
+  live.reserve(numVars * rounds);
+  size_t ops = 0;
+  BenchTimer t;
+  Expr acc = vars[0];
+  for (unsigned r = 0; r < rounds; ++r)
+    for (unsigned i = 0; i < numVars; ++i) {
+      acc = mk<PLUS>(acc, vars[i]);
+      live.push_back(
+          mk<ITE>(mk<LT>(acc, vars[i]), acc, vars[(i + r) % numVars]));
+      ops += 3;
+    }
+  report("mk.fresh", ops, t.seconds());
+  std::printf("%-28s %12zu bytes %8.1f bytes/node\n", "mk.fresh.footprint",
+              efac.allocatedBytes(),
+              static_cast<double>(efac.allocatedBytes()) / ops);
+}
+
+/// Re-creates existing nodes: every mk<> is a hit in the unique table
+void benchMkShared(unsigned numVars, unsigned rounds) {
+  ExprFactory efac;
+  ExprVector vars;
+  mkVars(numVars, efac, vars);
+
+  ExprVector live;
+  for (unsigned i = 0; i + 1 < numVars; ++i)
+    live.push_back(mk<AND>(mk<EQ>(vars[i], vars[i + 1]),
+                           mk<LEQ>(vars[i], vars[i + 1])));
+
+  size_t ops = 0;
+  BenchTimer t;
+  for (unsigned r = 0; r < rounds; ++r)
+    for (unsigned i = 0; i + 1 < numVars; ++i) {
+      Expr e = mk<AND>(mk<EQ>(vars[i], vars[i + 1]),
+                       mk<LEQ>(vars[i], vars[i + 1]));
+      (void)e;
+      ops += 3;
+    }
+  report("mk.shared", ops, t.seconds());
+}
+
+/// Creates and immediately drops nodes: exercises insert and remove
+void benchMkChurn(unsigned numVars, unsigned rounds) {
+  ExprFactory efac;
+  ExprVector vars;
+  mkVars(numVars, efac, vars);
+
+  size_t ops = 0;
+  BenchTimer t;
+  for (unsigned r = 0; r < rounds; ++r)
+    for (unsigned i = 0; i < numVars; ++i) {
+      Expr e = mk<MULT>(vars[i], mkTerm<mpz_class>(mpz_class(r), efac));
+      ops += 2;
+    }
+  report("mk.churn", ops, t.seconds());
+}
+
+/// Visits a deep, heavily shared DAG with the dagVisit based helpers
+void benchDagVisit(unsigned depth, unsigned rounds) {
+  ExprFactory efac;
+  ExprVector vars;
+  mkVars(16, efac, vars);
+
+  Expr acc = vars[0];
+  for (unsigned i = 0; i < depth; ++i)
+    acc = mk<ITE>(mk<LT>(acc, vars[i % 16]), mk<PLUS>(acc, vars[i % 16]), acc);
+
+  size_t ops = 0;
+  BenchTimer t;
+  for (unsigned r = 0; r < rounds; ++r)
+    ops += dagSize(acc);
+  report("visit.dagSize", ops, t.seconds());
+
+  ops = 0;
+  BenchTimer t2;
+  for (unsigned r = 0; r < rounds; ++r) {
+    Expr e = replaceAll(acc, vars[r % 16], vars[(r + 1) % 16]);
+    ops += depth * 3;
+  }
+  report("visit.replaceAll", ops, t2.seconds());
+}
+/// Builds the same expressions from several threads on a shared factory
+void benchMkConcurrent(unsigned numThreads, unsigned numVars,
+                       unsigned rounds) {
+  ExprFactory efac(true);
+  ExprVector vars;
+  mkVars(numVars, efac, vars);
+
+  BenchTimer t;
+  std::vector<std::thread> workers;
+  for (unsigned w = 0; w < numThreads; ++w)
+    workers.emplace_back([&]() {
+      ExprVector live;
+      for (unsigned r = 0; r < rounds; ++r)
+        for (unsigned i = 0; i + 1 < numVars; ++i)
+          live.push_back(mk<PLUS>(mk<MULT>(vars[i], vars[i + 1]),
+                                  mkTerm<unsigned>(r, efac)));
+    });
+  for (auto &w : workers)
+    w.join();
+  report(("mk.concurrent." + std::to_string(numThreads)).c_str(),
+         size_t(3) * numThreads * rounds * (numVars - 1), t.seconds());
+}
+
+/// Looks up all of keys in a Map that holds every other one of them
+template <typename Map>
+void benchLookup(const char *name, const ExprVector &keys, unsigned rounds) {
+  Map m;
+  for (size_t i = 0; i < keys.size(); i += 2)
+    m[keys[i]] = keys[i];
+
+  size_t ops = 0, hits = 0;
+  BenchTimer t;
+  for (unsigned r = 0; r < rounds; ++r)
+    for (const Expr &k : keys) {
+      hits += m.count(k);
+      ++ops;
+    }
+  report(name, ops, t.seconds());
+  if (hits != ops / 2)
+    std::printf("unexpected number of hits: %zu\n", hits);
+}
+
+void benchMapLookup(unsigned numKeys, unsigned rounds) {
+  ExprFactory efac;
+  ExprVector vars, keys;
+  mkVars(16, efac, vars);
+  for (unsigned i = 0; i < numKeys; ++i)
+    keys.push_back(mk<PLUS>(vars[i % 16], mkTerm<unsigned>(i, efac)));
+  // -- look keys up in an order unrelated to their ids
+  for (size_t i = 0; i < keys.size(); ++i)
+    std::swap(keys[i], keys[(i * 7919) % keys.size()]);
+
+  benchLookup<ExprMap>("lookup.ExprMap", keys, rounds);
+  benchLookup<std::unordered_map<Expr, Expr>>("lookup.unordered_map", keys,
+                                              rounds);
+  benchLookup<ExprIdMap<Expr, true>>("lookup.ExprIdMap", keys, rounds);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  benchMkFresh(1000, 200);
+  benchMkShared(1000, 500);
+  benchMkChurn(1000, 200);
+  benchDagVisit(2000, 200);
+  benchMapLookup(100000, 20);
+  benchMkConcurrent(1, 1000, 200);
+  benchMkConcurrent(std::max(2u, std::thread::hardware_concurrency()), 1000,
+                    200);
+  return 0;
+}
@@ -0,0 +1,264 @@
+#include "seahorn/Expr/Expr.hh"
+#include "seahorn/Expr/ExprIdMap.hh"
+
+#include "doctest.h"
+
+#include <thread>
+
+TEST_CASE("expr.hash_cons") {
+  using namespace std;
+  using namespace expr;
+
+  ExprFactory efac;
+
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+
+  // -- structurally equal expressions are pointer equal
+  CHECK(mk<PLUS>(x, y) == mk<PLUS>(x, y));
+  CHECK(mkTerm<unsigned>(5, efac) == mkTerm<unsigned>(5, efac));
+
+  // -- same children, different operators
+  CHECK(mk<PLUS>(x, y) != mk<MINUS>(x, y));
+  CHECK(mk<PLUS>(x, y) != mk<PLUS>(y, x));
+  // -- terminals of different types with equal hashes
+  CHECK(mkTerm<int>(5, efac) != mkTerm<unsigned>(5, efac));
+  // -- different arity
+  Expr args[] = {x, y, x};
+  CHECK(mknary<PLUS>(args) != mk<PLUS>(x, y));
+
+  // -- grow the table, drop most of it, and check that survivors are found
+  ExprVector keep;
+  unsigned keepId = 0;
+  {
+    ExprVector all;
+    for (unsigned i = 0; i < 20000; ++i) {
+      Expr e = mk<PLUS>(x, mkTerm<unsigned>(i, efac));
+      if (i % 7 == 0)
+        keep.push_back(e);
+      all.push_back(e);
+    }
+    keepId = keep.back()->getId();
+  }
+
+  for (unsigned i = 0, j = 0; i < 20000; i += 7, ++j)
+    CHECK(mk<PLUS>(x, mkTerm<unsigned>(i, efac)) == keep[j]);
+  CHECK(keep.back()->getId() == keepId);
+
+  // -- re-created nodes are new nodes
+  Expr e1 = mk<PLUS>(x, mkTerm<unsigned>(1, efac));
+  CHECK(e1->getId() > keepId);
+}
+
+TEST_CASE("expr.node_args") {
+  using namespace std;
+  using namespace expr;
+
+  ExprFactory efac;
+
+  ExprVector vars;
+  for (unsigned i = 0; i < 8; ++i)
+    vars.push_back(bind::intConst(mkTerm<string>("v" + to_string(i), efac)));
+
+  // -- nodes wider than the inline argument slots
+  Expr wide = mknary<PLUS>(vars);
+  CHECK(wide->arity() == vars.size());
+  CHECK(std::equal(wide->args_begin(), wide->args_end(), vars.begin()));
+  CHECK(wide == mknary<PLUS>(vars));
+  CHECK(wide->last() == vars.back());
+
+  // -- mutable nodes can outgrow their argument slots
+  Expr g = mk<AND_G>(vars[0], vars[1]);
+  CHECK(g->arity() == 2);
+  g->renew_args(vars.begin(), vars.end());
+  CHECK(g->arity() == vars.size());
+  CHECK(std::equal(g->args_begin(), g->args_end(), vars.begin()));
+  g->renew_args(vars.begin(), vars.begin() + 1);
+  CHECK(g->arity() == 1);
+  CHECK(g->left() == vars[0]);
+
+  // -- memory of dead nodes is reused
+  size_t used = efac.allocatedBytes();
+  {
+    Expr tmp = mk<MINUS>(wide, mknary<MULT>(vars));
+    CHECK(efac.allocatedBytes() > used);
+  }
+  CHECK(efac.allocatedBytes() == used);
+}
+
+TEST_CASE("expr.deep_chain") {
+  using namespace std;
+  using namespace expr;
+
+  ExprFactory efac;
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+
+  // -- releasing a long chain must not overflow the stack
+  size_t used = efac.allocatedBytes();
+  {
+    Expr acc = x;
+    for (unsigned i = 0; i < 500000; ++i)
+      acc = mk<PLUS>(acc, x);
+  }
+  CHECK(efac.allocatedBytes() == used);
+}
+
+TEST_CASE("expr.dag_visit") {
+  using namespace std;
+  using namespace expr;
+
+  ExprFactory efac;
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+
+  // -- shared sub-expressions are visited once
+  Expr s = mk<PLUS>(x, y);
+  Expr e = mk<MULT>(s, mk<MINUS>(s, x));
+  CHECK(dagSize(e) == 2 + dagSize(mk<PLUS>(x, y)));
+  CHECK(treeSize(e) == 2 + 2 * treeSize(s) + treeSize(x));
+  CHECK(replaceAll(e, x, y) == mk<MULT>(mk<PLUS>(y, y),
+                                        mk<MINUS>(mk<PLUS>(y, y), y)));
+
+  // -- deep expressions do not overflow the stack
+  Expr acc = x;
+  for (unsigned i = 0; i < 500000; ++i)
+    acc = mk<PLUS>(acc, mkTerm<unsigned>(i % 16, efac));
+  CHECK(dagSize(acc) == 500000 + 16 + dagSize(x));
+  Expr acc2 = replaceAll(acc, x, y);
+  CHECK(acc2 != acc);
+  CHECK(replaceAll(acc2, y, x) == acc);
+
+  // -- entries of a cache leave it when their keys die
+  DagVisitCache cache;
+  Expr k1 = mk<PLUS>(x, mkTerm<unsigned>(1, efac));
+  Expr k2 = mk<PLUS>(y, mkTerm<unsigned>(2, efac));
+  cache.insert(k1.get(), y);
+  cache.insert(k2.get(), k2);
+  CHECK(cache.size() == 2);
+  Expr hit;
+  CHECK(cache.lookup(k2.get(), hit));
+  CHECK(hit == k2);
+  k1.reset();
+  CHECK(cache.size() == 1);
+  // -- a result equal to its key does not keep the key alive
+  hit.reset();
+  k2.reset();
+  CHECK(cache.empty());
+}
+
+TEST_CASE("expr.id_map") {
+  using namespace std;
+  using namespace expr;
+
+  ExprFactory efac;
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+
+  // -- weak keys leave the map when they die
+  ExprIdMap<Expr> weak;
+  ExprIdSet set;
+  Expr k1 = mk<PLUS>(x, y);
+  weak[k1] = x;
+  weak.insert(x, y);
+  set.insert(k1);
+  set.insert(x);
+  CHECK(weak.size() == 2);
+  CHECK(weak.at(k1) == x);
+  CHECK(*weak.lookup(x) == y);
+  CHECK(set.count(k1) == 1);
+  CHECK_FALSE(weak.insert(x, x).second);
+  k1.reset();
+  CHECK(weak.size() == 1);
+  CHECK(set.size() == 1);
+  CHECK(weak.count(mk<PLUS>(x, y)) == 0);
+
+  // -- owned keys stay alive, iteration follows creation order
+  ExprIdMap<unsigned, true> owned;
+  std::vector<unsigned> ids;
+  for (unsigned i = 0; i < 1000; ++i) {
+    Expr k = mk<PLUS>(x, mkTerm<unsigned>(i, efac));
+    ids.push_back(k->getId());
+    owned[k] = i;
+  }
+  CHECK(owned.size() == 1000);
+  unsigned n = 0;
+  for (auto kv : owned) {
+    CHECK(kv.first->getId() == ids[n]);
+    CHECK(kv.second == n);
+    ++n;
+  }
+  CHECK(n == 1000);
+  CHECK(owned.at(mk<PLUS>(x, mkTerm<unsigned>(500, efac))) == 500);
+
+  // -- copies are independent
+  ExprIdMap<unsigned, true> copy(owned);
+  CHECK(copy.erase(mk<PLUS>(x, mkTerm<unsigned>(3, efac))) == 1);
+  CHECK(copy.size() == 999);
+  CHECK(owned.size() == 1000);
+
+  // -- erasing owned keys releases them
+  size_t used = efac.allocatedBytes();
+  owned.clear();
+  copy.clear();
+  CHECK(efac.allocatedBytes() < used);
+  CHECK(owned.begin() == owned.end());
+}
+
+TEST_CASE("expr.concurrent_factory") {
+  using namespace std;
+  using namespace expr;
+
+  ExprFactory efac(true);
+  CHECK(efac.isConcurrent());
+
+  ExprVector vars;
+  for (unsigned i = 0; i < 16; ++i)
+    vars.push_back(bind::intConst(mkTerm<string>("v" + to_string(i), efac)));
+  size_t used = efac.allocatedBytes();
+
+  const unsigned numThreads = 4, numExprs = 2000;
+  vector<ExprVector> built(numThreads);
+  vector<thread> workers;
+  for (unsigned t = 0; t < numThreads; ++t)
+    workers.emplace_back([&, t]() {
+      for (unsigned round = 0; round < 5; ++round) {
+        ExprVector &out = built[t];
+        out.clear();
+        for (unsigned i = 0; i < numExprs; ++i) {
+          Expr n = mkTerm<unsigned>(i, efac);
+          Expr e = mk<PLUS>(vars[i % 16], n);
+          out.push_back(mk<ITE>(mk<LT>(e, vars[(i + t) % 16]), e, n));
+          // -- nodes dropped here may be re-created by another thread
+          Expr tmp = mk<MULT>(e, vars[t]);
+        }
+      }
+    });
+  for (auto &w : workers)
+    w.join();
+
+  // -- equal expressions built by different threads are shared
+  for (unsigned i = 0; i < numExprs; ++i)
+    CHECK(built[0][i]->arg(1) == built[numThreads - 1][i]->arg(1));
+  {
+    Expr seven = mkTerm<unsigned>(7, efac);
+    Expr e7 = mk<PLUS>(vars[7], seven);
+    CHECK(built[0][7] == mk<ITE>(mk<LT>(e7, vars[7]), e7, seven));
+  }
+
+  built.clear();
+  CHECK(efac.allocatedBytes() == used);
+
+  // -- a cached value that dies with its key releases nodes while the
+  // -- caches are locked
+  {
+    ExprIdMap<Expr> weak;
+    Expr k = mk<PLUS>(vars[0], vars[1]);
+    Expr v = mk<MULT>(vars[2], vars[3]);
+    weak[k] = v;
+    weak[v] = vars[4];
+    v.reset();
+    k.reset();
+    CHECK(weak.empty());
+  }
+  CHECK(efac.allocatedBytes() == used);
+}
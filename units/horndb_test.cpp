@@ -0,0 +1,267 @@
+#include "seahorn/HornClauseDB.hh"
+#include "seahorn/HornClauseDBTransf.hh"
+#include "seahorn/HornDbModel.hh"
+
+#include "doctest.h"
+
+TEST_CASE("horndb.index") {
+  using namespace std;
+  using namespace expr;
+  using namespace seahorn;
+
+  ExprFactory efac;
+  HornClauseDB db(efac);
+
+  Expr intTy = sort::intTy(efac);
+  Expr boolTy = sort::boolTy(efac);
+  ExprVector sig = {intTy, boolTy};
+  Expr p = bind::fdecl(mkTerm<string>("p", efac), sig);
+  Expr q = bind::fdecl(mkTerm<string>("q", efac), sig);
+  db.registerRelation(p);
+  db.registerRelation(q);
+
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+  Expr zero = mkTerm<mpz_class>(0, efac);
+
+  // -- p(0).  p(x) -> p(x+1).  p(x) -> q(x).  q(x) & p(y) -> q(y)
+  ExprVector none, vx = {x}, vxy = {x, y};
+  db.addRule(none, bind::fapp(p, zero));
+  db.addRule(vx, mk<IMPL>(bind::fapp(p, x),
+                          bind::fapp(p, mk<PLUS>(x, mkTerm<mpz_class>(1, efac)))));
+  db.addRule(vx, mk<IMPL>(bind::fapp(p, x), bind::fapp(q, x)));
+  db.addRule(vxy, mk<IMPL>(mk<AND>(bind::fapp(q, x), bind::fapp(p, y)),
+                           bind::fapp(q, y)));
+
+  // -- indexes are available without buildIndexes()
+  CHECK(db.ruleSize() == 4);
+  CHECK(db.def(p).size() == 2);
+  CHECK(db.def(q).size() == 2);
+  CHECK(db.use(p).size() == 3);
+  CHECK(db.use(q).size() == 1);
+  CHECK(db.getVars().size() == 2);
+
+  // -- ids are unique and pointers in the indexes are the rules
+  std::set<unsigned> ids;
+  for (const HornRule &r : db.getRules())
+    ids.insert(r.id());
+  CHECK(ids.size() == 4);
+  CHECK(ids.count(0) == 0);
+  for (HornRule *r : db.use(q))
+    CHECK(bind::fname(r->head()) == q);
+
+  // -- remove a copy of a rule of the database
+  std::vector<HornRule> copies(db.getRules().begin(), db.getRules().end());
+  const HornRule &pq = copies[2];
+  CHECK(bind::fname(pq.head()) == q);
+  unsigned keptId = (**db.use(q).begin()).id();
+  db.removeRule(pq);
+  CHECK(db.ruleSize() == 3);
+  CHECK(db.def(q).size() == 1);
+  CHECK(db.use(p).size() == 2);
+  CHECK((**db.use(q).begin()).id() == keptId);
+
+  // -- remove a rule that was built outside of the database
+  HornRule step(vxy, bind::fapp(q, y),
+                mk<AND>(bind::fapp(q, x), bind::fapp(p, y)));
+  CHECK(step.id() == 0);
+  db.removeRule(step);
+  CHECK(db.ruleSize() == 2);
+  CHECK(db.def(q).empty());
+  CHECK(db.use(q).empty());
+  CHECK(db.getVars() == ExprVector{x});
+
+  // -- the remaining rules keep their ids, new rules get new ones
+  db.addRule(vx, mk<IMPL>(bind::fapp(p, x), bind::fapp(q, x)));
+  CHECK(db.getRules().back().id() > *ids.rbegin());
+  db.buildIndexes();
+  CHECK(db.use(p).size() == 2);
+  CHECK(db.def(q).size() == 1);
+
+  // -- a rule changed in place can be removed by value once re-indexed
+  HornRule &last = db.getRules().back();
+  last.setBody(mk<AND>(bind::fapp(p, x), mk<GT>(x, zero)));
+  db.buildIndexes();
+  HornRule edited(vx, bind::fapp(q, x),
+                  mk<AND>(bind::fapp(p, x), mk<GT>(x, zero)));
+  db.removeRule(edited);
+  CHECK(db.ruleSize() == 2);
+  CHECK(db.def(q).empty());
+  CHECK(db.getVars() == ExprVector{x});
+}
+
+TEST_CASE("horndb.preprocess") {
+  using namespace std;
+  using namespace expr;
+  using namespace seahorn;
+
+  ExprFactory efac;
+  EZ3 z3(efac);
+  HornClauseDB db(efac);
+
+  Expr intTy = sort::intTy(efac);
+  Expr boolTy = sort::boolTy(efac);
+  ExprVector sig1 = {intTy, boolTy}, sig2 = {intTy, intTy, boolTy},
+             sig0 = {boolTy};
+  Expr p = bind::fdecl(mkTerm<string>("p", efac), sig1);
+  Expr q = bind::fdecl(mkTerm<string>("q", efac), sig2);
+  Expr d = bind::fdecl(mkTerm<string>("d", efac), sig1);
+  Expr err = bind::fdecl(mkTerm<string>("err", efac), sig0);
+  for (Expr rel : {p, q, d, err})
+    db.registerRelation(rel);
+
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+  auto num = [&](unsigned v) { return mkTerm<mpz_class>(v, efac); };
+
+  // -- p(x) <- x = 0.  q(x, y) <- p(x) & y = x + 1.  err <- q(x, y) & x > 3
+  // -- d(x) <- x = 1
+  ExprVector vx = {x}, vxy = {x, y};
+  db.addRule(vx, mk<IMPL>(mk<EQ>(x, num(0)), bind::fapp(p, x)));
+  db.addRule(vxy, mk<IMPL>(mk<AND>(bind::fapp(p, x),
+                                   mk<EQ>(y, mk<PLUS>(x, num(1)))),
+                           bind::fapp(q, x, y)));
+  db.addRule(vxy, mk<IMPL>(mk<AND>(bind::fapp(q, x, y), mk<GT>(x, num(3))),
+                           bind::fapp(err)));
+  db.addRule(vx, mk<IMPL>(mk<EQ>(x, num(1)), bind::fapp(d, x)));
+  db.addQuery(bind::fapp(err));
+
+  HornClauseDB orig(efac);
+  copyHornClauseDB(db, orig);
+  CHECK(orig.ruleSize() == 4);
+
+  // -- d does not reach the query
+  HornModelConverterSeq conv;
+  conv.add(sliceHornClauses(db));
+  CHECK(db.ruleSize() == 3);
+  CHECK(!db.hasRelation(d));
+
+  // -- the second argument of q is never read
+  conv.add(reduceRelationArity(db));
+  CHECK(!db.hasRelation(q));
+  CHECK(db.relSize() == 3);
+  for (Expr rel : db.getRelations())
+    if (rel != p && rel != err)
+      CHECK(bind::domainSz(rel) == 1);
+
+  // -- p and then the reduced q have a single definition
+  conv.add(inlineSingleDefRelations(db, z3));
+  CHECK(db.ruleSize() == 1);
+  CHECK(db.relSize() == 1);
+  CHECK(db.hasRelation(err));
+  CHECK(!conv.empty());
+
+  // -- the model of the reduced clauses is a model of the original ones
+  auto isModel = [&](HornClauseDB &db, HornDbModel &model) {
+    for (const HornRule &r : db.getRules()) {
+      ExprVector apps;
+      get_all_pred_apps(r.body(), db, std::back_inserter(apps));
+      ExprMap defs;
+      for (Expr app : apps)
+        defs[app] = model.getDef(app);
+      ZSolver<EZ3> s(z3);
+      s.assertExpr(replace(r.body(), defs));
+      s.assertExpr(mk<NEG>(model.getDef(r.head())));
+      if (bool(s.solve()))
+        return false;
+    }
+    return true;
+  };
+  HornDbModel reduced, model;
+  reduced.addDef(bind::fapp(err), mk<FALSE>(efac));
+  REQUIRE(conv.convert(reduced, model));
+  CHECK(isModel(orig, model));
+  CHECK(isOpX<TRUE>(model.getDef(bind::fapp(d, x))));
+  CHECK(isOpX<FALSE>(model.getDef(bind::fapp(err))));
+
+  // -- a(x) <- x = 0.  a(x) <- x = 5.  b(x) <- a(x) & x > 3.
+  // -- err <- b(x) & x < 3
+  HornClauseDB chain(efac);
+  Expr a = bind::fdecl(mkTerm<string>("a", efac), sig1);
+  Expr b = bind::fdecl(mkTerm<string>("b", efac), sig1);
+  for (Expr rel : {a, b, err})
+    chain.registerRelation(rel);
+  chain.addRule(vx, mk<IMPL>(mk<EQ>(x, num(0)), bind::fapp(a, x)));
+  chain.addRule(vx, mk<IMPL>(mk<EQ>(x, num(5)), bind::fapp(a, x)));
+  chain.addRule(vx, mk<IMPL>(mk<AND>(bind::fapp(a, x), mk<GT>(x, num(3))),
+                             bind::fapp(b, x)));
+  chain.addRule(vx, mk<IMPL>(mk<AND>(bind::fapp(b, x), mk<LT>(x, num(3))),
+                             bind::fapp(err)));
+  chain.addQuery(bind::fapp(err));
+  HornClauseDB chainOrig(efac);
+  copyHornClauseDB(chain, chainOrig);
+
+  // -- both definitions of a end up in the rules of err
+  HornModelConverterSeq chainConv;
+  chainConv.add(mergeLinearChains(chain, z3));
+  CHECK(chain.ruleSize() == 2);
+  CHECK(chain.relSize() == 1);
+  CHECK(chain.def(err).size() == 2);
+
+  HornDbModel chainModel;
+  REQUIRE(chainConv.convert(reduced, chainModel));
+  CHECK(isModel(chainOrig, chainModel));
+
+  // -- a relation with an invariant keeps its rules, even if it does not
+  // -- reach the query
+  HornClauseDB withInv(efac);
+  for (Expr rel : {d, err})
+    withInv.registerRelation(rel);
+  withInv.addRule(vx, mk<IMPL>(mk<EQ>(x, num(1)), bind::fapp(d, x)));
+  withInv.addRule(vx, mk<IMPL>(mk<AND>(mk<GT>(x, num(3)), mk<LT>(x, num(2))),
+                               bind::fapp(err)));
+  withInv.addQuery(bind::fapp(err));
+  withInv.addInvariant(bind::fapp(d, x), mk<GEQ>(x, num(1)));
+  CHECK(!sliceHornClauses(withInv));
+  CHECK(withInv.ruleSize() == 2);
+  CHECK(withInv.def(d).size() == 1);
+}
+
+TEST_CASE("horndb.split") {
+  using namespace std;
+  using namespace expr;
+  using namespace seahorn;
+
+  ExprFactory efac;
+  HornClauseDB db(efac);
+
+  Expr intTy = sort::intTy(efac);
+  Expr boolTy = sort::boolTy(efac);
+  ExprVector sig1 = {intTy, boolTy}, sig0 = {boolTy};
+  Expr p = bind::fdecl(mkTerm<string>("p", efac), sig1);
+  Expr q = bind::fdecl(mkTerm<string>("q", efac), sig1);
+  Expr err = bind::fdecl(mkTerm<string>("err", efac), sig0);
+  for (Expr rel : {p, q, err})
+    db.registerRelation(rel);
+
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  auto num = [&](unsigned v) { return mkTerm<mpz_class>(v, efac); };
+
+  // -- p(x) <- x = 0.  q(x) <- x = 1.  err <- p(x) & x > 0.
+  // -- err <- q(x) & x > 1
+  ExprVector vx = {x};
+  db.addRule(vx, mk<IMPL>(mk<EQ>(x, num(0)), bind::fapp(p, x)));
+  db.addRule(vx, mk<IMPL>(mk<EQ>(x, num(1)), bind::fapp(q, x)));
+  db.addRule(vx, mk<IMPL>(mk<AND>(bind::fapp(p, x), mk<GT>(x, num(0))),
+                          bind::fapp(err)));
+  db.addRule(vx, mk<IMPL>(mk<AND>(bind::fapp(q, x), mk<GT>(x, num(1))),
+                          bind::fapp(err)));
+  db.addQuery(bind::fapp(err));
+
+  // -- one part per rule of err, each with only the relation it uses
+  std::vector<std::unique_ptr<HornClauseDB>> parts;
+  splitHornClauseDB(db, parts);
+  REQUIRE(parts.size() == 2);
+  for (auto &part : parts) {
+    CHECK(part->ruleSize() == 2);
+    CHECK(part->def(err).size() == 1);
+    CHECK(part->relSize() == 2);
+    CHECK(part->hasRelation(p) != part->hasRelation(q));
+  }
+  CHECK(db.ruleSize() == 4);
+
+  // -- a single error rule is not split
+  std::vector<std::unique_ptr<HornClauseDB>> one;
+  splitHornClauseDB(*parts[0], one);
+  CHECK(one.empty());
+}
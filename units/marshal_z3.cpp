@@ -0,0 +1,171 @@
+#include "seahorn/Expr/Smt/EZ3.hh"
+#include "seahorn/Support/Stats.hh"
+
+#include "doctest.h"
+
+TEST_CASE("z3.marshal_cache") {
+  using namespace std;
+  using namespace ufo;
+  using namespace expr;
+
+  ExprFactory efac;
+
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+  Expr f = mk<AND>(mk<LT>(x, y), mk<GT>(mk<PLUS>(x, y), x));
+
+  EZ3 z3(efac);
+  ZSolver<EZ3> s1(z3);
+  ZSolver<EZ3> s2(z3);
+
+  // -- the second solver on the context reuses the translation
+  s1.assertExpr(f);
+  size_t sz = z3.marshalCacheSize();
+  CHECK(z3.marshalCacheMisses() == 1);
+  s2.assertExpr(f);
+  CHECK(z3.marshalCacheHits() == 1);
+  CHECK(z3.marshalCacheSize() == sz);
+
+  // -- sub-expressions were translated with f
+  s2.assertExpr(mk<LT>(x, y));
+  CHECK(z3.marshalCacheHits() == 2);
+
+  // -- only the new parts of an expression are translated
+  s1.assertExpr(mk<OR>(f, mk<EQ>(x, y)));
+  CHECK(z3.marshalCacheSize() == sz + 2);
+
+  CHECK(bool(s1.solve()));
+  CHECK(bool(s2.solve()));
+  ZSolver<EZ3>::Model m = s1.getModel();
+  CHECK(m.eval(f) == mk<TRUE>(efac));
+
+  // -- counts are moved to Stats on request
+  unsigned hits = seahorn::Stats::get("z3.marshal.cache.hit");
+  z3.flushMarshalStats();
+  CHECK(seahorn::Stats::get("z3.marshal.cache.hit") == hits + 2);
+  CHECK(z3.marshalCacheHits() == 0);
+
+  // -- the cache can be dropped, and is dropped when it grows too large
+  z3.clearMarshalCache();
+  CHECK(z3.marshalCacheSize() == 0);
+  s1.assertExpr(f);
+  CHECK(z3.marshalCacheSize() == sz);
+  z3.setMarshalCacheLimit(sz);
+  s1.assertExpr(mk<EQ>(x, y));
+  CHECK(z3.marshalCacheSize() < sz);
+}
+
+TEST_CASE("z3.model_batch_eval") {
+  using namespace std;
+  using namespace ufo;
+  using namespace expr;
+
+  ExprFactory efac;
+
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+  Expr a = bv::bvConst(mkTerm<string>("a", efac), 8);
+  Expr five = mkTerm<mpz_class>(5, efac);
+
+  EZ3 z3(efac);
+  ZSolver<EZ3> s(z3);
+  s.assertExpr(mk<EQ>(x, five));
+  s.assertExpr(mk<LT>(x, y));
+  s.assertExpr(mk<EQ>(a, bv::bvnum(mpz_class(7), 8, efac)));
+  CHECK(bool(s.solve()));
+  ZSolver<EZ3>::Model m = s.getModel();
+
+  // -- same values as one expression at a time
+  Expr z = bind::intConst(mkTerm<string>("z", efac));
+  ExprVector es = {x, mk<PLUS>(x, y), Expr(), five, x, a, mk<LT>(x, y), z};
+  ExprVector vals;
+  m.eval(es, vals);
+  REQUIRE(vals.size() == es.size());
+  for (unsigned i = 0; i < es.size(); ++i)
+    if (es[i])
+      CHECK(vals[i] == m.eval(es[i]));
+  CHECK(!vals[2]);
+  CHECK(vals[0] == five);
+  CHECK(vals[5] == bv::bvnum(mpz_class(7), 8, efac));
+
+  // -- completion assigns unconstrained constants
+  m.eval(es, vals, true);
+  CHECK(vals[7] == m.eval(z, true));
+}
+
+TEST_CASE("z3.model_native_eval") {
+  using namespace std;
+  using namespace ufo;
+  using namespace expr;
+
+  ExprFactory efac;
+
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+  Expr p = bind::boolConst(mkTerm<string>("p", efac));
+  Expr a = bv::bvConst(mkTerm<string>("a", efac), 8);
+  Expr b = bv::bvConst(mkTerm<string>("b", efac), 8);
+  Expr arrTy = sort::arrayTy(bv::bvsort(8, efac), bv::bvsort(8, efac));
+  Expr arr = bind::mkConst(mkTerm<string>("arr", efac), arrTy);
+  auto num = [&](int v) { return bv::bvnum(mpz_class(v), 8, efac); };
+  auto inum = [&](int v) { return mkTerm<mpz_class>(v, efac); };
+
+  // -- every constant has exactly one value
+  ExprVector fmls = {mk<EQ>(x, inum(5)),
+                     mk<EQ>(y, inum(-3)),
+                     p,
+                     mk<EQ>(a, num(200)),
+                     mk<EQ>(b, num(7)),
+                     mk<EQ>(mk<SELECT>(arr, a), num(9)),
+                     mk<EQ>(mk<SELECT>(arr, b), num(11))};
+  EZ3 z3(efac);
+  ZSolver<EZ3> s(z3);
+  for (Expr f : fmls)
+    s.assertExpr(f);
+  REQUIRE(bool(s.solve()));
+  ZSolver<EZ3>::Model m = s.getModel();
+
+  Expr st = mk<STORE>(arr, mk<BADD>(a, num(1)), b);
+  ExprVector terms = {
+      mk<PLUS>(x, mk<MULT>(y, inum(2))),
+      mk<LT>(mk<UN_MINUS>(x), y),
+      mk<AND>(p, mk<GEQ>(x, y), mk<NEG>(mk<EQ>(x, y))),
+      mk<BADD>(a, mk<BMUL>(b, num(9))),
+      mk<BSDIV>(a, b),
+      mk<BSLT>(bv::extract(7, 4, a), bv::extract(3, 0, b)),
+      mk<EQ>(bv::sext(a, 16), mk<BCONCAT>(num(255), a)),
+      mk<ITE>(mk<BULT>(b, a), mk<SELECT>(arr, a), mk<SELECT>(arr, b)),
+      mk<SELECT>(st, mk<BADD>(a, num(1))),
+      mk<SELECT>(st, b),
+      mk<IMPL>(p, mk<EQ>(mk<SELECT>(arr, b), num(11)))};
+
+  // -- values computed without z3 agree with z3
+  for (Expr t : terms) {
+    Expr v = m.eval(t);
+    REQUIRE(v);
+    CHECK(ExprEvaluator::isValue(v));
+    ZSolver<EZ3> chk(z3);
+    for (Expr f : fmls)
+      chk.assertExpr(f);
+    chk.assertExpr(mk<NEQ>(t, v));
+    CHECK(!bool(chk.solve()));
+  }
+
+  // -- the batch interface gives the same values
+  ExprVector vals;
+  m.eval(terms, vals);
+  for (unsigned i = 0; i < terms.size(); ++i)
+    CHECK(vals[i] == m.eval(terms[i]));
+
+  // -- what is not folded is left to the caller, and then to z3
+  ExprEvaluator ev(efac);
+  ev.assign(x, inum(5));
+  ev.assign(y, inum(-3));
+  CHECK(ev.eval(mk<PLUS>(x, y)) == inum(2));
+  Expr idiv = mk<DIV>(x, y);
+  CHECK(!ev.eval(idiv));
+  Expr z = bind::intConst(mkTerm<string>("z", efac));
+  CHECK(!ev.eval(mk<PLUS>(x, z)));
+  CHECK(m.eval(mk<BUDIV>(a, num(0))) == num(255));
+  CHECK(m.eval(idiv) == inum(-1));
+}
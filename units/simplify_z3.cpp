@@ -0,0 +1,138 @@
+#include "seahorn/Expr/ExprSimplifier.hh"
+#include "seahorn/Expr/ExprSmtLib.hh"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "z3++.h"
+
+#include "doctest.h"
+
+namespace {
+using namespace expr;
+
+/// true if z3 proves that e and its simplification s are equal
+bool isValidRewrite(Expr e, Expr s) {
+  std::string str;
+  llvm::raw_string_ostream out(str);
+  SmtLibWriter w(out);
+  w.assertExpr(mk<NEG>(mk<EQ>(e, s)));
+  w.checkSat();
+
+  z3::context ctx;
+  z3::solver solver(ctx);
+  solver.from_string(out.str().c_str());
+  return solver.check() == z3::unsat;
+}
+} // namespace
+
+TEST_CASE("simplify.bv") {
+  using namespace std;
+  using namespace expr;
+
+  ExprFactory efac;
+  BvSimplifier simp(efac);
+
+  Expr a = bv::bvConst(mkTerm<string>("a", efac), 8);
+  Expr b = bv::bvConst(mkTerm<string>("b", efac), 8);
+  auto num = [&](int v, unsigned w) {
+    return bv::bvnum(mpz_class(v), w, efac);
+  };
+
+  // -- constant folding wraps around and respects signedness
+  CHECK(simp(mk<BADD>(num(200, 8), num(100, 8))) == num(44, 8));
+  CHECK(simp(mk<BSDIV>(num(-7, 8), num(2, 8))) == num(253, 8));
+  CHECK(simp(mk<BASHR>(num(-128, 8), num(7, 8))) == num(255, 8));
+  CHECK(simp(mk<BSLT>(num(255, 8), num(0, 8))) == mk<TRUE>(efac));
+  CHECK(simp(mk<BULT>(num(255, 8), num(0, 8))) == mk<FALSE>(efac));
+  Expr divZero = mk<BUDIV>(a, num(0, 8));
+  CHECK(simp(divZero) == divZero);
+
+  // -- identities
+  CHECK(simp(mk<BADD>(mk<BADD>(a, num(3, 8)), num(-3, 8))) == a);
+  CHECK(simp(mk<BSUB>(mk<BADD>(a, num(1, 8)), num(4, 8))) ==
+        mk<BADD>(a, num(253, 8)));
+  CHECK(simp(mk<BXOR>(a, a)) == num(0, 8));
+  CHECK(simp(mk<BAND>(num(255, 8), a)) == a);
+  CHECK(simp(mk<BMUL>(a, num(0, 8))) == num(0, 8));
+  CHECK(simp(mk<BULE>(a, a)) == mk<TRUE>(efac));
+
+  // -- extract and concat
+  Expr cat = mk<BCONCAT>(a, b);
+  CHECK(simp(bv::extract(7, 0, cat)) == b);
+  CHECK(simp(bv::extract(11, 4, cat)) ==
+        mk<BCONCAT>(bv::extract(3, 0, a), bv::extract(7, 4, b)));
+  CHECK(simp(mk<BCONCAT>(bv::extract(7, 4, a), bv::extract(3, 0, a))) == a);
+  CHECK(simp(bv::extract(7, 0, bv::zext(a, 32))) == a);
+  CHECK(simp(bv::extract(31, 8, bv::zext(a, 32))) == num(0, 24));
+  CHECK(simp(mk<BCONCAT>(num(1, 8), num(2, 8))) == num(258, 16));
+  CHECK(simp(bv::sext(num(-1, 8), 16)) == num(65535, 16));
+
+  // -- read over write
+  Expr arrTy = sort::arrayTy(bv::bvsort(8, efac), bv::bvsort(8, efac));
+  Expr m = bind::mkConst(mkTerm<string>("m", efac), arrTy);
+  Expr st = mk<STORE>(mk<STORE>(m, a, b), mk<BADD>(a, num(4, 8)), num(7, 8));
+  CHECK(simp(mk<SELECT>(st, a)) == b);
+  CHECK(simp(mk<SELECT>(st, mk<BADD>(a, num(4, 8)))) == num(7, 8));
+  CHECK(simp(mk<SELECT>(st, mk<BADD>(a, num(1, 8)))) ==
+        mk<SELECT>(m, mk<BADD>(a, num(1, 8))));
+  // -- b may be equal to a, the store is kept
+  CHECK(simp(mk<SELECT>(st, b)) == mk<SELECT>(st, b));
+  CHECK(simp(mk<STORE>(mk<STORE>(m, a, b), a, num(1, 8))) ==
+        mk<STORE>(m, a, num(1, 8)));
+  CHECK(simp(mk<STORE>(m, a, mk<SELECT>(m, a))) == m);
+  CHECK(simp(mk<SELECT>(mk<CONST_ARRAY>(bv::bvsort(8, efac), b), a)) == b);
+
+  // -- Booleans
+  Expr p = bind::boolConst(mkTerm<string>("p", efac));
+  CHECK(simp(mk<ITE>(p, mk<TRUE>(efac), mk<FALSE>(efac))) == p);
+  CHECK(simp(mk<EQ>(mk<ITE>(p, num(1, 8), num(0, 8)), num(1, 8))) == p);
+  CHECK(simp(mk<AND>(p, mk<EQ>(num(1, 8), num(2, 8)))) == mk<FALSE>(efac));
+
+  CHECK(simp.rewrites() > 0);
+  CHECK(simp.calls() > 0);
+}
+
+TEST_CASE("simplify.bv.z3") {
+  using namespace std;
+  using namespace expr;
+
+  ExprFactory efac;
+  BvSimplifier simp(efac);
+
+  Expr a = bv::bvConst(mkTerm<string>("a", efac), 8);
+  Expr b = bv::bvConst(mkTerm<string>("b", efac), 8);
+  Expr arrTy = sort::arrayTy(bv::bvsort(8, efac), bv::bvsort(8, efac));
+  Expr m = bind::mkConst(mkTerm<string>("m", efac), arrTy);
+  auto num = [&](int v, unsigned w) {
+    return bv::bvnum(mpz_class(v), w, efac);
+  };
+
+  // -- every rewrite is checked against z3. Terms are combined so that
+  // -- rules fire on the results of other rules
+  ExprVector terms = {a, b, num(0, 8), num(1, 8), num(255, 8), num(128, 8)};
+  ExprVector fmls;
+  for (unsigned i = 0; i < 6; ++i)
+    for (unsigned j = 0; j < 6; ++j) {
+      Expr x = terms[i], y = terms[j];
+      Expr sum = mk<BADD>(mk<BADD>(x, num(3, 8)), y);
+      Expr cat = mk<BCONCAT>(mk<BSUB>(x, y), mk<BXOR>(y, x));
+      Expr st = mk<STORE>(mk<STORE>(m, x, y), mk<BADD>(x, num(1, 8)), sum);
+      fmls.push_back(mk<EQ>(mk<BSDIV>(x, y), mk<BSREM>(sum, x)));
+      fmls.push_back(mk<BSLT>(bv::extract(11, 4, cat), bv::sext(y, 8)));
+      fmls.push_back(
+          mk<EQ>(mk<SELECT>(st, mk<BADD>(x, num(1, 8))),
+                 bv::extract(7, 0, bv::zext(mk<BLSHR>(x, y), 16))));
+      fmls.push_back(mk<EQ>(mk<SELECT>(st, x),
+                            mk<ITE>(mk<BULE>(x, y), mk<BAND>(x, y), y)));
+    }
+
+  unsigned changed = 0;
+  for (const Expr &e : fmls) {
+    Expr s = simp(e);
+    if (s == e)
+      continue;
+    ++changed;
+    CHECK(isValidRewrite(e, s));
+  }
+  CHECK(changed > fmls.size() / 2);
+}
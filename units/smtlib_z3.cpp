@@ -0,0 +1,109 @@
+#include "seahorn/Expr/ExprSmtLib.hh"
+#include "seahorn/Expr/Smt/EZ3.hh"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "doctest.h"
+
+namespace {
+using namespace expr;
+
+/// writes fmls with SmtLibWriter
+std::string writeSmtLib(const ExprVector &fmls) {
+  std::string str;
+  llvm::raw_string_ostream out(str);
+  SmtLibWriter w(out);
+  w.assertExprs(fmls);
+  w.checkSat();
+  return out.str();
+}
+
+/// true if z3 proves that the conjunction of fmls as written by
+/// SmtLibWriter is equivalent to its translation by the marshaller
+bool isEquivalent(ufo::EZ3 &z3, const ExprVector &fmls) {
+  Expr conj = mknary<AND>(mk<TRUE>(fmls[0]->efac()), fmls);
+  std::string str;
+  llvm::raw_string_ostream out(str);
+  SmtLibWriter w(out);
+  w.declare(conj);
+  out << "(assert (not (= ";
+  w.write(conj);
+  out << " " << ufo::z3_to_smtlib(z3, conj) << ")))\n";
+
+  z3::context ctx;
+  z3::solver solver(ctx);
+  solver.from_string(out.str().c_str());
+  return solver.check() == z3::unsat;
+}
+} // namespace
+
+TEST_CASE("smtlib.writer") {
+  using namespace std;
+  using namespace ufo;
+  using namespace expr;
+
+  ExprFactory efac;
+  EZ3 z3(efac);
+
+  Expr x = bind::intConst(mkTerm<string>("x", efac));
+  Expr y = bind::intConst(mkTerm<string>("y", efac));
+  Expr p = bind::boolConst(mkTerm<string>("p", efac));
+
+  // -- shared sub-expressions are let-bound, leaves are not
+  Expr s = mk<PLUS>(x, y);
+  ExprVector fmls = {mk<LT>(s, y), mk<OR>(p, mk<GT>(mk<MULT>(s, s), x)),
+                     mk<NEQ>(mk<DIV>(x, mkTerm<mpz_class>(-2, efac)), y)};
+  std::string smt = writeSmtLib(fmls);
+  CHECK(smt.find("(declare-fun x () Int)") != string::npos);
+  CHECK(smt.find("(let ((a!1 (+ x y)))") != string::npos);
+  CHECK(smt.find("(div x (- 2))") != string::npos);
+  CHECK(isEquivalent(z3, fmls));
+
+  // -- user symbols cannot clash with let-bound names
+  Expr clash = bind::intConst(mkTerm<string>("a!1", efac));
+  smt = writeSmtLib({mk<LT>(s, clash), mk<GT>(s, y)});
+  CHECK(smt.find("(declare-fun a!!1 () Int)") != string::npos);
+  CHECK(smt.find("(< a!1 a!!1)") != string::npos);
+
+  // -- bit-vectors
+  Expr a = bv::bvConst(mkTerm<string>("a", efac), 8);
+  Expr b = bv::bvConst(mkTerm<string>("b", efac), 8);
+  Expr wide = bv::sext(mk<BADD>(a, b, a), 16);
+  Expr cat = mk<BCONCAT>(a, b, bv::extract(3, 0, a));
+  ExprVector bvs = {
+      mk<BULT>(wide, bv::zext(b, 16)),
+      mk<EQ>(bv::extract(19, 4, cat), bv::bvnum(mpz_class(-1), 16, efac)),
+      mk<EQ>(mk<BREDOR>(a), bv::bvnum(mpz_class(1), 1, efac))};
+  smt = writeSmtLib(bvs);
+  CHECK(smt.find("((_ sign_extend 8) (bvadd a (bvadd b a)))") != string::npos);
+  CHECK(smt.find("(_ bv65535 16)") != string::npos);
+  CHECK(isEquivalent(z3, bvs));
+
+  // -- arrays, lambdas and quantifiers
+  Expr arrTy = sort::arrayTy(bv::bvsort(8, efac), bv::bvsort(8, efac));
+  Expr m = bind::mkConst(mkTerm<string>("m", efac), arrTy);
+  Expr z = bind::mkConst(mkTerm<string>("z", efac), bv::bvsort(8, efac));
+  Expr lmbd = bind::abs<LAMBDA>(std::array<Expr, 1>{z},
+                                mk<BADD>(mk<SELECT>(m, z), a));
+  Expr arr = mk<STORE>(mk<CONST_ARRAY>(bv::bvsort(8, efac), b), a, b);
+  ExprVector arrs = {
+      mk<EQ>(bind::fapp(lmbd, b), mk<SELECT>(arr, b)),
+      bind::abs<FORALL>(std::array<Expr, 1>{z},
+                        mk<BULE>(mk<SELECT>(m, z), bind::fapp(lmbd, z)))};
+  smt = writeSmtLib(arrs);
+  CHECK(smt.find("(lambda ((x!0 (_ BitVec 8)))") != string::npos);
+  CHECK(smt.find("((as const (Array (_ BitVec 8) (_ BitVec 8))) b)") !=
+        string::npos);
+  CHECK(isEquivalent(z3, arrs));
+
+  // -- expressions without an SMT-LIB form are rejected
+  CHECK_THROWS_AS(writeSmtLib({mk<EQ>(mk<ARRAY_MAP>(x, m), m)}),
+                  SmtLibError);
+
+  // -- deep expressions do not overflow the stack
+  Expr acc = x;
+  for (unsigned i = 0; i < 200000; ++i)
+    acc = mk<PLUS>(acc, mkTerm<mpz_class>(i % 7, efac));
+  smt = writeSmtLib({mk<GT>(acc, y)});
+  CHECK(smt.size() > 200000 * 4);
+}
@@ -0,0 +1,60 @@
+#include "seahorn/SymStore.hh"
+
+#include "doctest.h"
+
+TEST_CASE("symstore.copy") {
+  using namespace std;
+  using namespace expr;
+  using namespace seahorn;
+
+  ExprFactory efac;
+
+  ExprVector keys;
+  for (unsigned i = 0; i < 64; ++i)
+    keys.push_back(bind::intConst(mkTerm<string>("r" + to_string(i), efac)));
+  auto num = [&](unsigned v) { return mkTerm<mpz_class>(v, efac); };
+
+  // -- take a snapshot after every write, as BMC does after every edge
+  SymStore s(efac);
+  std::vector<SymStore> snapshots;
+  for (unsigned i = 0; i < 1000; ++i) {
+    s.write(keys[i % keys.size()], num(i));
+    snapshots.push_back(s);
+  }
+
+  CHECK(s.size() == keys.size());
+  for (unsigned i = 0; i < 1000; ++i) {
+    SymStore &snap = snapshots[i];
+    CHECK(snap.at(keys[i % keys.size()]) == num(i));
+    CHECK(snap.size() == std::min<size_t>(i + 1, keys.size()));
+    if (i + 1 < keys.size())
+      CHECK(!snap.isDefined(keys[i + 1]));
+  }
+
+  // -- writes to a copy are not visible in the original and vice versa
+  SymStore c(s);
+  c.write(keys[0], num(5000));
+  s.write(keys[1], num(6000));
+  CHECK(c.at(keys[0]) == num(5000));
+  CHECK(s.at(keys[0]) == num(999 - 999 % keys.size()));
+  CHECK(c.at(keys[1]) == num(999 - 999 % keys.size() + 1));
+  CHECK(s.at(keys[1]) == num(6000));
+
+  // -- iteration sees every key once with its latest value
+  unsigned count = 0;
+  for (auto kv : c) {
+    ++count;
+    CHECK(kv.second == c.at(kv.first));
+  }
+  CHECK(count == keys.size());
+  CHECK(c.at(keys[0]) == num(5000));
+
+  // -- havoc in a copy continues the variants of the original
+  SymStore h(efac);
+  Expr v0 = h.havoc(keys[0]);
+  SymStore hc(h);
+  Expr v1 = hc.havoc(keys[0]);
+  CHECK(v0 != v1);
+  CHECK(h.at(keys[0]) == v0);
+  CHECK(hc.at(keys[0]) == v1);
+}